@@ -0,0 +1,50 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include "common.h"
+
+/* In-kernel micro-benchmarks, driven by the shell's `bench` command.
+   Timings are raw TSC cycles. */
+
+#define BENCH_TEXT_MAX 100000   /* keystrokes for `bench text` */
+
+/* Types n characters at pseudo-random offsets into a scratch document,
+   then replays the same keystrokes into a flat array for comparison.
+   Returns 0, or -1 if the text pool ran out. */
+int bench_text_typing(int n, u64* text_cycles, u64* flat_cycles);
+
+#define BENCH_PAGE_MAX_KIB 8192 /* log size for `bench page` */
+#define BENCH_PAGE_LINES   20   /* one editor screen */
+
+/* Writes a kib-KiB log to bench.log in the CWD, opens it as a streamed
+   document and times painting one screen at the top and at the bottom.
+   Returns 0, or an FS_ERR_* / TEXT_ERR_* code. */
+int bench_text_page(int kib, u64* attach_cycles, u64* top_cycles, u64* bottom_cycles);
+
+#define BENCH_SWITCH_MAX 100000  /* round trips for `bench switch` */
+
+/* Two threads above the caller's priority trade the CPU n times each,
+   first by thread_yield(), then by waking each other and waiting.
+   *yield_cycles and *wake_cycles get the cost of one context switch
+   for each. Returns 0, or THREAD_ERR_NOMEM. */
+int bench_switch(int n, u64* yield_cycles, u64* wake_cycles);
+
+#define BENCH_SMP_MAX_KIB 4096  /* buffer for `bench smp` */
+#define BENCH_SMP_BLOCK   16    /* KiB per leaf task */
+
+/* CRC32 of each BENCH_SMP_BLOCK of a kib-KiB buffer, split fork-join
+   style over the first cpus CPUs, with the block CRCs folded into *sum
+   in order so every CPU count must give the same answer. Returns the
+   CPUs that took part, 0 if there is no memory for the buffer. */
+int bench_smp(int kib, int cpus, u64* cycles, u32* sum);
+
+#define BENCH_RCU_MAX    1000000  /* lookups per reader for `bench rcu` */
+#define BENCH_RCU_WRITES 10000    /* renames the writer stops at */
+
+/* One reader task per CPU looks up n names in the CWD while a writer
+   task renames a scratch file back and forth until the readers are
+   done. With locked set, every lookup and rename also takes one
+   spinlock, which is what lookups would cost without RCU. *lookups gets
+   the lookups done, *renames the renames. Returns 0 or an FS_ERR_* code. */
+int bench_rcu(int n, int cpus, int locked, u64* cycles, u32* lookups, u32* renames);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef BLK_H
+#define BLK_H
+#include "common.h"
+
+/* ---- Sizes ---- */
+#define BLK_SECTOR_SIZE          512
+#define BLK_MAX_DEVICES          4
+#define BLK_MAX_QUEUE_DEPTH      64
+#define BLK_DEFAULT_QUEUE_DEPTH  16
+#define BLK_MAX_XFER_SECTORS     128  /* cap on one merged transfer */
+#define BLK_LAT_BUCKETS          32   /* bucket i: 2^i <= cycles < 2^(i+1); the last one open-ended */
+
+/* Directions */
+#define BLK_READ  0
+#define BLK_WRITE 1
+
+/* Error codes */
+#define BLK_OK           0
+#define BLK_ERR_BUSY    -1   /* queue full, resubmit after a completion */
+#define BLK_ERR_RANGE   -2
+#define BLK_ERR_INVALID -3
+#define BLK_ERR_IO      -4
+#define BLK_ERR_NODEV   -5
+
+struct blk_request;
+typedef void (*blk_done_fn)(struct blk_request* rq, int status);
+
+/* Filled by the caller; owned by the block layer from blk_submit()
+   until its done callback runs. */
+struct blk_request {
+    int   dev;
+    int   dir;                 /* BLK_READ / BLK_WRITE */
+    u32   lba;
+    u32   count;               /* sectors */
+    char* buf;                 /* count * BLK_SECTOR_SIZE bytes */
+    blk_done_fn done;
+    void* ctx;
+
+    /* block layer private */
+    u64   submit_tsc;
+    struct blk_request* next;
+};
+
+/* One dispatched transfer: a run of LBA-contiguous, same-direction
+   requests chained through ->next, covering [lba, lba + count). */
+struct blk_xfer {
+    int dir;
+    u32 lba;
+    u32 count;
+    struct blk_request* head;
+};
+
+/* Driver interface. start() must not block: the driver reports the end
+   of the transfer later with blk_complete(), from its poll() hook or an
+   interrupt handler. */
+struct blk_ops {
+    int  (*start)(int dev, const struct blk_xfer* x);
+    void (*poll)(int dev);     /* optional, called from blk_poll() */
+};
+
+struct blk_stats {
+    u32 submitted;
+    u32 completed;
+    u32 errors;
+    u32 xfers;                 /* transfers dispatched to the driver */
+    u32 merged;                /* requests absorbed into another's transfer */
+    u32 sectors;
+    u32 busy_rejects;
+    u32 max_queued;
+    u32 lat_hist[BLK_LAT_BUCKETS];  /* submit -> completion, TSC cycles */
+};
+
+/* ---------- Devices ---------- */
+int  blk_register(const char* name, u32 sectors, const struct blk_ops* ops);  /* -> dev id */
+int  blk_device_count(void);
+const char* blk_device_name(int dev);
+u32  blk_device_sectors(int dev);
+int  blk_set_queue_depth(int dev, int depth);   /* 1..BLK_MAX_QUEUE_DEPTH */
+int  blk_queue_depth(int dev);
+int  blk_inflight(int dev);                     /* queued + dispatched requests */
+const struct blk_stats* blk_get_stats(int dev);
+void blk_reset_stats(int dev);
+
+/* ---------- Requests ---------- */
+int  blk_submit(struct blk_request* rq);        /* BLK_OK or BLK_ERR_* (done not called on error) */
+void blk_poll(void);                            /* drive polled devices, dispatch queued work */
+void blk_complete(int dev, int status);         /* driver: current transfer finished */
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef CPU_H
+#define CPU_H
+#include "common.h"
+
+/* Protected-mode plumbing: a flat GDT of our own, an IDT whose entries
+   all funnel into cpu_dispatch(), and the two 8259 PICs remapped to
+   vectors 32-47. CPU exceptions stop the machine with a message; IRQ
+   handlers are plain C functions registered per line. */
+
+#define IRQ_BASE   32
+#define IRQ_TIMER  0
+#define IRQ_KBD    1
+#define IRQ_MOUSE  12
+
+/* Vectors above the PIC's come from local APICs */
+#define VEC_IPI_BASE 48
+#define VEC_SPURIOUS 63
+#define IDT_VECTORS  64
+
+#define SEL_CODE 0x08
+#define SEL_DATA 0x10
+#define SEL_PERCPU 0x18   /* then one data segment per CPU */
+
+#define CPU_MAX 8
+
+/* Per-CPU data. Each CPU's %fs selects a segment based at its own
+   PerCpu, so this_cpu() is a single load and never needs the CPU's
+   number first. Nothing else may load %fs. */
+struct PerCpu {
+    struct PerCpu* self;
+    int id;
+    volatile u32 rcu_nest;   /* read-side sections open, see rcu.h */
+    volatile u32 rcu_qs;     /* times rcu_nest fell back to 0 */
+    volatile u32 ipis;       /* IPIs handled */
+    u32 trace_head;          /* records written to its trace ring, see trace.h */
+};
+
+static inline struct PerCpu* this_cpu(void) {
+    struct PerCpu* p;
+    __asm__ ("mov %%fs:0, %0" : "=r"(p));
+    return p;
+}
+
+static inline int cpu_id(void) {
+    int id;
+    __asm__ ("mov %%fs:4, %0" : "=r"(id));
+    return id;
+}
+
+struct PerCpu* cpu_percpu(int i);
+
+/* What the entry stubs push, lowest address first */
+struct IrqFrame {
+    u32 edi, esi, ebp, esp0, ebx, edx, ecx, eax;   /* pusha */
+    u32 vector, error;
+    u32 eip, cs, eflags;                           /* pushed by the CPU */
+};
+
+typedef void (*irq_handler_fn)(void);
+
+void cpu_init(void);                       /* GDT, IDT, PICs, CPU 0's %fs; interrupts stay off */
+void cpu_init_ap(int id);                  /* CPU id: the same GDT and IDT, its own %fs */
+void irq_set_handler(int irq, irq_handler_fn fn);   /* also unmasks the line */
+void pit_init(u32 hz);                     /* IRQ 0 at hz */
+
+/* Set from an IRQ handler to switch threads on the way out */
+extern void (*irq_exit_hook)(void);
+
+/* Vectors VEC_IPI_BASE..VEC_SPURIOUS - 1; it sends the local APIC's EOI */
+extern void (*ipi_handler)(int vector);
+
+/* Vector 14; returns nonzero once the fault is resolved, else it panics */
+extern int (*page_fault_hook)(struct IrqFrame* fr);
+
+static inline u32 irq_save(void) {
+    u32 f;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(f) : : "memory");
+    return f;
+}
+
+static inline void irq_restore(u32 f) {
+    if (f & 0x200) __asm__ volatile ("sti" : : : "memory");
+}
+
+static inline void irq_enable(void) {
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+#endif
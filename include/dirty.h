@@ -0,0 +1,37 @@
+#ifndef DIRTY_H
+#define DIRTY_H
+#include "common.h"
+
+/* Which bytes of a document differ from its file. The document is cut
+   into runs; each run is either still a copy of the file shifted by a
+   fixed amount (what inserts and deletes before it did to it) or new.
+   Bytes in runs with shift 0 are already on file, so a save writes only
+   the other runs, and an edit that is later undone, or a replacement of
+   the same length, leaves everything around it clean. When the runs
+   run out, the last ones are merged and conservatively marked new. */
+
+#define DIRTY_MAX_RUNS 32
+#define DIRTY_NEW      0x7FFFFFFF   /* run shift: bytes not taken from the file */
+
+struct DirtyMap {
+    int runs;
+    int start[DIRTY_MAX_RUNS];   /* run i covers [start[i], start[i + 1]) */
+    int shift[DIRTY_MAX_RUNS];   /* document byte off was file byte off - shift */
+    int len;                     /* document length */
+    int file_len;
+};
+
+void dirty_reset(struct DirtyMap* m, int len);           /* document equals a file of len bytes */
+void dirty_insert(struct DirtyMap* m, int off, int n);
+void dirty_delete(struct DirtyMap* m, int off, int n);
+int  dirty_clean(const struct DirtyMap* m);
+
+/* The file is about to be overwritten in place: runs that are copies of
+   other parts of it can no longer be trusted and become new. */
+void dirty_settle(struct DirtyMap* m);
+
+int  dirty_next(const struct DirtyMap* m, int* lo, int* hi);  /* first run not on file; 0 if none */
+void dirty_written(struct DirtyMap* m, int lo, int hi);      /* [lo, hi) now on file at the same offset */
+void dirty_truncated(struct DirtyMap* m);                    /* file cut to the document length */
+
+#endif
@@ -5,6 +5,11 @@ void editor_open(const char *fname, int *mode);
 /* editor_handle_key receives a pointer to mode so it can request exit */
 void editor_handle_key(int key, int *mode);
 void editor_draw(void);
+void editor_idle(void);   /* autosave; call while waiting for input */
+
+/* bytes of undo history kept per file (oldest dropped first) */
+void editor_set_undo_budget(int bytes);
+int  editor_undo_budget_get(void);
 
 #endif
 #define EDITOR_MOUSE_SUPPORT
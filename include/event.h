@@ -0,0 +1,55 @@
+#ifndef EVENT_H
+#define EVENT_H
+#include "common.h"
+
+/* The kernel's event loop. Keyboard, mouse and serial bytes and the
+   passing of time become events in one queue, and kernel_main() hands each to the
+   active screen, which reacts and returns instead of waiting for input
+   itself. Redraws are requested rather than done on the spot and are
+   delivered once the queue has drained, so a burst of keys costs one
+   frame. How long each key waits until it is handled and each redraw
+   until it is drawn is recorded, whatever screen is active. */
+
+#define EVENT_QUEUE        64          /* pending events */
+#define EVENT_TIMER_TICKS  10          /* thread ticks per timer event: 100 Hz */
+
+/* Event types */
+#define EV_KEY    1   /* code: the key */
+#define EV_MOUSE  2   /* code: buttons, x/y: position */
+#define EV_TIMER  3   /* code: timer periods since the last timer event */
+#define EV_REDRAW 4   /* tsc: when the first request came */
+#define EV_SERIAL 5   /* code: a byte from the serial console */
+
+struct Event {
+    int type;
+    int code;
+    int x, y;
+    u64 tsc;          /* when it was queued */
+};
+
+struct EventStats {
+    u32 keys;
+    u64 key_cycles;   /* queued until handled, summed */
+    u64 key_max;
+    u32 frames;
+    u64 frame_cycles; /* first redraw request until drawn, summed */
+    u64 frame_max;
+    u32 dropped;      /* input lost to a full queue */
+};
+
+void event_init(void);   /* after thread_init(): input interrupts wake event_wait() */
+void event_post(int type, int code, int x, int y);   /* drops the event if the queue is full */
+void event_request_redraw(void);                     /* coalesced into one EV_REDRAW */
+
+/* Next event: polls the hardware and the clock and returns 1 with *ev
+   filled, or 0 if there is nothing to do yet */
+int  event_next(struct Event* ev);
+void event_done(const struct Event* ev);   /* handled; updates the statistics */
+
+/* Nothing to do: give the CPU away until input arrives or the next
+   thread tick, whichever is first */
+void event_wait(void);
+
+const struct EventStats* event_stats(void);
+
+#endif
@@ -4,11 +4,23 @@
 
 /* ---- Sizes ---- */
 #define MAX_FILENAME 32
-#define MAX_CONTENT  2048
+
+/* File data lives in blocks from one shared pool. A file maps its first
+   FS_DIRECT_BLOCKS blocks directly and the rest through one indirect
+   block of block numbers. */
+#define FS_BLOCK_SIZE      4096
+#define FS_DATA_BLOCKS     4096   /* 16 MiB pool */
+#define FS_STATIC_BLOCKS   256    /* 1 MiB pool used when paging is off */
+#define FS_DIRECT_BLOCKS   8
+#define FS_PTRS_PER_BLOCK  (FS_BLOCK_SIZE / 2)
+#define FS_MAX_FILE_SIZE   ((FS_DIRECT_BLOCKS + FS_PTRS_PER_BLOCK) * FS_BLOCK_SIZE)  /* ~8 MiB */
+#define FS_NO_BLOCK        0xFFFF
 
 /* Per-directory limits (memory footprint tight) */
 #define MAX_FILES_PER_DIR  16
 #define MAX_DIRS_PER_DIR   8
+#define FS_FILE_SLOTS      (MAX_FILES_PER_DIR + 4)   /* spares for slots still being read */
+#define FS_DIR_LISTS       128                       /* directory versions, live and retired */
 
 /* File types */
 #define FILE_TEXT 0
@@ -24,6 +36,24 @@
 #define FS_ERR_INVALID -5
 #define FS_ERR_NOTDIR  -6
 #define FS_ERR_DIRNOTEMPTY -7
+#define FS_ERR_BADF    -8
+#define FS_ERR_NFILE   -9
+
+/* Open-file table */
+#define FS_MAX_OPEN 16
+
+/* fs_open flags (access mode in the low two bits) */
+#define FS_O_RDONLY  0x0
+#define FS_O_WRONLY  0x1
+#define FS_O_RDWR    0x2
+#define FS_O_ACCMODE 0x3
+#define FS_O_APPEND  0x4   /* fs_pwrite ignores off and appends */
+#define FS_O_TRUNC   0x8   /* truncate to 0 on open (needs write access) */
+
+/* fs_seek whence */
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
 
 /* Forward decl */
 struct Dir;
@@ -31,31 +61,40 @@ struct Dir;
 /* File visible to other modules */
 struct File {
     char name[MAX_FILENAME];
-    char content[MAX_CONTENT];
+    u16  blocks[FS_DIRECT_BLOCKS];
+    u16  indirect;
     int  length;
+    u32  version;   /* changes whenever the contents do */
     u8   type;
     u8   readonly;
 };
 
+/* One version of a directory's entries. A published list never
+   changes: a change builds a new one, swaps the pointer and retires the
+   old one through RCU (rcu.h), so lookups take no lock at all. */
+struct DirList {
+    int subdir_count;
+    struct Dir* subdirs[MAX_DIRS_PER_DIR];
+    int file_count;
+    struct File* files[MAX_FILES_PER_DIR];   /* into the directory's slots, in listing order */
+};
+
 /* Directory node (tree) */
 struct Dir {
     char name[MAX_FILENAME];
     struct Dir* parent;
-
-    /* children dirs */
-    struct Dir* subdirs[MAX_DIRS_PER_DIR];
-    int subdir_count;
-
-    /* files */
-    struct File files[MAX_FILES_PER_DIR];
-    int file_count;
+    struct DirList* list;                /* read it with fs_dir_list() */
+    struct File slots[FS_FILE_SLOTS];    /* a file stays in its slot; name[0] == 0 if free */
+    u32 version;   /* changes whenever an entry is added, removed or renamed */
 };
 
 /* ---------- Init / CWD ---------- */
 void init_filesystem(void);
 struct Dir* fs_root(void);
 struct Dir* fs_cwd(void);
+void fs_set_cwd(struct Dir* d);              /* back to a directory fs_cwd() returned */
 void fs_pwd(char* out, int out_len);        /* prints path like /, /docs, /docs/projects */
+const struct DirList* fs_dir_list(struct Dir* d);   /* only between rcu_read_lock() and unlock */
 
 /* ---------- Directory ops ---------- */
 int fs_mkdir(const char* name);              /* in CWD */
@@ -73,6 +112,20 @@ int fs_create(const char* name, u8 type);    /* create file in CWD */
 int fs_delete(const char* name);             /* delete file in CWD (not readonly) */
 int fs_write(const char* name, const char* data);
 int fs_append(const char* name, const char* data);
+int fs_rename(const char* from, const char* to); /* replaces `to`; its descriptors see the new data */
+int fs_free_blocks(void);
+
+/* ---------- Descriptor I/O (files in CWD at open time) ----------
+ * A descriptor keeps its own offset and stays bound to the same file even
+ * if the CWD changes. Deleting the file detaches its descriptors: they
+ * fail with FS_ERR_BADF but stay allocated until fs_close(). */
+int fs_open(const char* name, int flags);    /* -> fd >= 0 or FS_ERR_* */
+int fs_read(int fd, char* buf, int n);       /* reads at fd offset, advances it; 0 at EOF */
+int fs_pread(int fd, char* buf, int n, int off);        /* reads n bytes at off, fd offset untouched */
+int fs_pwrite(int fd, const char* buf, int n, int off); /* writes n bytes at off, fd offset untouched */
+int fs_seek(int fd, int off, int whence);    /* -> new offset */
+int fs_truncate(int fd, int len);            /* shrink or zero-extend */
+int fs_close(int fd);
 
 /* ---------- Optional helpers ---------- */
 void fs_list_counts(int* out_dirs, int* out_files);  /* both counts for UI */
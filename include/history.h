@@ -0,0 +1,29 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+#include "common.h"
+
+/* Shell command history. Commands are kept back to back in one text
+   arena with an offset per entry; when either fills up, the oldest
+   quarter is dropped in one move. Every entry also carries a 64-bit
+   signature of its trigrams, so a substring search tests one word per
+   entry and compares text only where all of the query's trigrams may
+   occur. The history is appended to HIST_FILE in the root directory as
+   it grows and read back by history_init(). */
+
+#define HIST_ARENA    (256 * 1024)   /* bytes of command text */
+#define HIST_MAX      16384          /* entries */
+#define HIST_LINE_MAX 128            /* longest command kept, with its NUL */
+#define HIST_FILE     ".history"
+
+/* Entries are numbered from 0 in the order they were added; the oldest
+   still kept is history_first(), the newest history_end() - 1. */
+void history_init(void);               /* after init_filesystem() */
+void history_add(const char* cmd);     /* a repeat of the newest entry is dropped */
+int  history_first(void);
+int  history_end(void);
+const char* history_get(int id);       /* 0 if id is no longer kept */
+
+/* Newest entry before before holding q[0..n); -1 if none */
+int  history_search(const char* q, int n, int before);
+
+#endif
@@ -20,6 +20,10 @@ u8 kb_read_scancode(void);
 
 /* Function declarations */
 int read_key(void);
+int key_decode(u8 sc);   /* -> key, 0 for none (releases, modifiers), -1 if it was a prefix */
+int key_pending(void);   /* a keyboard byte is waiting; read_key() won't block */
+int poll_key(void);      /* decodes a waiting byte: the key, or 0; never blocks */
+void input_set_idle_callback(void (*cb)(void));  /* called while waiting for a key */
 
 /* Modifier state functions */
 int input_readline(char *buf, int max);
@@ -0,0 +1,30 @@
+#ifndef IO_H
+#define IO_H
+#include "common.h"
+
+/* Port I/O and timestamp helpers shared by drivers */
+static inline u8 io_inb(u16 port) {
+    u8 val;
+    __asm__ volatile ("inb %1, %0" : "=a"(val) : "Nd"(port));
+    return val;
+}
+
+static inline void io_outb(u16 port, u8 val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static inline u64 rdtsc(void) {
+    u32 lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+}
+
+/* floor(log2(v)), 0 for v == 0; avoids libgcc 64-bit helpers */
+static inline int log2_u64(u64 v) {
+    u32 hi = (u32)(v >> 32), lo = (u32)v;
+    if (hi) return 63 - __builtin_clz(hi);
+    if (lo) return 31 - __builtin_clz(lo);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef KLOG_H
+#define KLOG_H
+#include "common.h"
+
+/* Kernel log. klog() does not format anything: it claims the next slot
+   of a fixed ring with one atomic add, stores the level, the tick, the
+   CPU, the format's address and the raw arguments, and marks the slot
+   done. No lock is taken and nothing is allocated, so any CPU and any
+   interrupt handler may log at any time; the cost is a scan of the
+   format and a handful of stores. Records are turned into text when
+   they are read: drained to the serial port from idle time, or shown
+   by dmesg. A ring that wraps overwrites its oldest records; readers
+   that fell behind count them as lost.
+
+   Conversions: %d %u %x %c %s %%. The format itself is kept by address
+   and must be a literal; %s strings are copied into the record, up to
+   KLOG_TEXT bytes between them. */
+
+#define KLOG_RING 256   /* records; a power of two */
+#define KLOG_ARGS 4     /* conversions kept per record; later ones print as ? */
+#define KLOG_TEXT 60    /* bytes of %s text per record */
+#define KLOG_LINE 128   /* a formatted record, "[seconds] level: message" */
+
+/* Levels */
+#define KLOG_ERR   0
+#define KLOG_WARN  1
+#define KLOG_INFO  2
+#define KLOG_DEBUG 3
+
+struct KlogRecord {
+    volatile u32 stamp;   /* 2 * seq + 1 while written, 2 * seq + 2 when done */
+    u32 ticks;            /* thread_ticks() */
+    const char* fmt;
+    u8  level, cpu;
+    u8  text_len;
+    u8  pad;
+    u32 args[KLOG_ARGS];  /* %s: offset into text */
+    char text[KLOG_TEXT];
+};
+
+struct KlogStats {
+    u32 written;
+    u32 drained;   /* sent to the serial port */
+    u32 lost;      /* overwritten before the drain got to them */
+};
+
+void klog(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+u32  klog_head(void);                          /* seq of the next record */
+int  klog_read(u32 seq, struct KlogRecord* out);   /* -> 1 if seq is done and still in the ring */
+int  klog_format(const struct KlogRecord* r, char* out, int max);   /* -> length, no newline */
+
+/* From idle: send finished records to the serial port, as many as its
+   transmit ring takes without waiting */
+void klog_drain(void);
+
+void klog_stats(struct KlogStats* out);
+
+#endif
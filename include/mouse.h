@@ -10,8 +10,8 @@ typedef struct {
 
 /* Mouse function prototypes */
 void init_mouse(void);
-void mouse_handler(void);
-mouse_state_t* get_mouse_state(void);
+int  mouse_handler(void);   /* reads one byte; 1 when it completed a packet */
+void mouse_get(mouse_state_t* out);   /* a consistent copy, from anywhere */
 
 /* Mouse button constants */
 #define MOUSE_LEFT_BUTTON   (1 << 0)
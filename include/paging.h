@@ -0,0 +1,65 @@
+#ifndef PAGING_H
+#define PAGING_H
+#include "common.h"
+
+/* Paging. Physical memory, kernel image and VGA included, is mapped 1:1
+   with global 4 MiB pages, so the kernel itself costs a handful of TLB
+   entries. Above it, a window of 4 KiB pages holds regions: named
+   ranges of virtual memory whose pages get frames either up front or
+   on first touch, when the page-fault handler backs them. Faults are
+   counted per region; a touch outside every region, or on a guard page,
+   still stops the machine. */
+
+#define PAGE_SIZE      4096
+#define LARGE_PAGE     (4u << 20)
+#define PAGING_MAX_RAM (768u << 20)   /* identity mapped at most; below DYN_BASE */
+#define DYN_BASE       0xD0000000     /* the 4 KiB window */
+#define DYN_SIZE       (128u << 20)
+#define REGION_MAX     16
+#define REGION_NAME_MAX 12
+
+/* region_create flags */
+#define REGION_LAZY  0x1   /* frames on first touch instead of now */
+#define REGION_GUARD 0x2   /* an unmapped page after it catches overruns */
+
+/* Error codes */
+#define PAGING_OK          0
+#define PAGING_ERR_NOMEM  -1   /* out of frames, window space or region slots */
+#define PAGING_ERR_OFF    -2   /* paging is not enabled */
+
+struct RegionInfo {
+    char name[REGION_NAME_MAX];
+    u32  base, size;
+    u32  pages;     /* backed by frames */
+    u32  faults;    /* lazy pages filled in */
+    u32  bad;       /* touches of its guard page */
+    int  flags;
+};
+
+struct FrameStats {
+    u32 total;      /* frames of RAM */
+    u32 kernel;     /* below the end of the kernel image */
+    u32 used;       /* handed to regions */
+    u32 reserved;   /* promised to lazy regions, not touched yet */
+    u32 free;
+};
+
+/* Boot CPU, after cpu_init(): maps RAM and enables paging; -> PAGING_OK
+   or PAGING_ERR_OFF if the CPU has no 4 MiB pages */
+int  paging_init(void);
+void paging_init_ap(void);    /* another CPU: the same page directory */
+
+/* size rounds up to pages; -> base address, 0 on failure */
+void* region_create(const char* name, u32 size, int flags);
+int   region_info(int i, struct RegionInfo* out);   /* slot i, 0 if unused */
+/* Set aside frames for up to `pages` first touches of the lazy region at
+   base, so they cannot fault for want of RAM; -> pages actually set aside,
+   fewer when RAM is short */
+u32   region_reserve(void* base, u32 pages);
+
+/* identity map device memory [phys, phys + size), uncached */
+int  paging_map_mmio(u32 phys, u32 size);
+
+void paging_frame_stats(struct FrameStats* out);
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef POOL_H
+#define POOL_H
+#include "common.h"
+#include "smp.h"
+
+/* Fork-join task pool across CPUs. Each CPU has a deque of tasks: it
+   pushes and pops at the bottom, so its own work stays LIFO and cache
+   warm, while an idle CPU steals from the top of someone else's, where
+   the biggest unsplit ranges sit. A task waiting for its children runs
+   other tasks meanwhile instead of blocking. */
+
+#define POOL_DEQUE 256   /* tasks per CPU; a spawn into a full deque runs inline */
+
+/* Runs [lo, hi) of the job described by arg */
+typedef void (*pool_fn)(void* arg, int lo, int hi);
+
+struct PoolStats {
+    u32 executed;    /* tasks run on the CPU */
+    u32 stolen;      /* of those, taken from another CPU's deque */
+};
+
+/* Counts *pending up; it drops back once the task has run */
+void pool_spawn(pool_fn fn, void* arg, int lo, int hi, volatile int* pending);
+void pool_wait(volatile int* pending);   /* until *pending is 0, helping out */
+
+/* From a thread on the BSP: fn(arg, lo, hi) on the first cpus CPUs that
+   are online; -> CPUs that took part */
+int  pool_run(pool_fn fn, void* arg, int lo, int hi, int cpus);
+
+void pool_worker(int cpu);               /* an AP's loop, never returns */
+void pool_stats(int cpu, struct PoolStats* out);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+#include "common.h"
+
+#define RAMDISK_SECTORS          512  /* 256 KiB */
+#define RAMDISK_SECTORS_PER_POLL 8    /* transfer progress per blk_poll() */
+
+/* Registers "ram0" with the block layer; returns its device id. */
+int ramdisk_init(void);
+
+#endif
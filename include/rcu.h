@@ -0,0 +1,65 @@
+#ifndef RCU_H
+#define RCU_H
+#include "common.h"
+#include "cpu.h"
+
+/* Read-copy-update for read-mostly pointers.
+
+   Readers bracket a lookup with rcu_read_lock()/rcu_read_unlock(): each
+   is one non-locked increment or decrement of a per-CPU counter, with
+   no lock, no atomic instruction and no write to shared data. A writer
+   never changes what readers can see. It builds a new version, publishes
+   it with rcu_assign_pointer() and hands the old one to rcu_retire(). The
+   old version is freed once a grace period has passed, which means every
+   CPU has been seen outside any read-side section.
+
+   Rules for readers: do not sleep or yield inside a read-side section,
+   and do not keep a pointer obtained in it after rcu_read_unlock(),
+   unless something other than RCU keeps that object alive. */
+
+#define RCU_PENDING 128   /* objects waiting for their grace period */
+
+struct RcuStats {
+    u32 grace_periods;   /* completed */
+    u32 retired;
+    u32 freed;
+    u32 pending;
+};
+
+typedef void (*rcu_free_fn)(void* obj);
+
+static inline void rcu_read_lock(void) {
+    __asm__ volatile ("incl %%fs:%c0" : : "i"(__builtin_offsetof(struct PerCpu, rcu_nest)) : "memory");
+}
+
+/* back at 0, the CPU has passed a quiescent state */
+static inline void rcu_read_unlock(void) {
+    __asm__ volatile ("decl %%fs:%c0\n\t"
+                      "jnz 1f\n\t"
+                      "incl %%fs:%c1\n"
+                      "1:"
+                      : : "i"(__builtin_offsetof(struct PerCpu, rcu_nest)),
+                          "i"(__builtin_offsetof(struct PerCpu, rcu_qs)) : "memory", "cc");
+}
+
+/* x86 does not reorder loads with loads or stores with stores, so both
+   only have to keep the compiler in order */
+#define rcu_dereference(p)      __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+/* Free obj with fn after the next grace period; fine under a spinlock.
+   -> 0, or -1 if RCU_PENDING objects are already waiting. */
+int  rcu_retire(void* obj, rcu_free_fn fn);
+int  rcu_room(void);           /* rcu_retire() calls that will succeed now */
+
+/* Move grace periods along and free what is due, without waiting;
+   outside read-side sections and spinlocks. -> objects freed. */
+int  rcu_poll(void);
+
+/* Wait for a full grace period, then free what it covers. Thread
+   context, outside read-side sections and spinlocks. */
+void rcu_synchronize(void);
+
+void rcu_stats(struct RcuStats* out);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+#include "common.h"
+#include "fs.h"
+
+/* Shell scripts. A script file is compiled once into a flat list of
+   operations: every line becomes a command or a control word, blank
+   lines and comments are dropped, and each block's jump targets are
+   resolved up front. Compiled scripts are cached by directory, name and
+   file version, so running one again costs no parsing at all. */
+
+#define SCRIPT_LINE_MAX  128    /* longest line, after $variables expand */
+#define SCRIPT_MAX_OPS   512
+#define SCRIPT_TEXT      16384  /* command text of one script */
+#define SCRIPT_CACHE     4      /* compiled scripts kept */
+#define SCRIPT_MAX_DEPTH 8      /* nested if/while/repeat blocks */
+
+/* Operations */
+#define SOP_CMD    0   /* run the text as a command */
+#define SOP_IF     1   /* run the text; on failure jump */
+#define SOP_ELSE   2   /* jump past the end of the if */
+#define SOP_END    3   /* jump = the op that opened the block */
+#define SOP_WHILE  4   /* run the text; on failure jump past the end */
+#define SOP_REPEAT 5   /* text is a count; jump past the end if it is 0 */
+#define SOP_BREAK  6   /* jump past the end of the innermost loop */
+#define SOP_EXIT   7   /* text is the status, empty for the last one */
+
+/* Error codes */
+#define SCRIPT_OK            0
+#define SCRIPT_ERR_NOTFOUND -1
+#define SCRIPT_ERR_TOOBIG   -2   /* too many lines, or a line too long */
+#define SCRIPT_ERR_SYNTAX   -3   /* unbalanced block, stray else/break */
+#define SCRIPT_ERR_BUSY     -4   /* every cached script is running */
+
+struct ScriptOp {
+    u8  type;
+    u8  depth;     /* blocks open around it */
+    u8  expand;    /* text holds a '$' */
+    u16 line;      /* 1-based, for messages */
+    u16 jump;
+    u16 text;      /* offset of the NUL-terminated text */
+};
+
+struct Script {
+    char name[MAX_FILENAME];
+    struct Dir* dir;
+    u32  version;              /* of the file it was compiled from */
+    int  nops;
+    struct ScriptOp ops[SCRIPT_MAX_OPS];
+    char text[SCRIPT_TEXT];
+    int  text_len;
+    u32  last_used;
+    int  running;              /* runs in progress; such a slot is never reused */
+};
+
+/* Compiled script for name in the CWD, compiling it if the cache has no
+   current copy. On failure returns 0 with *err set and *line at the
+   offending line (0 if none). */
+struct Script* script_load(const char* name, int* err, int* line);
+
+u32 script_compiles(void);     /* compilations so far, cache misses */
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+#include "common.h"
+#include "text.h"
+
+/* Substring search for the editor (Boyer-Moore-Horspool). A pattern is
+   compiled once into a skip table; the text is then scanned through a
+   small window copied out of the document, so searching a large or
+   partly cold file reads each byte once. */
+
+#define SEARCH_MAX_PATTERN 64
+#define SEARCH_WINDOW      1024   /* bytes examined per text_copy() */
+
+struct Search {
+    char pat[SEARCH_MAX_PATTERN];
+    int  len;
+    u8   skip[256];   /* shift by the byte under the window's last position */
+};
+
+void search_compile(struct Search* s, const char* pat, int n);   /* n is clamped */
+
+/* First match starting at or after from in buf[0..n), or -1 */
+int  search_buf(const struct Search* s, const char* buf, int n, int from);
+
+/* Document offset of the first match at or after from / the last match
+   starting before before; -1 if none. Neither wraps around. */
+int  search_next(const struct Search* s, struct Text* t, int from);
+int  search_prev(const struct Search* s, struct Text* t, int before);
+
+/* Writes src with every non-overlapping match replaced by rep into the
+   empty document dst, in one pass. Returns the number of matches, or
+   TEXT_ERR_NOMEM with dst partly filled. */
+int  search_replace_all(const struct Search* s, struct Text* src, struct Text* dst,
+                        const char* rep, int rlen);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+#include "common.h"
+
+/* COM1 console on a 16550 UART. Both directions go through rings in
+   memory and the UART's 16-byte FIFOs: a writer copies its whole buffer
+   into the transmit ring under one lock and returns, and the interrupt
+   handler refills the FIFO 16 bytes at a time as it empties. Received
+   bytes are moved into their ring from the interrupt, so nothing is
+   lost while the UI thread is busy. A writer finding the transmit ring
+   full sleeps until the UART has drained half of it; bytes are never
+   dropped on the way out. */
+
+#define SERIAL_BAUD    115200
+#define SERIAL_TX_RING 16384   /* powers of two */
+#define SERIAL_RX_RING 1024
+#define SERIAL_FIFO    16
+
+#define IRQ_COM1 4
+
+struct SerialStats {
+    u32 tx_bytes;
+    u32 rx_bytes;
+    u32 tx_irqs;       /* FIFO refills */
+    u32 tx_waits;      /* writers that found the ring full */
+    u32 rx_dropped;    /* received with the ring full, or overrun in the UART */
+};
+
+/* After cpu_init(); -> 1 if a UART answered at COM1, else the port stays silent */
+int  serial_init(void);
+int  serial_present(void);
+
+/* Queue n bytes, '\n' sent as "\r\n"; may sleep while the ring is full */
+void serial_write(const char* s, int n);
+void serial_puts(const char* s);
+
+int  serial_tx_room(void);    /* bytes the transmit ring takes without waiting */
+
+int  serial_getc(void);       /* next received byte, -1 if none */
+int  serial_pending(void);    /* a received byte is waiting */
+
+/* Called from the interrupt whenever bytes arrive */
+void serial_set_rx_callback(void (*cb)(void));
+
+void serial_stats(struct SerialStats* out);
+
+#endif
@@ -1,11 +1,21 @@
 #ifndef SHELL_H
 #define SHELL_H
 
-/* Called every kernel loop while in browser mode.
+/* Called for every key while in browser mode; it returns at once, and a
+ * command line or a command's screen carries over to the next key.
  * explorer_sel: current selected index in the explorer
  * mode pointer to current_mode (so shell can switch to MODE_EDITOR / MODE_GAME)
  * Returns updated explorer_sel.
  */
-int shell_loop(int explorer_sel, int *mode);
+int shell_handle_key(int key, int explorer_sel, int *mode);
+void shell_draw(void);   /* the browser and whatever the shell shows over it */
+
+/* A byte from the serial console, in any mode. It edits a line of its
+   own; a finished line runs as a command with its output copied to the
+   port. Returns updated explorer_sel. */
+int shell_serial_char(int c, int explorer_sel, int *mode);
+
+/* Builds the command lookup; after init_filesystem(), before shell_handle_key() */
+void shell_init(void);
 
 #endif 
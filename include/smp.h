@@ -0,0 +1,35 @@
+#ifndef SMP_H
+#define SMP_H
+#include "common.h"
+#include "cpu.h"
+
+/* Multiprocessor bring-up. The CPUs come from the ACPI MADT; the BSP
+   enables its local APIC and starts every other enabled CPU with
+   INIT-SIPI-SIPI through a real-mode trampoline at AP_TRAMPOLINE. An AP
+   gets its own stack, loads the kernel's GDT and IDT, and runs the task
+   pool's worker loop; kernel threads stay on the BSP. */
+
+#define SMP_MAX_CPUS   CPU_MAX
+#define SMP_STACK      16384
+#define AP_TRAMPOLINE  0x8000   /* below 1 MiB, page aligned: SIPI vector 0x08 */
+#define VEC_IPI_WAKE   48       /* gets an AP out of hlt */
+
+struct Cpu {
+    int  id;             /* index into the CPU table */
+    u8   apic_id;
+    volatile int online;
+};
+
+/* After thread_init(): finds and starts the APs; -> CPUs online */
+int  smp_init(void);
+int  smp_count(void);              /* CPUs online, 1 without an APIC */
+int  smp_cpu(void);                /* index of the calling CPU */
+const struct Cpu* smp_get(int i);
+void smp_wake_all(void);           /* IPI every AP out of hlt */
+
+/* Interrupt every other CPU online and wait until each has taken it.
+   An interrupt drains the CPU's store buffer, so afterwards its earlier
+   stores are visible here. Call with no spinlock held. */
+void smp_sync(void);
+
+#endif
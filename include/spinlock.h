@@ -0,0 +1,113 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+#include "common.h"
+#include "io.h"
+#include "cpu.h"
+
+/* Locks for data shared between CPUs, threads and interrupt handlers.
+
+   A spinlock is a ticket lock: each CPU takes the next ticket and waits
+   for its number to come up, so waiters get the lock in arrival order and
+   none starves. Holders must not sleep. Data an interrupt handler also
+   touches takes the _irqsave variants, or the handler could spin on a
+   lock its own CPU holds.
+
+   A seqlock is for small read-mostly data such as the mouse position or
+   the clock: writers bump a sequence number around the update under a
+   spinlock, readers copy the data without writing anything and retry if
+   the number was odd or changed meanwhile.
+
+   Every lock keeps statistics, updated while it is held: acquisitions,
+   how many had to wait, and hold time in TSC cycles. A lock joins the
+   list that lock_info() walks the first time it is taken. */
+
+#define LOCK_MAX 32   /* locks lock_info() can list */
+
+struct Spinlock {
+    volatile u16 owner;      /* ticket being served */
+    volatile u16 next;       /* next ticket to hand out */
+    volatile u32 listed;
+    const char* name;
+    u32 acquires;
+    u32 contended;           /* acquisitions that had to wait */
+    u32 retries;             /* seqlocks: reads that had to start over */
+    u32 hold_max;
+    u64 hold_cycles;
+    u64 since;               /* TSC when the holder got it */
+};
+
+#define SPINLOCK_INIT(n) { .name = (n) }
+
+struct Seqlock {
+    volatile u32 seq;        /* odd while a write is in progress */
+    struct Spinlock lock;    /* between writers */
+};
+
+#define SEQLOCK_INIT(n) { .lock = SPINLOCK_INIT(n) }
+
+struct LockInfo {
+    const char* name;
+    u32 acquires, contended, retries, hold_max;
+    u64 hold_cycles;
+};
+
+/* slow paths, spinlock.c */
+void spin_wait(struct Spinlock* l, u16 ticket);
+void lock_list(struct Spinlock* l);
+
+static inline void spin_lock(struct Spinlock* l) {
+    u16 ticket = __atomic_fetch_add(&l->next, 1, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != ticket) spin_wait(l, ticket);
+    if (!l->listed) lock_list(l);
+    l->acquires++;
+    l->since = rdtsc();
+}
+
+static inline void spin_unlock(struct Spinlock* l) {
+    u64 held = rdtsc() - l->since;
+    l->hold_cycles += held;
+    if (held > l->hold_max) l->hold_max = (held >> 32) ? 0xFFFFFFFF : (u32)held;
+    __atomic_store_n(&l->owner, (u16)(l->owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline u32 spin_lock_irqsave(struct Spinlock* l) {
+    u32 f = irq_save();
+    spin_lock(l);
+    return f;
+}
+
+static inline void spin_unlock_irqrestore(struct Spinlock* l, u32 f) {
+    spin_unlock(l);
+    irq_restore(f);
+}
+
+/* Writers; interrupts stay off in between, so a handler may write too */
+static inline u32 seq_write_begin(struct Seqlock* s) {
+    u32 f = spin_lock_irqsave(&s->lock);
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return f;
+}
+
+static inline void seq_write_end(struct Seqlock* s, u32 f) {
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&s->lock, f);
+}
+
+/* Readers: do { v = seq_read_begin(s); copy } while (seq_read_retry(s, v)); */
+static inline u32 seq_read_begin(const struct Seqlock* s) {
+    u32 v;
+    while ((v = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1) __asm__ volatile ("pause");
+    return v;
+}
+
+static inline int seq_read_retry(struct Seqlock* s, u32 v) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == v) return 0;
+    __atomic_add_fetch(&s->lock.retries, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+int lock_info(int i, struct LockInfo* out);   /* i-th listed lock, 0 past the end */
+
+#endif
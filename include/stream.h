@@ -0,0 +1,61 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include "common.h"
+
+/* Byte streams between shell commands. Output is written into fixed-size
+   pipe pages from a small static pool; a full page is handed to the
+   stream's sink as is, and the sink owns it from then on: it reads the
+   bytes in place, passes the page further down a pipeline or frees it.
+   A pipeline therefore holds a page or two per stage, whatever the size
+   of the data flowing through it. */
+
+#define PIPE_PAGE_SIZE  4096   /* one file system block */
+#define PIPE_POOL_PAGES 16
+
+/* Error codes */
+#define STREAM_OK            0
+#define STREAM_ERR_NOMEM    -1   /* pipe page pool exhausted */
+#define STREAM_ERR_CLOSED   -2   /* the reader wants no more; not a failure */
+#define STREAM_ERR_IO       -3
+#define STREAM_ERR_NOTFOUND -4
+
+struct PipePage {
+    struct PipePage* next;   /* free list */
+    int len;
+    char data[PIPE_PAGE_SIZE];
+};
+
+/* Takes ownership of pg; a negative return stops the writer */
+typedef int (*stream_sink_fn)(void* ctx, struct PipePage* pg);
+
+struct Stream {
+    struct PipePage* page;   /* being filled, 0 if none */
+    stream_sink_fn sink;
+    void* ctx;
+    int fd;                  /* file streams: descriptor, else -1 */
+    int err;                 /* first error; writes fail once set */
+    u32 bytes;
+};
+
+struct PipePage* pipe_page_alloc(void);   /* 0 if the pool is empty */
+void pipe_page_free(struct PipePage* pg);
+int  pipe_free_pages(void);
+
+void stream_init(struct Stream* s, stream_sink_fn sink, void* ctx);
+/* writes into name in the CWD, created if needed; truncated unless append */
+int  stream_open_file(struct Stream* s, const char* name, int append);
+
+/* Room left in the current page, to be filled in place and then
+   committed; 0 (and *room 0) once the stream has failed */
+char* stream_space(struct Stream* s, int* room);
+void  stream_commit(struct Stream* s, int n);
+
+int  stream_write(struct Stream* s, const char* buf, int n);   /* -> STREAM_OK or error */
+int  stream_pass(struct Stream* s, struct PipePage* pg);       /* hand a filled page on */
+int  stream_flush(struct Stream* s);
+int  stream_close(struct Stream* s);                           /* flush, close any file */
+
+/* Read a file of the CWD straight into the stream's pages; -> bytes or error */
+int  stream_copy_file(struct Stream* s, const char* name);
+
+#endif
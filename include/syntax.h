@@ -0,0 +1,72 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+#include "common.h"
+#include "text.h"
+
+/* Syntax highlighting for the editor. The lexer runs one character at a
+   time, so a line can be fed in pieces; only a small mode survives from
+   one line to the next (inside a block comment, a fenced code block, a
+   multi-line shell string). That mode is cached for the start of every
+   line: painting a line needs just its own bytes, and after an edit the
+   lines below are re-lexed only until their start mode matches what was
+   cached before. */
+
+/* Languages */
+#define SYN_NONE 0
+#define SYN_C    1
+#define SYN_MD   2
+#define SYN_SH   3
+
+/* Colours */
+#define SYN_ATTR_TEXT    0x07
+#define SYN_ATTR_KEYWORD 0x0B
+#define SYN_ATTR_COMMENT 0x02
+#define SYN_ATTR_STRING  0x06
+#define SYN_ATTR_NUMBER  0x0D
+#define SYN_ATTR_PREPROC 0x0A
+#define SYN_ATTR_HEADING 0x0F
+#define SYN_ATTR_CODE    0x06
+#define SYN_ATTR_MARKER  0x0B
+#define SYN_ATTR_VAR     0x0D
+
+#define SYN_MAX_LINES 65536   /* lines with a cached start mode; later ones start plain */
+
+/* Lexer position inside a line */
+struct SynLexer {
+    u8   lang;
+    u8   mode;
+    u8   esc;      /* previous char was a backslash inside a string */
+    u8   num;      /* inside a number */
+    u8   var;      /* inside a shell $variable */
+    u8   ticks;    /* markdown: backticks opening the line */
+    char prev;
+    int  col;
+};
+
+struct SynCache {
+    u8  lang;
+    int valid;     /* start modes of lines [0, valid) are exact */
+    int hint_end;  /* [valid, hint_end): modes from before the last edits */
+    u8  state[SYN_MAX_LINES];
+};
+
+int  syntax_lang_for(const char* filename);   /* by extension */
+
+void syntax_begin(struct SynLexer* lx, int lang, u8 state);
+void syntax_scan(struct SynLexer* lx, const char* s, int n, u8* attrs); /* attrs may be 0 */
+u8   syntax_end(struct SynLexer* lx);         /* mode carried into the next line */
+
+/* Colours the visible prefix of one line starting in mode state */
+void syntax_color(int lang, u8 state, const char* s, int n, u8* attrs);
+
+/* Colours n bytes at column from of the line at off (of length len);
+   the part of the line before them is lexed without colouring */
+void syntax_color_span(int lang, u8 state, struct Text* t, int off, int len,
+                       int from, int n, u8* attrs);
+
+void syntax_reset(struct SynCache* c, int lang);
+void syntax_edit(struct SynCache* c, int line, int delta);   /* line changed, delta lines added after it */
+void syntax_forget(struct SynCache* c, int line);            /* everything after line may have changed */
+u8   syntax_state_at(struct SynCache* c, struct Text* t, int line);
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef TEXT_H
+#define TEXT_H
+#include "common.h"
+
+/* Text engine for the editor: a gap buffer split into fixed-size pages.
+   Every page keeps its own gap, so an edit only ever moves bytes inside
+   one page, and the document grows by adding pages instead of being
+   capped by a single array. Page frames come from a shared static pool.
+
+   Two Fenwick trees over page order (bytes and newlines per page) turn
+   offset and line lookups into a tree descent plus a scan of one page,
+   so they cost the same anywhere in the document.
+
+   A document can also be a view of a larger source (text_attach). Its
+   pages start out cold: only their extent and newline count are known,
+   and the bytes are read on first touch. Edited pages stay resident as
+   an overlay; unmodified ones are evicted when the frame pool runs dry,
+   so memory follows the viewport rather than the file size. */
+
+/* ---- Sizes ---- */
+#define TEXT_PAGE_SIZE   4096
+#define TEXT_POOL_PAGES  256    /* frames shared by all documents (1 MiB) */
+#define TEXT_MAX_PAGES   4096   /* page descriptors per document */
+#define TEXT_MAX_BACKED  4      /* documents attached to a source at once */
+#define TEXT_COLD_FILL   (TEXT_PAGE_SIZE - TEXT_PAGE_SIZE / 4)  /* bytes per attached page */
+#define TEXT_NO_FRAME    0xFFFF
+
+/* Error codes */
+#define TEXT_OK          0
+#define TEXT_ERR_NOMEM  -1
+#define TEXT_ERR_RANGE  -2
+
+/* Reads n bytes at off from a document's source; returns bytes read */
+typedef int (*text_read_fn)(void* ctx, char* buf, int n, int off);
+
+/* One page in document order; its text is
+   frame[0 .. gap_start) followed by frame[gap_end .. TEXT_PAGE_SIZE). */
+struct TextPage {
+    u16 frame;      /* TEXT_NO_FRAME while cold */
+    u16 gap_start;
+    u16 gap_end;
+    u16 nl;         /* newlines in this page */
+    int src;        /* source offset of an unmodified copy, -1 once edited */
+    u8  ref;        /* touched since the eviction clock last passed */
+};
+
+struct Text {
+    struct TextPage pages[TEXT_MAX_PAGES];
+    int npages;
+    int len;
+    int nl;
+    /* 1-based Fenwick trees over pages[]: byte and newline counts */
+    int fw_len[TEXT_MAX_PAGES + 1];
+    int fw_nl[TEXT_MAX_PAGES + 1];
+    text_read_fn read;  /* 0 unless attached */
+    void* read_ctx;
+    int clock;          /* eviction hand */
+    int lost;           /* a cold page could not be read back: the document is incomplete */
+};
+
+/* Sequential reader, cheaper than repeated text_char_at() */
+struct TextIter {
+    struct Text* t;
+    int page;
+    int idx;        /* logical index inside the page */
+};
+
+void text_init(struct Text* t);
+void text_free(struct Text* t);               /* returns frames to the pool */
+int  text_length(const struct Text* t);
+
+/* Make t a view of the first len bytes of a source. Newlines are counted
+   in one streaming pass; pages are loaded while frames are plentiful and
+   left cold after that. */
+int  text_attach(struct Text* t, text_read_fn read, void* ctx, int len);
+int  text_fully_loaded(const struct Text* t);  /* no cold pages */
+int  text_source_lost(const struct Text* t);   /* source shrank or went away; don't save over it */
+void text_rebase(struct Text* t);              /* source now equals the document */
+int  text_detach(struct Text* t);              /* load everything, forget the source */
+int  text_pin(struct Text* t);                 /* load everything, keep it resident until the next rebase */
+void text_move(struct Text* dst, struct Text* src);  /* dst takes over src's pages, src ends empty */
+
+int  text_insert(struct Text* t, int off, const char* s, int n);  /* TEXT_OK / TEXT_ERR_* */
+int  text_delete(struct Text* t, int off, int n);
+char text_char_at(struct Text* t, int off);                 /* '\0' past the end */
+int  text_copy(struct Text* t, int off, char* out, int n);  /* -> bytes copied */
+
+/* Lines: a line runs up to (not including) '\n' */
+int  text_line_count(const struct Text* t);
+int  text_line_start(struct Text* t, int line);  /* text_length() past the last line */
+int  text_line_length(struct Text* t, int start);
+int  text_line_of(struct Text* t, int off);      /* line containing off */
+
+void text_iter_init(struct TextIter* it, struct Text* t, int off);
+int  text_iter_next(struct TextIter* it);     /* next char, or -1 at the end */
+
+int  text_free_frames(void);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef THREAD_H
+#define THREAD_H
+#include "common.h"
+
+/* Kernel threads. Each has its own stack from a static pool and a fixed
+   priority; the ready threads of each priority wait in a FIFO, and one
+   bit per priority says which FIFOs are non-empty, so picking the next
+   thread is a find-first-set and a dequeue. The PIT tick preempts a
+   thread when a higher priority one becomes ready or when its quantum
+   runs out with a peer waiting. kernel_main() becomes the "ui" thread;
+   an idle thread halts the CPU when nothing else can run. */
+
+#define THREAD_MAX      8
+#define THREAD_STACK    8192
+#define THREAD_PRIOS    8      /* 0 runs first */
+#define THREAD_HZ       1000   /* timer ticks per second */
+#define THREAD_QUANTUM  10     /* ticks before a peer of the same priority runs */
+#define THREAD_NAME_MAX 12
+
+/* Priorities */
+#define PRIO_HIGH       0
+#define PRIO_UI         1
+#define PRIO_NORMAL     3
+#define PRIO_BACKGROUND 6
+#define PRIO_IDLE       7      /* the idle thread only */
+
+/* States */
+#define T_FREE     0
+#define T_READY    1
+#define T_RUNNING  2
+#define T_BLOCKED  3   /* on a channel and/or a deadline */
+#define T_DONE     4
+
+/* Error codes */
+#define THREAD_OK         0
+#define THREAD_ERR_NOMEM -1   /* no free thread slot */
+#define THREAD_ERR_PRIO  -2
+
+struct ThreadInfo {
+    int  id;
+    char name[THREAD_NAME_MAX];
+    int  prio;
+    int  state;
+    u32  switches;   /* times it was switched to */
+    u32  ticks;      /* timer ticks it was running for */
+};
+
+typedef void (*thread_fn)(void* arg);
+
+/* Starts the timer and makes the caller thread 0 with priority PRIO_UI;
+   after cpu_init(), enables interrupts */
+void thread_init(void);
+
+int  thread_create(const char* name, int prio, thread_fn fn, void* arg);   /* -> id or THREAD_ERR_* */
+void thread_exit(void);
+void thread_yield(void);                 /* to the next ready thread of the same or a higher priority */
+void thread_sleep(u32 ticks);
+
+/* Block until chan is woken or, if timeout is nonzero, that many ticks
+   pass; -> 1 if woken, 0 on timeout. Check the condition and wait with
+   interrupts off (irq_save()) so a wakeup cannot slip in between. */
+int  thread_wait(const void* chan, u32 timeout);
+int  thread_wakeup(const void* chan);    /* -> threads woken; fine in IRQ handlers */
+
+int  thread_self(void);
+u32  thread_ticks(void);                 /* since thread_init(), wraps */
+u64  thread_uptime(void);                /* the same, in full */
+u32  thread_switches(void);              /* context switches so far */
+int  thread_info(int i, struct ThreadInfo* out);   /* slot i, 0 if unused */
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include "common.h"
+#include "cpu.h"
+
+/* Static tracepoints. A TRACE_*() site compiles to a compare of one
+   global byte with 0 and a jump that is not taken while tracing is off:
+   trace_record() is cold, so the call is moved out of line and the
+   fast path is the single fused cmp/jne. While it is on, each site
+   writes a 16-byte record into the ring of the CPU it runs on. The slot
+   is claimed by an xadd on the CPU's own counter, which an interrupt on
+   the same CPU cannot split, so no lock and no locked instruction is
+   needed. A ring keeps its newest TRACE_RING records.
+
+   trace_dump() merges the rings by timestamp into text for a host
+   script, one record per line after a few '#' header lines:
+
+       # noir-trace 1
+       # cycles_per_ms <n>
+       <cpu> <tsc> <B|E|I> <name> <arg>
+
+   B and E open and close a span of the same name on that CPU, I is an
+   instant; they map one to one onto Chrome trace events "ph" fields. */
+
+#define TRACE_RING 4096   /* records per CPU; a power of two */
+
+/* Tracepoints */
+#define TP_KEY        0   /* I: a key was decoded; arg the key */
+#define TP_EVENT      1   /* B/E: kernel_main handles an event; arg its type */
+#define TP_SHELL_KEY  2   /* B/E: shell_handle_key(); arg the key */
+#define TP_EXEC       3   /* B/E: execute_command(); E arg: 1 on success */
+#define TP_UI_DRAW    4   /* B/E: ui_draw() */
+#define TP_VGA_CLEAR  5   /* B/E */
+#define TP_VGA_SCROLL 6   /* I: vga_move_rows(); arg rows */
+#define TP_FS_READ    7   /* B/E: arg bytes asked, then read or error */
+#define TP_FS_WRITE   8   /* B/E: arg bytes given, then written or error */
+#define TP_FS_OPEN    9   /* B/E: arg the flags, then the descriptor or error */
+#define TP_FS_CREATE  10  /* B/E, these five: E arg FS_OK or error */
+#define TP_FS_DELETE  11
+#define TP_FS_RENAME  12
+#define TP_FS_MKDIR   13
+#define TP_FS_RMDIR   14
+#define TP_COUNT      15
+
+/* Record kinds */
+#define TRACE_B 'B'
+#define TRACE_E 'E'
+#define TRACE_I 'I'
+
+/* Error codes */
+#define TRACE_OK         0
+#define TRACE_ERR_NOMEM -1   /* no memory for the rings */
+
+struct TraceRecord {
+    u64 tsc;
+    u16 id;
+    u8  kind;
+    u8  cpu;
+    u32 arg;
+};
+
+struct TraceStats {
+    int on;
+    u32 records;   /* written since the last trace_start() */
+    u32 kept;      /* of those, still in the rings */
+};
+
+extern u8 trace_on;   /* read plainly: a site may act on a stale value once */
+void trace_record(int id, int kind, u32 arg) __attribute__((cold));
+
+#define TRACE_AT(id, kind, arg) \
+    do { if (__builtin_expect(trace_on, 0)) trace_record((id), (kind), (u32)(arg)); } while (0)
+#define TRACE_BEGIN(id, arg) TRACE_AT(id, TRACE_B, arg)
+#define TRACE_END(id, arg)   TRACE_AT(id, TRACE_E, arg)
+#define TRACE_MARK(id, arg)  TRACE_AT(id, TRACE_I, arg)
+
+int  trace_start(void);   /* empties the rings; -> TRACE_OK or TRACE_ERR_NOMEM */
+void trace_stop(void);
+void trace_stats(struct TraceStats* out);
+
+/* Stopped first if need be; emit gets the text a line at a time and
+   may stop the dump by returning nonzero */
+typedef int (*trace_emit_fn)(void* ctx, const char* line, int len);
+void trace_dump(trace_emit_fn emit, void* ctx);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef TRIE_H
+#define TRIE_H
+#include "common.h"
+
+/* Prefix tree of short names with a value each, for shell lookup and
+   completion. Nodes come from a fixed array inside the trie; a node's
+   children are a sibling list kept in byte order, and every node counts
+   the names below it, so a prefix's matches and their longest common
+   extension are found by walking the prefix alone, however many names
+   the trie holds. */
+
+#define TRIE_NODES    1024
+#define TRIE_NAME_MAX 64     /* longest name, with its NUL */
+#define TRIE_NONE     0xFFFF
+
+struct TrieNode {
+    char c;
+    u8   end;        /* a name ends here */
+    u16  child;      /* first child, TRIE_NONE if none */
+    u16  next;       /* next sibling */
+    u16  words;      /* names at or below this node */
+    int  value;
+};
+
+struct Trie {
+    struct TrieNode node[TRIE_NODES];   /* node 0 is the root */
+    int used;
+};
+
+void trie_init(struct Trie* t);
+int  trie_insert(struct Trie* t, const char* key, int value);   /* -> 0, -1 if full or key too long */
+int  trie_find(const struct Trie* t, const char* key, int len);  /* value of exactly key[0..len), -1 if none */
+
+/* Names starting with key[0..len); out gets what all of them share past
+   the prefix, NUL-terminated, and *value the value of the only one */
+int  trie_complete(const struct Trie* t, const char* key, int len, char* out, int max, int* value);
+
+/* Calls fn for the names starting with key[0..len), in byte order, until
+   fn returns nonzero; -> names visited */
+typedef int (*trie_visit_fn)(void* ctx, const char* name, int value);
+int  trie_each(const struct Trie* t, const char* key, int len, trie_visit_fn fn, void* ctx);
+
+#endif
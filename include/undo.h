@@ -0,0 +1,60 @@
+#ifndef UNDO_H
+#define UNDO_H
+#include "common.h"
+
+/* Undo/redo log of edit records. Each record is the operation, its
+   offset and the bytes involved, packed back to back in a byte ring;
+   a trailing size lets the log be walked in both directions. Records
+   before the cursor can be undone, records after it redone. When the
+   budget is exceeded the oldest records are dropped. */
+
+#define UNDO_ARENA_SIZE     65536   /* per log, power of two */
+#define UNDO_DEFAULT_BUDGET 32768
+#define UNDO_MIN_BUDGET     1024
+
+/* Record types */
+#define UNDO_INSERT 1
+#define UNDO_DELETE 2
+
+/* Record flags */
+#define UNDO_COALESCE 0x1   /* later contiguous typing may extend this insert */
+#define UNDO_CHAIN    0x2   /* undone and redone together with the previous record */
+
+/* Step directions */
+#define UNDO_BACK 0
+#define UNDO_FWD  1
+
+struct UndoLog {
+    char arena[UNDO_ARENA_SIZE];
+    u32 tail;       /* oldest record */
+    u32 cursor;     /* undo/redo split */
+    u32 head;       /* end of the newest record */
+    int budget;
+};
+
+/* A record as seen by undo_peek(); its text may wrap around the ring,
+   so it comes in up to two spans. */
+struct UndoOp {
+    u8  type;
+    u8  flags;
+    int off;
+    int len;
+    const char* text[2];
+    int text_len[2];
+};
+
+void undo_init(struct UndoLog* u, int budget);
+void undo_clear(struct UndoLog* u);
+int  undo_set_budget(struct UndoLog* u, int budget);   /* trims old history to fit */
+int  undo_used(const struct UndoLog* u);                /* bytes of history held */
+int  undo_fits(const struct UndoLog* u, int records, int bytes);  /* would they fit the budget */
+
+/* Log an edit that was just applied; drops any redo history */
+void undo_record(struct UndoLog* u, int type, int off, const char* text, int len, int flags);
+
+/* Record the next undo (UNDO_BACK) or redo (UNDO_FWD) would apply; 0 if none.
+   The caller applies it and then moves past it with undo_step(). */
+int  undo_peek(const struct UndoLog* u, int dir, struct UndoOp* op);
+void undo_step(struct UndoLog* u, int dir);
+
+#endif
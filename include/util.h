@@ -7,5 +7,13 @@ int kstrncmp(const char* a, const char* b, int n);
 void kstrcpy(char* dst, const char* src);
 int kstrlen(const char* s);
 void kstrncpy(char *dest, const char *src, int n);
+int kutoa(char* out, u32 val);               /* decimal, returns length */
+int ku64toa(char* out, u64 val);
+u32 kdiv64(u64* n, u32 base);                /* *n /= base, returns remainder */
+
+void* kmemcpy(void* dst, const void* src, int n);
+void* kmemmove(void* dst, const void* src, int n);
+void* kmemset(void* dst, int c, int n);
+int kmemcmp(const void* a, const void* b, int n);
 
 #endif
@@ -4,6 +4,9 @@
 
 void vga_putcell(int x, int y, char ch, u8 attr);
 void vga_clear(void);
+void vga_move_rows(int dst_y, int src_y, int n);
+char vga_getcell_char(int x, int y);
+unsigned char vga_getcell_attr(int x, int y);
 void term_putc(char c);
 void term_write(const char* s);
 void draw_box(int x, int y, int w, int h, const char* title, u8 title_attr, u8 border_attr, u8 bg_attr);
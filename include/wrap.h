@@ -0,0 +1,34 @@
+#ifndef WRAP_H
+#define WRAP_H
+#include "common.h"
+#include "text.h"
+
+/* Soft-wrap map for the editor. Every document line takes
+   len / width + 1 screen rows; a Fenwick tree over those heights turns
+   "first row of line" and "line shown on row" into O(log n) lookups,
+   and an edit updates only the heights of the lines it touched. */
+
+#define WRAP_MAX_LINES 65536
+
+/* Error codes */
+#define WRAP_OK         0
+#define WRAP_ERR_LINES -1   /* document has more than WRAP_MAX_LINES lines */
+
+struct WrapMap {
+    int lines;
+    int width;
+    int height[WRAP_MAX_LINES];
+    int fw[WRAP_MAX_LINES + 1];   /* 1-based Fenwick tree over height[] */
+};
+
+int  wrap_build(struct WrapMap* m, struct Text* t, int width);   /* one pass over the text */
+
+/* line changed and delta lines were added (or removed) right after it;
+   returns 1 if rows below it moved, 0 if not, or WRAP_ERR_LINES */
+int  wrap_edit(struct WrapMap* m, struct Text* t, int line, int delta);
+
+int  wrap_rows(const struct WrapMap* m);                    /* total screen rows */
+int  wrap_row_of(const struct WrapMap* m, int line);        /* first row of line */
+int  wrap_line_at(const struct WrapMap* m, int row, int* sub);  /* line on row, *sub its row within */
+
+#endif
@@ -0,0 +1,305 @@
+#include "../include/bench.h"
+#include "../include/fs.h"
+#include "../include/io.h"
+#include "../include/text.h"
+#include "../include/util.h"
+#include "../include/thread.h"
+#include "../include/cpu.h"
+#include "../include/pool.h"
+#include "../include/spinlock.h"
+#include "../include/rcu.h"
+#include "../include/paging.h"
+
+static u32 bench_seed;
+
+static u32 bench_rand(void) {
+    /* xorshift32 */
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+/* -------- text engine -------- */
+static struct Text bench_doc;
+static char bench_flat[BENCH_TEXT_MAX];
+
+int bench_text_typing(int n, u64* text_cycles, u64* flat_cycles) {
+    if (n < 1) n = 1;
+    if (n > BENCH_TEXT_MAX) n = BENCH_TEXT_MAX;
+
+    text_init(&bench_doc);
+    bench_seed = 0x2545F491;
+    u64 t0 = rdtsc();
+    for (int i = 0; i < n; ++i) {
+        u32 r = bench_rand();
+        char ch = (r & 31) == 0 ? '\n' : (char)('a' + (r >> 8) % 26);
+        if (text_insert(&bench_doc, (int)((r >> 5) % (u32)(i + 1)), &ch, 1) != TEXT_OK) {
+            text_free(&bench_doc);
+            return -1;
+        }
+    }
+    *text_cycles = rdtsc() - t0;
+    text_free(&bench_doc);
+
+    /* same keystrokes, shifting the tail of one flat array each time */
+    bench_seed = 0x2545F491;
+    t0 = rdtsc();
+    for (int i = 0; i < n; ++i) {
+        u32 r = bench_rand();
+        char ch = (r & 31) == 0 ? '\n' : (char)('a' + (r >> 8) % 26);
+        int off = (int)((r >> 5) % (u32)(i + 1));
+        kmemmove(bench_flat + off + 1, bench_flat + off, i - off);
+        bench_flat[off] = ch;
+    }
+    *flat_cycles = rdtsc() - t0;
+    return 0;
+}
+
+/* -------- streamed documents -------- */
+#define BENCH_LOG_NAME "bench.log"
+
+static int bench_read(void* ctx, char* buf, int n, int off) {
+    return fs_pread(*(int*)ctx, buf, n, off);
+}
+
+/* what the editor does per screen: find each line and copy it out */
+static u64 bench_screen(int first_line) {
+    char line[80];
+    u64 t0 = rdtsc();
+    for (int i = 0; i < BENCH_PAGE_LINES; ++i) {
+        int off = text_line_start(&bench_doc, first_line + i);
+        int len = text_line_length(&bench_doc, off);
+        text_copy(&bench_doc, off, line, len < (int)sizeof(line) ? len : (int)sizeof(line));
+    }
+    return rdtsc() - t0;
+}
+
+int bench_text_page(int kib, u64* attach_cycles, u64* top_cycles, u64* bottom_cycles) {
+    if (kib < 1) kib = 1;
+    if (kib > BENCH_PAGE_MAX_KIB) kib = BENCH_PAGE_MAX_KIB;
+
+    fs_delete(BENCH_LOG_NAME);
+    int r = fs_create(BENCH_LOG_NAME, FILE_TEXT);
+    if (r < 0) return r;
+    int fd = fs_open(BENCH_LOG_NAME, FS_O_RDWR);
+    if (fd < 0) { fs_delete(BENCH_LOG_NAME); return fd; }
+
+    /* log lines of 16..79 pseudo-random letters */
+    char chunk[1024];
+    int total = kib * 1024, off = 0, col = 0, width = 16;
+    bench_seed = 0x2545F491;
+    while (off < total && r >= 0) {
+        int n = (total - off < (int)sizeof(chunk)) ? total - off : (int)sizeof(chunk);
+        for (int i = 0; i < n; ++i) {
+            u32 x = bench_rand();
+            if (col == width) { chunk[i] = '\n'; col = 0; width = 16 + (int)(x & 63); }
+            else { chunk[i] = (char)('a' + (x >> 8) % 26); col++; }
+        }
+        r = fs_pwrite(fd, chunk, n, off);
+        if (r >= 0 && r < n) r = FS_ERR_NOSPACE;
+        off += n;
+    }
+
+    if (r >= 0) {
+        u64 t0 = rdtsc();
+        r = text_attach(&bench_doc, bench_read, &fd, total);
+        *attach_cycles = rdtsc() - t0;
+    }
+    if (r >= 0) {
+        int last = text_line_count(&bench_doc) - BENCH_PAGE_LINES;
+        *top_cycles = bench_screen(0);
+        *bottom_cycles = bench_screen(last > 0 ? last : 0);
+    }
+    text_free(&bench_doc);
+    fs_close(fd);
+    fs_delete(BENCH_LOG_NAME);
+    return r < 0 ? r : 0;
+}
+
+/* -------- context switch -------- */
+static struct {
+    int n;
+    int wake;          /* hand the turn over by wakeup instead of yield */
+    int turn;
+    int done;
+    u64 t1;
+    int start;         /* channels */
+    int chan[2];
+} sw;
+
+static void switch_worker(void* arg) {
+    int me = (int)(uintptr)arg;
+    u32 f = irq_save();
+    thread_wait(&sw.start, 0);
+    irq_restore(f);
+    for (int i = 0; i < sw.n; ++i) {
+        if (!sw.wake) {
+            thread_yield();
+            continue;
+        }
+        f = irq_save();
+        while (sw.turn != me) thread_wait(&sw.chan[me], 0);
+        sw.turn = !me;
+        thread_wakeup(&sw.chan[!me]);
+        irq_restore(f);
+    }
+    f = irq_save();
+    if (++sw.done == 2) {
+        sw.t1 = rdtsc();
+        thread_wakeup(&sw.done);
+    }
+    irq_restore(f);
+}
+
+/* cycles per switch for one run of the two workers */
+static int switch_run(int n, int wake, u64* cycles) {
+    sw.n = n;
+    sw.wake = wake;
+    sw.turn = 0;
+    sw.done = 0;
+    for (int i = 0; i < 2; ++i)
+        if (thread_create(i ? "pong" : "ping", PRIO_HIGH, switch_worker, (void*)(uintptr)i) < 0) {
+            /* let a lone worker finish */
+            sw.n = 0;
+            sw.done = 1;
+            thread_wakeup(&sw.start);
+            return THREAD_ERR_NOMEM;
+        }
+    u32 s0 = thread_switches();
+    u64 t0 = rdtsc();
+    thread_wakeup(&sw.start);      /* both outrank us: they run until done */
+    u32 f = irq_save();
+    while (sw.done < 2) thread_wait(&sw.done, 0);
+    irq_restore(f);
+    *cycles = sw.t1 - t0;
+    kdiv64(cycles, thread_switches() - s0);
+    return 0;
+}
+
+int bench_switch(int n, u64* yield_cycles, u64* wake_cycles) {
+    if (n < 1) n = 1;
+    if (n > BENCH_SWITCH_MAX) n = BENCH_SWITCH_MAX;
+    int r = switch_run(n, 0, yield_cycles);
+    if (r == 0) r = switch_run(n, 1, wake_cycles);
+    return r;
+}
+
+/* -------- SMP task pool -------- */
+static u8* smp_buf;   /* a lazy region, made on first use */
+static u32 smp_crc[BENCH_SMP_MAX_KIB / BENCH_SMP_BLOCK];
+static u32 crc_table[256];
+static int smp_filled = 0;
+
+static u32 crc32(u32 crc, const u8* p, int n) {
+    crc = ~crc;
+    while (n--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* blocks [lo, hi): halves are forked until one block is left */
+static void smp_task(void* arg, int lo, int hi) {
+    (void)arg;
+    if (hi - lo > 1) {
+        volatile int pending = 0;
+        int mid = lo + (hi - lo) / 2;
+        pool_spawn(smp_task, 0, mid, hi, &pending);
+        smp_task(0, lo, mid);
+        pool_wait(&pending);
+        return;
+    }
+    smp_crc[lo] = crc32(0, smp_buf + lo * BENCH_SMP_BLOCK * 1024, BENCH_SMP_BLOCK * 1024);
+}
+
+int bench_smp(int kib, int cpus, u64* cycles, u32* sum) {
+    if (kib < BENCH_SMP_BLOCK) kib = BENCH_SMP_BLOCK;
+    if (kib > BENCH_SMP_MAX_KIB) kib = BENCH_SMP_MAX_KIB;
+    if (!smp_filled) {
+        if (!smp_buf) smp_buf = region_create("bench", BENCH_SMP_MAX_KIB * 1024, REGION_LAZY | REGION_GUARD);
+        if (!smp_buf) return 0;
+        for (u32 i = 0; i < 256; ++i) {
+            u32 c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+        bench_seed = 0x5EED5;
+        for (u32 i = 0; i < BENCH_SMP_MAX_KIB * 1024; i += 4) *(u32*)(smp_buf + i) = bench_rand();
+        smp_filled = 1;
+    }
+    int blocks = kib / BENCH_SMP_BLOCK;
+    u64 t0 = rdtsc();
+    int taking = pool_run(smp_task, 0, 0, blocks, cpus);
+    *cycles = rdtsc() - t0;
+    *sum = crc32(0, (const u8*)smp_crc, blocks * 4);
+    return taking;
+}
+
+/* -------- RCU directory lookups -------- */
+static const char* rcu_names[2] = { "rcu.a", "rcu.b" };
+static volatile int rcu_readers;     /* reader tasks not finished */
+static volatile u32 rcu_renamed;
+static int rcu_n, rcu_cpus, rcu_locked;
+static struct Spinlock rcu_bench_lock = SPINLOCK_INIT("bench");
+
+/* the bench lock keeps interrupts on: a rename under it may wait for
+   every CPU to take an IPI */
+static void rcu_reader(int n) {
+    for (int i = 0; i < n; ++i) {
+        if (rcu_locked) spin_lock(&rcu_bench_lock);
+        fs_find(rcu_names[i & 1]);
+        if (rcu_locked) spin_unlock(&rcu_bench_lock);
+    }
+    __atomic_sub_fetch(&rcu_readers, 1, __ATOMIC_RELEASE);
+}
+
+/* bounded, so it also ends if it runs alone before the readers */
+static void rcu_writer(void) {
+    u32 done = 0;
+    int at = fs_find(rcu_names[0]) ? 0 : 1;
+    while (rcu_readers > 0 && done < BENCH_RCU_WRITES) {
+        if (rcu_locked) spin_lock(&rcu_bench_lock);
+        int r = fs_rename(rcu_names[at], rcu_names[at ^ 1]);
+        if (rcu_locked) spin_unlock(&rcu_bench_lock);
+        if (r == FS_OK) { at ^= 1; done++; }
+        else __asm__ volatile ("pause");   /* old versions not reclaimed yet */
+    }
+    rcu_renamed = done;
+}
+
+/* the last index is the writer, so on one CPU the reader goes first */
+static void rcu_task(void* arg, int lo, int hi) {
+    (void)arg;
+    if (hi - lo > 1) {
+        volatile int pending = 0;
+        int mid = lo + (hi - lo) / 2;
+        pool_spawn(rcu_task, 0, mid, hi, &pending);
+        rcu_task(0, lo, mid);
+        pool_wait(&pending);
+        return;
+    }
+    if (lo == rcu_cpus) rcu_writer();
+    else rcu_reader(rcu_n);
+}
+
+int bench_rcu(int n, int cpus, int locked, u64* cycles, u32* lookups, u32* renames) {
+    if (n < 1) n = 1;
+    if (n > BENCH_RCU_MAX) n = BENCH_RCU_MAX;
+    if (!fs_find(rcu_names[0]) && !fs_find(rcu_names[1])) {
+        int r = fs_create(rcu_names[0], FILE_TEXT);
+        if (r < 0) return r;
+    }
+    rcu_n = n;
+    rcu_cpus = cpus;
+    rcu_locked = locked;
+    rcu_readers = cpus;
+    rcu_renamed = 0;
+    u64 t0 = rdtsc();
+    pool_run(rcu_task, 0, 0, cpus + 1, cpus);
+    *cycles = rdtsc() - t0;
+    *lookups = (u32)n * (u32)cpus;
+    *renames = rcu_renamed;
+    fs_delete(rcu_names[0]);
+    fs_delete(rcu_names[1]);
+    rcu_synchronize();   /* leave no versions of the CWD behind */
+    return 0;
+}
@@ -0,0 +1,194 @@
+#include "../include/blk.h"
+#include "../include/io.h"
+#include "../include/util.h"
+
+/* Each device has a software queue kept sorted by LBA and at most one
+   transfer in flight at the driver. Dispatch follows C-LOOK: serve the
+   first request at or above the head position, sweeping upward, then
+   jump back to the lowest LBA. Requests that continue the chosen one
+   (same direction, next LBA) are merged into the same transfer. */
+
+struct blk_device {
+    const char* name;
+    u32 sectors;
+    const struct blk_ops* ops;
+    int depth;
+    int queued;                 /* requests in ->queue */
+    int active;                 /* requests in ->xfer (0 = driver idle) */
+    struct blk_request* queue;  /* sorted by lba ascending */
+    struct blk_xfer xfer;
+    u32 head_pos;               /* LBA just past the last dispatched transfer */
+    struct blk_stats stats;
+};
+
+static struct blk_device s_devs[BLK_MAX_DEVICES];
+static int s_dev_count = 0;
+
+static struct blk_device* dev_get(int dev) {
+    if (dev < 0 || dev >= s_dev_count) return 0;
+    return &s_devs[dev];
+}
+
+/* -------- Devices -------- */
+int blk_register(const char* name, u32 sectors, const struct blk_ops* ops) {
+    if (!ops || !ops->start) return BLK_ERR_INVALID;
+    if (s_dev_count >= BLK_MAX_DEVICES) return BLK_ERR_NODEV;
+
+    int id = s_dev_count++;
+    struct blk_device* d = &s_devs[id];
+    kmemset(d, 0, sizeof(*d));
+    d->name    = name;
+    d->sectors = sectors;
+    d->ops     = ops;
+    d->depth   = BLK_DEFAULT_QUEUE_DEPTH;
+    return id;
+}
+
+int blk_device_count(void) { return s_dev_count; }
+
+const char* blk_device_name(int dev) {
+    struct blk_device* d = dev_get(dev);
+    return d ? d->name : 0;
+}
+
+u32 blk_device_sectors(int dev) {
+    struct blk_device* d = dev_get(dev);
+    return d ? d->sectors : 0;
+}
+
+int blk_set_queue_depth(int dev, int depth) {
+    struct blk_device* d = dev_get(dev);
+    if (!d) return BLK_ERR_NODEV;
+    if (depth < 1 || depth > BLK_MAX_QUEUE_DEPTH) return BLK_ERR_INVALID;
+    d->depth = depth;  /* shrinking only affects new submissions */
+    return BLK_OK;
+}
+
+int blk_queue_depth(int dev) {
+    struct blk_device* d = dev_get(dev);
+    return d ? d->depth : 0;
+}
+
+int blk_inflight(int dev) {
+    struct blk_device* d = dev_get(dev);
+    return d ? d->queued + d->active : 0;
+}
+
+const struct blk_stats* blk_get_stats(int dev) {
+    struct blk_device* d = dev_get(dev);
+    return d ? &d->stats : 0;
+}
+
+void blk_reset_stats(int dev) {
+    struct blk_device* d = dev_get(dev);
+    if (d) kmemset(&d->stats, 0, sizeof(d->stats));
+}
+
+/* -------- Elevator -------- */
+static void queue_insert(struct blk_device* d, struct blk_request* rq) {
+    struct blk_request** pp = &d->queue;
+    while (*pp && (*pp)->lba <= rq->lba) pp = &(*pp)->next;
+    rq->next = *pp;
+    *pp = rq;
+    d->queued++;
+}
+
+static void dispatch(int dev) {
+    struct blk_device* d = &s_devs[dev];
+    if (d->active || !d->queue) return;
+
+    /* C-LOOK: first request at or past the head, else wrap to the lowest */
+    struct blk_request** pp = &d->queue;
+    while (*pp && (*pp)->lba < d->head_pos) pp = &(*pp)->next;
+    if (!*pp) pp = &d->queue;
+
+    struct blk_request* rq = *pp;
+    *pp = rq->next;
+    rq->next = 0;
+
+    struct blk_xfer* x = &d->xfer;
+    x->dir   = rq->dir;
+    x->lba   = rq->lba;
+    x->count = rq->count;
+    x->head  = rq;
+    int n = 1;
+
+    /* back-merge LBA-contiguous followers, which sit right behind in sort order */
+    struct blk_request* tail = rq;
+    while (*pp) {
+        struct blk_request* nx = *pp;
+        if (nx->dir != x->dir || nx->lba != x->lba + x->count) break;
+        if (x->count + nx->count > BLK_MAX_XFER_SECTORS) break;
+        *pp = nx->next;
+        nx->next = 0;
+        tail->next = nx;
+        tail = nx;
+        x->count += nx->count;
+        n++;
+    }
+
+    d->queued -= n;
+    d->active  = n;
+    d->head_pos = x->lba + x->count;
+    d->stats.xfers++;
+    d->stats.merged  += n - 1;
+    d->stats.sectors += x->count;
+
+    if (d->ops->start(dev, x) < 0) blk_complete(dev, BLK_ERR_IO);
+}
+
+/* -------- Requests -------- */
+int blk_submit(struct blk_request* rq) {
+    if (!rq) return BLK_ERR_INVALID;
+    struct blk_device* d = dev_get(rq->dev);
+    if (!d) return BLK_ERR_NODEV;
+    if (rq->dir != BLK_READ && rq->dir != BLK_WRITE) return BLK_ERR_INVALID;
+    if (!rq->buf || rq->count == 0 || rq->count > BLK_MAX_XFER_SECTORS) return BLK_ERR_INVALID;
+    if (rq->lba >= d->sectors || rq->count > d->sectors - rq->lba) return BLK_ERR_RANGE;
+    if (d->queued + d->active >= d->depth) {
+        d->stats.busy_rejects++;
+        return BLK_ERR_BUSY;
+    }
+
+    rq->submit_tsc = rdtsc();
+    queue_insert(d, rq);
+    d->stats.submitted++;
+    if ((u32)(d->queued + d->active) > d->stats.max_queued)
+        d->stats.max_queued = (u32)(d->queued + d->active);
+
+    dispatch(rq->dev);
+    return BLK_OK;
+}
+
+void blk_complete(int dev, int status) {
+    struct blk_device* d = dev_get(dev);
+    if (!d || !d->active) return;
+
+    /* detach first so callbacks can resubmit */
+    struct blk_request* rq = d->xfer.head;
+    d->xfer.head = 0;
+    d->active = 0;
+
+    u64 now = rdtsc();
+    while (rq) {
+        struct blk_request* next = rq->next;
+        rq->next = 0;
+        /* a TSC that went backwards counts as 0, the slowest land in the last bucket */
+        int b = (now > rq->submit_tsc) ? log2_u64(now - rq->submit_tsc) : 0;
+        if (b >= BLK_LAT_BUCKETS) b = BLK_LAT_BUCKETS - 1;
+        d->stats.lat_hist[b]++;
+        d->stats.completed++;
+        if (status < 0) d->stats.errors++;
+        if (rq->done) rq->done(rq, status);
+        rq = next;
+    }
+
+    dispatch(dev);
+}
+
+void blk_poll(void) {
+    for (int i = 0; i < s_dev_count; ++i) {
+        if (s_devs[i].ops->poll) s_devs[i].ops->poll(i);
+        dispatch(i);
+    }
+}
@@ -0,0 +1,184 @@
+#include "../include/cpu.h"
+#include "../include/io.h"
+#include "../include/vga.h"
+#include "../include/util.h"
+
+/* -------- GDT -------- */
+static u64 gdt[3 + CPU_MAX] = {
+    0,
+    0x00CF9A000000FFFFULL,   /* code: base 0, 4 GiB, ring 0 */
+    0x00CF92000000FFFFULL,   /* data */
+};
+
+static struct PerCpu percpu[CPU_MAX];
+
+/* byte-granular 32-bit data segment over [base, base + limit] */
+static u64 data_segment(u32 base, u32 limit) {
+    return (limit & 0xFFFF) | ((u64)(base & 0xFFFFFF) << 16) | (0x92ULL << 40) |
+           ((u64)((limit >> 16) & 0xF) << 48) | (0x4ULL << 52) | ((u64)(base >> 24) << 56);
+}
+
+struct __attribute__((packed)) TablePtr {
+    u16 limit;
+    u32 base;
+};
+
+static void gdt_load(void) {
+    struct TablePtr p = { sizeof(gdt) - 1, (u32)gdt };
+    __asm__ volatile (
+        "lgdt %0\n"
+        "ljmp $0x08, $1f\n"
+        "1:\n"
+        "mov $0x10, %%ax\n"
+        "mov %%ax, %%ds\n"
+        "mov %%ax, %%es\n"
+        "mov %%ax, %%fs\n"
+        "mov %%ax, %%gs\n"
+        "mov %%ax, %%ss\n"
+        : : "m"(p) : "eax", "memory");
+}
+
+/* -------- IDT -------- */
+struct __attribute__((packed)) IdtEntry {
+    u16 off_lo;
+    u16 sel;
+    u8  zero;
+    u8  type;    /* present, ring 0, 32-bit interrupt gate */
+    u16 off_hi;
+};
+
+static struct IdtEntry idt[IDT_VECTORS];
+extern u32 isr_table[IDT_VECTORS];   /* entry stubs, start.S */
+
+static irq_handler_fn handlers[16];
+void (*irq_exit_hook)(void) = 0;
+void (*ipi_handler)(int vector) = 0;
+int (*page_fault_hook)(struct IrqFrame* fr) = 0;
+
+static void idt_fill(void) {
+    for (int v = 0; v < IDT_VECTORS; ++v) {
+        idt[v].off_lo = (u16)isr_table[v];
+        idt[v].sel = SEL_CODE;
+        idt[v].zero = 0;
+        idt[v].type = 0x8E;
+        idt[v].off_hi = (u16)(isr_table[v] >> 16);
+    }
+}
+
+static void idt_load(void) {
+    struct TablePtr p = { sizeof(idt) - 1, (u32)idt };
+    __asm__ volatile ("lidt %0" : : "m"(p));
+}
+
+/* -------- PIC / PIT -------- */
+#define PIC1_CMD  0x20
+#define PIC1_DATA 0x21
+#define PIC2_CMD  0xA0
+#define PIC2_DATA 0xA1
+#define PIC_EOI   0x20
+
+static u16 irq_mask = 0xFFFB;   /* all masked but the cascade */
+
+static void pic_write_mask(void) {
+    io_outb(PIC1_DATA, (u8)irq_mask);
+    io_outb(PIC2_DATA, (u8)(irq_mask >> 8));
+}
+
+static void pic_remap(void) {
+    io_outb(PIC1_CMD, 0x11);          /* init, expect ICW4 */
+    io_outb(PIC2_CMD, 0x11);
+    io_outb(PIC1_DATA, IRQ_BASE);
+    io_outb(PIC2_DATA, IRQ_BASE + 8);
+    io_outb(PIC1_DATA, 0x04);         /* slave on IRQ 2 */
+    io_outb(PIC2_DATA, 0x02);
+    io_outb(PIC1_DATA, 0x01);         /* 8086 mode */
+    io_outb(PIC2_DATA, 0x01);
+    pic_write_mask();
+}
+
+void pit_init(u32 hz) {
+    u32 div = 1193182 / hz;
+    io_outb(0x43, 0x36);              /* channel 0, lo/hi, square wave */
+    io_outb(0x40, (u8)div);
+    io_outb(0x40, (u8)(div >> 8));
+}
+
+void irq_set_handler(int irq, irq_handler_fn fn) {
+    if (irq < 0 || irq >= 16) return;
+    u32 f = irq_save();
+    handlers[irq] = fn;
+    irq_mask &= (u16)~(1u << irq);
+    pic_write_mask();
+    irq_restore(f);
+}
+
+static void percpu_load(int id) {
+    u16 sel = (u16)(SEL_PERCPU + 8 * id);
+    __asm__ volatile ("mov %0, %%fs" : : "r"(sel) : "memory");
+}
+
+void cpu_init(void) {
+    for (int i = 0; i < CPU_MAX; ++i) {
+        percpu[i].self = &percpu[i];
+        percpu[i].id = i;
+        gdt[3 + i] = data_segment((u32)&percpu[i], sizeof(struct PerCpu) - 1);
+    }
+    gdt_load();
+    percpu_load(0);
+    idt_fill();
+    idt_load();
+    pic_remap();
+}
+
+void cpu_init_ap(int id) {
+    gdt_load();
+    percpu_load(id);
+    idt_load();
+}
+
+struct PerCpu* cpu_percpu(int i) {
+    return (i >= 0 && i < CPU_MAX) ? &percpu[i] : 0;
+}
+
+/* -------- Dispatch -------- */
+static int put_str(int x, const char* s) {
+    for (; *s && x < WIDTH; ++s) vga_putcell(x++, 0, *s, 0x4F);
+    return x;
+}
+
+static int put_hex(int x, u32 v) {
+    for (int i = 28; i >= 0 && x < WIDTH; i -= 4) vga_putcell(x++, 0, "0123456789ABCDEF"[(v >> i) & 15], 0x4F);
+    return x;
+}
+
+/* "CPU exception <n> at <eip>, error <code>" across the top row, then stop */
+static void panic_exception(const struct IrqFrame* fr) {
+    char num[12];
+    for (int x = 0; x < WIDTH; ++x) vga_putcell(x, 0, ' ', 0x4F);
+    kutoa(num, fr->vector);
+    int x = put_str(put_str(0, "CPU exception "), num);
+    x = put_hex(put_str(x, " at eip "), fr->eip);
+    x = put_hex(put_str(x, ", error "), fr->error);
+    if (fr->vector == 14) {
+        u32 cr2;
+        __asm__ volatile ("mov %%cr2, %0" : "=r"(cr2));
+        put_hex(put_str(x, ", addr "), cr2);
+    }
+    for (;;) __asm__ volatile ("cli; hlt");
+}
+
+void cpu_dispatch(struct IrqFrame* fr) {
+    if (fr->vector == 14 && page_fault_hook && page_fault_hook(fr)) return;
+    if (fr->vector < IRQ_BASE) panic_exception(fr);
+    if (fr->vector >= VEC_IPI_BASE) {
+        /* spurious APIC interrupts get no EOI */
+        if (fr->vector != VEC_SPURIOUS && ipi_handler) ipi_handler((int)fr->vector);
+        return;
+    }
+    int irq = (int)fr->vector - IRQ_BASE;
+    if (handlers[irq]) handlers[irq]();
+    if (irq >= 8) io_outb(PIC2_CMD, PIC_EOI);
+    io_outb(PIC1_CMD, PIC_EOI);
+    /* after the EOI: a thread switch may not come back here for a while */
+    if (irq_exit_hook) irq_exit_hook();
+}
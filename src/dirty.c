@@ -0,0 +1,135 @@
+#include "../include/dirty.h"
+
+static int run_end(const struct DirtyMap* m, int i) {
+    return (i + 1 < m->runs) ? m->start[i + 1] : m->len;
+}
+
+static void run_remove(struct DirtyMap* m, int i, int k) {
+    for (int j = k; j < m->runs; ++j) {
+        m->start[i + j - k] = m->start[j];
+        m->shift[i + j - k] = m->shift[j];
+    }
+    m->runs -= k - i;
+}
+
+/* drop empty runs and join neighbours with the same shift */
+static void normalize(struct DirtyMap* m) {
+    int out = 0;
+    for (int i = 0; i < m->runs; ++i) {
+        if (m->start[i] == run_end(m, i)) continue;
+        if (out > 0 && m->shift[out - 1] == m->shift[i]) continue;
+        m->start[out] = m->start[i];
+        m->shift[out] = m->shift[i];
+        out++;
+    }
+    m->runs = out;
+    if (m->runs > 0) m->start[0] = 0;
+}
+
+/* keep need free slots by merging the last runs into one new run */
+static void make_room(struct DirtyMap* m, int need) {
+    while (m->runs + need > DIRTY_MAX_RUNS) {
+        m->shift[m->runs - 2] = DIRTY_NEW;
+        m->runs--;
+    }
+}
+
+/* index of the run starting at pos, splitting the one around it;
+   m->runs if pos is the end of the document */
+static int split(struct DirtyMap* m, int pos) {
+    int i = 0;
+    while (i < m->runs && run_end(m, i) <= pos) i++;
+    if (i == m->runs || m->start[i] == pos) return i;
+    for (int j = m->runs; j > i + 1; --j) {
+        m->start[j] = m->start[j - 1];
+        m->shift[j] = m->shift[j - 1];
+    }
+    m->start[i + 1] = pos;
+    m->shift[i + 1] = m->shift[i];
+    m->runs++;
+    return i + 1;
+}
+
+/* runs from i on moved by delta bytes */
+static void move_from(struct DirtyMap* m, int i, int delta) {
+    for (; i < m->runs; ++i) {
+        m->start[i] += delta;
+        if (m->shift[i] != DIRTY_NEW) m->shift[i] += delta;
+    }
+}
+
+/* -------- Public API -------- */
+void dirty_reset(struct DirtyMap* m, int len) {
+    m->runs = (len > 0) ? 1 : 0;
+    m->start[0] = 0;
+    m->shift[0] = 0;
+    m->len = len;
+    m->file_len = len;
+}
+
+void dirty_insert(struct DirtyMap* m, int off, int n) {
+    if (n <= 0 || off < 0 || off > m->len) return;
+    make_room(m, 3);
+    int i = split(m, off);
+    move_from(m, i, n);
+    for (int j = m->runs; j > i; --j) {
+        m->start[j] = m->start[j - 1];
+        m->shift[j] = m->shift[j - 1];
+    }
+    m->start[i] = off;
+    m->shift[i] = DIRTY_NEW;
+    m->runs++;
+    m->len += n;
+    normalize(m);
+}
+
+void dirty_delete(struct DirtyMap* m, int off, int n) {
+    if (off < 0 || off >= m->len) return;
+    if (n > m->len - off) n = m->len - off;
+    if (n <= 0) return;
+    make_room(m, 3);
+    int i = split(m, off);
+    int k = split(m, off + n);
+    run_remove(m, i, k);
+    move_from(m, i, -n);
+    m->len -= n;
+    normalize(m);
+}
+
+int dirty_clean(const struct DirtyMap* m) {
+    if (m->len != m->file_len) return 0;
+    for (int i = 0; i < m->runs; ++i)
+        if (m->shift[i] != 0) return 0;
+    return 1;
+}
+
+void dirty_settle(struct DirtyMap* m) {
+    for (int i = 0; i < m->runs; ++i)
+        if (m->shift[i] != 0) m->shift[i] = DIRTY_NEW;
+    normalize(m);
+}
+
+int dirty_next(const struct DirtyMap* m, int* lo, int* hi) {
+    for (int i = 0; i < m->runs; ++i) {
+        if (m->shift[i] == 0) continue;
+        *lo = m->start[i];
+        *hi = run_end(m, i);
+        return 1;
+    }
+    return 0;
+}
+
+void dirty_written(struct DirtyMap* m, int lo, int hi) {
+    if (hi > m->len) hi = m->len;
+    if (lo < 0 || lo >= hi) return;
+    make_room(m, 3);
+    int i = split(m, lo);
+    int k = split(m, hi);
+    for (int j = i; j < k; ++j) m->shift[j] = 0;
+    if (hi > m->file_len) m->file_len = hi;
+    normalize(m);
+}
+
+void dirty_truncated(struct DirtyMap* m) {
+    m->file_len = m->len;
+}
@@ -5,125 +5,961 @@
 #include "../include/input.h"
 #include "../include/util.h"
 #include "../include/mode.h"   /* for MODE_BROWSER / MODE_EDITOR */
+#include "../include/text.h"
+#include "../include/undo.h"
+#include "../include/syntax.h"
+#include "../include/search.h"
+#include "../include/wrap.h"
+#include "../include/dirty.h"
+#include "../include/io.h"
 
-/* Buffer */
-static int editor_file_index = -1;
-static char editor_buffer[4096];
-static int editor_len = 0;
-static int editor_cursor_x = 0, editor_cursor_y = 0;
-static int editor_scroll = 0;
-static int editor_modified = 0;
+#define EDITOR_SAVE_TMP ".save~"
+/* a streamed save could not make its scratch file; nothing was written */
+#define SAVE_ERR_TMP_FULL   -20   /* the directory has no free entry */
+#define SAVE_ERR_TMP_TAKEN  -21   /* a file of that name is in the way */
+#define EDITOR_SAVE_CHUNK    4096          /* bytes written per idle step */
+#define EDITOR_AUTOSAVE_IDLE (1ULL << 31)  /* TSC cycles without a key, ~1 s at 2 GHz */
 
 static const int VIEW_W = 76; /* columns for editing region */
-static const int VIEW_H = 20; /* lines visible */
+#define LINEBUF_SIZE 77
+#define EDIT_ROW0    2  /* screen row of the first text line */
+#define EDIT_ROWS    20 /* screen rows for text, shared by the views */
+
+#define EDITOR_MAX_BUFFERS TEXT_MAX_BACKED   /* each may stream from its file */
+#define EDITOR_MAX_VIEWS   2                 /* one, or a horizontal split */
+
+/* Columns covered by search matches, per document line. Entries survive
+   repaints and scrolling; an edit drops only the lines it touched. */
+#define MATCH_CACHE 32
+struct MatchLine {
+    int line;                           /* -1 = unused */
+    int sub;                            /* row within the line when wrapping */
+    u8  cols[(LINEBUF_SIZE + 7) / 8];
+};
+
+/* An open file: its text and everything derived from the contents. The
+   text stays resident while the buffer is open, so switching to it costs
+   nothing; views onto it add only a cursor and a scroll position. */
+struct EditorBuffer {
+    int in_use;
+    char name[MAX_FILENAME];
+    struct Dir* dir;             /* directory the file is in: buffers are told apart by (dir, name) */
+    char dir_path[64];           /* its path, for the status line */
+    struct Text text;
+    struct DirtyMap dirty;       /* what differs from the file */
+    int save_err;                /* last save failed; not retried before the next edit */
+    u32 save_bytes;              /* written by the last completed save */
+    u64 save_cycles;             /* TSC cycles its steps took */
+    int src_fd;                  /* read-only descriptor cold pages load from */
+    struct UndoLog undo;
+    struct SynCache syn;         /* lexer mode at each line start */
+    struct WrapMap wrap;         /* kept while wrap_on */
+    struct MatchLine match[MATCH_CACHE];
+    int match_victim;
+    int last_x, last_y, last_scroll;   /* where the last view to leave it was */
+};
+
+/* Damage tracking: editor_draw() repaints only what changed since the
+   last paint. Document lines [damage_lo, damage_hi] need repainting;
+   scroll changes are replayed by moving VGA rows. */
+#define DAMAGE_TO_END 0x7FFFFFFF
+
+/* A window onto a buffer: screen rows [row0, row0 + height) */
+struct EditorView {
+    struct EditorBuffer* buf;
+    int cursor_x, cursor_y;
+    int scroll;
+    int row0, height;
+    int damage_lo, damage_hi;
+    int drawn_scroll;            /* scroll at the last paint */
+    int drawn_cursor_y;          /* cursor line at the last paint */
+    u8  row_state[HEIGHT];       /* lexer mode each screen row was painted from */
+    u8  row_dirty[HEIGHT];       /* screen rows to repaint whatever their line */
+};
+
+static struct EditorBuffer buffers[EDITOR_MAX_BUFFERS];
+static struct EditorView views[EDITOR_MAX_VIEWS];
+static int view_count = 1;
+static int active_view = 0;
+
+/* the view being worked on and its buffer; everything below goes
+   through these */
+static struct EditorView* V = &views[0];
+static struct EditorBuffer* B = 0;
+
+static int editor_undo_budget = UNDO_DEFAULT_BUDGET;
+static int wrap_on = 0;              /* soft wrap: long lines continue on the next rows */
+static int full_redraw = 1;
+
+/* Search prompt in the status line: Ctrl+F finds as you type, Ctrl+R
+   asks for a pattern and then its replacement */
+#define PROMPT_NONE    0
+#define PROMPT_FIND    1
+#define PROMPT_REPLACE 2   /* typing the pattern to replace */
+#define PROMPT_WITH    3   /* typing what replaces it */
+#define SEARCH_ATTR    0x60
+static int prompt = PROMPT_NONE;
+static int prompt_failed = 0;           /* the pattern has no match */
+static char query[SEARCH_MAX_PATTERN];
+static int query_len = 0;
+static char replacement[SEARCH_MAX_PATTERN];
+static int replacement_len = 0;
+static int search_origin = 0;           /* cursor offset when the prompt opened */
+static struct Search editor_search;     /* highlighted in the active view while len > 0 */
+static struct Text replace_text;        /* replace-all builds the new document here */
+
+/* transient status-line message, cleared by the next key */
+static const char* status_msg = 0;
+static u8 status_msg_attr = 0x0A;
 
 static int get_line_start(int line) {
-    int off = 0;
-    int l = 0;
-    while (l < line && off < editor_len) {
-        if (editor_buffer[off] == '\n') l++;
-        off++;
-    }
-    return off;
+    return text_line_start(&B->text, line);
 }
 
 static int get_line_length_at_off(int off) {
-    int len = 0;
-    while (off + len < editor_len && editor_buffer[off + len] != '\n') len++;
-    return len;
+    return text_line_length(&B->text, off);
+}
+
+static int last_line(void) {
+    return text_line_count(&B->text) - 1;
+}
+
+static void view_damage(struct EditorView* v, int lo, int hi) {
+    if (lo < v->damage_lo) v->damage_lo = lo;
+    if (hi > v->damage_hi) v->damage_hi = hi;
+}
+
+/* lines of the current buffer changed: every view onto it repaints them */
+static void damage_lines(int lo, int hi) {
+    for (int i = 0; i < view_count; ++i)
+        if (views[i].buf == B) view_damage(&views[i], lo, hi);
+}
+
+/* Screen rows: without soft wrap a row is a document line; with it, a
+   line takes len / VIEW_W + 1 rows and V->scroll counts rows. */
+static int row_count(void) {
+    return wrap_on ? wrap_rows(&B->wrap) : last_line() + 1;
+}
+
+static int row_to_line(int row, int* sub) {
+    if (!wrap_on) { *sub = 0; return row; }
+    return wrap_line_at(&B->wrap, row, sub);
+}
+
+static void wrap_off(void) {
+    wrap_on = 0;
+    for (int i = 0; i < view_count; ++i) {
+        views[i].scroll = views[i].cursor_y;   /* re-aligned by scroll_to_cursor() */
+        if (views[i].cursor_x > VIEW_W - 1) views[i].cursor_x = VIEW_W - 1;
+    }
+    full_redraw = 1;
+}
+
+static void match_flush(void) {
+    for (int i = 0; i < MATCH_CACHE; ++i) B->match[i].line = -1;
+}
+
+/* match columns of a visible line, from the cache or a scan of its prefix */
+static const u8* match_cols(int line, int sub) {
+    for (int i = 0; i < MATCH_CACHE; ++i)
+        if (B->match[i].line == line && B->match[i].sub == sub) return B->match[i].cols;
+
+    struct MatchLine* e = &B->match[B->match_victim];
+    B->match_victim = (B->match_victim + 1) % MATCH_CACHE;
+    e->line = line;
+    e->sub = sub;
+    kmemset(e->cols, 0, sizeof(e->cols));
+
+    /* matches may start before the row or run past it */
+    char buf[LINEBUF_SIZE + 2 * SEARCH_MAX_PATTERN];
+    int off = get_line_start(line);
+    int len = get_line_length_at_off(off);
+    int seg = sub * VIEW_W;
+    int from = seg - (editor_search.len - 1);
+    int to = seg + VIEW_W + editor_search.len - 1;
+    if (from < 0) from = 0;
+    if (to > len) to = len;
+    if (to <= from) return e->cols;
+    text_copy(&B->text, off + from, buf, to - from);
+    for (int at = search_buf(&editor_search, buf, to - from, 0); at >= 0;
+         at = search_buf(&editor_search, buf, to - from, at + editor_search.len))
+        for (int x = from + at - seg; x < from + at - seg + editor_search.len; ++x)
+            if (x >= 0 && x < VIEW_W) e->cols[x / 8] |= (u8)(1 << (x % 8));
+    return e->cols;
+}
+
+/* line changed and delta lines were added (or removed) right after it */
+static void lines_changed(int line, int delta) {
+    syntax_edit(&B->syn, line, delta);
+    if (wrap_on) {
+        int r = wrap_edit(&B->wrap, &B->text, line, delta);
+        if (r == WRAP_ERR_LINES) {
+            wrap_off();
+            status_msg = "Too many lines to wrap";
+            status_msg_attr = 0x0C;
+        } else if (r) {
+            damage_lines(line, DAMAGE_TO_END);   /* rows below moved */
+        }
+    }
+    for (int i = 0; i < MATCH_CACHE; ++i) {
+        struct MatchLine* e = &B->match[i];
+        if (e->line < 0 || e->line < line) continue;
+        if (e->line == line || (delta < 0 && e->line <= line - delta)) e->line = -1;
+        else e->line += delta;
+    }
+    /* other views onto the buffer keep their cursor on the same text */
+    for (int i = 0; i < view_count; ++i) {
+        struct EditorView* v = &views[i];
+        if (v == V || v->buf != B || v->cursor_y <= line) continue;
+        v->cursor_y += delta;
+        if (v->cursor_y < line) v->cursor_y = line;
+    }
 }
 
 /* convert cursor (x,y) to buffer offset */
 static int cursor_to_offset(void) {
-    int off = get_line_start(editor_cursor_y);
+    int off = get_line_start(V->cursor_y);
     int line_len = get_line_length_at_off(off);
-    if (editor_cursor_x > line_len) return off + line_len;
-    return off + editor_cursor_x;
+    if (V->cursor_x > line_len) return off + line_len;
+    return off + V->cursor_x;
 }
 
-/* insert char at offset */
-static void insert_char_at(int off, char ch) {
-    if (editor_len >= (int)sizeof(editor_buffer) - 1) return;
-    for (int i = editor_len; i > off; --i) editor_buffer[i] = editor_buffer[i - 1];
-    editor_buffer[off] = ch;
-    editor_len++;
-    editor_buffer[editor_len] = '\0';
-    editor_modified = 1;
+/* screen row of the cursor */
+static int cursor_row(void) {
+    if (!wrap_on) return V->cursor_y;
+    int x = cursor_to_offset() - get_line_start(V->cursor_y);
+    return wrap_row_of(&B->wrap, V->cursor_y) + x / VIEW_W;
 }
 
-/* delete char before offset (backspace) */
-static void delete_char_before(int off) {
-    if (off <= 0) return;
-    for (int i = off - 1; i < editor_len - 1; ++i) editor_buffer[i] = editor_buffer[i + 1];
-    editor_len--;
-    editor_buffer[editor_len] = '\0';
-    editor_modified = 1;
+static int cursor_col(void) {
+    return wrap_on ? V->cursor_x % VIEW_W : V->cursor_x;
 }
 
-/* redraw editor view */
-void editor_draw(void) {
-    ui_clear();
+static void scroll_to_cursor(void) {
+    int r = cursor_row();
+    if (r < V->scroll) V->scroll = r;
+    if (r >= V->scroll + V->height) V->scroll = r - V->height + 1;
+}
+
+/* put the cursor on screen row row at column col, clamped to its line */
+static void cursor_to_row(int row, int col) {
+    int sub;
+    if (row > row_count() - 1) row = row_count() - 1;
+    if (row < 0) row = 0;
+    V->cursor_y = row_to_line(row, &sub);
+    int len = get_line_length_at_off(get_line_start(V->cursor_y));
+    V->cursor_x = sub * VIEW_W + col;
+    if (V->cursor_x > len) V->cursor_x = len;
+    if (V->cursor_x < 0) V->cursor_x = 0;
+}
+
+static int buffer_modified(const struct EditorBuffer* b) {
+    return !dirty_clean(&b->dirty);
+}
+
+/* Autosave: a save runs in steps of at most EDITOR_SAVE_CHUNK bytes from
+   the input idle hook, so typing is never held up by it; edits made
+   between steps are picked up by the same save. */
+static struct {
+    struct EditorBuffer* buf;   /* 0 when no save is running */
+    int streamed;               /* copying into EDITOR_SAVE_TMP, not in place */
+    int fd;
+    int pos;                    /* streamed: document bytes already copied */
+    u32 bytes;
+    u64 cycles;
+} save;
+static u64 last_key_tsc = 0;
+
+/* removed bytes at off were replaced by added ones */
+static void mark_dirty(int off, int removed, int added) {
+    dirty_delete(&B->dirty, off, removed);
+    dirty_insert(&B->dirty, off, added);
+    B->save_err = 0;
+    if (save.buf == B && save.streamed && off < save.pos) save.pos = off;
+}
+
+static int editor_read_src(void* ctx, char* buf, int n, int off) {
+    return fs_pread(*(int*)ctx, buf, n, off);
+}
+
+static int find_file_index(const char* name) {
+    for (int i = 0; i < fs_count(); ++i)
+        if (kstrcmp(fs_get(i)->name, name) == 0) return i;
+    return -1;
+}
+
+static char save_chunk[EDITOR_SAVE_CHUNK];
+
+/* Start saving b. A fully loaded document is pinned in memory and only
+   its dirty runs are written over the file. Cold pages still read from
+   the file, so it cannot be overwritten as we go: the document is then
+   copied into a scratch file that replaces it at the end; the source
+   descriptor stays on the original name and sees the new contents.
+   Names resolve in the CWD, which save_begin() points at b's directory. */
+static int save_open(struct EditorBuffer* b) {
+    if (text_source_lost(&b->text)) return FS_ERR_NOTFOUND;   /* parts of the document are gone */
+    int idx = find_file_index(b->name);
+    if (idx < 0) return FS_ERR_NOTFOUND;
+    struct File* f = fs_get(idx);
+    if (f->readonly) return FS_ERR_RDONLY;
+
+    if (text_fully_loaded(&b->text) && text_pin(&b->text) == TEXT_OK) {
+        save.streamed = 0;
+        save.fd = fs_open(b->name, FS_O_WRONLY);
+    } else {
+        /* a failed save deletes its scratch file, so one already there
+           belongs to someone else and is left alone */
+        int r = fs_create(EDITOR_SAVE_TMP, f->type);
+        if (r == FS_ERR_EXISTS) return SAVE_ERR_TMP_TAKEN;
+        if (r == FS_ERR_NOSPACE) return SAVE_ERR_TMP_FULL;
+        if (r < 0) return r;
+        save.streamed = 1;
+        save.fd = fs_open(EDITOR_SAVE_TMP, FS_O_WRONLY);
+        if (save.fd < 0) fs_delete(EDITOR_SAVE_TMP);
+    }
+    if (save.fd < 0) return save.fd;
+    save.buf = b;
+    save.pos = 0;
+    save.bytes = 0;
+    save.cycles = 0;
+    return FS_OK;
+}
+
+static int save_begin(struct EditorBuffer* b) {
+    struct Dir* here = fs_cwd();
+    fs_set_cwd(b->dir);
+    int r = save_open(b);
+    fs_set_cwd(here);
+    return r;
+}
+
+static void save_end(int r) {
+    struct EditorBuffer* b = save.buf;
+    fs_close(save.fd);
+    if (save.streamed) {
+        struct Dir* here = fs_cwd();
+        fs_set_cwd(b->dir);
+        if (r >= 0) r = fs_rename(EDITOR_SAVE_TMP, b->name);
+        if (r < 0) fs_delete(EDITOR_SAVE_TMP);
+        fs_set_cwd(here);
+    }
+    if (r >= 0) {
+        /* the file is the document again; unedited pages may be evicted */
+        text_rebase(&b->text);
+        if (save.streamed) dirty_reset(&b->dirty, text_length(&b->text));
+        b->save_bytes = save.bytes;
+        b->save_cycles = save.cycles;
+    }
+    b->save_err = (r < 0) ? r : 0;
+    save.buf = 0;
+}
+
+/* write the next chunk to the file being saved:
+   1 when the save is complete, 0 if there is more, FS_ERR_* on failure */
+static int save_step(void) {
+    struct EditorBuffer* b = save.buf;
+    u64 t0 = rdtsc();
+    int len = text_length(&b->text), lo, hi, r;
+    if (save.streamed) {
+        lo = save.pos;
+        hi = len;
+    } else {
+        dirty_settle(&b->dirty);
+        if (!dirty_next(&b->dirty, &lo, &hi)) lo = hi = len;
+    }
+    if (lo < hi) {
+        if (hi - lo > EDITOR_SAVE_CHUNK) hi = lo + EDITOR_SAVE_CHUNK;
+        int n = text_copy(&b->text, lo, save_chunk, hi - lo);
+        r = (n > 0) ? fs_pwrite(save.fd, save_chunk, n, lo) : FS_ERR_INVALID;
+        if (r > 0) {
+            save.bytes += (u32)r;
+            if (save.streamed) save.pos += r;
+            else dirty_written(&b->dirty, lo, lo + r);
+        }
+        if (r >= 0 && r < n) r = FS_ERR_NOSPACE;   /* pool or file size exhausted */
+        if (r > 0) r = 0;
+    } else {
+        r = fs_truncate(save.fd, len);
+        if (r >= 0) {
+            if (!save.streamed) dirty_truncated(&b->dirty);
+            r = 1;
+        }
+    }
+    save.cycles += rdtsc() - t0;
+    if (r != 0) save_end(r);
+    return r;
+}
+
+/* Ctrl+S, closing a file, leaving the editor: run b's save to the end */
+static int buffer_flush(struct EditorBuffer* b) {
+    if (save.buf && save.buf != b)
+        while (save_step() == 0) ;   /* the scratch file is shared */
+    if (!save.buf) {
+        if (!buffer_modified(b)) return FS_OK;
+        int r = save_begin(b);
+        if (r < 0) { b->save_err = r; return r; }
+    }
+    int r;
+    while ((r = save_step()) == 0) ;
+    return (r < 0) ? r : FS_OK;
+}
+
+/* insert char at offset; 0 if the text pool is exhausted */
+static int insert_char_at(int off, char ch) {
+    if (text_insert(&B->text, off, &ch, 1) != TEXT_OK) return 0;
+    mark_dirty(off, 0, 1);
+    /* typed runs undo as one; a newline ends the run */
+    undo_record(&B->undo, UNDO_INSERT, off, &ch, 1, (ch == '\n') ? 0 : UNDO_COALESCE);
+    lines_changed(V->cursor_y, (ch == '\n') ? 1 : 0);
+    /* a newline shifts every line below it */
+    damage_lines(V->cursor_y, (ch == '\n') ? DAMAGE_TO_END : V->cursor_y);
+    return 1;
+}
+
+/* edited pages stay resident until saved; saving lets them be evicted */
+static void out_of_memory(void) {
+    status_msg = "Edit memory full, save with Ctrl+S";
+    status_msg_attr = 0x0C;
+}
+
+/* delete char before offset (backspace); 0 if the text pool is exhausted */
+static int delete_char_before(int off) {
+    if (off <= 0) return 0;
+    char ch = text_char_at(&B->text, off - 1);
+    if (text_delete(&B->text, off - 1, 1) != TEXT_OK) return 0;
+    mark_dirty(off - 1, 1, 0);
+    undo_record(&B->undo, UNDO_DELETE, off - 1, &ch, 1, 0);
+    /* joining two lines pulls everything below up by one */
+    if (ch == '\n') {
+        lines_changed(V->cursor_y - 1, -1);
+        damage_lines(V->cursor_y - 1, DAMAGE_TO_END);
+    } else {
+        lines_changed(V->cursor_y, 0);
+        damage_lines(V->cursor_y, V->cursor_y);
+    }
+    return 1;
+}
+
+/* put the cursor on a document offset and scroll it into view */
+static void set_cursor_offset(int off) {
+    V->cursor_y = text_line_of(&B->text, off);
+    V->cursor_x = off - get_line_start(V->cursor_y);
+    if (!wrap_on && V->cursor_x > VIEW_W - 1) V->cursor_x = VIEW_W - 1;
+    scroll_to_cursor();
+}
+
+/* Apply one log record forwards (redo) or backwards (undo). Only the
+   record's own bytes are touched, so a paste undoes in time proportional
+   to its size. Returns the offset to leave the cursor at, -1 on failure. */
+static int apply_undo_op(const struct UndoOp* op, int dir) {
+    int insert = (op->type == UNDO_INSERT) == (dir == UNDO_FWD);
+    int line = text_line_of(&B->text, op->off);
+    int lines = text_line_count(&B->text);
+    int cur;
+    if (insert) {
+        if (text_insert(&B->text, op->off, op->text[0], op->text_len[0]) != TEXT_OK) return -1;
+        if (op->text_len[1] > 0 &&
+            text_insert(&B->text, op->off + op->text_len[0], op->text[1], op->text_len[1]) != TEXT_OK) {
+            text_delete(&B->text, op->off, op->text_len[0]);
+            return -1;
+        }
+        cur = op->off + op->len;
+    } else {
+        if (text_delete(&B->text, op->off, op->len) != TEXT_OK) return -1;
+        cur = op->off;
+    }
+    if (insert) mark_dirty(op->off, 0, op->len);
+    else mark_dirty(op->off, op->len, 0);
+    lines_changed(line, text_line_count(&B->text) - lines);
+    damage_lines(line, DAMAGE_TO_END);
+    return cur;
+}
+
+/* undo (UNDO_BACK) or redo (UNDO_FWD) one step, chained records included */
+static void editor_undo_step(int dir) {
+    struct UndoOp op;
+    int cur = -1;
+    if (!undo_peek(&B->undo, dir, &op)) {
+        status_msg = (dir == UNDO_BACK) ? "Nothing to undo" : "Nothing to redo";
+        status_msg_attr = 0x0E;
+        return;
+    }
+    for (;;) {
+        int r = apply_undo_op(&op, dir);
+        if (r < 0) { out_of_memory(); break; }
+        cur = r;
+        undo_step(&B->undo, dir);
+        /* a chained record goes with the one before it */
+        if (dir == UNDO_BACK && !(op.flags & UNDO_CHAIN)) break;
+        if (!undo_peek(&B->undo, dir, &op)) break;
+        if (dir == UNDO_FWD && !(op.flags & UNDO_CHAIN)) break;
+    }
+    if (cur >= 0) set_cursor_offset(cur);
+}
+
+void editor_set_undo_budget(int bytes) {
+    if (bytes < UNDO_MIN_BUDGET) bytes = UNDO_MIN_BUDGET;
+    if (bytes > UNDO_ARENA_SIZE) bytes = UNDO_ARENA_SIZE;
+    editor_undo_budget = bytes;
+    for (int i = 0; i < EDITOR_MAX_BUFFERS; ++i)
+        if (buffers[i].in_use) undo_set_budget(&buffers[i].undo, bytes);
+}
+
+int editor_undo_budget_get(void) {
+    return editor_undo_budget;
+}
+
+/* -------- Search and replace -------- */
+static void damage_view(void) {
+    kmemset(V->row_dirty, 1, sizeof(V->row_dirty));
+}
+
+/* the pattern changed: recompile it and drop every cached match */
+static void search_set(const char* pat, int n) {
+    search_compile(&editor_search, pat, n);
+    match_flush();
+    damage_view();
+}
+
+/* next (dir > 0) or previous match from off, wrapping around the document */
+static int search_wrap(int off, int dir) {
+    int at;
+    if (dir > 0) {
+        at = search_next(&editor_search, &B->text, off);
+        if (at < 0) at = search_next(&editor_search, &B->text, 0);
+    } else {
+        at = search_prev(&editor_search, &B->text, off);
+        if (at < 0) at = search_prev(&editor_search, &B->text, text_length(&B->text));
+    }
+    return at;
+}
+
+static void search_jump(int from, int dir) {
+    int at = (editor_search.len > 0) ? search_wrap(from, dir) : -1;
+    prompt_failed = (editor_search.len > 0 && at < 0);
+    if (at >= 0) set_cursor_offset(at);
+}
+
+static void prompt_open(int kind) {
+    prompt = kind;
+    prompt_failed = 0;
+    search_origin = cursor_to_offset();
+    query_len = 0;
+    search_set(query, 0);
+}
 
-    /* Title */
-    for (int x = 0; x < WIDTH; ++x) vga_putcell(x, 0, ' ', 0x1F);
-    const char* title = "NoirOS Editor - Ctrl+S save, Ctrl+X exit";
-    for (int i = 0; title[i] && i < WIDTH - 2; ++i) vga_putcell(1 + i, 0, title[i], 0x1F);
+static void prompt_close(void) {
+    prompt = PROMPT_NONE;
+    search_set(query, 0);   /* highlighting ends with the prompt */
+}
+
+/* Replace every match in one pass over the document: the result is
+   streamed into replace_text, which then takes the place of the old one.
+   The undo log gets a delete and an insert per match, chained so a
+   single Ctrl+Z restores everything. */
+static void replace_all(void) {
+    int plen = editor_search.len;
+    int first = search_next(&editor_search, &B->text, 0);
+    if (first < 0) {
+        status_msg = "Not found";
+        status_msg_attr = 0x0E;
+        return;
+    }
+    text_init(&replace_text);
+    int count = search_replace_all(&editor_search, &B->text, &replace_text, replacement, replacement_len);
+    if (count < 0) {
+        text_free(&replace_text);
+        out_of_memory();
+        return;
+    }
+
+    /* a replacement of the same length leaves the bytes between matches
+       clean for the next save */
+    int keep = undo_fits(&B->undo, 2 * count, count * (plen + replacement_len));
+    if (!keep) undo_clear(&B->undo);   /* too big to keep; older records no longer apply */
+    int shift = 0, flags = 0;
+    for (int at = first; at >= 0; at = search_next(&editor_search, &B->text, at + plen)) {
+        if (keep) {
+            undo_record(&B->undo, UNDO_DELETE, at + shift, query, plen, flags);
+            flags = UNDO_CHAIN;
+            if (replacement_len > 0)
+                undo_record(&B->undo, UNDO_INSERT, at + shift, replacement, replacement_len, flags);
+        }
+        mark_dirty(at + shift, plen, replacement_len);
+        shift += replacement_len - plen;
+    }
+
+    int cur = cursor_to_offset();
+    int line = text_line_of(&B->text, first);
+    text_move(&B->text, &replace_text);
+    if (wrap_on && wrap_build(&B->wrap, &B->text, VIEW_W) != WRAP_OK) wrap_off();
+    syntax_forget(&B->syn, line);
+    match_flush();
+    damage_lines(line, DAMAGE_TO_END);
+    if (cur > text_length(&B->text)) cur = text_length(&B->text);
+    set_cursor_offset(cur);
+
+    static char msg[32];
+    kstrcpy(msg, "Replaced ");
+    int p = kstrlen(msg);
+    p += kutoa(msg + p, (u32)count);
+    msg[p] = 0;
+    status_msg = msg;
+    status_msg_attr = 0x0A;
+}
+
+/* keys while a prompt owns the status line */
+static void prompt_key(int key) {
+    int editing_with = (prompt == PROMPT_WITH);
+    char* buf = editing_with ? replacement : query;
+    int* len = editing_with ? &replacement_len : &query_len;
+
+    if (key == K_ESC) {
+        set_cursor_offset(search_origin);
+        prompt_close();
+        return;
+    }
+    if (is_ctrl_pressed()) {
+        if (key == 6 && prompt == PROMPT_FIND) search_jump(cursor_to_offset() + 1, 1);  /* Ctrl+F again */
+        return;
+    }
+    if (key == '\n' || key == '\r') {
+        if (prompt == PROMPT_REPLACE && query_len > 0) {
+            prompt = PROMPT_WITH;
+            replacement_len = 0;
+        } else {
+            if (prompt == PROMPT_WITH) replace_all();
+            prompt_close();
+        }
+        return;
+    }
+    if (key == K_ARROW_DOWN && !editing_with) { search_jump(cursor_to_offset() + 1, 1); return; }
+    if (key == K_ARROW_UP && !editing_with) { search_jump(cursor_to_offset(), -1); return; }
+
+    if (key == '\b' && *len > 0) (*len)--;
+    else if (key >= 32 && key <= 126 && *len < SEARCH_MAX_PATTERN) buf[(*len)++] = (char)key;
+    else return;
 
-    /* show lines from editor_buffer starting at editor_scroll */
-    for (int ln = 0; ln < VIEW_H; ++ln) {
-        int line_no = editor_scroll + ln;
+    if (editing_with) return;
+    /* incremental: the first match from where the prompt opened */
+    search_set(query, query_len);
+    if (query_len > 0) search_jump(search_origin, 1);
+    else { prompt_failed = 0; set_cursor_offset(search_origin); }
+}
+
+/* paint screen row ln, which shows row sub of document line line_no,
+   cursor included */
+static void paint_row(int ln, int line_no, int sub) {
+    int y = V->row0 + ln;
+    int seg = sub * VIEW_W;   /* first column of the line on this row */
+    char linebuf[LINEBUF_SIZE];
+    u8 attrs[LINEBUF_SIZE];
+    int n = 0, line_len = 0;
+    V->row_state[ln] = 0;
+    if (line_no <= last_line()) {
         int off = get_line_start(line_no);
-        if (off >= editor_len) {
-            /* empty line: blank area */
-            draw_text_in_win(0, 2, WIDTH, HEIGHT - 3, 0, ln, "", 0x07);
-            continue;
+        line_len = get_line_length_at_off(off);
+        n = line_len - seg;
+        if (n > VIEW_W) n = VIEW_W;
+        if (n < 0) n = 0;
+        text_copy(&B->text, off + seg, linebuf, n);
+        V->row_state[ln] = syntax_state_at(&B->syn, &B->text, line_no);
+        syntax_color_span(B->syn.lang, V->row_state[ln], &B->text, off, line_len, seg, n, attrs);
+        if (editor_search.len > 0 && V == &views[active_view]) {
+            const u8* cols = match_cols(line_no, sub);
+            for (int x = 0; x < n; ++x)
+                if (cols[x / 8] & (1 << (x % 8))) attrs[x] = SEARCH_ATTR;
         }
-        int llen = get_line_length_at_off(off);
-        #define LINEBUF_SIZE 77
-        char linebuf[LINEBUF_SIZE];
-        int copy_len = (llen < VIEW_W) ? llen : VIEW_W;
-        for (int i = 0; i < copy_len; ++i) linebuf[i] = editor_buffer[off + i];
-        linebuf[copy_len] = '\0';
-        draw_text_in_win(0, 2, WIDTH, HEIGHT - 3, 0, ln, linebuf, 0x07);
-    }
-
-    /* draw cursor visually as inverted cell */
-    int cursor_screen_line = editor_cursor_y - editor_scroll;
-    if (cursor_screen_line >= 0 && cursor_screen_line < VIEW_H) {
-        int off = get_line_start(editor_cursor_y);
-        int col = editor_cursor_x;
-        int line_len = get_line_length_at_off(off);
-        if (col > line_len) col = line_len;
-        vga_putcell(1 + col, 2 + cursor_screen_line, (col < line_len) ? editor_buffer[off + col] : ' ', 0x70);
     }
+    for (int x = 0; x < WIDTH; ++x) {
+        char ch = ' ';
+        u8 attr = 0x07;
+        if (x >= 1 && x - 1 < n) {
+            attr = attrs[x - 1];
+            if (linebuf[x - 1] >= 32 && linebuf[x - 1] <= 126) ch = linebuf[x - 1];
+        }
+        vga_putcell(x, y, ch, attr);
+    }
+    if (line_no == V->cursor_y) {
+        /* draw cursor visually as inverted cell */
+        int x = (V->cursor_x < line_len) ? V->cursor_x : line_len;
+        if (!wrap_on && x > VIEW_W - 1) x = VIEW_W - 1;
+        int col = x - seg;
+        if (col >= 0 && col < VIEW_W)
+            vga_putcell(1 + col, y, (col < n) ? linebuf[col] : ' ', 0x70);
+    }
+}
 
-    /* status */
-    const char* fname = (editor_file_index >= 0 && editor_file_index < fs_count()) ? fs_get(editor_file_index)->name : "untitled";
+/* right end of the status line: how the last save of B went */
+static int save_info(char* out, u8* attr) {
+    int p = 0;
+    *attr = 0x08;
+    if (save.buf == B) {
+        kstrcpy(out, "saving...");
+        return kstrlen(out);
+    }
+    if (B->save_err < 0) {
+        *attr = 0x0C;
+        kstrcpy(out, "not saved");
+        return kstrlen(out);
+    }
+    if (B->save_cycles == 0) return 0;
+    u64 kcyc = B->save_cycles;
+    kdiv64(&kcyc, 1000);
+    kstrcpy(out, "saved ");
+    p = kstrlen(out);
+    p += kutoa(out + p, B->save_bytes);
+    kstrcpy(out + p, "B in ");
+    p += kstrlen(out + p);
+    p += ku64toa(out + p, kcyc);
+    kstrcpy(out + p, "k cyc");
+    return p + kstrlen(out + p);
+}
+
+static void paint_status(void) {
+    const char* fname = B->name;
     char status[80];
     int p=0;
-    for (int i=0; fname[i] && p < 60; ++i) status[p++]=fname[i];
-    if (editor_modified && p < 78) { status[p++]='*'; }
+    /* "/docs/notes.md": same-named files in two directories can both be open */
+    for (int i=0; B->dir_path[i] && p < 36; ++i) status[p++]=B->dir_path[i];
+    if (p > 1) status[p++]='/';
+    for (int i=0; fname[i] && p < 36; ++i) status[p++]=fname[i];
+    if (buffer_modified(B)) { status[p++]='*'; }
+    while (p < 40) status[p++] = ' ';
     status[p]=0;
+    for (int x = 0; x < WIDTH; ++x) vga_putcell(x, HEIGHT - 1, ' ', 0x07);
     for (int i = 0; status[i]; ++i) vga_putcell(1 + i, HEIGHT - 1, status[i], 0x0F);
+    if (prompt != PROMPT_NONE) {
+        const char* label = (prompt == PROMPT_FIND) ? "Find: " : (prompt == PROMPT_REPLACE) ? "Replace: " : "With: ";
+        const char* text = (prompt == PROMPT_WITH) ? replacement : query;
+        int len = (prompt == PROMPT_WITH) ? replacement_len : query_len;
+        u8 attr = prompt_failed ? 0x0C : 0x0E;
+        int x = 41;
+        for (int i = 0; label[i]; ++i) vga_putcell(x++, HEIGHT - 1, label[i], attr);
+        int room = WIDTH - 1 - x;
+        int from = (len > room) ? len - room : 0;   /* keep the end in view */
+        for (int i = from; i < len; ++i) vga_putcell(x++, HEIGHT - 1, text[i], 0x0F);
+        return;
+    }
+    int end = 41;
+    if (status_msg)
+        for (int i = 0; status_msg[i] && end < WIDTH; ++i) vga_putcell(end++, HEIGHT - 1, status_msg[i], status_msg_attr);
+    char info[40];
+    u8 info_attr;
+    int n = save_info(info, &info_attr);
+    if (n > 0 && WIDTH - 1 - n > end)
+        for (int i = 0; i < n; ++i) vga_putcell(WIDTH - 1 - n + i, HEIGHT - 1, info[i], info_attr);
 }
 
-/* open file */
-void editor_open(const char *fname, int *mode) {
-    int idx = -1;
-    for (int i = 0; i < fs_count(); ++i) {
-        if (kstrcmp(fs_get(i)->name, fname) == 0) { idx = i; break; }
+/* screen row between the two views of a split: the top view's file */
+#define DIVIDER_ROW (EDIT_ROW0 + EDIT_ROWS / 2 - 1)
+
+static void layout_views(void) {
+    if (view_count == 1) {
+        views[0].row0 = EDIT_ROW0;
+        views[0].height = EDIT_ROWS;
+    } else {
+        views[0].row0 = EDIT_ROW0;
+        views[0].height = EDIT_ROWS / 2 - 1;
+        views[1].row0 = DIVIDER_ROW + 1;
+        views[1].height = EDIT_ROWS / 2;
     }
-    if (idx == -1) return;
+    full_redraw = 1;
+}
 
-    editor_file_index = idx;
-    struct File* f = fs_get(idx);
-    int len = (f->length < (int)(sizeof(editor_buffer)-1)) ? f->length : (int)(sizeof(editor_buffer)-1);
-    for (int i = 0; i < len; ++i) editor_buffer[i] = f->content[i];
-    editor_len = len;
-    editor_buffer[editor_len] = 0;
+static void paint_divider(void) {
+    const char* name = views[0].buf ? views[0].buf->name : "";
+    u8 attr = (active_view == 0) ? 0x1F : 0x70;
+    for (int x = 0; x < WIDTH; ++x) vga_putcell(x, DIVIDER_ROW, (x < 2) ? '-' : ' ', attr);
+    int x = 3;
+    for (int i = 0; name[i] && x < WIDTH - 2; ++i) vga_putcell(x++, DIVIDER_ROW, name[i], attr);
+    if (views[0].buf && buffer_modified(views[0].buf)) vga_putcell(x, DIVIDER_ROW, '*', attr);
+}
+
+/* bring view v up to date on screen */
+static void draw_view(struct EditorView* v) {
+    V = v;
+    B = v->buf;
+    if (full_redraw) {
+        view_damage(V, 0, DAMAGE_TO_END);
+    } else {
+        /* replay scrolling by moving the rows that stay visible */
+        int d = V->scroll - V->drawn_scroll;
+        if (d > 0 && d < V->height) {
+            vga_move_rows(V->row0, V->row0 + d, V->height - d);
+            kmemmove(V->row_state, V->row_state + d, V->height - d);
+            kmemset(V->row_dirty + V->height - d, 1, d);
+        } else if (d < 0 && -d < V->height) {
+            vga_move_rows(V->row0 - d, V->row0, V->height + d);
+            kmemmove(V->row_state - d, V->row_state, V->height + d);
+            kmemset(V->row_dirty, 1, -d);
+        } else if (d != 0) {
+            view_damage(V, 0, DAMAGE_TO_END);
+        }
+        view_damage(V, V->drawn_cursor_y, V->drawn_cursor_y);
+        view_damage(V, V->cursor_y, V->cursor_y);
+    }
+
+    /* show rows from V->scroll on; an edit can also recolour
+       untouched lines below it (opening a comment), which shows up as a
+       changed start mode */
+    int last = last_line(), rows = row_count();
+    for (int ln = 0; ln < V->height; ++ln) {
+        int row = V->scroll + ln, sub = 0;
+        int line_no = (row < rows) ? row_to_line(row, &sub) : last + 1 + (row - rows);
+        if (V->row_dirty[ln] || (line_no >= V->damage_lo && line_no <= V->damage_hi)) paint_row(ln, line_no, sub);
+        else if (line_no <= last && B->syn.lang != SYN_NONE &&
+                 syntax_state_at(&B->syn, &B->text, line_no) != V->row_state[ln]) paint_row(ln, line_no, sub);
+        V->row_dirty[ln] = 0;
+    }
+
+    V->damage_lo = DAMAGE_TO_END;
+    V->damage_hi = -1;
+    V->drawn_scroll = V->scroll;
+    V->drawn_cursor_y = V->cursor_y;
+}
+
+/* redraw editor view: everything after editor_open, afterwards only
+   damaged lines, the old and new cursor rows and the status line */
+void editor_draw(void) {
+    if (!views[active_view].buf) return;
+    if (full_redraw) {
+        ui_clear();
+
+        /* Title */
+        for (int x = 0; x < WIDTH; ++x) vga_putcell(x, 0, ' ', 0x1F);
+        const char* title = "^S save ^F find ^R repl ^Z/^Y undo ^W wrap ^T split ^O view ^Tab next ^X close";
+        for (int i = 0; title[i] && i < WIDTH - 2; ++i) vga_putcell(1 + i, 0, title[i], 0x1F);
+    }
+
+    /* a view that is not being typed in may have had its cursor moved by
+       edits through the other one */
+    for (int i = 0; i < view_count; ++i) {
+        V = &views[i];
+        B = V->buf;
+        if (V->cursor_y > last_line()) V->cursor_y = last_line();
+        scroll_to_cursor();
+        draw_view(V);
+    }
+    if (view_count > 1) paint_divider();
+    full_redraw = 0;
+
+    V = &views[active_view];
+    B = V->buf;
+    paint_status();
+}
 
-    editor_cursor_x = editor_cursor_y = editor_scroll = 0;
-    editor_modified = 0;
+/* Show buffer b in view v, where the last view onto it left off */
+static void view_show(struct EditorView* v, struct EditorBuffer* b) {
+    if (v->buf) {
+        v->buf->last_x = v->cursor_x;
+        v->buf->last_y = v->cursor_y;
+        v->buf->last_scroll = v->scroll;
+    }
+    v->buf = b;
+    v->cursor_x = b->last_x;
+    v->cursor_y = b->last_y;
+    v->scroll = b->last_scroll;
+    v->drawn_scroll = v->scroll;
+    view_damage(v, 0, DAMAGE_TO_END);
+}
+
+static struct EditorBuffer* find_buffer(struct Dir* dir, const char* name) {
+    for (int i = 0; i < EDITOR_MAX_BUFFERS; ++i)
+        if (buffers[i].in_use && buffers[i].dir == dir && kstrcmp(buffers[i].name, name) == 0)
+            return &buffers[i];
+    return 0;
+}
+
+/* next open buffer after b, b itself if it is the only one, 0 if none */
+static struct EditorBuffer* next_buffer(struct EditorBuffer* b) {
+    int at = b ? (int)(b - buffers) : -1;
+    for (int k = 1; k <= EDITOR_MAX_BUFFERS; ++k) {
+        struct EditorBuffer* c = &buffers[(at + k + EDITOR_MAX_BUFFERS) % EDITOR_MAX_BUFFERS];
+        if (c->in_use) return c;
+    }
+    return 0;
+}
+
+/* Open fname in the CWD into a free buffer: only the newline index is
+   built up front, the text is read on demand. 0 if no buffer or no memory. */
+static struct EditorBuffer* buffer_load(const char* fname) {
+    int idx = find_file_index(fname);
+    if (idx == -1) return 0;
+    struct EditorBuffer* b = 0;
+    for (int i = 0; i < EDITOR_MAX_BUFFERS && !b; ++i)
+        if (!buffers[i].in_use) b = &buffers[i];
+    if (!b) {
+        status_msg = "Too many open files, close one with Ctrl+X";
+        status_msg_attr = 0x0C;
+        return 0;
+    }
+
+    b->src_fd = fs_open(fname, FS_O_RDONLY);
+    if (b->src_fd < 0) return 0;
+    text_init(&b->text);
+    if (text_attach(&b->text, editor_read_src, &b->src_fd, fs_get(idx)->length) != TEXT_OK) {
+        fs_close(b->src_fd);
+        return 0;
+    }
+    b->in_use = 1;
+    kstrncpy(b->name, fname, MAX_FILENAME);
+    b->dir = fs_cwd();
+    fs_pwd(b->dir_path, sizeof(b->dir_path));
+    dirty_reset(&b->dirty, text_length(&b->text));
+    b->save_err = 0;
+    b->save_cycles = 0;
+    b->last_x = b->last_y = b->last_scroll = 0;
+    undo_init(&b->undo, editor_undo_budget);
+    syntax_reset(&b->syn, syntax_lang_for(fname));
+    for (int i = 0; i < MATCH_CACHE; ++i) b->match[i].line = -1;
+    b->match_victim = 0;
+    if (wrap_on && wrap_build(&b->wrap, &b->text, VIEW_W) != WRAP_OK) wrap_off();
+    return b;
+}
+
+/* Ctrl+X: drop the current buffer; its views move on to another one */
+static void buffer_close(int* mode) {
+    struct EditorBuffer* b = B;
+    if (save.buf == b) save_end(FS_ERR_INVALID);   /* changes are being discarded */
+    text_free(&b->text);
+    if (b->src_fd >= 0) fs_close(b->src_fd);
+    b->src_fd = -1;
+    b->in_use = 0;
+
+    struct EditorBuffer* next = next_buffer(b);
+    for (int i = 0; i < view_count; ++i) {
+        if (views[i].buf != b) continue;
+        views[i].buf = 0;
+        if (next) view_show(&views[i], next);
+    }
+    if (!next) {
+        /* nothing left open: back to the explorer */
+        view_count = 1;
+        active_view = 0;
+        layout_views();
+        *mode = MODE_BROWSER;
+        return;
+    }
+    V = &views[active_view];
+    B = V->buf;
+    full_redraw = 1;
+}
+
+/* open file, or switch the active view to it if it is already open */
+void editor_open(const char *fname, int *mode) {
+    struct EditorBuffer* b = find_buffer(fs_cwd(), fname);
+    if (!b) b = buffer_load(fname);
+    if (!b) {
+        if (!views[active_view].buf) return;   /* nothing to show */
+    } else {
+        V = &views[active_view];
+        view_show(V, b);
+        B = b;
+    }
+    prompt = PROMPT_NONE;
+    search_compile(&editor_search, query, 0);
+    layout_views();
     
     /* Define MODE_EDITOR if not already defined */
     #ifndef MODE_EDITOR
@@ -134,20 +970,146 @@ void editor_open(const char *fname, int *mode) {
     editor_draw();
 }
 
+/* Ctrl+T: split the screen into two views of the current buffer, or go
+   back to the active view alone */
+static void toggle_split(void) {
+    if (view_count == 1) {
+        views[1] = views[0];
+        view_count = 2;
+    } else {
+        views[0] = views[active_view];
+        view_count = 1;
+        active_view = 0;
+    }
+    layout_views();
+    V = &views[active_view];
+    B = V->buf;
+}
+
+/* Ctrl+W: switch soft wrap for every view, keeping their top lines */
+static void toggle_wrap(void) {
+    int top[EDITOR_MAX_VIEWS], sub;
+    for (int i = 0; i < view_count; ++i) {
+        V = &views[i];
+        B = V->buf;
+        top[i] = row_to_line(V->scroll, &sub);
+    }
+    if (wrap_on) {
+        wrap_off();
+    } else {
+        for (int i = 0; i < EDITOR_MAX_BUFFERS; ++i) {
+            if (buffers[i].in_use && wrap_build(&buffers[i].wrap, &buffers[i].text, VIEW_W) != WRAP_OK) {
+                status_msg = "Too many lines to wrap";
+                status_msg_attr = 0x0C;
+                V = &views[active_view];
+                B = V->buf;
+                return;
+            }
+        }
+        wrap_on = 1;
+        full_redraw = 1;
+    }
+    for (int i = 0; i < view_count; ++i) {
+        V = &views[i];
+        B = V->buf;
+        V->scroll = wrap_on ? wrap_row_of(&B->wrap, top[i]) : top[i];
+        match_flush();
+        scroll_to_cursor();
+    }
+    V = &views[active_view];
+    B = V->buf;
+}
+
+/* Called while input is awaited: once no key has come for
+   EDITOR_AUTOSAVE_IDLE cycles, save modified buffers a chunk at a time */
+void editor_idle(void) {
+    if (!views[active_view].buf) return;
+    if (!save.buf) {
+        if (rdtsc() - last_key_tsc < EDITOR_AUTOSAVE_IDLE) return;
+        struct EditorBuffer* b = 0;
+        for (int i = 0; i < EDITOR_MAX_BUFFERS && !b; ++i)
+            if (buffers[i].in_use && !buffers[i].save_err && buffer_modified(&buffers[i])) b = &buffers[i];
+        if (!b) return;
+        int r = save_begin(b);
+        if (r < 0) b->save_err = r;
+        editor_draw();
+        if (r < 0) return;
+    }
+    if (save_step() != 0) editor_draw();
+}
+
 void editor_handle_key(int key, int *mode) {
+    static int close_armed = 0;   /* Ctrl+X was refused once */
+    int discard = close_armed;
+    close_armed = 0;
+    last_key_tsc = rdtsc();
+    status_msg = 0;
+    if (prompt != PROMPT_NONE) {
+        prompt_key(key);
+        return;
+    }
+    if (key == K_ESC) {
+        /* back to the explorer; open files stay as they are, on file */
+        for (int i = 0; i < EDITOR_MAX_BUFFERS; ++i)
+            if (buffers[i].in_use) buffer_flush(&buffers[i]);
+        *mode = MODE_BROWSER;
+        return;
+    }
     if (is_ctrl_pressed()) {
-        if (key == 19 && editor_file_index != -1) { /* Ctrl+S */
-            struct File* f = fs_get(editor_file_index);
-            fs_write(f->name, editor_buffer);
-            editor_modified = 0;
-            const char *msg = "Saved!";
-            for (int i=0; msg[i]; ++i) vga_putcell(1+i,24,msg[i],0x0A);
+        if (key == 19) { /* Ctrl+S */
+            int r = buffer_flush(B);
+            status_msg = (r == FS_OK) ? "Saved!" : (r == FS_ERR_RDONLY) ? "Read-only!" :
+                         (r == FS_ERR_NOSPACE) ? "File full, saved partially!" :
+                         (r == FS_ERR_NOTFOUND) ? "File gone, not saved!" :
+                         (r == SAVE_ERR_TMP_FULL) ? "No room for " EDITOR_SAVE_TMP ", not saved!" :
+                         (r == SAVE_ERR_TMP_TAKEN) ? EDITOR_SAVE_TMP " is in the way, not saved!" : "Save failed!";
+            status_msg_attr = (r == FS_OK) ? 0x0A : 0x0C;
+            return;
+        } else if (key == 6) { /* Ctrl+F find */
+            prompt_open(PROMPT_FIND);
+            return;
+        } else if (key == 18) { /* Ctrl+R replace all */
+            prompt_open(PROMPT_REPLACE);
+            return;
+        } else if (key == 23) { /* Ctrl+W soft wrap */
+            toggle_wrap();
+            return;
+        } else if (key == 26) { /* Ctrl+Z undo */
+            editor_undo_step(UNDO_BACK);
             return;
-        } else if (key == 24) { /* Ctrl+X exit */
-            /* Switch back to browser mode and clear editor state */
-            editor_file_index = -1;
-            *mode = MODE_BROWSER;
-            ui_draw(); /* redraw the explorer */
+        } else if (key == 25) { /* Ctrl+Y redo */
+            editor_undo_step(UNDO_FWD);
+            return;
+        } else if (key == '\t') { /* Ctrl+Tab next buffer */
+            struct EditorBuffer* next = next_buffer(B);
+            if (next == B) {
+                status_msg = "No other open files";
+                status_msg_attr = 0x0E;
+                return;
+            }
+            view_show(V, next);
+            B = next;
+            return;
+        } else if (key == 20) { /* Ctrl+T split */
+            toggle_split();
+            return;
+        } else if (key == 15) { /* Ctrl+O other view */
+            if (view_count > 1) {
+                active_view ^= 1;
+                V = &views[active_view];
+                B = V->buf;
+                paint_divider();
+            }
+            return;
+        } else if (key == 24) { /* Ctrl+X close file */
+            if (!discard && buffer_flush(B) < 0) {
+                status_msg = "Not saved! ^X again discards";
+                status_msg_attr = 0x0C;
+                close_armed = 1;
+                return;
+            }
+            buffer_close(mode);
+            if (*mode == MODE_BROWSER) ui_draw(); /* redraw the explorer */
             return;
         } else {
             return;
@@ -155,103 +1117,82 @@ void editor_handle_key(int key, int *mode) {
     }
 
     if (key == K_ARROW_UP) {
-        if (editor_cursor_y > 0) editor_cursor_y--;
-        if (editor_cursor_y < editor_scroll) editor_scroll--;
-        /* clamp cursor_x to the new line length */
-        {
-            int off = get_line_start(editor_cursor_y);
-            int line_len = get_line_length_at_off(off);
-            if (editor_cursor_x > line_len) editor_cursor_x = line_len;
-        }
+        /* one screen row up, keeping the column where the line allows */
+        int r = cursor_row();
+        if (r > 0) cursor_to_row(r - 1, cursor_col());
     } else if (key == K_ARROW_DOWN) {
-        editor_cursor_y++;
-        if (editor_cursor_y >= editor_scroll + VIEW_H) editor_scroll++;
-        /* clamp cursor_x */
-        {
-            int off = get_line_start(editor_cursor_y);
-            int line_len = get_line_length_at_off(off);
-            if (editor_cursor_x > line_len) editor_cursor_x = line_len;
-        }
+        int r = cursor_row();
+        if (r < row_count() - 1) cursor_to_row(r + 1, cursor_col());
     } else if (key == K_ARROW_LEFT) {
-        if (editor_cursor_x > 0) {
-            editor_cursor_x--;
-        } else if (editor_cursor_y > 0) {
+        if (V->cursor_x > 0) {
+            V->cursor_x--;
+        } else if (V->cursor_y > 0) {
             /* move to end of previous line */
-            editor_cursor_y--;
-            if (editor_cursor_y < editor_scroll) editor_scroll--;
-            int off = get_line_start(editor_cursor_y);
-            editor_cursor_x = get_line_length_at_off(off);
+            V->cursor_y--;
+            int off = get_line_start(V->cursor_y);
+            V->cursor_x = get_line_length_at_off(off);
         }
     } else if (key == K_ARROW_RIGHT) {
-        int off = get_line_start(editor_cursor_y);
+        int off = get_line_start(V->cursor_y);
         int line_len = get_line_length_at_off(off);
-        if (editor_cursor_x < line_len) {
-            editor_cursor_x++;
-        } else {
+        if (V->cursor_x < line_len) {
+            V->cursor_x++;
+        } else if (V->cursor_y < last_line()) {
             /* move to next line start */
-            editor_cursor_y++;
-            editor_cursor_x = 0;
-            if (editor_cursor_y >= editor_scroll + VIEW_H) editor_scroll++;
+            V->cursor_y++;
+            V->cursor_x = 0;
         }
     } 
     /* page up/down, backspace, enter, printable chars remain same but ensure clamping after edits */
     else if (key == K_PAGE_UP) {
-        editor_scroll -= VIEW_H;
-        if (editor_scroll < 0) editor_scroll = 0;
-        editor_cursor_y = editor_scroll;
-        int off = get_line_start(editor_cursor_y);
-        int len = get_line_length_at_off(off);
-        if (editor_cursor_x > len) editor_cursor_x = len;
+        V->scroll -= V->height;
+        if (V->scroll < 0) V->scroll = 0;
+        cursor_to_row(V->scroll, cursor_col());
     } else if (key == K_PAGE_DOWN) {
-        editor_scroll += VIEW_H;
-        editor_cursor_y = editor_scroll;
-        int off = get_line_start(editor_cursor_y);
-        int len = get_line_length_at_off(off);
-        if (editor_cursor_x > len) editor_cursor_x = len;
+        if (V->scroll + V->height < row_count()) V->scroll += V->height;
+        cursor_to_row(V->scroll, cursor_col());
     } else if (key == '\b') {
         int off = cursor_to_offset();
         if (off > 0) {
-            delete_char_before(off);
+            if (!delete_char_before(off)) { out_of_memory(); return; }
             /* move cursor back one position */
-            if (editor_cursor_x > 0) editor_cursor_x--;
-            else if (editor_cursor_y > 0) {
-                editor_cursor_y--;
-                editor_cursor_x = get_line_length_at_off(get_line_start(editor_cursor_y));
-                if (editor_cursor_y < editor_scroll) editor_scroll--;
+            if (V->cursor_x > 0) V->cursor_x--;
+            else if (V->cursor_y > 0) {
+                V->cursor_y--;
+                V->cursor_x = get_line_length_at_off(get_line_start(V->cursor_y));
             }
         }
     } else if (key == '\n' || key == '\r') {
         int off = cursor_to_offset();
-        insert_char_at(off, '\n');
-        editor_cursor_y++;
-        editor_cursor_x = 0;
-        if (editor_cursor_y >= editor_scroll + VIEW_H) editor_scroll++;
+        if (!insert_char_at(off, '\n')) { out_of_memory(); return; }
+        V->cursor_y++;
+        V->cursor_x = 0;
     } else if (key >= 32 && key <= 126) {
         int off = cursor_to_offset();
-        insert_char_at(off, (char)key);
-        editor_cursor_x++;
-        if (editor_cursor_x > VIEW_W - 1) editor_cursor_x = VIEW_W - 1;
+        if (!insert_char_at(off, (char)key)) { out_of_memory(); return; }
+        V->cursor_x++;
+        if (!wrap_on && V->cursor_x > VIEW_W - 1) V->cursor_x = VIEW_W - 1;
     }
+    scroll_to_cursor();
 }
 
 /* Mouse support for editor (optional) */
 #ifdef EDITOR_MOUSE_SUPPORT
 void editor_set_cursor_pos(int x, int y) {
+    if (!views[active_view].buf) return;
     /* Adjust for editor window bounds and scrolling */
-    if (x >= 1 && x < 80 && y >= 2 && y < 22) {  /* Editor content area */
-        /* Convert screen coordinates to editor coordinates */
-        editor_cursor_x = x - 1;  /* Account for border */
-        int screen_line = y - 2;  /* Account for title bar */
-        editor_cursor_y = screen_line + editor_scroll;
-        
-        /* Clamp to actual line length */
-        int off = get_line_start(editor_cursor_y);
-        int line_len = get_line_length_at_off(off);
-        if (editor_cursor_x > line_len) editor_cursor_x = line_len;
-        
-        /* Bounds checking */
-        if (editor_cursor_x < 0) editor_cursor_x = 0;
-        if (editor_cursor_y < 0) editor_cursor_y = 0;
+    for (int i = 0; i < view_count; ++i) {
+        struct EditorView* v = &views[i];
+        if (x >= 1 && x < 80 && y >= v->row0 && y < v->row0 + v->height) {  /* Editor content area */
+            /* a click focuses the view it lands in */
+            active_view = i;
+            V = v;
+            B = v->buf;
+            /* Convert screen coordinates to editor coordinates, clamped
+               to the document and the line's length */
+            cursor_to_row(y - v->row0 + V->scroll, x - 1);
+            if (view_count > 1) paint_divider();
+        }
     }
 }
 #endif /* EDITOR_MOUSE_SUPPORT */
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "../include/event.h"
+#include "../include/input.h"
+#include "../include/mouse.h"
+#include "../include/io.h"
+#include "../include/cpu.h"
+#include "../include/thread.h"
+#include "../include/serial.h"
+#include "../include/klog.h"
+
+static struct Event queue[EVENT_QUEUE];
+static int head = 0, count = 0;
+static u64 redraw_since = 0;   /* first request not yet drawn, 0 if none */
+static u32 next_tick = 0;   /* thread tick of the next timer event */
+static int input_chan;      /* event_wait() sleeps here */
+static struct EventStats stats;
+
+void event_post(int type, int code, int x, int y) {
+    if (count == EVENT_QUEUE) {
+        stats.dropped++;
+        klog(KLOG_WARN, "event: queue full, type %d dropped", type);
+        return;
+    }
+    struct Event* e = &queue[(head + count++) % EVENT_QUEUE];
+    e->type = type;
+    e->code = code;
+    e->x = x;
+    e->y = y;
+    e->tsc = rdtsc();
+}
+
+void event_request_redraw(void) {
+    if (!redraw_since) redraw_since = rdtsc();
+}
+
+/* move whatever the keyboard controller holds into the queue */
+static void poll_input(void) {
+    u8 st;
+    while ((st = io_inb(0x64)) & 0x01) {
+        if (st & 0x20) {   /* from the mouse */
+            if (mouse_handler()) {
+                mouse_state_t m;
+                mouse_get(&m);
+                event_post(EV_MOUSE, m.buttons, m.x, m.y);
+            }
+            continue;
+        }
+        int k = key_decode(io_inb(0x60));
+        if (k > 0) event_post(EV_KEY, k, 0, 0);
+    }
+    /* what does not fit waits in the serial ring rather than being dropped */
+    int c;
+    while (count < EVENT_QUEUE && (c = serial_getc()) >= 0) event_post(EV_SERIAL, c, 0, 0);
+}
+
+static void poll_clock(void) {
+    u32 now = thread_ticks();
+    if ((s32)(now - next_tick) < 0) return;
+    /* periods missed while something ran long arrive as one event */
+    int periods = 1 + (int)((now - next_tick) / EVENT_TIMER_TICKS);
+    next_tick += (u32)periods * EVENT_TIMER_TICKS;
+    event_post(EV_TIMER, periods, 0, 0);
+}
+
+static void input_irq(void) {
+    thread_wakeup(&input_chan);
+}
+
+void event_init(void) {
+    next_tick = thread_ticks() + EVENT_TIMER_TICKS;
+    irq_set_handler(IRQ_KBD, input_irq);
+    irq_set_handler(IRQ_MOUSE, input_irq);
+    serial_set_rx_callback(input_irq);
+}
+
+void event_wait(void) {
+    u32 f = irq_save();
+    if (!(io_inb(0x64) & 0x01) && !serial_pending() && count == 0 && !redraw_since) thread_wait(&input_chan, 1);
+    irq_restore(f);
+}
+
+int event_next(struct Event* ev) {
+    poll_input();
+    poll_clock();
+    if (count > 0) {
+        *ev = queue[head];
+        head = (head + 1) % EVENT_QUEUE;
+        count--;
+        return 1;
+    }
+    if (redraw_since) {
+        ev->type = EV_REDRAW;
+        ev->code = ev->x = ev->y = 0;
+        ev->tsc = redraw_since;
+        redraw_since = 0;
+        return 1;
+    }
+    return 0;
+}
+
+void event_done(const struct Event* ev) {
+    u64 d = rdtsc() - ev->tsc;
+    if (ev->type == EV_KEY) {
+        stats.keys++;
+        stats.key_cycles += d;
+        if (d > stats.key_max) stats.key_max = d;
+    } else if (ev->type == EV_REDRAW) {
+        stats.frames++;
+        stats.frame_cycles += d;
+        if (d > stats.frame_max) stats.frame_max = d;
+    }
+}
+
+const struct EventStats* event_stats(void) {
+    return &stats;
+}
@@ -1,5 +1,9 @@
 #include "../include/fs.h"
 #include "../include/util.h"
+#include "../include/spinlock.h"
+#include "../include/rcu.h"
+#include "../include/paging.h"
+#include "../include/trace.h"
 
 /* Ensure you have kstrncpy in util.c and declared in util.h:
    void kstrncpy(char* d, const char* s, int n);  -- always NUL-terminates. */
@@ -8,6 +12,21 @@
 static struct Dir  s_root;
 static struct Dir* s_cwd = &s_root;
 
+/* Namespace changes, moving s_cwd and adding or removing entries of a
+   directory, are made under ns_lock, so a lookup and the insert or
+   removal it decided on cannot be split by another thread. s_cwd is one
+   word and is read without it. */
+static struct Spinlock ns_lock = SPINLOCK_INIT("fs");
+
+/* open-file table: descriptors index into this */
+struct OpenFile {
+    struct File* f;   /* 0 once the file is deleted: the slot stays taken until fs_close */
+    int off;
+    int flags;
+    u8  used;
+};
+static struct OpenFile s_open[FS_MAX_OPEN];
+
 /* -------- Internal helpers -------- */
 static int name_invalid(const char* n) {
     if (!n) return 1;
@@ -18,99 +37,348 @@ static int name_invalid(const char* n) {
     return 0;
 }
 
-static struct Dir* dir_find_child(struct Dir* d, const char* name) {
-    if (!d || !name) return 0;
-    for (int i = 0; i < d->subdir_count; ++i) {
-        if (kstrcmp(d->subdirs[i]->name, name) == 0) return d->subdirs[i];
+static struct Dir* dir_find_child(const struct DirList* l, const char* name) {
+    if (!name) return 0;
+    for (int i = 0; i < l->subdir_count; ++i) {
+        if (kstrcmp(l->subdirs[i]->name, name) == 0) return l->subdirs[i];
     }
     return 0;
 }
 
+static struct File* file_find(const struct DirList* l, const char* name) {
+    for (int i = 0; i < l->file_count; ++i)
+        if (kstrcmp(l->files[i]->name, name) == 0) return l->files[i];
+    return 0;
+}
+
 static int dir_is_empty(struct Dir* d) {
-    return d->file_count == 0 && d->subdir_count == 0;
+    return d->list->file_count == 0 && d->list->subdir_count == 0;
+}
+
+static struct OpenFile* fd_get(int fd) {
+    if (fd < 0 || fd >= FS_MAX_OPEN || !s_open[fd].used) return 0;
+    return &s_open[fd];
+}
+
+static int fd_writable(const struct OpenFile* of) {
+    return (of->flags & FS_O_ACCMODE) != FS_O_RDONLY;
+}
+
+/* -------- Data blocks -------- */
+/* a lazy region: a block gets a frame the first time it is handed out.
+   Only as many blocks as there are frames reserved for it are handed
+   out, so a write runs out of blocks rather than faulting without RAM.
+   Without paging there are no regions, and a smaller static pool is used. */
+static char (*s_data)[FS_BLOCK_SIZE];
+static char s_static_data[FS_STATIC_BLOCKS][FS_BLOCK_SIZE];
+static u16  s_free_blocks[FS_DATA_BLOCKS];
+static int  s_free_count;
+
+static void blocks_init(void) {
+    int n = FS_DATA_BLOCKS;
+    s_data = region_create("fs-data", FS_DATA_BLOCKS * FS_BLOCK_SIZE, REGION_LAZY | REGION_GUARD);
+    if (s_data) {
+        n = (int)(region_reserve(s_data, FS_DATA_BLOCKS * FS_BLOCK_SIZE / PAGE_SIZE) * PAGE_SIZE / FS_BLOCK_SIZE);
+    } else {
+        s_data = s_static_data;
+        n = FS_STATIC_BLOCKS;
+    }
+    for (int i = 0; i < n; ++i) s_free_blocks[i] = (u16)(n - 1 - i);
+    s_free_count = n;
+}
+
+/* blocks come back zeroed: bytes past a file's length always read as 0 */
+static int block_alloc(void) {
+    if (s_free_count == 0) return -1;
+    int b = s_free_blocks[--s_free_count];
+    kmemset(s_data[b], 0, FS_BLOCK_SIZE);
+    return b;
+}
+
+static void block_release(u16* slot) {
+    if (*slot == FS_NO_BLOCK) return;
+    s_free_blocks[s_free_count++] = *slot;
+    *slot = FS_NO_BLOCK;
+}
+
+/* content versions come from one counter, so a file deleted and created
+   again never repeats an old one */
+static u32 s_version = 0;
+static void file_touch(struct File* f) {
+    f->version = ++s_version;
+}
+
+static void dir_touch(struct Dir* d) {
+    d->version = ++s_version;
+}
+
+static void file_init(struct File* f) {
+    for (int i = 0; i < FS_DIRECT_BLOCKS; ++i) f->blocks[i] = FS_NO_BLOCK;
+    f->indirect = FS_NO_BLOCK;
+    f->length = 0;
+    file_touch(f);
+}
+
+/* data of logical block bi, mapping a fresh one if alloc is set;
+   0 when unmapped or out of space */
+static char* file_block(struct File* f, int bi, int alloc) {
+    u16* slot;
+    if (bi < FS_DIRECT_BLOCKS) {
+        slot = &f->blocks[bi];
+    } else {
+        bi -= FS_DIRECT_BLOCKS;
+        if (bi >= FS_PTRS_PER_BLOCK) return 0;
+        if (f->indirect == FS_NO_BLOCK) {
+            if (!alloc) return 0;
+            int b = block_alloc();
+            if (b < 0) return 0;
+            f->indirect = (u16)b;
+            u16* tbl = (u16*)s_data[b];
+            for (int i = 0; i < FS_PTRS_PER_BLOCK; ++i) tbl[i] = FS_NO_BLOCK;
+        }
+        slot = (u16*)s_data[f->indirect] + bi;
+    }
+    if (*slot == FS_NO_BLOCK) {
+        if (!alloc) return 0;
+        int b = block_alloc();
+        if (b < 0) return 0;
+        *slot = (u16)b;
+    }
+    return s_data[*slot];
+}
+
+/* unmap every block from logical block `from` on */
+static void file_release_from(struct File* f, int from) {
+    for (int i = from; i < FS_DIRECT_BLOCKS; ++i) block_release(&f->blocks[i]);
+    if (f->indirect == FS_NO_BLOCK) return;
+    u16* tbl = (u16*)s_data[f->indirect];
+    int i = (from > FS_DIRECT_BLOCKS) ? from - FS_DIRECT_BLOCKS : 0;
+    for (; i < FS_PTRS_PER_BLOCK; ++i) block_release(&tbl[i]);
+    if (from <= FS_DIRECT_BLOCKS) block_release(&f->indirect);
+}
+
+/* shrink or zero-extend f to len bytes */
+static int file_set_length(struct File* f, int len) {
+    if (len < 0 || len > FS_MAX_FILE_SIZE) return FS_ERR_INVALID;
+    int nb = (len + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+    if (len < f->length) {
+        file_release_from(f, nb);
+        /* keep the tail of the last block zero for a later extension */
+        int tail = len % FS_BLOCK_SIZE;
+        char* b = tail ? file_block(f, nb - 1, 0) : 0;
+        if (b) kmemset(b + tail, 0, FS_BLOCK_SIZE - tail);
+    } else {
+        for (int bi = f->length / FS_BLOCK_SIZE; bi < nb; ++bi)
+            if (!file_block(f, bi, 1)) return FS_ERR_NOSPACE;
+    }
+    f->length = len;
+    file_touch(f);
+    return FS_OK;
+}
+
+/* copy n bytes into f at off, zero-filling any hole past the old end.
+   Returns bytes written (short when the pool or file size runs out). */
+static int write_at(struct File* f, const char* data, int n, int off) {
+    if (off < 0 || n < 0) return FS_ERR_INVALID;
+    if (off > f->length) {
+        int r = file_set_length(f, (off < FS_MAX_FILE_SIZE) ? off : FS_MAX_FILE_SIZE);
+        if (r < 0) return r;
+    }
+
+    int done = 0;
+    while (done < n && off + done < FS_MAX_FILE_SIZE) {
+        int pos = off + done;
+        char* b = file_block(f, pos / FS_BLOCK_SIZE, 1);
+        if (!b) break;
+        int k = FS_BLOCK_SIZE - pos % FS_BLOCK_SIZE;
+        if (k > n - done) k = n - done;
+        kmemcpy(b + pos % FS_BLOCK_SIZE, data + done, k);
+        done += k;
+    }
+    if (off + done > f->length) f->length = off + done;
+    if (done > 0) file_touch(f);
+    if (done == 0 && n > 0) return FS_ERR_NOSPACE;
+    return done;
+}
+
+static int read_at(struct File* f, char* buf, int n, int off) {
+    if (off < 0 || n < 0) return FS_ERR_INVALID;
+    if (off >= f->length) return 0;
+    if (n > f->length - off) n = f->length - off;
+
+    for (int done = 0; done < n; ) {
+        int pos = off + done;
+        int k = FS_BLOCK_SIZE - pos % FS_BLOCK_SIZE;
+        if (k > n - done) k = n - done;
+        char* b = file_block(f, pos / FS_BLOCK_SIZE, 0);
+        if (b) kmemcpy(buf + done, b + pos % FS_BLOCK_SIZE, k);
+        else   kmemset(buf + done, 0, k);
+        done += k;
+    }
+    return n;
+}
+
+static int file_write_at(struct File* f, const char* data, int n, int off) {
+    TRACE_BEGIN(TP_FS_WRITE, n);
+    int r = write_at(f, data, n, off);
+    TRACE_END(TP_FS_WRITE, r);
+    return r;
+}
+
+static int file_read_at(struct File* f, char* buf, int n, int off) {
+    TRACE_BEGIN(TP_FS_READ, n);
+    int r = read_at(f, buf, n, off);
+    TRACE_END(TP_FS_READ, r);
+    return r;
+}
+
+/* -------- Directory entries --------
+   A directory's entries are one published DirList. Writers hold ns_lock,
+   copy the list, change the copy and publish it; the old list goes back
+   to the pool after an RCU grace period, and so does the slot of a file
+   deleted or renamed away, so a reader still on the old list never finds
+   either reused under it. */
+static struct DirList s_lists[FS_DIR_LISTS];
+static struct DirList* s_free_lists[FS_DIR_LISTS];
+static int s_free_list_count;
+
+static void lists_init(void) {
+    for (int i = 0; i < FS_DIR_LISTS; ++i) s_free_lists[i] = &s_lists[FS_DIR_LISTS - 1 - i];
+    s_free_list_count = FS_DIR_LISTS;
+}
+
+static struct DirList* list_alloc(void) {
+    return s_free_list_count ? s_free_lists[--s_free_list_count] : 0;
+}
+
+static void list_free(void* p) {
+    u32 f = spin_lock_irqsave(&ns_lock);
+    s_free_lists[s_free_list_count++] = (struct DirList*)p;
+    spin_unlock_irqrestore(&ns_lock, f);
+}
+
+static void slot_free(void* p) {
+    ((struct File*)p)->name[0] = '\0';
+}
+
+/* a private copy of d's entries to change and publish; 0 if the pool is dry */
+static struct DirList* list_copy(const struct Dir* d) {
+    struct DirList* nl = list_alloc();
+    if (nl) kmemcpy(nl, d->list, sizeof(*nl));
+    return nl;
+}
+
+static void list_publish(struct Dir* d, struct DirList* nl) {
+    struct DirList* old = d->list;
+    rcu_assign_pointer(d->list, nl);
+    rcu_retire(old, list_free);
+    dir_touch(d);
+}
+
+/* each change retires at most a list and a file slot */
+static int ns_room(void) {
+    return s_free_list_count >= 2 && rcu_room() >= 2;
+}
+
+static int dir_init(struct Dir* d, const char* name, struct Dir* parent) {
+    struct DirList* l = list_alloc();
+    if (!l) return FS_ERR_NOSPACE;
+    kmemset(l, 0, sizeof(*l));
+    for (int i = 0; i < FS_FILE_SLOTS; ++i) d->slots[i].name[0] = '\0';
+    kstrncpy(d->name, name, MAX_FILENAME);
+    d->parent = parent;
+    d->list = l;
+    dir_touch(d);
+    return FS_OK;
+}
+
+static struct File* slot_alloc(struct Dir* d) {
+    for (int i = 0; i < FS_FILE_SLOTS; ++i)
+        if (d->slots[i].name[0] == '\0') return &d->slots[i];
+    return 0;
+}
+
+/* new empty file in d; ns_lock held */
+static struct File* file_add(struct Dir* d, const char* name, u8 type, int* err) {
+    *err = FS_ERR_NOSPACE;
+    if (d->list->file_count >= MAX_FILES_PER_DIR || !ns_room()) return 0;
+    if (file_find(d->list, name)) { *err = FS_ERR_EXISTS; return 0; }
+    struct File* f = slot_alloc(d);
+    struct DirList* nl = f ? list_copy(d) : 0;
+    if (!nl) return 0;
+    kstrncpy(f->name, name, MAX_FILENAME);
+    file_init(f);
+    f->type     = type;
+    f->readonly = 0;
+    nl->files[nl->file_count++] = f;
+    list_publish(d, nl);
+    *err = FS_OK;
+    return f;
+}
+
+static struct File* preload(struct Dir* d, const char* name, const char* text, u8 readonly) {
+    int err;
+    struct File* f = file_add(d, name, FILE_TEXT, &err);
+    if (!f) return 0;
+    file_write_at(f, text, kstrlen(text), 0);
+    f->readonly = readonly;
+    return f;
 }
 
 /* -------- Init -------- */
 void init_filesystem(void) {
+    blocks_init();
+    lists_init();
+
     /* root dir */
-    for (int i=0;i<MAX_DIRS_PER_DIR;i++) s_root.subdirs[i] = 0;
-    s_root.subdir_count = 0;
-    s_root.file_count   = 0;
-    s_root.parent       = 0;
-    kstrncpy(s_root.name, "/", MAX_FILENAME);
+    dir_init(&s_root, "/", 0);
     s_cwd = &s_root;
 
     /* preload sample content in root */
-    struct File* f;
-
-    /* README */
-    if (s_root.file_count < MAX_FILES_PER_DIR) {
-        f = &s_root.files[s_root.file_count++];
-        kstrncpy(f->name, "README.txt", MAX_FILENAME);
-        kstrncpy(f->content,
-                 "NoirOS\n"
-                 "Use arrows/W-S to navigate, Enter for cmd.\n"
-                 "Commands: ls, cd, mkdir, rmdir, touch/new, del, edit <file>, pwd\n",
-                 MAX_CONTENT);
-        f->length  = kstrlen(f->content);
-        f->type    = FILE_TEXT;
-        f->readonly= 1;
-    }
-
-    /* help */
-    if (s_root.file_count < MAX_FILES_PER_DIR) {
-        f = &s_root.files[s_root.file_count++];
-        kstrncpy(f->name, "help.txt", MAX_FILENAME);
-        kstrncpy(f->content,
-                 "Help:\n"
-                 " ls                 - list current folder\n"
-                 " cd <dir>|..|/      - change directory\n"
-                 " mkdir <name>       - make directory\n"
-                 " rmdir <name>       - remove EMPTY directory\n"
-                 " new <name> <type>  - create file (type: 0 text, 1 exe, 2 game)\n"
-                 " del <name>         - delete file\n"
-                 " edit <file>        - open editor\n"
-                 " pwd                - show current path\n",
-                 MAX_CONTENT);
-        f->length  = kstrlen(f->content);
-        f->type    = FILE_TEXT;
-        f->readonly= 1;
-    }
+    preload(&s_root, "README.txt",
+            "NoirOS\n"
+            "Use arrows/W-S to navigate, Enter for cmd.\n"
+            "Commands: ls, cd, mkdir, rmdir, touch/new, del, edit <file>, pwd\n",
+            1);
+
+    preload(&s_root, "help.txt",
+            "Help:\n"
+            " ls                 - list current folder\n"
+            " cd <dir>|..|/      - change directory\n"
+            " mkdir <name>       - make directory\n"
+            " rmdir <name>       - remove EMPTY directory\n"
+            " new <name> <type>  - create file (type: 0 text, 1 exe, 2 game)\n"
+            " del <name>         - delete file\n"
+            " edit <file>        - open editor\n"
+            " pwd                - show current path\n",
+            1);
 
     /* sample editable file */
-    if (s_root.file_count < MAX_FILES_PER_DIR) {
-        f = &s_root.files[s_root.file_count++];
-        kstrncpy(f->name, "notes.md", MAX_FILENAME);
-        kstrncpy(f->content, "Editable notes.md\nTry: mkdir docs; cd docs; new todo.txt 0\n", MAX_CONTENT);
-        f->length  = kstrlen(f->content);
-        f->type    = FILE_TEXT;
-        f->readonly= 0;
-    }
+    preload(&s_root, "notes.md", "Editable notes.md\nTry: mkdir docs; cd docs; new todo.txt 0\n", 0);
 
     /* also create a sample subdir: docs/ with one file */
-    if (s_root.subdir_count < MAX_DIRS_PER_DIR) {
-        static struct Dir docs; /* static to keep lifetime */
-        docs.parent = &s_root;
-        for (int i=0;i<MAX_DIRS_PER_DIR;i++) docs.subdirs[i]=0;
-        docs.subdir_count=0;
-        docs.file_count=0;
-        kstrncpy(docs.name, "docs", MAX_FILENAME);
-        s_root.subdirs[s_root.subdir_count++] = &docs;
-
-        if (docs.file_count < MAX_FILES_PER_DIR) {
-            struct File* df = &docs.files[docs.file_count++];
-            kstrncpy(df->name, "guide.txt", MAX_FILENAME);
-            kstrncpy(df->content, "Welcome to /docs\n", MAX_CONTENT);
-            df->length  = kstrlen(df->content);
-            df->type    = FILE_TEXT;
-            df->readonly= 0;
-        }
+    static struct Dir docs; /* static to keep lifetime */
+    struct DirList* nl = list_copy(&s_root);
+    if (nl && dir_init(&docs, "docs", &s_root) == FS_OK) {
+        nl->subdirs[nl->subdir_count++] = &docs;
+        list_publish(&s_root, nl);
+        preload(&docs, "guide.txt", "Welcome to /docs\n", 0);
     }
 }
 
 /* -------- Root/CWD/PWD -------- */
 struct Dir* fs_root(void) { return &s_root; }
 struct Dir* fs_cwd(void)  { return s_cwd;  }
+void fs_set_cwd(struct Dir* d) {
+    if (!d) return;
+    u32 f = spin_lock_irqsave(&ns_lock);
+    s_cwd = d;
+    spin_unlock_irqrestore(&ns_lock, f);
+}
+
+const struct DirList* fs_dir_list(struct Dir* d) {
+    return rcu_dereference(d->list);
+}
 
 void fs_pwd(char* out, int out_len) {
     if (!out || out_len <= 0) return;
@@ -141,10 +409,11 @@ void fs_pwd(char* out, int out_len) {
 }
 
 /* -------- Directory ops -------- */
-int fs_mkdir(const char* name) {
+static int mkdir_locked(const char* name) {
     if (name_invalid(name)) return FS_ERR_INVALID;
-    if (s_cwd->subdir_count >= MAX_DIRS_PER_DIR) return FS_ERR_NOSPACE;
-    if (dir_find_child(s_cwd, name)) return FS_ERR_EXISTS;
+    if (s_cwd->list->subdir_count >= MAX_DIRS_PER_DIR) return FS_ERR_NOSPACE;
+    if (dir_find_child(s_cwd->list, name)) return FS_ERR_EXISTS;
+    if (!ns_room()) return FS_ERR_NOSPACE;
 
     /* find a free static slot to place new dir: use static array bank */
     /* approach: allocate from a static pool of directories */
@@ -154,139 +423,384 @@ int fs_mkdir(const char* name) {
     for (int i = 0; i < 32; ++i) if (!pool_used[i]) { slot = i; break; }
     if (slot < 0) return FS_ERR_NOSPACE;
 
-    pool_used[slot] = 1;
     struct Dir* nd = &pool[slot];
-    nd->parent = s_cwd;
-    nd->subdir_count = 0;
-    nd->file_count = 0;
-    for (int i=0;i<MAX_DIRS_PER_DIR;i++) nd->subdirs[i] = 0;
-    kstrncpy(nd->name, name, MAX_FILENAME);
-
-    s_cwd->subdirs[s_cwd->subdir_count++] = nd;
+    struct DirList* nl = list_copy(s_cwd);
+    if (!nl) return FS_ERR_NOSPACE;
+    if (dir_init(nd, name, s_cwd) != FS_OK) {
+        s_free_lists[s_free_list_count++] = nl;
+        return FS_ERR_NOSPACE;
+    }
+    pool_used[slot] = 1;
+    nl->subdirs[nl->subdir_count++] = nd;
+    list_publish(s_cwd, nl);
     return FS_OK;
 }
 
-int fs_chdir(const char* name) {
+static int chdir_locked(const char* name) {
     if (!name) return FS_ERR_INVALID;
     if (kstrcmp(name, "/") == 0) { s_cwd = &s_root; return FS_OK; }
     if (kstrcmp(name, "..") == 0) {
         if (s_cwd->parent) s_cwd = s_cwd->parent;
         return FS_OK;
     }
-    struct Dir* d = dir_find_child(s_cwd, name);
+    struct Dir* d = dir_find_child(s_cwd->list, name);
     if (!d) return FS_ERR_NOTFOUND;
     s_cwd = d;
     return FS_OK;
 }
 
-int fs_rmdir(const char* name) {
+static int rmdir_locked(const char* name) {
     if (name_invalid(name)) return FS_ERR_INVALID;
-    for (int i = 0; i < s_cwd->subdir_count; ++i) {
-        struct Dir* d = s_cwd->subdirs[i];
+    const struct DirList* cur = s_cwd->list;
+    for (int i = 0; i < cur->subdir_count; ++i) {
+        struct Dir* d = cur->subdirs[i];
         if (kstrcmp(d->name, name) == 0) {
             if (!dir_is_empty(d)) return FS_ERR_DIRNOTEMPTY;
+            if (!ns_room()) return FS_ERR_NOSPACE;
+            struct DirList* nl = list_copy(s_cwd);
             /* remove by shifting */
-            for (int j = i; j < s_cwd->subdir_count-1; ++j)
-                s_cwd->subdirs[j] = s_cwd->subdirs[j+1];
-            s_cwd->subdir_count--;
+            for (int j = i; j < nl->subdir_count-1; ++j)
+                nl->subdirs[j] = nl->subdirs[j+1];
+            nl->subdir_count--;
+            list_publish(s_cwd, nl);
             return FS_OK;
         }
     }
     return FS_ERR_NOTFOUND;
 }
 
+/* Namespace changes reclaim what earlier ones retired first, then run
+   under ns_lock */
+int fs_mkdir(const char* name) {
+    TRACE_BEGIN(TP_FS_MKDIR, 0);
+    rcu_poll();
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = mkdir_locked(name);
+    spin_unlock_irqrestore(&ns_lock, f);
+    TRACE_END(TP_FS_MKDIR, r);
+    return r;
+}
+
+int fs_chdir(const char* name) {
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = chdir_locked(name);
+    spin_unlock_irqrestore(&ns_lock, f);
+    return r;
+}
+
+int fs_rmdir(const char* name) {
+    TRACE_BEGIN(TP_FS_RMDIR, 0);
+    rcu_poll();
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = rmdir_locked(name);
+    spin_unlock_irqrestore(&ns_lock, f);
+    TRACE_END(TP_FS_RMDIR, r);
+    return r;
+}
+
+/* Lookups read the published list without a lock */
 int fs_dir_count(void) {
-    return s_cwd->subdir_count;
+    rcu_read_lock();
+    int n = fs_dir_list(s_cwd)->subdir_count;
+    rcu_read_unlock();
+    return n;
 }
 struct Dir* fs_dir_get(int idx) {
-    if (idx < 0 || idx >= s_cwd->subdir_count) return 0;
-    return s_cwd->subdirs[idx];
+    rcu_read_lock();
+    const struct DirList* l = fs_dir_list(s_cwd);
+    struct Dir* d = (idx >= 0 && idx < l->subdir_count) ? l->subdirs[idx] : 0;
+    rcu_read_unlock();
+    return d;
 }
 struct Dir* fs_find_dir(const char* name) {
-    return dir_find_child(s_cwd, name);
+    rcu_read_lock();
+    struct Dir* d = dir_find_child(fs_dir_list(s_cwd), name);
+    rcu_read_unlock();
+    return d;
 }
 
 /* -------- Files (scoped to CWD) -------- */
-int fs_count(void) { return s_cwd->file_count; }
+int fs_count(void) {
+    rcu_read_lock();
+    int n = fs_dir_list(s_cwd)->file_count;
+    rcu_read_unlock();
+    return n;
+}
 
+/* The File pointers below are looked up in a read section and only good
+   for a quick look (name, length): once it ends a rename or delete can
+   retire the slot. Changes go through fs_write, fs_append or a
+   descriptor, which find the file again under ns_lock. */
 struct File* fs_get(int idx) {
-    if (idx < 0 || idx >= s_cwd->file_count) return 0;
-    return &s_cwd->files[idx];
+    rcu_read_lock();
+    const struct DirList* l = fs_dir_list(s_cwd);
+    struct File* f = (idx >= 0 && idx < l->file_count) ? l->files[idx] : 0;
+    rcu_read_unlock();
+    return f;
 }
 
 struct File* fs_find(const char* name) {
     if (!name) return 0;
-    for (int i = 0; i < s_cwd->file_count; ++i)
-        if (kstrcmp(s_cwd->files[i].name, name) == 0) return &s_cwd->files[i];
-    return 0;
+    rcu_read_lock();
+    struct File* f = file_find(fs_dir_list(s_cwd), name);
+    rcu_read_unlock();
+    return f;
 }
 
-int fs_create(const char* name, u8 type) {
-    if (name_invalid(name)) return FS_ERR_INVALID;
-    if (s_cwd->file_count >= MAX_FILES_PER_DIR) return FS_ERR_NOSPACE;
-    if (fs_find(name)) return FS_ERR_EXISTS;
-
-    struct File* f = &s_cwd->files[s_cwd->file_count++];
-    kstrncpy(f->name, name, MAX_FILENAME);
-    f->content[0] = '\0';
-    f->length  = 0;
-    f->type    = type;
-    f->readonly= 0;
-    return FS_OK;
-}
-
-int fs_delete(const char* name) {
+static int delete_locked(const char* name) {
     if (!name) return FS_ERR_INVALID;
+    const struct DirList* cur = s_cwd->list;
     int idx = -1;
-    for (int i = 0; i < s_cwd->file_count; ++i) {
-        if (kstrcmp(s_cwd->files[i].name, name) == 0) { idx = i; break; }
+    for (int i = 0; i < cur->file_count; ++i) {
+        if (kstrcmp(cur->files[i]->name, name) == 0) { idx = i; break; }
     }
     if (idx < 0) return FS_ERR_NOTFOUND;
-    if (s_cwd->files[idx].readonly) return FS_ERR_RDONLY;
+    struct File* victim = cur->files[idx];
+    if (victim->readonly) return FS_ERR_RDONLY;
+    if (!ns_room()) return FS_ERR_NOSPACE;
+
+    /* descriptors on the victim are detached, not freed: their holders
+       still own the numbers, and I/O on them fails until they close */
+    for (int i = 0; i < FS_MAX_OPEN; ++i)
+        if (s_open[i].used && s_open[i].f == victim) s_open[i].f = 0;
+
+    /* free its blocks; the slot itself waits for readers */
+    file_release_from(victim, 0);
+    victim->length = 0;
+
+    struct DirList* nl = list_copy(s_cwd);
+    for (int j = idx; j < nl->file_count-1; ++j)
+        nl->files[j] = nl->files[j+1];
+    nl->file_count--;
+    list_publish(s_cwd, nl);
+    rcu_retire(victim, slot_free);
+    return FS_OK;
+}
 
-    /* clear and shift */
-    s_cwd->files[idx].name[0] = '\0';
-    s_cwd->files[idx].content[0] = '\0';
-    s_cwd->files[idx].length = 0;
+int fs_create(const char* name, u8 type) {
+    if (name_invalid(name)) return FS_ERR_INVALID;
+    TRACE_BEGIN(TP_FS_CREATE, 0);
+    rcu_poll();
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r;
+    file_add(s_cwd, name, type, &r);
+    spin_unlock_irqrestore(&ns_lock, f);
+    TRACE_END(TP_FS_CREATE, r);
+    return r;
+}
 
-    for (int j = idx; j < s_cwd->file_count-1; ++j)
-        s_cwd->files[j] = s_cwd->files[j+1];
-    s_cwd->file_count--;
-    return FS_OK;
+int fs_delete(const char* name) {
+    TRACE_BEGIN(TP_FS_DELETE, 0);
+    rcu_poll();
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = delete_locked(name);
+    spin_unlock_irqrestore(&ns_lock, f);
+    TRACE_END(TP_FS_DELETE, r);
+    return r;
 }
 
-int fs_write(const char* name, const char* data) {
-    struct File* f = fs_find(name);
+/* lookup and write under ns_lock, so a rename cannot move the file to a
+   new slot while the old one is being written */
+static int write_locked(const char* name, const char* data, int append) {
+    if (!name) return FS_ERR_INVALID;
+    struct File* f = file_find(s_cwd->list, name);
     if (!f) return FS_ERR_NOTFOUND;
     if (f->readonly) return FS_ERR_RDONLY;
     if (!data) return FS_ERR_INVALID;
 
-    int len = kstrlen(data);
-    if (len >= MAX_CONTENT) len = MAX_CONTENT - 1;
-    kstrncpy(f->content, data, MAX_CONTENT);
-    f->content[len] = '\0';
-    f->length = len;
-    return len;
+    if (!append) file_set_length(f, 0);
+    return file_write_at(f, data, kstrlen(data), append ? f->length : 0);
+}
+
+int fs_write(const char* name, const char* data) {
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = write_locked(name, data, 0);
+    spin_unlock_irqrestore(&ns_lock, f);
+    return r;
 }
 
 int fs_append(const char* name, const char* data) {
-    struct File* f = fs_find(name);
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = write_locked(name, data, 1);
+    spin_unlock_irqrestore(&ns_lock, f);
+    return r;
+}
+
+static int rename_locked(const char* from, const char* to) {
+    const struct DirList* cur = s_cwd->list;
+    struct File* src = file_find(cur, from);
+    if (!src) return FS_ERR_NOTFOUND;
+    if (src->readonly) return FS_ERR_RDONLY;
+    if (kstrcmp(from, to) == 0) return FS_OK;
+
+    struct File* dst = file_find(cur, to);
+    if (!dst) {
+        /* readers may be comparing src's name: the file moves to a new
+           slot under the new name and the old slot is retired */
+        if (!ns_room()) return FS_ERR_NOSPACE;
+        struct File* nf = slot_alloc(s_cwd);
+        if (!nf) return FS_ERR_NOSPACE;
+        *nf = *src;
+        kstrncpy(nf->name, to, MAX_FILENAME);
+        file_touch(nf);
+        for (int i = 0; i < FS_MAX_OPEN; ++i)
+            if (s_open[i].used && s_open[i].f == src) s_open[i].f = nf;
+        struct DirList* nl = list_copy(s_cwd);
+        for (int i = 0; i < nl->file_count; ++i)
+            if (nl->files[i] == src) nl->files[i] = nf;
+        list_publish(s_cwd, nl);
+        rcu_retire(src, slot_free);
+        return FS_OK;
+    }
+    if (dst->readonly) return FS_ERR_RDONLY;
+    /* checked before anything moves: delete_locked() below must not fail */
+    if (!ns_room()) return FS_ERR_NOSPACE;
+
+    /* dst keeps its slot and takes over src's blocks, so descriptors on
+       either name end up on dst; then the emptied src entry is dropped */
+    file_release_from(dst, 0);
+    for (int i = 0; i < FS_DIRECT_BLOCKS; ++i) dst->blocks[i] = src->blocks[i];
+    dst->indirect = src->indirect;
+    dst->length   = src->length;
+    dst->type     = src->type;
+    file_touch(dst);
+    for (int i = 0; i < FS_MAX_OPEN; ++i)
+        if (s_open[i].used && s_open[i].f == src) s_open[i].f = dst;
+    file_init(src);
+    return delete_locked(from);
+}
+
+int fs_rename(const char* from, const char* to) {
+    if (!from || name_invalid(to)) return FS_ERR_INVALID;
+    TRACE_BEGIN(TP_FS_RENAME, 0);
+    rcu_poll();
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = rename_locked(from, to);
+    spin_unlock_irqrestore(&ns_lock, f);
+    TRACE_END(TP_FS_RENAME, r);
+    return r;
+}
+
+int fs_free_blocks(void) {
+    return s_free_count;
+}
+
+/* -------- Descriptor I/O -------- */
+/* A rename re-points of->f under ns_lock and retires the old slot, so
+   descriptor I/O reads of->f and uses it with the lock held. */
+/* lookup and install under ns_lock: a rename in between would miss the
+   new descriptor when it moves the file's slot */
+static int open_locked(const char* name, int flags) {
+    if (!name) return FS_ERR_INVALID;
+    struct File* f = file_find(s_cwd->list, name);
     if (!f) return FS_ERR_NOTFOUND;
-    if (f->readonly) return FS_ERR_RDONLY;
-    if (!data) return FS_ERR_INVALID;
+    if ((flags & FS_O_ACCMODE) == FS_O_ACCMODE) return FS_ERR_INVALID;
+    if ((flags & FS_O_ACCMODE) != FS_O_RDONLY && f->readonly) return FS_ERR_RDONLY;
+
+    int fd = -1;
+    for (int i = 0; i < FS_MAX_OPEN; ++i) if (!s_open[i].used) { fd = i; break; }
+    if (fd < 0) return FS_ERR_NFILE;
+
+    s_open[fd].f     = f;
+    s_open[fd].off   = 0;
+    s_open[fd].flags = flags;
+    s_open[fd].used  = 1;
+    if ((flags & FS_O_TRUNC) && fd_writable(&s_open[fd])) file_set_length(f, 0);
+    return fd;
+}
+
+int fs_open(const char* name, int flags) {
+    TRACE_BEGIN(TP_FS_OPEN, flags);
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int fd = open_locked(name, flags);
+    spin_unlock_irqrestore(&ns_lock, f);
+    TRACE_END(TP_FS_OPEN, fd);
+    return fd;
+}
+
+int fs_read(int fd, char* buf, int n) {
+    struct OpenFile* of = fd_get(fd);
+    if (!of) return FS_ERR_BADF;
+    if (!buf || n < 0) return FS_ERR_INVALID;
+
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = of->f ? file_read_at(of->f, buf, n, of->off) : FS_ERR_BADF;
+    if (r > 0) of->off += r;
+    spin_unlock_irqrestore(&ns_lock, f);
+    return r;
+}
+
+int fs_pread(int fd, char* buf, int n, int off) {
+    struct OpenFile* of = fd_get(fd);
+    if (!of) return FS_ERR_BADF;
+    if (!buf) return FS_ERR_INVALID;
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = of->f ? file_read_at(of->f, buf, n, off) : FS_ERR_BADF;
+    spin_unlock_irqrestore(&ns_lock, f);
+    return r;
+}
 
-    int old = f->length;
-    int add = kstrlen(data);
-    if (old + add >= MAX_CONTENT) add = MAX_CONTENT - 1 - old;
+int fs_pwrite(int fd, const char* buf, int n, int off) {
+    struct OpenFile* of = fd_get(fd);
+    if (!of) return FS_ERR_BADF;
+    if (!fd_writable(of)) return FS_ERR_RDONLY;
+    if (!buf) return FS_ERR_INVALID;
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = FS_ERR_BADF;
+    if (of->f) {
+        if (of->flags & FS_O_APPEND) off = of->f->length;
+        r = file_write_at(of->f, buf, n, off);
+    }
+    spin_unlock_irqrestore(&ns_lock, f);
+    return r;
+}
 
-    for (int i = 0; i < add; ++i) f->content[old + i] = data[i];
-    f->content[old + add] = '\0';
-    f->length = old + add;
-    return add;
+int fs_seek(int fd, int off, int whence) {
+    struct OpenFile* of = fd_get(fd);
+    if (!of) return FS_ERR_BADF;
+
+    int base;
+    if (whence == FS_SEEK_SET) base = 0;
+    else if (whence == FS_SEEK_CUR) base = of->off;
+    else if (whence == FS_SEEK_END) {
+        u32 f = spin_lock_irqsave(&ns_lock);
+        base = of->f ? of->f->length : FS_ERR_BADF;
+        spin_unlock_irqrestore(&ns_lock, f);
+        if (base < 0) return base;
+    }
+    else return FS_ERR_INVALID;
+
+    int pos = base + off;
+    if (pos < 0 || pos > FS_MAX_FILE_SIZE) return FS_ERR_INVALID;
+    of->off = pos;
+    return pos;
+}
+
+int fs_truncate(int fd, int len) {
+    struct OpenFile* of = fd_get(fd);
+    if (!of) return FS_ERR_BADF;
+    if (!fd_writable(of)) return FS_ERR_RDONLY;
+    u32 f = spin_lock_irqsave(&ns_lock);
+    int r = of->f ? file_set_length(of->f, len) : FS_ERR_BADF;
+    spin_unlock_irqrestore(&ns_lock, f);
+    return r;
+}
+
+int fs_close(int fd) {
+    struct OpenFile* of = fd_get(fd);
+    if (!of) return FS_ERR_BADF;
+    u32 f = spin_lock_irqsave(&ns_lock);
+    of->used = 0;
+    of->f = 0;
+    spin_unlock_irqrestore(&ns_lock, f);
+    return FS_OK;
 }
 
 /* Both counts (helpful for UI) */
 void fs_list_counts(int* out_dirs, int* out_files) {
-    if (out_dirs)  *out_dirs  = s_cwd->subdir_count;
-    if (out_files) *out_files = s_cwd->file_count;
+    rcu_read_lock();
+    const struct DirList* l = fs_dir_list(s_cwd);
+    if (out_dirs)  *out_dirs  = l->subdir_count;
+    if (out_files) *out_files = l->file_count;
+    rcu_read_unlock();
 }
@@ -0,0 +1,143 @@
+#include "../include/history.h"
+#include "../include/fs.h"
+#include "../include/util.h"
+
+static char arena[HIST_ARENA];
+static int  arena_used = 0;
+static int  offset[HIST_MAX];   /* of entry first + i */
+static u64  sig[HIST_MAX];
+static int  count = 0;
+static int  first = 0;
+static int  file_bytes = 0;     /* HIST_FILE length, compacted past 2 * HIST_ARENA */
+
+/* -------- Signatures -------- */
+static int tri_bit(const char* s) {
+    u32 h = ((u32)(u8)s[0] << 16 | (u32)(u8)s[1] << 8 | (u8)s[2]) * 2654435761u;
+    return (int)(h >> 26);
+}
+
+static u64 signature(const char* s, int n) {
+    u64 m = 0;
+    for (int i = 0; i + 3 <= n; ++i) m |= (u64)1 << tri_bit(s + i);
+    return m;
+}
+
+static int contains(const char* s, const char* q, int n) {
+    for (; *s; ++s)
+        if (*s == q[0] && kstrncmp(s, q, n) == 0) return 1;
+    return 0;
+}
+
+/* -------- Storage -------- */
+/* forget the oldest quarter of the entries */
+static void drop_oldest(void) {
+    int k = (count + 3) / 4;
+    int base = (k < count) ? offset[k] : arena_used;
+    kmemmove(arena, arena + base, arena_used - base);
+    arena_used -= base;
+    for (int i = k; i < count; ++i) {
+        offset[i - k] = offset[i] - base;
+        sig[i - k] = sig[i];
+    }
+    count -= k;
+    first += k;
+}
+
+static int store(const char* cmd, int n) {
+    if (n >= HIST_LINE_MAX) n = HIST_LINE_MAX - 1;
+    const char* last = count ? arena + offset[count - 1] : 0;
+    if (last && kstrncmp(last, cmd, n) == 0 && last[n] == '\0') return 0;
+    while (count == HIST_MAX || arena_used + n + 1 > HIST_ARENA) drop_oldest();
+    offset[count] = arena_used;
+    sig[count] = signature(cmd, n);
+    kmemcpy(arena + arena_used, cmd, n);
+    arena[arena_used + n] = '\0';
+    arena_used += n + 1;
+    count++;
+    return 1;
+}
+
+/* -------- File -------- */
+/* HIST_FILE in the root, whatever the CWD; -> fd or FS_ERR_* */
+static int file_open(int flags) {
+    struct Dir* here = fs_cwd();
+    fs_set_cwd(fs_root());
+    if ((flags & FS_O_ACCMODE) != FS_O_RDONLY && !fs_find(HIST_FILE)) fs_create(HIST_FILE, FILE_TEXT);
+    int fd = fs_open(HIST_FILE, flags);
+    fs_set_cwd(here);
+    return fd;
+}
+
+/* rewrite the file with just the entries kept */
+static void file_compact(void) {
+    int fd = file_open(FS_O_WRONLY | FS_O_TRUNC);
+    if (fd < 0) return;
+    file_bytes = 0;
+    for (int i = 0; i < count; ++i) {
+        const char* s = arena + offset[i];
+        int n = kstrlen(s);
+        char nl = '\n';
+        fs_pwrite(fd, s, n, file_bytes);
+        fs_pwrite(fd, &nl, 1, file_bytes + n);
+        file_bytes += n + 1;
+    }
+    fs_close(fd);
+}
+
+void history_init(void) {
+    arena_used = count = first = file_bytes = 0;
+    int fd = file_open(FS_O_RDONLY);
+    if (fd < 0) return;
+    char chunk[512], line[HIST_LINE_MAX];
+    int n, len = 0;
+    while ((n = fs_read(fd, chunk, sizeof(chunk))) > 0) {
+        file_bytes += n;
+        for (int i = 0; i < n; ++i) {
+            if (chunk[i] != '\n') {
+                if (len < HIST_LINE_MAX - 1) line[len++] = chunk[i];
+                continue;
+            }
+            if (len) store(line, len);
+            len = 0;
+        }
+    }
+    if (len) store(line, len);
+    fs_close(fd);
+    if (file_bytes > 2 * HIST_ARENA) file_compact();
+}
+
+void history_add(const char* cmd) {
+    int n = kstrlen(cmd);
+    if (n == 0 || !store(cmd, n)) return;
+    if (file_bytes > 2 * HIST_ARENA) {
+        file_compact();
+        return;
+    }
+    int fd = file_open(FS_O_WRONLY | FS_O_APPEND);
+    if (fd < 0) return;
+    const char* s = arena + offset[count - 1];
+    n = kstrlen(s);
+    char nl = '\n';
+    if (fs_pwrite(fd, s, n, 0) == n && fs_pwrite(fd, &nl, 1, 0) == 1) file_bytes += n + 1;
+    fs_close(fd);
+}
+
+int history_first(void) { return first; }
+int history_end(void)   { return first + count; }
+
+const char* history_get(int id) {
+    if (id < first || id >= first + count) return 0;
+    return arena + offset[id - first];
+}
+
+int history_search(const char* q, int n, int before) {
+    if (n <= 0) return -1;
+    u64 want = signature(q, n);
+    int i = before - first;
+    if (i > count) i = count;
+    while (--i >= 0) {
+        if ((sig[i] & want) != want) continue;
+        if (contains(arena + offset[i], q, n)) return first + i;
+    }
+    return -1;
+}
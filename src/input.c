@@ -1,5 +1,7 @@
 #include "../include/input.h"
 #include "../include/common.h"
+#include "../include/spinlock.h"
+#include "../include/trace.h"
 
 static inline u8 inb(u16 port) {
     u8 val;
@@ -7,12 +9,25 @@ static inline u8 inb(u16 port) {
     return val;
 }
 
+/* run while spinning for a scancode, so background work keeps moving */
+static void (*idle_cb)(void) = 0;
+
+void input_set_idle_callback(void (*cb)(void)) { idle_cb = cb; }
+
+int key_pending(void) {
+    return (inb(0x64) & 0x21) == 0x01;   /* output full, not from the mouse */
+}
+
  u8 kb_read_scancode(void) {
-    while (!(inb(0x64) & 1)) { /* spin */ }
+    while (!(inb(0x64) & 1)) {
+        if (idle_cb) idle_cb();
+    }
     return inb(0x60);
 }
 
-/* Keyboard state tracking */
+/* Keyboard state tracking. Decoding changes it under kb_lock; the
+   is_*() helpers read one byte and need no lock. */
+static struct Spinlock kb_lock = SPINLOCK_INIT("kbd");
 static struct {
     u8 shift_pressed : 1;
     u8 ctrl_pressed : 1;
@@ -57,13 +72,18 @@ static const char scancode_map_upper[128] = {
 #define SC_CAPS_LOCK 0x3A
 #define SC_SPACE     0x39
 
-/* Enhanced read_key function with full modifier support */
-int read_key(void) {
-    u8 sc = kb_read_scancode();
-    
+/* One scancode in, full modifier support; the byte after an 0xE0 prefix
+   is decoded on the next call */
+static u8 e0_prefix = 0;
+
+static int decode(u8 sc) {
     /* Handle extended scancodes (0xE0 prefix) */
     if (sc == 0xE0) {
-        sc = kb_read_scancode();
+        e0_prefix = 1;
+        return -1;
+    }
+    if (e0_prefix) {
+        e0_prefix = 0;
         /* if release, high bit will be set (e.g., 0xC8 for released Up Arrow) */
         if (sc & 0x80) {
             u8 sc_rel = sc & 0x7F;
@@ -191,6 +211,28 @@ int read_key(void) {
     return 0;
 }
 
+int key_decode(u8 sc) {
+    u32 f = spin_lock_irqsave(&kb_lock);
+    int k = decode(sc);
+    spin_unlock_irqrestore(&kb_lock, f);
+    if (k > 0) TRACE_MARK(TP_KEY, k);
+    return k;
+}
+
+int read_key(void) {
+    int k;
+    do {
+        k = key_decode(kb_read_scancode());
+    } while (k < 0);
+    return k;
+}
+
+int poll_key(void) {
+    if (!key_pending()) return 0;
+    int k = key_decode(inb(0x60));
+    return (k > 0) ? k : 0;
+}
+
 /* Helper functions to check modifier states */
 int is_shift_pressed(void) {
     return kb_state.shift_pressed;
@@ -9,23 +9,43 @@
 #include "../include/editor.h"
 #include "../include/game_snake.h"
 #include "../include/mouse.h"
+#include "../include/blk.h"
+#include "../include/ramdisk.h"
+#include "../include/event.h"
+#include "../include/cpu.h"
+#include "../include/thread.h"
+#include "../include/smp.h"
+#include "../include/paging.h"
+#include "../include/serial.h"
+#include "../include/klog.h"
+#include "../include/trace.h"
 
 enum { MODE_BROWSER = 0, MODE_EDITOR = 1, MODE_GAME = 2 };
 static int current_mode = MODE_BROWSER;
 
+#define SNAKE_TICKS 12   /* timer events per snake step */
+
 /* Mouse cursor state */
 static char saved_char = ' ';
 static unsigned char saved_attr = 0x07;
 static int last_mouse_x = -1, last_mouse_y = -1;
 
+/* Take the cursor off the screen, putting back the cell under it */
+static void hide_mouse_cursor(void) {
+    if (last_mouse_x >= 0 && last_mouse_y >= 0) {
+        vga_putcell(last_mouse_x, last_mouse_y, saved_char, saved_attr);
+    }
+    last_mouse_x = last_mouse_y = -1;
+}
+
 /* Simple mouse cursor management */
 static void update_mouse_cursor(void) {
-    mouse_state_t* mouse = get_mouse_state();
+    mouse_state_t snap;
+    mouse_get(&snap);
+    const mouse_state_t* mouse = &snap;
     
     /* Restore previous position */
-    if (last_mouse_x >= 0 && last_mouse_y >= 0) {
-        vga_putcell(last_mouse_x, last_mouse_y, saved_char, saved_attr);
-    }
+    hide_mouse_cursor();
     
     /* Save new position and draw cursor */
     if (mouse->x >= 0 && mouse->x < 80 && mouse->y >= 0 && mouse->y < 25) {
@@ -45,7 +65,9 @@ static void update_mouse_cursor(void) {
 
 /* Handle mouse clicks in different modes */
 static void handle_mouse_input(int *explorer_sel) {
-    mouse_state_t* mouse = get_mouse_state();
+    mouse_state_t snap;
+    mouse_get(&snap);
+    const mouse_state_t* mouse = &snap;
     static unsigned char prev_buttons = 0;
     
     /* Left click - different behavior per mode */
@@ -56,13 +78,13 @@ static void handle_mouse_input(int *explorer_sel) {
             if (clicked_file >= 0 && clicked_file < fs_count()) {
                 *explorer_sel = clicked_file;
                 ui_set_selected(*explorer_sel);
-                ui_draw();
+                event_request_redraw();
             }
         }
         else if (current_mode == MODE_EDITOR) {
             #ifdef EDITOR_MOUSE_SUPPORT
             editor_set_cursor_pos(mouse->x, mouse->y);
-            editor_draw();
+            event_request_redraw();
             #endif
         }
         else if (current_mode == MODE_GAME) {
@@ -82,67 +104,95 @@ static void handle_mouse_input(int *explorer_sel) {
     if ((mouse->buttons & 2) && !(prev_buttons & 2)) {
         if (current_mode == MODE_BROWSER && mouse->x >= 40) {
             ui_scroll_viewer(mouse->y < 12 ? -1 : 1);
-            ui_draw();
+            event_request_redraw();
         }
     }
     
     prev_buttons = mouse->buttons;
 }
 
+/* Background work, run whenever input is being waited on */
+static void kernel_idle(void) {
+    blk_poll();
+    klog_drain();
+    if (current_mode == MODE_EDITOR) editor_idle();
+}
+
+static void draw_screen(void) {
+    hide_mouse_cursor();
+    if (current_mode == MODE_BROWSER) shell_draw();
+    else if (current_mode == MODE_EDITOR) editor_draw();
+    else snake_draw();
+    update_mouse_cursor();
+}
+
+static void handle_key(int k, int* explorer_sel) {
+    if (current_mode == MODE_BROWSER) {
+        *explorer_sel = shell_handle_key(k, *explorer_sel, &current_mode);
+    } else if (current_mode == MODE_EDITOR) {
+        /* the editor handles ESC itself: it cancels a prompt first */
+        editor_handle_key(k, &current_mode);
+        event_request_redraw();
+    } else if (current_mode == MODE_GAME) {
+        if (k == K_ESC) current_mode = MODE_BROWSER;
+        else snake_handle_key(k);
+        event_request_redraw();
+    }
+}
+
 void kernel_main(void) {
+    cpu_init();
+    if (paging_init() < 0) klog(KLOG_WARN, "paging: no 4 MiB pages, running unpaged");
+    if (serial_init()) klog(KLOG_INFO, "serial: COM1 at %d baud", SERIAL_BAUD);
     init_filesystem();
+    shell_init();
     init_mouse();
+    ramdisk_init();
+    thread_init();
+    event_init();
+    klog(KLOG_INFO, "smp: %d CPUs online", smp_init());
+    input_set_idle_callback(kernel_idle);
     ui_draw();
 
     int explorer_sel = ui_get_selected();
-    int game_timer = 0;
-    const int game_speed = 15;
+    int game_ticks = 0;
 
+    /* Every screen reacts to one event and returns; nothing waits for
+       input anywhere else, so the mouse, the game clock and background
+       work keep going whichever screen is up. */
     while (1) {
-        int k = read_key();
-        
-        /* Update mouse cursor */
-        update_mouse_cursor();
-        
-        /* Handle mouse input */
-        handle_mouse_input(&explorer_sel);
-
-        /* Handle keyboard input by mode */
-        if (current_mode == MODE_BROWSER) {
-            explorer_sel = shell_loop(explorer_sel, &current_mode);
-
-        } else if (current_mode == MODE_EDITOR) {
-            if (k == K_ESC) {
-                current_mode = MODE_BROWSER;
-                ui_draw();
-            } else if (k != 0) {
-                editor_handle_key(k, &current_mode);
-                if (current_mode == MODE_BROWSER) {
-                    ui_draw();
-                } else {
-                    editor_draw();
-                }
-            }
-
-        } else if (current_mode == MODE_GAME) {
-            if (k == K_ESC) { 
-                current_mode = MODE_BROWSER; 
-                ui_draw(); 
-                continue; 
-            }
-            if (k != 0) snake_handle_key(k);
-
-            game_timer++;
-            if (game_timer >= game_speed) { 
-                snake_update(); 
-                snake_draw(); 
-                game_timer = 0; 
-            }
+        struct Event ev;
+        if (!event_next(&ev)) {
+            kernel_idle();
+            event_wait();
+            continue;
         }
-
-        /* Small delay */
-        for (volatile int i = 0; i < 10000; ++i) { 
-            asm volatile("nop"); 
+        TRACE_BEGIN(TP_EVENT, ev.type);
+        switch (ev.type) {
+        case EV_KEY:
+            handle_key(ev.code, &explorer_sel);
+            break;
+        case EV_SERIAL:
+            explorer_sel = shell_serial_char(ev.code, explorer_sel, &current_mode);
+            break;
+        case EV_MOUSE:
+            update_mouse_cursor();
+            handle_mouse_input(&explorer_sel);
+            break;
+        case EV_TIMER:
+            if (current_mode != MODE_GAME) break;
+            game_ticks += ev.code;
+            if (game_ticks >= SNAKE_TICKS) {
+                snake_update();
+                event_request_redraw();
+                game_ticks = 0;
+            }
+            break;
+        case EV_REDRAW:
+            draw_screen();
+            break;
         }
+        TRACE_END(TP_EVENT, ev.type);
+        event_done(&ev);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,160 @@
+#include "../include/klog.h"
+#include "../include/cpu.h"
+#include "../include/thread.h"
+#include "../include/serial.h"
+#include "../include/util.h"
+#include <stdarg.h>
+
+static struct KlogRecord ring[KLOG_RING];
+static volatile u32 head = 0;   /* seq of the next record to claim */
+static u32 drained = 0;         /* seq of the next record to send; idle thread only */
+static u32 drained_count = 0, lost = 0;
+
+static const char* level_names[] = { "err", "warn", "info", "debug" };
+
+static inline void barrier(void) {
+    __asm__ volatile ("" : : : "memory");   /* x86 keeps stores, and loads, in order */
+}
+
+void klog(int level, const char* fmt, ...) {
+    u32 seq = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    struct KlogRecord* r = &ring[seq % KLOG_RING];
+    r->stamp = 2 * seq + 1;
+    barrier();
+    r->ticks = thread_ticks();
+    r->fmt = fmt;
+    r->level = (u8)level;
+    r->cpu = (u8)cpu_id();
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = 0, t = 0;
+    for (const char* p = fmt; *p && n < KLOG_ARGS; ++p) {
+        if (*p != '%') continue;
+        char c = *++p;
+        if (c == 's') {
+            const char* s = va_arg(ap, const char*);
+            r->args[n++] = (u32)(t < KLOG_TEXT ? t : KLOG_TEXT - 1);
+            while (*s && t < KLOG_TEXT - 1) r->text[t++] = *s++;
+            if (t < KLOG_TEXT) r->text[t++] = '\0';
+        } else if (c == 'd' || c == 'u' || c == 'x' || c == 'c') {
+            r->args[n++] = va_arg(ap, u32);
+        } else if (c == '\0') {
+            break;
+        }
+    }
+    va_end(ap);
+    r->text_len = (u8)t;
+    barrier();
+    r->stamp = 2 * seq + 2;
+}
+
+u32 klog_head(void) {
+    return head;
+}
+
+int klog_read(u32 seq, struct KlogRecord* out) {
+    const struct KlogRecord* r = &ring[seq % KLOG_RING];
+    u32 want = 2 * seq + 2;
+    u32 s = r->stamp;
+    if (s != want) return ((s32)(s - want) > 0) ? -1 : 0;
+    barrier();
+    kmemcpy(out, (const void*)r, sizeof(*out));
+    barrier();
+    return (r->stamp == want) ? 1 : -1;   /* overwritten while copied */
+}
+
+static int put_str(char* out, int p, int max, const char* s) {
+    while (*s && p < max) out[p++] = *s++;
+    return p;
+}
+
+static int put_hex(char* out, int p, int max, u32 v) {
+    int shift = 28;
+    while (shift > 0 && !(v >> shift)) shift -= 4;
+    for (; shift >= 0 && p < max; shift -= 4) out[p++] = "0123456789abcdef"[(v >> shift) & 15];
+    return p;
+}
+
+int klog_format(const struct KlogRecord* r, char* out, int max) {
+    char num[12];
+    int p = 0, n = 0;
+    /* "[   12.345] cpu0 err: " */
+    int len = kutoa(num, r->ticks / THREAD_HZ);
+    p = put_str(out, p, max, "[");
+    for (; len < 5; ++len) p = put_str(out, p, max, " ");
+    p = put_str(out, p, max, num);
+    kutoa(num, 1000 + (r->ticks % THREAD_HZ) * 1000 / THREAD_HZ);   /* keeps the leading zeros */
+    p = put_str(out, p, max, ".");
+    p = put_str(out, p, max, num + 1);
+    p = put_str(out, p, max, "] cpu");
+    kutoa(num, r->cpu);
+    p = put_str(out, p, max, num);
+    p = put_str(out, p, max, " ");
+    p = put_str(out, p, max, level_names[r->level & 3]);
+    p = put_str(out, p, max, ": ");
+
+    for (const char* f = r->fmt; *f && p < max; ++f) {
+        if (*f != '%') {
+            out[p++] = *f;
+            continue;
+        }
+        char c = *++f;
+        if (c == '\0') break;
+        if (c == '%') {
+            out[p++] = '%';
+            continue;
+        }
+        if (n == KLOG_ARGS) {
+            out[p++] = '?';
+            continue;
+        }
+        u32 v = r->args[n++];
+        if (c == 's') {
+            p = put_str(out, p, max, r->text + (v < KLOG_TEXT ? v : KLOG_TEXT - 1));
+        } else if (c == 'c') {
+            out[p++] = (char)v;
+        } else if (c == 'x') {
+            p = put_hex(out, p, max, v);
+        } else if (c == 'd' && (s32)v < 0) {
+            kutoa(num, 0u - v);
+            p = put_str(out, put_str(out, p, max, "-"), max, num);
+        } else {
+            kutoa(num, v);
+            p = put_str(out, p, max, num);
+        }
+    }
+    return p;
+}
+
+void klog_drain(void) {
+    if (!serial_present()) return;
+    char line[KLOG_LINE + 1];
+    struct KlogRecord r;
+    u32 h = head;
+    if (h - drained > KLOG_RING) {
+        lost += h - KLOG_RING - drained;
+        drained = h - KLOG_RING;
+    }
+    while (drained != h) {
+        int k = klog_read(drained, &r);
+        if (k == 0) break;   /* still being written */
+        if (k < 0) {
+            lost++;
+            drained++;
+            continue;
+        }
+        int n = klog_format(&r, line, KLOG_LINE);
+        line[n++] = '\n';
+        if (serial_tx_room() < 2 * n) break;   /* each '\n' goes out as two bytes */
+        serial_write(line, n);
+        drained++;
+        drained_count++;
+    }
+}
+
+void klog_stats(struct KlogStats* out) {
+    out->written = head;
+    out->drained = drained_count;
+    out->lost = lost;
+}
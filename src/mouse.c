@@ -1,6 +1,8 @@
 #include "mouse.h"
+#include "spinlock.h"
 
 static mouse_state_t mouse = {0};
+static struct Seqlock mouse_seq = SEQLOCK_INIT("mouse");
 static unsigned char mouse_packet[3];
 static unsigned char packet_index = 0;
 
@@ -65,12 +67,14 @@ void init_mouse(void) {
     mouse_read();  // ACK
 
     // Initialize position
+    u32 f = seq_write_begin(&mouse_seq);
     mouse.x = 40;  // 80x25 center
     mouse.y = 12;
+    seq_write_end(&mouse_seq, f);
 }
 
 /* ---------- Mouse interrupt handler ---------- */
-void mouse_handler(void) {
+int mouse_handler(void) {
     unsigned char data = inb(0x60);
     mouse_packet[packet_index++] = data;
 
@@ -81,8 +85,9 @@ void mouse_handler(void) {
         signed char delta_x = (signed char)mouse_packet[1];
         signed char delta_y = (signed char)mouse_packet[2];
 
-        if (!(flags & 0x08)) return;  // invalid packet
+        if (!(flags & 0x08)) return 0;  // invalid packet
 
+        u32 f = seq_write_begin(&mouse_seq);
         // Update button states
         mouse.buttons = flags & 0x07;
 
@@ -98,10 +103,17 @@ void mouse_handler(void) {
         if (mouse.x >= 80) mouse.x = 79;
         if (mouse.y < 0) mouse.y = 0;
         if (mouse.y >= 25) mouse.y = 24;
+        seq_write_end(&mouse_seq, f);
+        return 1;
     }
+    return 0;
 }
 
 /* ---------- Getter for other modules ---------- */
-mouse_state_t* get_mouse_state(void) {
-    return &mouse;
+void mouse_get(mouse_state_t* out) {
+    u32 v;
+    do {
+        v = seq_read_begin(&mouse_seq);
+        *out = mouse;
+    } while (seq_read_retry(&mouse_seq, v));
 }
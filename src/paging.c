@@ -0,0 +1,241 @@
+#include "../include/paging.h"
+#include "../include/cpu.h"
+#include "../include/spinlock.h"
+#include "../include/util.h"
+
+#define PG_PRESENT 0x001
+#define PG_WRITE   0x002
+#define PG_PWT     0x008
+#define PG_PCD     0x010
+#define PG_LARGE   0x080
+#define PG_GLOBAL  0x100
+
+#define CR0_PG  0x80000000
+#define CR4_PSE 0x10
+#define CR4_PGE 0x80
+
+#define MB_MAGIC    0x2BADB002
+#define MB_MEM_INFO 0x1           /* mem_lower/mem_upper are valid */
+#define RAM_GUESS   (32u << 20)   /* without boot loader information */
+
+u32 boot_magic, boot_info;        /* eax and ebx at entry, saved by start.S */
+extern char _kernel_end[];        /* linker.ld */
+
+static u32 page_dir[1024] __attribute__((aligned(PAGE_SIZE)));
+static u32 dyn_tables[DYN_SIZE / LARGE_PAGE][1024] __attribute__((aligned(PAGE_SIZE)));
+static u32 cr4_bits = 0;
+static int enabled = 0;
+
+/* -------- Frames -------- */
+static u32 frame_map[PAGING_MAX_RAM / PAGE_SIZE / 32];   /* bit set: in use */
+static u32 ram_frames;     /* frames of usable RAM */
+static u32 kernel_frames;  /* below the end of the image, never handed out */
+static u32 used_frames;
+static u32 reserved_frames; /* promised to lazy regions, not handed out yet */
+static u32 next_frame;     /* where the search for a free one starts */
+
+static struct Spinlock pg_lock = SPINLOCK_INIT("paging");
+
+static u32 ram_size(void) {
+    u32 ram = RAM_GUESS;
+    if (boot_magic == MB_MAGIC && (*(const u32*)boot_info & MB_MEM_INFO))
+        ram = (1u << 20) + ((const u32*)boot_info)[2] * 1024;   /* mem_upper, KiB above 1 MiB */
+    return ram > PAGING_MAX_RAM ? PAGING_MAX_RAM : ram;
+}
+
+/* -> physical address, 0 if none is left; pg_lock held */
+static u32 frame_alloc(void) {
+    for (u32 n = 0; n < ram_frames - kernel_frames; ++n) {
+        u32 f = next_frame;
+        next_frame = (f + 1 < ram_frames) ? f + 1 : kernel_frames;
+        if (frame_map[f / 32] & (1u << (f % 32))) continue;
+        frame_map[f / 32] |= 1u << (f % 32);
+        used_frames++;
+        return f * PAGE_SIZE;
+    }
+    return 0;
+}
+
+/* frames neither in use nor promised; pg_lock held */
+static u32 frames_unreserved(void) {
+    return ram_frames - kernel_frames - used_frames - reserved_frames;
+}
+
+/* -------- Regions -------- */
+struct Region {
+    struct RegionInfo info;
+    u32 reserved;   /* of reserved_frames, kept for this region's first touches */
+    int used;
+};
+
+static struct Region regions[REGION_MAX];
+static u32 dyn_next = DYN_BASE;   /* regions are carved off in order */
+
+static u32* pte_of(u32 va) {
+    return &dyn_tables[(va - DYN_BASE) / LARGE_PAGE][(va / PAGE_SIZE) % 1024];
+}
+
+/* region va falls in, counting its guard page */
+static struct Region* region_at(u32 va) {
+    for (int i = 0; i < REGION_MAX; ++i) {
+        struct RegionInfo* r = &regions[i].info;
+        u32 span = r->size + ((r->flags & REGION_GUARD) ? PAGE_SIZE : 0);
+        if (regions[i].used && va - r->base < span) return &regions[i];
+    }
+    return 0;
+}
+
+/* a zeroed frame under va, from r's reservation while it lasts; pg_lock held */
+static int back_page(struct Region* r, u32 va) {
+    if (!r->reserved && frames_unreserved() == 0) return 0;
+    u32 pa = frame_alloc();
+    if (!pa) return 0;
+    if (r->reserved) {
+        r->reserved--;
+        reserved_frames--;
+    }
+    kmemset((void*)pa, 0, PAGE_SIZE);   /* RAM is identity mapped */
+    *pte_of(va) = pa | PG_PRESENT | PG_WRITE;
+    __asm__ volatile ("invlpg (%0)" : : "r"(va) : "memory");
+    r->info.pages++;
+    return 1;
+}
+
+static int page_fault(struct IrqFrame* fr) {
+    (void)fr;
+    u32 va;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(va));
+    struct Region* r = region_at(va);
+    if (!r) return 0;
+    u32 f = spin_lock_irqsave(&pg_lock);
+    int ok = 0;
+    if (va - r->info.base >= r->info.size) {
+        r->info.bad++;                               /* its guard page */
+    } else if (*pte_of(va) & PG_PRESENT) {
+        ok = 1;                                      /* another CPU was first */
+    } else if (r->info.flags & REGION_LAZY) {
+        ok = back_page(r, va & ~(PAGE_SIZE - 1));
+        r->info.faults += (u32)ok;
+    }
+    spin_unlock_irqrestore(&pg_lock, f);
+    return ok;
+}
+
+void* region_create(const char* name, u32 size, int flags) {
+    if (!enabled || size == 0) return 0;
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    u32 span = size + ((flags & REGION_GUARD) ? PAGE_SIZE : 0);
+    u32 f = spin_lock_irqsave(&pg_lock);
+    struct Region* r = 0;
+    for (int i = 0; i < REGION_MAX && !r; ++i) if (!regions[i].used) r = &regions[i];
+    u32 pages = size / PAGE_SIZE;
+    int room = r && span <= DYN_BASE + DYN_SIZE - dyn_next &&
+               ((flags & REGION_LAZY) || pages <= frames_unreserved());
+    if (!room) {
+        spin_unlock_irqrestore(&pg_lock, f);
+        return 0;
+    }
+    kmemset(&r->info, 0, sizeof(r->info));
+    kstrncpy(r->info.name, name, REGION_NAME_MAX);
+    r->info.base = dyn_next;
+    r->info.size = size;
+    r->info.flags = flags;
+    r->reserved = 0;
+    r->used = 1;
+    dyn_next += span;
+    if (!(flags & REGION_LAZY))
+        for (u32 va = r->info.base; va < r->info.base + size; va += PAGE_SIZE) back_page(r, va);
+    spin_unlock_irqrestore(&pg_lock, f);
+    return (void*)r->info.base;
+}
+
+u32 region_reserve(void* base, u32 pages) {
+    u32 f = spin_lock_irqsave(&pg_lock);
+    struct Region* r = region_at((u32)base);
+    u32 got = 0;
+    if (r && (r->info.flags & REGION_LAZY)) {
+        u32 unbacked = r->info.size / PAGE_SIZE - r->info.pages - r->reserved;
+        got = (pages < unbacked) ? pages : unbacked;
+        /* short of RAM: take half of what is left, the rest stays for others */
+        if (got > frames_unreserved()) got = frames_unreserved() / 2;
+        r->reserved += got;
+        reserved_frames += got;
+    }
+    spin_unlock_irqrestore(&pg_lock, f);
+    return got;
+}
+
+int region_info(int i, struct RegionInfo* out) {
+    if (i < 0 || i >= REGION_MAX || !regions[i].used) return 0;
+    u32 f = spin_lock_irqsave(&pg_lock);
+    *out = regions[i].info;
+    spin_unlock_irqrestore(&pg_lock, f);
+    return 1;
+}
+
+/* -------- Setup -------- */
+static void paging_load(void) {
+    u32 cr;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr));
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(cr | cr4_bits));
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(page_dir) : "memory");
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(cr));
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(cr | CR0_PG) : "memory");
+}
+
+int paging_init(void) {
+    u32 a, b, c, d;
+    __asm__ volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1));
+    if (!(d & (1u << 3))) return PAGING_ERR_OFF;   /* PSE */
+    cr4_bits = CR4_PSE | ((d & (1u << 13)) ? CR4_PGE : 0);
+    u32 global = (cr4_bits & CR4_PGE) ? PG_GLOBAL : 0;
+
+    u32 ram = ram_size();
+    u32 kend = ((u32)_kernel_end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    if (ram < kend) ram = kend;
+    /* the last large page may run past RAM: such addresses are never used */
+    for (u32 pa = 0; pa < ram; pa += LARGE_PAGE)
+        page_dir[pa / LARGE_PAGE] = pa | PG_PRESENT | PG_WRITE | PG_LARGE | global;
+    for (u32 i = 0; i < DYN_SIZE / LARGE_PAGE; ++i)
+        page_dir[DYN_BASE / LARGE_PAGE + i] = (u32)dyn_tables[i] | PG_PRESENT | PG_WRITE;
+
+    ram_frames = ram / PAGE_SIZE;
+    kernel_frames = kend / PAGE_SIZE;
+    next_frame = kernel_frames;
+    used_frames = 0;
+    reserved_frames = 0;
+
+    page_fault_hook = page_fault;
+    paging_load();
+    enabled = 1;
+    return PAGING_OK;
+}
+
+void paging_init_ap(void) {
+    if (enabled) paging_load();
+}
+
+int paging_map_mmio(u32 phys, u32 size) {
+    if (!enabled) return PAGING_OK;   /* nothing to map without paging */
+    u32 f = spin_lock_irqsave(&pg_lock);
+    int r = PAGING_OK;
+    for (u32 pa = phys & ~(LARGE_PAGE - 1); pa - phys < size || pa < phys; pa += LARGE_PAGE) {
+        u32* pde = &page_dir[pa / LARGE_PAGE];
+        if (pa >= DYN_BASE && pa < DYN_BASE + DYN_SIZE) { r = PAGING_ERR_NOMEM; break; }
+        if (!(*pde & PG_PRESENT)) *pde = pa | PG_PRESENT | PG_WRITE | PG_LARGE | PG_PCD | PG_PWT;
+        __asm__ volatile ("invlpg (%0)" : : "r"(pa) : "memory");
+        if (pa + LARGE_PAGE == 0) break;   /* top of the address space */
+    }
+    spin_unlock_irqrestore(&pg_lock, f);
+    return r;
+}
+
+void paging_frame_stats(struct FrameStats* out) {
+    u32 f = spin_lock_irqsave(&pg_lock);
+    out->total = ram_frames;
+    out->kernel = kernel_frames;
+    out->used = used_frames;
+    out->reserved = reserved_frames;
+    out->free = frames_unreserved();
+    spin_unlock_irqrestore(&pg_lock, f);
+}
@@ -0,0 +1,105 @@
+#include "../include/pool.h"
+#include "../include/spinlock.h"
+
+struct PoolTask {
+    pool_fn fn;
+    void* arg;
+    int lo, hi;
+    volatile int* pending;
+};
+
+struct Deque {
+    struct Spinlock lock;
+    u32 top, bottom;             /* tasks are [top, bottom), indices wrap */
+    struct PoolTask tasks[POOL_DEQUE];
+    struct PoolStats stats;
+} __attribute__((aligned(64)));  /* no false sharing between CPUs */
+
+static struct Deque deques[SMP_MAX_CPUS] = {
+    [0 ... SMP_MAX_CPUS - 1] = { .lock = SPINLOCK_INIT("pool") }
+};
+static volatile int pool_cpus = 0;   /* CPUs below this index take part */
+
+static int push(struct Deque* d, const struct PoolTask* t) {
+    u32 f = spin_lock_irqsave(&d->lock);
+    int ok = d->bottom - d->top < POOL_DEQUE;
+    if (ok) d->tasks[d->bottom++ % POOL_DEQUE] = *t;
+    spin_unlock_irqrestore(&d->lock, f);
+    return ok;
+}
+
+/* from the bottom for the owner, from the top for a thief */
+static int take(struct Deque* d, struct PoolTask* t, int steal) {
+    u32 f = spin_lock_irqsave(&d->lock);
+    int ok = d->bottom != d->top;
+    if (ok) *t = steal ? d->tasks[d->top++ % POOL_DEQUE] : d->tasks[--d->bottom % POOL_DEQUE];
+    spin_unlock_irqrestore(&d->lock, f);
+    return ok;
+}
+
+static void execute(int cpu, const struct PoolTask* t, int stolen) {
+    t->fn(t->arg, t->lo, t->hi);
+    deques[cpu].stats.executed++;
+    deques[cpu].stats.stolen += (u32)stolen;
+    __atomic_sub_fetch(t->pending, 1, __ATOMIC_RELEASE);
+}
+
+/* one task of our own or, failing that, one stolen; -> 0 if none anywhere */
+static int run_one(int cpu) {
+    struct PoolTask t;
+    if (take(&deques[cpu], &t, 0)) { execute(cpu, &t, 0); return 1; }
+    int n = pool_cpus;
+    for (int i = 1; i < n; ++i) {
+        int victim = (cpu + i) % n;
+        if (take(&deques[victim], &t, 1)) { execute(cpu, &t, 1); return 1; }
+    }
+    return 0;
+}
+
+void pool_spawn(pool_fn fn, void* arg, int lo, int hi, volatile int* pending) {
+    struct PoolTask t = { fn, arg, lo, hi, pending };
+    int cpu = smp_cpu();
+    __atomic_add_fetch(pending, 1, __ATOMIC_RELAXED);
+    if (!push(&deques[cpu], &t)) execute(cpu, &t, 0);
+}
+
+void pool_wait(volatile int* pending) {
+    int cpu = smp_cpu();
+    while (__atomic_load_n(pending, __ATOMIC_ACQUIRE) > 0)
+        if (!run_one(cpu)) __asm__ volatile ("pause");
+}
+
+int pool_run(pool_fn fn, void* arg, int lo, int hi, int cpus) {
+    if (cpus < 1) cpus = 1;
+    if (cpus > SMP_MAX_CPUS) cpus = SMP_MAX_CPUS;
+    int taking = 0;
+    for (int i = 0; i < cpus; ++i) {
+        const struct Cpu* c = smp_get(i);
+        taking += (c && c->online);
+    }
+    volatile int pending = 0;
+    pool_cpus = cpus;
+    smp_wake_all();
+    pool_spawn(fn, arg, lo, hi, &pending);
+    pool_wait(&pending);
+    pool_cpus = 0;
+    return taking ? taking : 1;
+}
+
+void pool_worker(int cpu) {
+    for (;;) {
+        if (cpu < pool_cpus) {
+            if (!run_one(cpu)) __asm__ volatile ("pause");
+            continue;
+        }
+        /* sti only takes effect after hlt starts, so a wake-up IPI sent
+           once pool_cpus was checked still gets us out */
+        __asm__ volatile ("cli");
+        if (cpu >= pool_cpus) __asm__ volatile ("sti; hlt" ::: "memory");
+        else __asm__ volatile ("sti");
+    }
+}
+
+void pool_stats(int cpu, struct PoolStats* out) {
+    *out = deques[cpu].stats;
+}
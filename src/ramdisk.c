@@ -0,0 +1,48 @@
+#include "../include/ramdisk.h"
+#include "../include/blk.h"
+#include "../include/util.h"
+
+/* Memory-backed block device. It behaves like a real controller: start()
+   only latches the transfer and each poll moves a bounded number of
+   sectors, so a large merged transfer completes over several polls. */
+
+static char rd_data[RAMDISK_SECTORS * BLK_SECTOR_SIZE];
+
+static struct blk_xfer rd_cur;
+static struct blk_request* rd_rq;  /* request being copied, 0 = idle */
+static u32 rd_rq_done;             /* sectors of rd_rq already copied */
+
+static int rd_start(int dev, const struct blk_xfer* x) {
+    (void)dev;
+    rd_cur = *x;
+    rd_rq = x->head;
+    rd_rq_done = 0;
+    return BLK_OK;
+}
+
+static void rd_poll(int dev) {
+    if (!rd_rq) return;
+
+    u32 budget = RAMDISK_SECTORS_PER_POLL;
+    while (rd_rq && budget) {
+        u32 n = rd_rq->count - rd_rq_done;
+        if (n > budget) n = budget;
+        char* disk = rd_data + (rd_rq->lba + rd_rq_done) * BLK_SECTOR_SIZE;
+        char* mem  = rd_rq->buf + rd_rq_done * BLK_SECTOR_SIZE;
+        if (rd_cur.dir == BLK_READ) kmemcpy(mem, disk, n * BLK_SECTOR_SIZE);
+        else                        kmemcpy(disk, mem, n * BLK_SECTOR_SIZE);
+        rd_rq_done += n;
+        budget -= n;
+        if (rd_rq_done == rd_rq->count) {
+            rd_rq = rd_rq->next;
+            rd_rq_done = 0;
+        }
+    }
+    if (!rd_rq) blk_complete(dev, BLK_OK);
+}
+
+static const struct blk_ops rd_ops = { rd_start, rd_poll };
+
+int ramdisk_init(void) {
+    return blk_register("ram0", RAMDISK_SECTORS, &rd_ops);
+}
@@ -0,0 +1,123 @@
+#include "../include/rcu.h"
+#include "../include/spinlock.h"
+#include "../include/smp.h"
+#include "../include/thread.h"
+
+struct Retired {
+    void* obj;
+    rcu_free_fn fn;
+    u32 gp;                  /* freed once grace period gp is done */
+};
+
+#define GP_IDLE     0
+#define GP_STARTING 1        /* claimed, other CPUs being synced */
+#define GP_WAITING  2        /* waiting for every CPU to go quiet */
+
+static struct Spinlock rcu_lock = SPINLOCK_INIT("rcu");
+static struct Retired queue[RCU_PENDING];   /* FIFO, so gp never decreases along it */
+static int head = 0, count = 0;
+static u32 gp_started = 0, gp_done = 0, gp_wanted = 0;
+static int gp_state = GP_IDLE;
+static u32 snap[CPU_MAX];
+static struct RcuStats stats;
+
+static int before(u32 a, u32 b) { return (s32)(a - b) < 0; }
+
+/* every CPU either has no section open or closed its last one since the snapshot */
+static int all_quiet(void) {
+    for (int i = 0; i < CPU_MAX; ++i) {
+        const struct Cpu* c = smp_get(i);
+        if (i > 0 && !(c && c->online)) continue;
+        struct PerCpu* p = cpu_percpu(i);
+        if (p->rcu_nest != 0 && p->rcu_qs == snap[i]) return 0;
+    }
+    return 1;
+}
+
+int rcu_retire(void* obj, rcu_free_fn fn) {
+    u32 f = spin_lock_irqsave(&rcu_lock);
+    int r = -1;
+    if (count < RCU_PENDING) {
+        struct Retired* e = &queue[(head + count++) % RCU_PENDING];
+        e->obj = obj;
+        e->fn = fn;
+        e->gp = gp_started + 1;   /* one that starts after the caller published */
+        stats.retired++;
+        r = 0;
+    }
+    spin_unlock_irqrestore(&rcu_lock, f);
+    return r;
+}
+
+int rcu_room(void) {
+    return RCU_PENDING - count;
+}
+
+int rcu_poll(void) {
+    int freed = 0;
+    for (int pass = 0; pass < 2; ++pass) {
+        struct Retired due[RCU_PENDING];
+        int ndue = 0;
+
+        u32 f = spin_lock_irqsave(&rcu_lock);
+        if (gp_state == GP_WAITING && all_quiet()) {
+            gp_done = gp_started;
+            gp_state = GP_IDLE;
+            stats.grace_periods++;
+        }
+        while (count > 0 && !before(gp_done, queue[head].gp)) {
+            due[ndue++] = queue[head];
+            head = (head + 1) % RCU_PENDING;
+            count--;
+        }
+        int start = gp_state == GP_IDLE &&
+                    ((count > 0 && before(gp_done, queue[(head + count - 1) % RCU_PENDING].gp)) ||
+                     before(gp_done, gp_wanted));
+        if (start) {
+            gp_state = GP_STARTING;
+            gp_started++;
+        }
+        spin_unlock_irqrestore(&rcu_lock, f);
+
+        for (int i = 0; i < ndue; ++i) due[i].fn(due[i].obj);
+        freed += ndue;
+        if (!start) break;
+
+        /* whatever was published before the claim is visible everywhere,
+           and every reader that may still hold an old version shows it
+           in its rcu_nest */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        smp_sync();
+        f = spin_lock_irqsave(&rcu_lock);
+        for (int i = 0; i < CPU_MAX; ++i) snap[i] = cpu_percpu(i)->rcu_qs;
+        gp_state = GP_WAITING;
+        spin_unlock_irqrestore(&rcu_lock, f);
+    }
+    if (freed) {
+        u32 f = spin_lock_irqsave(&rcu_lock);
+        stats.freed += (u32)freed;
+        spin_unlock_irqrestore(&rcu_lock, f);
+    }
+    return freed;
+}
+
+void rcu_synchronize(void) {
+    u32 f = spin_lock_irqsave(&rcu_lock);
+    u32 target = gp_started + 1;
+    if (before(gp_wanted, target)) gp_wanted = target;
+    spin_unlock_irqrestore(&rcu_lock, f);
+    for (;;) {
+        rcu_poll();
+        if (!before(__atomic_load_n(&gp_done, __ATOMIC_ACQUIRE), target)) break;
+        /* a reader preempted on this CPU has to run to finish */
+        if (cpu_id() == 0) thread_sleep(1);
+        else __asm__ volatile ("pause");
+    }
+}
+
+void rcu_stats(struct RcuStats* out) {
+    u32 f = spin_lock_irqsave(&rcu_lock);
+    *out = stats;
+    out->pending = (u32)count;
+    spin_unlock_irqrestore(&rcu_lock, f);
+}
@@ -0,0 +1,194 @@
+#include "../include/script.h"
+#include "../include/util.h"
+
+static struct Script cache[SCRIPT_CACHE];
+static u32 use_clock = 0;
+static u32 compiles = 0;
+
+/* -------- Compiler -------- */
+struct Block {
+    int open;      /* op index of the if/while/repeat */
+    int els;       /* op index of its else, -1 if none */
+};
+
+static int is_word(const char* s, const char* w, const char** rest) {
+    int n = kstrlen(w);
+    if (kstrncmp(s, w, n) != 0 || (s[n] != '\0' && s[n] != ' ')) return 0;
+    s += n;
+    while (*s == ' ') s++;
+    *rest = s;
+    return 1;
+}
+
+static int add_text(struct Script* sc, const char* s) {
+    int n = kstrlen(s) + 1;
+    if (sc->text_len + n > SCRIPT_TEXT) return -1;
+    kmemcpy(sc->text + sc->text_len, s, n);
+    sc->text_len += n;
+    return sc->text_len - n;
+}
+
+static int innermost_loop(const struct Script* sc, const struct Block* stack, int depth) {
+    for (int d = depth - 1; d >= 0; --d) {
+        int t = sc->ops[stack[d].open].type;
+        if (t == SOP_WHILE || t == SOP_REPEAT) return stack[d].open;
+    }
+    return -1;
+}
+
+/* one trimmed, non-empty line */
+static int compile_line(struct Script* sc, struct Block* stack, int* depth, char* s, int line) {
+    if (sc->nops == SCRIPT_MAX_OPS) return SCRIPT_ERR_TOOBIG;
+    int at = sc->nops;
+    struct ScriptOp* op = &sc->ops[at];
+    const char* rest = "";
+    op->line = (u16)line;
+    op->jump = 0;
+    op->depth = (u8)*depth;
+
+    if (is_word(s, "if", &rest)) op->type = SOP_IF;
+    else if (is_word(s, "while", &rest)) op->type = SOP_WHILE;
+    else if (is_word(s, "repeat", &rest)) op->type = SOP_REPEAT;
+    else if (is_word(s, "else", &rest)) op->type = SOP_ELSE;
+    else if (is_word(s, "end", &rest)) op->type = SOP_END;
+    else if (is_word(s, "break", &rest)) op->type = SOP_BREAK;
+    else if (is_word(s, "exit", &rest)) op->type = SOP_EXIT;
+    else { op->type = SOP_CMD; rest = s; }
+
+    switch (op->type) {
+    case SOP_IF: case SOP_WHILE: case SOP_REPEAT:
+        if (!rest[0] || *depth == SCRIPT_MAX_DEPTH) return SCRIPT_ERR_SYNTAX;
+        stack[*depth].open = at;
+        stack[*depth].els = -1;
+        (*depth)++;
+        break;
+    case SOP_ELSE:
+        if (*depth == 0 || rest[0]) return SCRIPT_ERR_SYNTAX;
+        if (sc->ops[stack[*depth - 1].open].type != SOP_IF || stack[*depth - 1].els >= 0) return SCRIPT_ERR_SYNTAX;
+        stack[*depth - 1].els = at;
+        op->depth = (u8)(*depth - 1);
+        break;
+    case SOP_END: {
+        if (*depth == 0 || rest[0]) return SCRIPT_ERR_SYNTAX;
+        struct Block* b = &stack[--(*depth)];
+        struct ScriptOp* open = &sc->ops[b->open];
+        op->depth = (u8)*depth;
+        op->jump = (u16)b->open;
+        if (open->type == SOP_IF) {
+            if (b->els >= 0) {
+                open->jump = (u16)(b->els + 1);
+                sc->ops[b->els].jump = (u16)(at + 1);
+            } else {
+                open->jump = (u16)(at + 1);
+            }
+        } else {
+            open->jump = (u16)(at + 1);
+            /* breaks out of this loop were parked on its opening op */
+            for (int i = b->open + 1; i < at; ++i)
+                if (sc->ops[i].type == SOP_BREAK && sc->ops[i].jump == b->open) sc->ops[i].jump = (u16)(at + 1);
+        }
+        break;
+    }
+    case SOP_BREAK: {
+        int loop = innermost_loop(sc, stack, *depth);
+        if (loop < 0 || rest[0]) return SCRIPT_ERR_SYNTAX;
+        op->jump = (u16)loop;
+        break;
+    }
+    default:
+        break;
+    }
+
+    int t = add_text(sc, rest);
+    if (t < 0) return SCRIPT_ERR_TOOBIG;
+    op->text = (u16)t;
+    op->expand = 0;
+    for (const char* p = rest; *p; ++p) if (*p == '$') op->expand = 1;
+    sc->nops++;
+    return SCRIPT_OK;
+}
+
+static int compile(struct Script* sc, const char* name, int* line) {
+    int fd = fs_open(name, FS_O_RDONLY);
+    if (fd < 0) return SCRIPT_ERR_NOTFOUND;
+    compiles++;
+    sc->nops = 0;
+    sc->text_len = 0;
+
+    struct Block stack[SCRIPT_MAX_DEPTH];
+    int depth = 0, r = SCRIPT_OK, n, len = 0;
+    char chunk[256], buf[SCRIPT_LINE_MAX];
+    *line = 1;
+    do {
+        n = fs_read(fd, chunk, sizeof(chunk));
+        for (int i = 0; i < n || (n == 0 && len > 0); ++i) {
+            char c = (i < n) ? chunk[i] : '\n';   /* last line without a newline */
+            if (c == '\r' || c == '\t') c = ' ';
+            if (c != '\n') {
+                if (len == SCRIPT_LINE_MAX - 1) { r = SCRIPT_ERR_TOOBIG; break; }
+                buf[len++] = c;
+                continue;
+            }
+            while (len > 0 && buf[len - 1] == ' ') len--;
+            buf[len] = '\0';
+            char* s = buf;
+            while (*s == ' ') s++;
+            if (*s && *s != '#') r = compile_line(sc, stack, &depth, s, *line);
+            len = 0;
+            if (r < 0) break;
+            (*line)++;
+        }
+    } while (n > 0 && r == SCRIPT_OK);
+    fs_close(fd);
+
+    if (r == SCRIPT_OK && depth > 0) {
+        *line = sc->ops[stack[depth - 1].open].line;   /* the block never ended */
+        r = SCRIPT_ERR_SYNTAX;
+    }
+    return r;
+}
+
+/* -------- Cache -------- */
+struct Script* script_load(const char* name, int* err, int* line) {
+    *line = 0;
+    struct File* f = fs_find(name);
+    if (!f) { *err = SCRIPT_ERR_NOTFOUND; return 0; }
+
+    struct Script* slot = 0;
+    for (int i = 0; i < SCRIPT_CACHE; ++i) {
+        struct Script* sc = &cache[i];
+        if (sc->dir != fs_cwd() || kstrcmp(sc->name, name) != 0) continue;
+        if (sc->version == f->version) {
+            sc->last_used = ++use_clock;
+            *err = SCRIPT_OK;
+            return sc;
+        }
+        if (!sc->running) slot = sc;   /* stale copy: recompile in place */
+    }
+    for (int i = 0; i < SCRIPT_CACHE && !slot; ++i)
+        if (!cache[i].dir) slot = &cache[i];
+    for (int i = 0; i < SCRIPT_CACHE && !slot; ++i) {
+        /* least recently used of those not running */
+        struct Script* sc = &cache[i];
+        if (sc->running) continue;
+        for (int j = 0; j < SCRIPT_CACHE; ++j)
+            if (!cache[j].running && cache[j].last_used < sc->last_used) sc = &cache[j];
+        slot = sc;
+    }
+    if (!slot) { *err = SCRIPT_ERR_BUSY; return 0; }
+
+    slot->dir = 0;
+    int r = compile(slot, name, line);
+    if (r < 0) { *err = r; return 0; }
+    kstrncpy(slot->name, name, MAX_FILENAME);
+    slot->dir = fs_cwd();
+    slot->version = f->version;
+    slot->last_used = ++use_clock;
+    slot->running = 0;
+    *err = SCRIPT_OK;
+    return slot;
+}
+
+u32 script_compiles(void) {
+    return compiles;
+}
@@ -0,0 +1,108 @@
+#include "../include/search.h"
+#include "../include/util.h"
+
+static char window[SEARCH_WINDOW];
+
+/* replace-all output is batched so dst sees few, large appends */
+static char out_buf[SEARCH_WINDOW];
+static int out_len;
+
+void search_compile(struct Search* s, const char* pat, int n) {
+    if (n < 0) n = 0;
+    if (n > SEARCH_MAX_PATTERN) n = SEARCH_MAX_PATTERN;
+    kmemcpy(s->pat, pat, n);
+    s->len = n;
+    for (int c = 0; c < 256; ++c) s->skip[c] = (u8)(n ? n : 1);
+    for (int i = 0; i + 1 < n; ++i) s->skip[(u8)pat[i]] = (u8)(n - 1 - i);
+}
+
+int search_buf(const struct Search* s, const char* buf, int n, int from) {
+    int m = s->len;
+    if (m == 0 || from < 0) return -1;
+    char last = s->pat[m - 1];
+    for (int i = from; i + m <= n; ) {
+        char c = buf[i + m - 1];
+        if (c == last && kmemcmp(buf + i, s->pat, m - 1) == 0) return i;
+        i += s->skip[(u8)c];
+    }
+    return -1;
+}
+
+int search_next(const struct Search* s, struct Text* t, int from) {
+    int m = s->len, len = text_length(t);
+    if (m == 0 || from < 0) return -1;
+    while (from + m <= len) {
+        int n = text_copy(t, from, window, SEARCH_WINDOW);
+        if (n < m) return -1;
+        int at = search_buf(s, window, n, 0);
+        if (at >= 0) return from + at;
+        if (from + n >= len) return -1;
+        from += n - (m - 1);   /* keep a match straddling the window edge */
+    }
+    return -1;
+}
+
+int search_prev(const struct Search* s, struct Text* t, int before) {
+    int m = s->len, len = text_length(t);
+    if (m == 0 || before <= 0) return -1;
+    int end = before + m - 1;   /* windows end where a match starting before 'before' can */
+    if (end > len) end = len;
+    while (end >= m) {
+        int start = (end > SEARCH_WINDOW) ? end - SEARCH_WINDOW : 0;
+        int n = text_copy(t, start, window, end - start);
+        int best = -1;
+        for (int at = search_buf(s, window, n, 0); at >= 0; at = search_buf(s, window, n, at + 1))
+            best = at;
+        if (best >= 0) return start + best;
+        if (start == 0) return -1;
+        end = start + m - 1;
+    }
+    return -1;
+}
+
+static int out_flush(struct Text* dst) {
+    int r = text_insert(dst, text_length(dst), out_buf, out_len);
+    out_len = 0;
+    return r;
+}
+
+static int out_write(struct Text* dst, const char* p, int n) {
+    while (n > 0) {
+        if (out_len == SEARCH_WINDOW && out_flush(dst) != TEXT_OK) return TEXT_ERR_NOMEM;
+        int k = SEARCH_WINDOW - out_len;
+        if (k > n) k = n;
+        kmemcpy(out_buf + out_len, p, k);
+        out_len += k;
+        p += k;
+        n -= k;
+    }
+    return TEXT_OK;
+}
+
+int search_replace_all(const struct Search* s, struct Text* src, struct Text* dst,
+                       const char* rep, int rlen) {
+    int m = s->len, len = text_length(src);
+    int count = 0, pos = 0;
+    out_len = 0;
+    if (m == 0) return 0;
+    while (pos < len) {
+        int n = text_copy(src, pos, window, SEARCH_WINDOW);
+        /* short of the end: a page could not be loaded, and a window this
+           small might not move pos past its held-back tail */
+        if (n <= 0 || (n < SEARCH_WINDOW && pos + n < len)) return TEXT_ERR_NOMEM;
+        int done = 0;   /* window bytes already written out */
+        for (int at = search_buf(s, window, n, 0); at >= 0; at = search_buf(s, window, n, at + m)) {
+            if (out_write(dst, window + done, at - done) != TEXT_OK ||
+                out_write(dst, rep, rlen) != TEXT_OK) return TEXT_ERR_NOMEM;
+            done = at + m;
+            count++;
+        }
+        /* hold back a tail that may begin a match in the next window */
+        int keep = (pos + n >= len) ? n : n - (m - 1);
+        if (keep < done) keep = done;
+        if (out_write(dst, window + done, keep - done) != TEXT_OK) return TEXT_ERR_NOMEM;
+        pos += keep;
+    }
+    if (out_len > 0 && out_flush(dst) != TEXT_OK) return TEXT_ERR_NOMEM;
+    return count;
+}
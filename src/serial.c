@@ -0,0 +1,196 @@
+#include "../include/serial.h"
+#include "../include/io.h"
+#include "../include/cpu.h"
+#include "../include/spinlock.h"
+#include "../include/thread.h"
+#include "../include/util.h"
+#include "../include/klog.h"
+
+#define COM1 0x3F8
+
+/* Registers, offsets from the base port */
+#define UART_DATA 0   /* THR/RBR; divisor low with DLAB */
+#define UART_IER  1   /* divisor high with DLAB */
+#define UART_IIR  2   /* FCR when written */
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+#define UART_MSR  6
+
+#define IER_RX    0x01
+#define IER_TX    0x02
+#define FCR_14    0xC7   /* FIFOs on and cleared, RX interrupt at 14 bytes */
+#define LCR_8N1   0x03
+#define LCR_DLAB  0x80
+#define MCR_ON    0x0B   /* DTR, RTS, OUT2: OUT2 gates the IRQ line */
+#define MCR_LOOP  0x1E   /* loopback, for the presence test */
+#define LSR_DR    0x01
+#define LSR_OE    0x02
+#define LSR_THRE  0x20
+#define IIR_NONE  0x01
+#define IIR_FIFO  0xC0   /* both set: a 16550A with working FIFOs */
+
+#define EFLAGS_IF 0x200
+
+static int present = 0;
+static int fifo = 1;              /* bytes the transmitter takes at once */
+static char tx_ring[SERIAL_TX_RING];
+static u32  tx_head, tx_tail;     /* free running */
+static char rx_ring[SERIAL_RX_RING];
+static u32  rx_head, rx_tail;
+static int  tx_chan;              /* writers sleep here while the ring is full */
+static void (*rx_cb)(void) = 0;
+static struct SerialStats stats;
+static struct Spinlock ser_lock = SPINLOCK_INIT("serial");
+
+/* ser_lock held: top up the transmit FIFO, which must be empty */
+static void tx_fill(void) {
+    int n = 0;
+    while (n < fifo && tx_tail != tx_head) {
+        io_outb(COM1 + UART_DATA, (u8)tx_ring[tx_tail++ % SERIAL_TX_RING]);
+        n++;
+    }
+}
+
+/* ser_lock held: everything the UART has received */
+static int rx_drain(void) {
+    int n = 0;
+    u8 lsr;
+    while ((lsr = io_inb(COM1 + UART_LSR)) & LSR_DR) {
+        u8 c = io_inb(COM1 + UART_DATA);
+        if (lsr & LSR_OE) stats.rx_dropped++;
+        if (rx_head - rx_tail == SERIAL_RX_RING) {
+            stats.rx_dropped++;
+            continue;
+        }
+        rx_ring[rx_head++ % SERIAL_RX_RING] = (char)c;
+        stats.rx_bytes++;
+        n++;
+    }
+    return n;
+}
+
+static void serial_irq(void) {
+    int rx = 0, room = 0;
+    u8 iir;
+    spin_lock(&ser_lock);
+    while (!((iir = io_inb(COM1 + UART_IIR)) & IIR_NONE)) {
+        switch (iir & 0x0E) {
+        case 0x04: case 0x0C:   /* data, or a timeout with data below the trigger */
+            rx += rx_drain();
+            break;
+        case 0x02:              /* transmitter empty */
+            stats.tx_irqs++;
+            tx_fill();
+            room = tx_head - tx_tail <= SERIAL_TX_RING / 2;
+            break;
+        case 0x06:
+            if (io_inb(COM1 + UART_LSR) & LSR_OE) {
+                stats.rx_dropped++;
+                klog(KLOG_WARN, "serial: receiver overrun");
+            }
+            break;
+        default:
+            io_inb(COM1 + UART_MSR);
+            break;
+        }
+    }
+    spin_unlock(&ser_lock);
+    if (room) thread_wakeup(&tx_chan);
+    if (rx && rx_cb) rx_cb();
+}
+
+int serial_init(void) {
+    u32 div = 115200 / SERIAL_BAUD;
+    io_outb(COM1 + UART_IER, 0);
+    io_outb(COM1 + UART_LCR, LCR_DLAB);
+    io_outb(COM1 + UART_DATA, (u8)div);
+    io_outb(COM1 + UART_IER, (u8)(div >> 8));
+    io_outb(COM1 + UART_LCR, LCR_8N1);
+    io_outb(COM1 + UART_IIR, FCR_14);
+    io_outb(COM1 + UART_MCR, MCR_LOOP);
+    io_outb(COM1 + UART_DATA, 0xAE);
+    if (io_inb(COM1 + UART_DATA) != 0xAE) return 0;
+    io_outb(COM1 + UART_MCR, MCR_ON);
+    fifo = ((io_inb(COM1 + UART_IIR) & IIR_FIFO) == IIR_FIFO) ? SERIAL_FIFO : 1;
+    present = 1;
+    irq_set_handler(IRQ_COM1, serial_irq);
+    io_outb(COM1 + UART_IER, IER_RX | IER_TX);
+    return 1;
+}
+
+int serial_present(void) {
+    return present;
+}
+
+/* The ring is full. The UI thread sleeps until the interrupt has made
+   room; anywhere interrupts are off, or on another CPU, the FIFO is
+   refilled by polling instead. Interrupts are off on entry. */
+static void tx_wait(u32 flags) {
+    if ((flags & EFLAGS_IF) && cpu_id() == 0) {
+        thread_wait(&tx_chan, 1);
+        return;
+    }
+    while (!(io_inb(COM1 + UART_LSR) & LSR_THRE)) __asm__ volatile ("pause");
+    spin_lock(&ser_lock);
+    tx_fill();
+    spin_unlock(&ser_lock);
+}
+
+void serial_write(const char* s, int n) {
+    if (!present) return;
+    int i = 0, cr = 0;   /* cr: the '\r' before s[i] is queued */
+    while (i < n) {
+        u32 f = spin_lock_irqsave(&ser_lock);
+        u32 head = tx_head;
+        while (i < n && tx_head - tx_tail < SERIAL_TX_RING) {
+            char c = s[i];
+            if (c == '\n' && !cr) {
+                c = '\r';
+                cr = 1;
+            } else {
+                i++;
+                cr = 0;
+            }
+            tx_ring[tx_head++ % SERIAL_TX_RING] = c;
+        }
+        stats.tx_bytes += tx_head - head;
+        /* an empty FIFO is filled here, a busy one by the interrupt */
+        if (io_inb(COM1 + UART_LSR) & LSR_THRE) tx_fill();
+        int full = i < n;
+        if (full) stats.tx_waits++;
+        spin_unlock(&ser_lock);
+        if (full) tx_wait(f);
+        irq_restore(f);
+    }
+}
+
+void serial_puts(const char* s) {
+    serial_write(s, kstrlen(s));
+}
+
+int serial_tx_room(void) {
+    return present ? (int)(SERIAL_TX_RING - (tx_head - tx_tail)) : 0;
+}
+
+int serial_getc(void) {
+    if (!present) return -1;
+    u32 f = spin_lock_irqsave(&ser_lock);
+    int c = (rx_head != rx_tail) ? (u8)rx_ring[rx_tail++ % SERIAL_RX_RING] : -1;
+    spin_unlock_irqrestore(&ser_lock, f);
+    return c;
+}
+
+int serial_pending(void) {
+    return rx_head != rx_tail;
+}
+
+void serial_set_rx_callback(void (*cb)(void)) {
+    rx_cb = cb;
+}
+
+void serial_stats(struct SerialStats* out) {
+    u32 f = spin_lock_irqsave(&ser_lock);
+    *out = stats;
+    spin_unlock_irqrestore(&ser_lock, f);
+}
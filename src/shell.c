@@ -8,23 +8,135 @@
 #include "../include/game_snake.h"
 #include "../include/shell.h"
 #include "../include/mode.h"
+#include "../include/blk.h"
+#include "../include/bench.h"
+#include "../include/smp.h"
+#include "../include/pool.h"
+#include "../include/spinlock.h"
+#include "../include/rcu.h"
+#include "../include/undo.h"
+#include "../include/stream.h"
+#include "../include/search.h"
+#include "../include/script.h"
+#include "../include/trie.h"
+#include "../include/history.h"
+#include "../include/event.h"
+#include "../include/thread.h"
+#include "../include/paging.h"
+#include "../include/serial.h"
+#include "../include/klog.h"
+#include "../include/trace.h"
 #include <stddef.h> /* for NULL */
 
-/* Command history */
-#define CMD_HISTORY_SIZE 10
 #define MAX_CMD_LEN 64
-
-static char cmd_history[CMD_HISTORY_SIZE][MAX_CMD_LEN];
-static int history_count = 0;
-static int history_pos = 0;
 static void show_error(const char* message);
 static void show_message(const char* message, unsigned char color);
+static int execute_command(const char* input, int* mode, int* explorer_sel);
+/* A command that reads standard input. In a pipeline it is fed its
+   input a page at a time as the command before it produces it; run on
+   its own it reads the file named in its arguments the same way. */
+struct Stage;
+typedef struct {
+    const char* usage;
+    int (*start)(struct Stage* st, const char* args);   /* parse args, may set st->src */
+    int (*feed)(struct Stage* st, struct PipePage* pg); /* owns pg */
+    int (*finish)(struct Stage* st);                    /* end of input */
+} shell_filter_t;
+
 /* Command structure for better organization */
 typedef struct {
     const char* name;
     const char* description;
     int (*handler)(const char* args, int* mode, int* explorer_sel);
+    const shell_filter_t* filter;
+    int draws;     /* CMD_DRAWS: paints its own screen and writes nothing to sh_out */
 } shell_command_t;
+#define CMD_DRAWS 1
+
+/* grep: a line cut by a page boundary is reassembled here; longer
+   lines are matched on their first GREP_LINE_MAX bytes */
+#define GREP_LINE_MAX PIPE_PAGE_SIZE
+struct GrepState {
+    struct Search search;
+    char carry[GREP_LINE_MAX];
+    int  carry_len;
+    u32  hits;
+};
+
+struct WcState {
+    u32 lines, words, bytes;
+    int in_word;
+};
+
+/* One command of a pipeline and the stream it writes to */
+#define MAX_STAGES 4
+struct Stage {
+    const shell_command_t* cmd;
+    const char* args;
+    const char* src;            /* file a filter reads when nothing is piped in */
+    struct Stream out;
+    union {
+        struct GrepState grep;
+        struct WcState wc;
+    } u;
+};
+
+/* standard output of the command being run: the next stage, a file,
+   or the screen */
+static struct Stream* sh_out;
+static int screen_sink(void* ctx, struct PipePage* pg);
+static int out_is_screen(const struct Stream* s) { return s->sink == screen_sink; }
+
+/* Scripts: `run file` executes a compiled script (script.h) op by op.
+   While one runs nothing waits for a key, so a batch goes through
+   unattended; ESC stops it. */
+#define SCRIPT_MAX_NEST 4
+struct ScriptFrame {
+    struct Script* sc;
+    int line;                    /* being executed, for messages */
+    char args[SCRIPT_LINE_MAX];  /* $1..$9 point in here */
+    char* argv[10];              /* $0 is the script name */
+    int argc;
+};
+static struct ScriptFrame frames[SCRIPT_MAX_NEST];
+static int script_depth = 0;
+static int script_abort = 0;
+static int last_status = 0;      /* $? */
+static int pending_status = -1;  /* run: the script's own status, not just 0/1 */
+static u32 script_commands = 0;
+
+/* What the shell is doing between keys */
+#define SH_BROWSE 0   /* file browser */
+#define SH_LINE   1   /* reading a command line */
+#define SH_HOLD   2   /* a command's screen stays up until the next key */
+static int sh_state = SH_BROWSE;
+
+/* The serial console's own command line, and what the command it runs
+   has sent the port so far */
+#define SERIAL_PROMPT "noir> "
+static struct {
+    char buf[SCRIPT_LINE_MAX];
+    int  len;
+    int  last;       /* previous byte: "\r\n" ends one line, not two */
+    int  esc;        /* inside an escape sequence, which is ignored */
+    int  remote;     /* the command running came from here */
+    int  sent;       /* its output has reached the port */
+} sl;
+
+/* Leave what is on screen up until a key is pressed, then go back to the
+   browser; scripts carry on without anyone watching */
+static void hold_screen(void) {
+    if (!script_depth) sh_state = SH_HOLD;
+}
+
+/* Shell variables, set with set/let and read back as $name */
+#define SHELL_MAX_VARS 32
+#define VAR_NAME_MAX   16
+static struct {
+    char name[VAR_NAME_MAX];
+    char value[SCRIPT_LINE_MAX];
+} vars[SHELL_MAX_VARS];
+static int var_count = 0;
 
 /* Command handlers */
 static int cmd_help(const char* args, int* mode, int* explorer_sel) {
@@ -70,14 +182,25 @@ static int cmd_help(const char* args, int* mode, int* explorer_sel) {
         }
     }
     
-    read_key();
-    ui_draw();
+    hold_screen();
     return 1;
 }
 
 static int cmd_list(const char* args, int* mode, int* explorer_sel) {
     (void)args; (void)mode; (void)explorer_sel; /* unused */
-    ui_draw(); /* Just refresh the file listing */
+    if (out_is_screen(sh_out)) {
+        ui_draw(); /* Just refresh the file listing */
+        return 1;
+    }
+    /* redirected: one name per line, directories first */
+    for (int i = 0; i < fs_dir_count(); ++i) {
+        stream_write(sh_out, fs_dir_get(i)->name, kstrlen(fs_dir_get(i)->name));
+        stream_write(sh_out, "/\n", 2);
+    }
+    for (int i = 0; i < fs_count(); ++i) {
+        stream_write(sh_out, fs_get(i)->name, kstrlen(fs_get(i)->name));
+        stream_write(sh_out, "\n", 1);
+    }
     return 1;
 }
 
@@ -93,67 +216,6 @@ static int cmd_edit(const char* args, int* mode, int* explorer_sel) {
     return 1;
 }
 
-static int cmd_cat(const char* args, int* mode, int* explorer_sel) {
-    (void)mode; (void)explorer_sel; /* unused */
-    
-    if (!args || !args[0]) {
-        show_error("Usage: cat <filename>");
-        return 0;
-    }
-    
-    /* Find and display file */
-    for (int i = 0; i < fs_count(); ++i) {
-        if (kstrcmp(fs_get(i)->name, args) == 0) {
-            struct File* f = fs_get(i);
-            vga_clear();
-            
-            /* Title */
-            char title[80];
-            int pos = 0;
-            const char* prefix = "Viewing: ";
-            for (int j = 0; prefix[j]; j++) title[pos++] = prefix[j];
-            for (int j = 0; args[j] && pos < 70; j++) title[pos++] = args[j];
-            title[pos] = '\0';
-            
-            for (int x = 0; x < WIDTH; ++x) vga_putcell(x, 0, ' ', 0x1F);
-            for (int j = 0; title[j] && j < WIDTH - 2; ++j) {
-                vga_putcell(1 + j, 0, title[j], 0x1F);
-            }
-            
-            /* Content */
-            int line = 2, col = 1;
-            for (int j = 0; j < f->length && line < HEIGHT - 2; j++) {
-                char ch = f->content[j];
-                if (ch == '\n') {
-                    line++;
-                    col = 1;
-                } else if (ch >= 32 && ch <= 126) {
-                    if (col < WIDTH - 1) {
-                        vga_putcell(col, line, ch, 0x07);
-                        col++;
-                    }
-                } else if (ch == '\t') {
-                    col += 4;
-                    if (col >= WIDTH) col = WIDTH - 1;
-                }
-            }
-            
-            /* Footer */
-            const char* footer = "Press any key to return...";
-            for (int j = 0; footer[j]; ++j) {
-                vga_putcell(1 + j, HEIGHT - 1, footer[j], 0x0E);
-            }
-            
-            read_key();
-            ui_draw();
-            return 1;
-        }
-    }
-    
-    show_error("File not found");
-    return 0;
-}
-
 static int cmd_snake(const char* args, int* mode, int* explorer_sel) {
     (void)args; (void)explorer_sel; /* unused */
     
@@ -170,45 +232,6 @@ static int cmd_clear(const char* args, int* mode, int* explorer_sel) {
     return 1;
 }
 
-static int cmd_info(const char* args, int* mode, int* explorer_sel) {
-    (void)args; (void)mode; (void)explorer_sel; /* unused */
-    
-    vga_clear();
-    
-    const char* info_lines[] = {
-        "NoirOS System Information",
-        "========================",
-        "",
-        "Version: 1.0.0",
-        "Architecture: x86",
-        "Display: 80x25 VGA Text Mode",
-        "",
-        "Features:",
-        "- File System Browser",
-        "- Text Editor with Syntax Support",
-        "- Snake Game",
-        "- Mouse Support",
-        "- Command Shell",
-        "",
-        "Memory Usage:",
-        "- Kernel: ~64KB",
-        "- Available RAM: Detected at boot",
-        "",
-        "Press any key to continue..."
-    };
-    
-    for (int i = 0; i < 19; i++) {
-        unsigned char color = (i == 0 || i == 1) ? 0x0E : 0x07;
-        for (int j = 0; info_lines[i][j]; j++) {
-            vga_putcell(2 + j, 2 + i, info_lines[i][j], color);
-        }
-    }
-    
-    read_key();
-    ui_draw();
-    return 1;
-}
-
 static int cmd_exit(const char* args, int* mode, int* explorer_sel) {
     (void)args; (void)mode; (void)explorer_sel; /* unused */
     
@@ -297,220 +320,1726 @@ static int cmd_pwd(const char* args, int* mode, int* explorer_sel) {
     (void)args; (void)mode; (void)explorer_sel;
     char path[128];
     fs_pwd(path, sizeof(path));
-    show_message(path, 0x0F);
+    if (out_is_screen(sh_out)) {
+        show_message(path, 0x0F);
+        return 1;
+    }
+    stream_write(sh_out, path, kstrlen(path));
+    stream_write(sh_out, "\n", 1);
+    return 1;
+}
+
+/* -------- small formatting helpers for report screens -------- */
+static int sappend(char* buf, int p, const char* s, int max) {
+    while (*s && p < max - 1) buf[p++] = *s++;
+    buf[p] = '\0';
+    return p;
+}
+static int sappend_u(char* buf, int p, u32 v, int max) {
+    char tmp[12];
+    kutoa(tmp, v);
+    return sappend(buf, p, tmp, max);
+}
+static void put_line(int y, const char* s, unsigned char attr) {
+    for (int j = 0; s[j] && 2 + j < WIDTH; j++) vga_putcell(2 + j, y, s[j], attr);
+}
+static int cmd_info(const char* args, int* mode, int* explorer_sel) {
+    (void)args; (void)mode; (void)explorer_sel; /* unused */
+    
+    vga_clear();
+    
+    const char* info_lines[] = {
+        "NoirOS System Information",
+        "========================",
+        "",
+        "Version: 1.0.0",
+        "Architecture: x86",
+        "Display: 80x25 VGA Text Mode",
+        "",
+        "Features:",
+        "- File System Browser",
+        "- Text Editor with Syntax Support",
+        "- Snake Game",
+        "- Mouse Support",
+        "- Command Shell",
+        "",
+        "Memory Usage:",
+    };
+    
+    for (int i = 0; i < 15; i++) {
+        unsigned char color = (i == 0 || i == 1) ? 0x0E : 0x07;
+        put_line(2 + i, info_lines[i], color);
+    }
+
+    /* frames are 4 KiB: 256 to the MiB */
+    struct FrameStats fs;
+    paging_frame_stats(&fs);
+    char line[80];
+    if (fs.total == 0) {
+        put_line(17, "- Paging is off", 0x07);
+        put_line(24, "Press any key to continue...", 0x07);
+        hold_screen();
+        return 1;
+    }
+    int p = sappend(line, 0, "- RAM: ", sizeof(line));
+    p = sappend_u(line, p, fs.total / 256, sizeof(line));
+    p = sappend(line, p, " MiB, kernel image ", sizeof(line));
+    p = sappend_u(line, p, fs.kernel * 4, sizeof(line));
+    sappend(line, p, " KiB", sizeof(line));
+    put_line(17, line, 0x07);
+    p = sappend(line, 0, "- Frames: ", sizeof(line));
+    p = sappend_u(line, p, fs.used, sizeof(line));
+    p = sappend(line, p, " used, ", sizeof(line));
+    p = sappend_u(line, p, fs.reserved, sizeof(line));
+    p = sappend(line, p, " reserved, ", sizeof(line));
+    p = sappend_u(line, p, fs.free, sizeof(line));
+    sappend(line, p, " free", sizeof(line));
+    put_line(18, line, 0x07);
+
+    int y = 19;
+    struct RegionInfo ri;
+    for (int i = 0; i < REGION_MAX && y < 24; ++i) {
+        if (!region_info(i, &ri)) continue;
+        p = sappend(line, 0, "- ", sizeof(line));
+        p = sappend(line, p, ri.name, sizeof(line));
+        p = sappend(line, p, ": ", sizeof(line));
+        p = sappend_u(line, p, ri.pages * 4, sizeof(line));
+        p = sappend(line, p, " of ", sizeof(line));
+        p = sappend_u(line, p, ri.size / 1024, sizeof(line));
+        p = sappend(line, p, " KiB backed, ", sizeof(line));
+        p = sappend_u(line, p, ri.faults, sizeof(line));
+        p = sappend(line, p, " faults", sizeof(line));
+        if (ri.bad) {
+            p = sappend(line, p, ", ", sizeof(line));
+            p = sappend_u(line, p, ri.bad, sizeof(line));
+            p = sappend(line, p, " bad", sizeof(line));
+        }
+        put_line(y++, line, 0x07);
+    }
+    put_line(24, "Press any key to continue...", 0x07);
+    
+    hold_screen();
+    return 1;
+}
+
+/* parse leading decimal; returns chars consumed (0 if none) */
+static int parse_uint(const char* s, int* out) {
+    int i = 0, v = 0;
+    while (s[i] >= '0' && s[i] <= '9') { v = v * 10 + (s[i] - '0'); i++; }
+    if (i) *out = v;
+    return i;
+}
+
+/* cat: passes its input on page by page, untouched */
+static int cat_start(struct Stage* st, const char* args) {
+    st->src = args[0] ? args : 0;
+    return STREAM_OK;
+}
+
+static int cat_feed(struct Stage* st, struct PipePage* pg) {
+    return stream_pass(&st->out, pg);
+}
+
+static int cat_finish(struct Stage* st) {
+    (void)st;
+    return STREAM_OK;
+}
+
+static const shell_filter_t cat_filter = { "Usage: cat <filename>", cat_start, cat_feed, cat_finish };
+
+/* grep <pattern> [file]: whole pages are searched for the pattern and
+   only the lines around a match are looked at */
+static int grep_start(struct Stage* st, const char* args) {
+    struct GrepState* g = &st->u.grep;
+    int n = 0;
+    while (args[n] && args[n] != ' ') n++;
+    if (n == 0) return STREAM_ERR_IO;
+    search_compile(&g->search, args, n);
+    while (args[n] == ' ') n++;
+    st->src = args[n] ? args + n : 0;
+    g->carry_len = 0;
+    g->hits = 0;
+    return STREAM_OK;
+}
+
+static void grep_carry(struct GrepState* g, const char* s, int n) {
+    if (n > GREP_LINE_MAX - g->carry_len) n = GREP_LINE_MAX - g->carry_len;
+    kmemcpy(g->carry + g->carry_len, s, n);
+    g->carry_len += n;
+}
+
+static int grep_line(struct Stage* st, const char* s, int n) {
+    struct GrepState* g = &st->u.grep;
+    if (search_buf(&g->search, s, n, 0) < 0) return STREAM_OK;
+    g->hits++;
+    int r = stream_write(&st->out, s, n);
+    return (r < 0) ? r : stream_write(&st->out, "\n", 1);
+}
+
+static int grep_feed(struct Stage* st, struct PipePage* pg) {
+    struct GrepState* g = &st->u.grep;
+    const char* d = pg->data;
+    int n = pg->len, i = 0, r = STREAM_OK;
+    if (g->carry_len > 0) {
+        /* finish the line the last page ended in */
+        int e = 0;
+        while (e < n && d[e] != '\n') e++;
+        grep_carry(g, d, e);
+        if (e == n) { pipe_page_free(pg); return STREAM_OK; }
+        r = grep_line(st, g->carry, g->carry_len);
+        g->carry_len = 0;
+        i = e + 1;
+    }
+    /* whole lines are [i, end); the pattern holds no newline, so a
+       match never spans two of them */
+    int end = n;
+    while (end > i && d[end - 1] != '\n') end--;
+    for (int at; r >= 0 && (at = search_buf(&g->search, d, end, i)) >= 0; ) {
+        int ls = at, le = at;
+        while (ls > i && d[ls - 1] != '\n') ls--;
+        while (d[le] != '\n') le++;
+        g->hits++;
+        r = stream_write(&st->out, d + ls, le + 1 - ls);
+        i = le + 1;
+    }
+    grep_carry(g, d + end, n - end);
+    pipe_page_free(pg);
+    return r;
+}
+
+static int grep_finish(struct Stage* st) {
+    struct GrepState* g = &st->u.grep;
+    int r = STREAM_OK;
+    if (g->carry_len > 0) r = grep_line(st, g->carry, g->carry_len);   /* no final newline */
+    g->carry_len = 0;
+    if (r >= 0 && g->hits == 0 && out_is_screen(&st->out)) show_error("No matches");
+    return r;
+}
+
+static const shell_filter_t grep_filter = { "Usage: grep <pattern> [file]", grep_start, grep_feed, grep_finish };
+
+/* wc [file]: lines, words and bytes */
+static int wc_start(struct Stage* st, const char* args) {
+    st->src = args[0] ? args : 0;
+    kmemset(&st->u.wc, 0, sizeof(st->u.wc));
+    return STREAM_OK;
+}
+
+static int wc_feed(struct Stage* st, struct PipePage* pg) {
+    struct WcState* w = &st->u.wc;
+    for (int i = 0; i < pg->len; ++i) {
+        char c = pg->data[i];
+        int space = (c == ' ' || c == '\n' || c == '\t' || c == '\r');
+        if (c == '\n') w->lines++;
+        if (!space && !w->in_word) w->words++;
+        w->in_word = !space;
+    }
+    w->bytes += (u32)pg->len;
+    pipe_page_free(pg);
+    return STREAM_OK;
+}
+
+static int wc_finish(struct Stage* st) {
+    struct WcState* w = &st->u.wc;
+    char line[40];
+    int p = sappend_u(line, 0, w->lines, sizeof(line));
+    p = sappend(line, p, " ", sizeof(line));
+    p = sappend_u(line, p, w->words, sizeof(line));
+    p = sappend(line, p, " ", sizeof(line));
+    p = sappend_u(line, p, w->bytes, sizeof(line));
+    p = sappend(line, p, "\n", sizeof(line));
+    return stream_write(&st->out, line, p);
+}
+
+static const shell_filter_t wc_filter = { "Usage: wc [file]", wc_start, wc_feed, wc_finish };
+
+/* -------- Variables -------- */
+static int var_find(const char* name, int len) {
+    for (int i = 0; i < var_count; ++i)
+        if (kstrncmp(vars[i].name, name, len) == 0 && vars[i].name[len] == '\0') return i;
+    return -1;
+}
+
+static int var_name_ok(const char* name) {
+    int n = kstrlen(name);
+    if (n == 0 || n >= VAR_NAME_MAX || (name[0] >= '0' && name[0] <= '9')) return 0;
+    for (int i = 0; i < n; ++i) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) return 0;
+    }
+    return 1;
+}
+
+static int var_set(const char* name, const char* value) {
+    int i = var_find(name, kstrlen(name));
+    if (i < 0) {
+        if (var_count == SHELL_MAX_VARS) return 0;
+        i = var_count++;
+        kstrncpy(vars[i].name, name, VAR_NAME_MAX);
+    }
+    kstrncpy(vars[i].value, value, SCRIPT_LINE_MAX);
+    return 1;
+}
+
+static int is_name_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/* Copy s to out replacing $name, $? (last status), $0-$9 (script
+   arguments) and $$ (a dollar); unknown names expand to nothing */
+static void expand_vars(const char* s, char* out, int max) {
+    int p = 0;
+    char num[12];
+    while (*s && p < max - 1) {
+        if (*s != '$') { out[p++] = *s++; continue; }
+        s++;
+        const char* val = "";
+        if (*s == '$') {
+            val = "$";
+            s++;
+        } else if (*s == '?') {
+            kutoa(num, (u32)last_status);
+            val = num;
+            s++;
+        } else if (*s >= '0' && *s <= '9') {
+            int k = *s++ - '0';
+            if (script_depth && k < frames[script_depth - 1].argc) val = frames[script_depth - 1].argv[k];
+        } else {
+            int n = 0;
+            while (is_name_char(s[n])) n++;
+            int i = var_find(s, n);
+            if (n && i >= 0) val = vars[i].value;
+            s += n;
+        }
+        while (*val && p < max - 1) out[p++] = *val++;
+    }
+    out[p] = '\0';
+}
+
+/* split s in place at spaces; -> number of words */
+static int split_words(char* s, char** argv, int max) {
+    int n = 0;
+    while (*s) {
+        while (*s == ' ') *s++ = '\0';
+        if (!*s) break;
+        if (n == max) return max + 1;
+        argv[n++] = s;
+        while (*s && *s != ' ') s++;
+    }
+    return n;
+}
+
+/* whole-string signed decimal */
+static int parse_int(const char* s, int* out) {
+    int neg = (*s == '-');
+    int v = 0;
+    int n = parse_uint(s + neg, &v);
+    if (n == 0 || s[neg + n] != '\0') return 0;
+    *out = neg ? -v : v;
+    return 1;
+}
+
+static int format_int(char* out, int v) {
+    if (v >= 0) return kutoa(out, (u32)v);
+    out[0] = '-';
+    return 1 + kutoa(out + 1, (u32)(-(v + 1)) + 1);
+}
+
+/* set [name [value...]]: with no name, list the variables */
+static int cmd_set(const char* args, int* mode, int* explorer_sel) {
+    (void)mode; (void)explorer_sel;
+    if (!args[0]) {
+        for (int i = 0; i < var_count; ++i) {
+            stream_write(sh_out, vars[i].name, kstrlen(vars[i].name));
+            stream_write(sh_out, "=", 1);
+            stream_write(sh_out, vars[i].value, kstrlen(vars[i].value));
+            stream_write(sh_out, "\n", 1);
+        }
+        return 1;
+    }
+    char name[VAR_NAME_MAX + 1];
+    int n = 0;
+    while (args[n] && args[n] != ' ' && n < VAR_NAME_MAX) { name[n] = args[n]; n++; }
+    name[n] = '\0';
+    if (!var_name_ok(name) || (args[n] && args[n] != ' ')) { show_error("Usage: set <name> [value]"); return 0; }
+    while (args[n] == ' ') n++;
+    if (!var_set(name, args + n)) { show_error("Too many variables"); return 0; }
+    return 1;
+}
+
+/* let name a [op b]: integer arithmetic, op one of + - * / % */
+static int cmd_let(const char* args, int* mode, int* explorer_sel) {
+    (void)mode; (void)explorer_sel;
+    char buf[SCRIPT_LINE_MAX];
+    char* w[4];
+    kstrncpy(buf, args, sizeof(buf));
+    int n = split_words(buf, w, 4);
+    int a, b = 0;
+    if ((n != 2 && n != 4) || !var_name_ok(w[0]) || !parse_int(w[1], &a) ||
+        (n == 4 && (!parse_int(w[3], &b) || w[2][1] != '\0'))) {
+        show_error("Usage: let <name> <a> [+ - * / % <b>]");
+        return 0;
+    }
+    if (n == 4) {
+        char op = w[2][0];
+        if ((op == '/' || op == '%') && b == 0) { show_error("Division by zero"); return 0; }
+        if (op == '+') a += b;
+        else if (op == '-') a -= b;
+        else if (op == '*') a *= b;
+        else if (op == '/') a /= b;
+        else if (op == '%') a %= b;
+        else { show_error("Unknown operator"); return 0; }
+    }
+    char val[12];
+    val[format_int(val, a)] = '\0';
+    if (!var_set(w[0], val)) { show_error("Too many variables"); return 0; }
+    return 1;
+}
+
+/* test a | test -f file | test -d dir | test a op b: succeeds when true.
+   = and != compare text, -eq -ne -lt -le -gt -ge numbers */
+static int cmd_test(const char* args, int* mode, int* explorer_sel) {
+    (void)mode; (void)explorer_sel;
+    char buf[SCRIPT_LINE_MAX];
+    char* w[3];
+    kstrncpy(buf, args, sizeof(buf));
+    int n = split_words(buf, w, 3);
+    if (n == 0) return 0;
+    if (n == 1) return w[0][0] != '\0';
+    if (n == 2 && kstrcmp(w[0], "-f") == 0) return fs_find(w[1]) != NULL;
+    if (n == 2 && kstrcmp(w[0], "-d") == 0) return fs_find_dir(w[1]) != NULL;
+    if (n == 3 && kstrcmp(w[1], "=") == 0) return kstrcmp(w[0], w[2]) == 0;
+    if (n == 3 && kstrcmp(w[1], "!=") == 0) return kstrcmp(w[0], w[2]) != 0;
+    int a, b;
+    if (n != 3 || !parse_int(w[0], &a) || !parse_int(w[2], &b)) {
+        show_error("Usage: test <a> [= != -eq -ne -lt -le -gt -ge <b>]");
+        return 0;
+    }
+    const char* op = w[1];
+    if (kstrcmp(op, "-eq") == 0) return a == b;
+    if (kstrcmp(op, "-ne") == 0) return a != b;
+    if (kstrcmp(op, "-lt") == 0) return a < b;
+    if (kstrcmp(op, "-le") == 0) return a <= b;
+    if (kstrcmp(op, "-gt") == 0) return a > b;
+    if (kstrcmp(op, "-ge") == 0) return a >= b;
+    show_error("Unknown test");
+    return 0;
+}
+
+/* -------- Scripts -------- */
+/* one command line; -> its status, also left in $? */
+static int run_line(const char* text, int* mode, int* explorer_sel) {
+    pending_status = -1;
+    int ok = execute_command(text, mode, explorer_sel);
+    last_status = (pending_status >= 0) ? pending_status : !ok;
+    script_commands++;
+    return last_status;
+}
+
+static int run_script(struct ScriptFrame* fr, int* mode, int* explorer_sel) {
+    struct Script* sc = fr->sc;
+    int counters[SCRIPT_MAX_DEPTH];   /* repeat: iterations left, by block depth */
+    char line[SCRIPT_LINE_MAX];
+    int status = 0, pc = 0;
+    while (pc < sc->nops && !script_abort) {
+        int k = poll_key();
+        if (k == K_ESC) {
+            script_abort = 1;
+            break;
+        }
+        if (k) event_post(EV_KEY, k, 0, 0);   /* typed ahead: the shell gets it afterwards */
+        const struct ScriptOp* op = &sc->ops[pc];
+        const char* text = sc->text + op->text;
+        fr->line = op->line;
+        if (op->expand) {
+            expand_vars(text, line, sizeof(line));
+            text = line;
+        }
+        switch (op->type) {
+        case SOP_CMD:
+            status = run_line(text, mode, explorer_sel);
+            pc++;
+            break;
+        case SOP_IF:
+        case SOP_WHILE:
+            status = run_line(text, mode, explorer_sel);
+            pc = (status == 0) ? pc + 1 : op->jump;
+            break;
+        case SOP_ELSE:
+        case SOP_BREAK:
+            pc = op->jump;
+            break;
+        case SOP_REPEAT: {
+            int n = 0;
+            if (!parse_int(text, &n)) show_error("repeat needs a count");
+            counters[op->depth] = n;
+            pc = (n > 0) ? pc + 1 : op->jump;
+            break;
+        }
+        case SOP_END: {
+            const struct ScriptOp* open = &sc->ops[op->jump];
+            if (open->type == SOP_WHILE) pc = op->jump;
+            else if (open->type == SOP_REPEAT && --counters[open->depth] > 0) pc = op->jump + 1;
+            else pc++;
+            break;
+        }
+        case SOP_EXIT:
+            if (text[0] && !parse_int(text, &status)) status = 1;
+            pc = sc->nops;
+            break;
+        }
+    }
+    return script_abort ? 1 : status;
+}
+
+/* run <file> [args...]: execute a script; its status becomes $? */
+static int cmd_run(const char* args, int* mode, int* explorer_sel) {
+    if (!args[0]) { show_error("Usage: run <file> [args]"); return 0; }
+    if (script_depth == SCRIPT_MAX_NEST) { show_error("Scripts nested too deep"); return 0; }
+
+    struct ScriptFrame* fr = &frames[script_depth];
+    kstrncpy(fr->args, args, sizeof(fr->args));
+    fr->argc = split_words(fr->args, fr->argv, 10);
+    if (fr->argc > 10) fr->argc = 10;
+    if (fr->argc == 0) { show_error("Usage: run <file> [args]"); return 0; }
+
+    u32 compiled = script_compiles();
+    int err, line;
+    struct Script* sc = script_load(fr->argv[0], &err, &line);
+    if (!sc) {
+        char msg[80];
+        int p = sappend(msg, 0, fr->argv[0], sizeof(msg));
+        if (line > 0) {
+            p = sappend(msg, p, ":", sizeof(msg));
+            p = sappend_u(msg, p, (u32)line, sizeof(msg));
+        }
+        sappend(msg, p, (err == SCRIPT_ERR_NOTFOUND) ? ": not found" :
+                        (err == SCRIPT_ERR_TOOBIG) ? ": too long" :
+                        (err == SCRIPT_ERR_SYNTAX) ? ": unbalanced if/while/repeat/end" :
+                        ": too many scripts running", sizeof(msg));
+        show_error(msg);
+        return 0;
+    }
+
+    u32 before = script_commands;
+    fr->sc = sc;
+    fr->line = 0;
+    sc->running++;
+    script_depth++;
+    int status = run_script(fr, mode, explorer_sel);
+    script_depth--;
+    sc->running--;
+
+    if (script_depth == 0) {
+        int aborted = script_abort;
+        script_abort = 0;
+        char msg[80];
+        int p = sappend(msg, 0, sc->name, sizeof(msg));
+        p = sappend(msg, p, aborted ? ": stopped after " : ": ", sizeof(msg));
+        p = sappend_u(msg, p, script_commands - before, sizeof(msg));
+        p = sappend(msg, p, " commands, status ", sizeof(msg));
+        p += format_int(msg + p, status);
+        msg[p] = '\0';
+        sappend(msg, p, (script_compiles() != compiled) ? " (compiled)" : " (cached)", sizeof(msg));
+        show_message(msg, (status == 0) ? 0x0A : 0x0C);
+    }
+    pending_status = status;
+    return status == 0;
+}
+
+static int cmd_echo(const char* args, int* mode, int* explorer_sel) {
+    (void)mode; (void)explorer_sel;
+    stream_write(sh_out, args, kstrlen(args));
+    stream_write(sh_out, "\n", 1);
     return 1;
 }
+
+/* blk test: a burst of 1-sector reads in runs of 4 adjacent LBAs,
+   submitted interleaved so the elevator has to sort and merge them */
+#define BLK_TEST_MAX 32
+static struct blk_request blk_test_rq[BLK_TEST_MAX];
+static char blk_test_buf[BLK_TEST_MAX][BLK_SECTOR_SIZE];
+static int blk_test_pending = 0;
+
+static void blk_test_done(struct blk_request* rq, int status) {
+    (void)rq; (void)status;
+    blk_test_pending--;
+}
+
+static int blk_test(int n) {
+    if (blk_device_count() == 0) { show_error("No block devices"); return 0; }
+    if (blk_test_pending) { show_error("blk test still in flight"); return 0; }
+    if (n < 1) n = 1;
+    if (n > BLK_TEST_MAX) n = BLK_TEST_MAX;
+
+    u32 span = blk_device_sectors(0) - 4;
+    int runs = (n + 3) / 4;
+    int submitted = 0, rejected = 0;
+    for (int j = 0; j < n; ++j) {
+        int i = (j % runs) * 4 + j / runs;
+        if (i >= n) continue;
+        struct blk_request* rq = &blk_test_rq[submitted];
+        rq->dev   = 0;
+        rq->dir   = BLK_READ;
+        rq->lba   = (u32)((i / 4) * 97) % span + (u32)(i % 4);
+        rq->count = 1;
+        rq->buf   = blk_test_buf[submitted];
+        rq->done  = blk_test_done;
+        rq->ctx   = 0;
+        if (blk_submit(rq) == BLK_OK) { submitted++; blk_test_pending++; }
+        else rejected++;
+    }
+
+    char msg[80];
+    int p = sappend(msg, 0, "Submitted ", sizeof(msg));
+    p = sappend_u(msg, p, (u32)submitted, sizeof(msg));
+    p = sappend(msg, p, " requests, ", sizeof(msg));
+    p = sappend_u(msg, p, (u32)rejected, sizeof(msg));
+    sappend(msg, p, " rejected (queue full)", sizeof(msg));
+    show_message(msg, 0x0A);
+    return 1;
+}
+
+static int cmd_blk(const char* args, int* mode, int* explorer_sel) {
+    (void)mode; (void)explorer_sel;
+    int v = 0;
+
+    if (kstrncmp(args, "test", 4) == 0 && (args[4] == 0 || args[4] == ' ')) {
+        const char* a = args + 4;
+        while (*a == ' ') a++;
+        if (!parse_uint(a, &v)) v = 16;
+        return blk_test(v);
+    }
+    if (kstrncmp(args, "depth", 5) == 0 && (args[5] == 0 || args[5] == ' ')) {
+        const char* a = args + 5;
+        while (*a == ' ') a++;
+        if (!parse_uint(a, &v) || v < 1 || v > BLK_MAX_QUEUE_DEPTH) {
+            show_error("Usage: blk depth <1-64>");
+            return 0;
+        }
+        for (int d = 0; d < blk_device_count(); ++d) blk_set_queue_depth(d, v);
+        show_message("Queue depth updated", 0x0A);
+        return 1;
+    }
+    if (args[0]) { show_error("Usage: blk [test [n] | depth <n>]"); return 0; }
+
+    vga_clear();
+    int y = 1;
+    put_line(y++, "Block devices", 0x0E);
+    for (int d = 0; d < blk_device_count() && y < HEIGHT - 2; ++d) {
+        const struct blk_stats* st = blk_get_stats(d);
+        char line[80];
+        int p;
+
+        y++;
+        p = sappend(line, 0, blk_device_name(d), sizeof(line));
+        p = sappend(line, p, ": ", sizeof(line));
+        p = sappend_u(line, p, blk_device_sectors(d), sizeof(line));
+        p = sappend(line, p, " sectors, depth ", sizeof(line));
+        p = sappend_u(line, p, (u32)blk_queue_depth(d), sizeof(line));
+        p = sappend(line, p, ", in flight ", sizeof(line));
+        sappend_u(line, p, (u32)blk_inflight(d), sizeof(line));
+        put_line(y++, line, 0x0F);
+
+        p = sappend(line, 0, "requests ", sizeof(line));
+        p = sappend_u(line, p, st->submitted, sizeof(line));
+        p = sappend(line, p, "  done ", sizeof(line));
+        p = sappend_u(line, p, st->completed, sizeof(line));
+        p = sappend(line, p, "  errors ", sizeof(line));
+        p = sappend_u(line, p, st->errors, sizeof(line));
+        p = sappend(line, p, "  busy ", sizeof(line));
+        p = sappend_u(line, p, st->busy_rejects, sizeof(line));
+        p = sappend(line, p, "  max queued ", sizeof(line));
+        sappend_u(line, p, st->max_queued, sizeof(line));
+        put_line(y++, line, 0x07);
+
+        p = sappend(line, 0, "transfers ", sizeof(line));
+        p = sappend_u(line, p, st->xfers, sizeof(line));
+        p = sappend(line, p, "  merged ", sizeof(line));
+        p = sappend_u(line, p, st->merged, sizeof(line));
+        p = sappend(line, p, "  sectors ", sizeof(line));
+        sappend_u(line, p, st->sectors, sizeof(line));
+        put_line(y++, line, 0x07);
+
+        put_line(y++, "latency histogram (TSC cycles):", 0x07);
+        u32 peak = 1;
+        for (int b = 0; b < BLK_LAT_BUCKETS; ++b) if (st->lat_hist[b] > peak) peak = st->lat_hist[b];
+        for (int b = 0; b < BLK_LAT_BUCKETS && y < HEIGHT - 2; ++b) {
+            if (!st->lat_hist[b]) continue;
+            p = sappend(line, 0, "  >=2^", sizeof(line));
+            p = sappend_u(line, p, (u32)b, sizeof(line));
+            while (p < 10) line[p++] = ' ';
+            int bar = (int)(st->lat_hist[b] * 40 / peak);
+            if (bar < 1) bar = 1;
+            for (int k = 0; k < bar; ++k) line[p++] = '#';
+            line[p++] = ' ';
+            line[p] = '\0';
+            sappend_u(line, p, st->lat_hist[b], sizeof(line));
+            put_line(y++, line, 0x0A);
+        }
+    }
+    put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+
+    hold_screen();
+    return 1;
+}
+static int sappend_u64(char* buf, int p, u64 v, int max) {
+    char tmp[21];
+    ku64toa(tmp, v);
+    return sappend(buf, p, tmp, max);
+}
+
+/* "<label><total> cycles (<total/n> per <unit>)" */
+static void put_cycles(int y, const char* label, u64 total, u32 n, const char* unit) {
+    char line[80];
+    u64 per = total;
+    kdiv64(&per, n ? n : 1);
+    int p = sappend(line, 0, label, sizeof(line));
+    p = sappend_u64(line, p, total, sizeof(line));
+    p = sappend(line, p, " cycles (", sizeof(line));
+    p = sappend_u64(line, p, per, sizeof(line));
+    p = sappend(line, p, " per ", sizeof(line));
+    p = sappend(line, p, unit, sizeof(line));
+    sappend(line, p, ")", sizeof(line));
+    put_line(y, line, 0x07);
+}
+
+/* threads: what each kernel thread is doing and how much it ran */
+static int cmd_threads(const char* args, int* mode, int* explorer_sel) {
+    (void)args; (void)mode; (void)explorer_sel;
+    static const char* states[] = { "free", "ready", "running", "blocked", "done" };
+    char line[80];
+    vga_clear();
+    put_line(1, "ID  NAME        PRIO  STATE     SWITCHES   TICKS", 0x0E);
+    int y = 2;
+    struct ThreadInfo ti;
+    for (int i = 0; i < THREAD_MAX; ++i) {
+        if (!thread_info(i, &ti)) continue;
+        int p = sappend_u(line, 0, (u32)ti.id, sizeof(line));
+        while (p < 4) line[p++] = ' ';
+        p = sappend(line, p, ti.name, sizeof(line));
+        while (p < 16) line[p++] = ' ';
+        p = sappend_u(line, p, (u32)ti.prio, sizeof(line));
+        while (p < 22) line[p++] = ' ';
+        p = sappend(line, p, states[ti.state], sizeof(line));
+        while (p < 32) line[p++] = ' ';
+        p = sappend_u(line, p, ti.switches, sizeof(line));
+        while (p < 43) line[p++] = ' ';
+        line[p] = '\0';
+        sappend_u(line, p, ti.ticks, sizeof(line));
+        put_line(y++, line, 0x07);
+    }
+    int p = sappend(line, 0, "Context switches: ", sizeof(line));
+    p = sappend_u(line, p, thread_switches(), sizeof(line));
+    p = sappend(line, p, "   uptime: ", sizeof(line));
+    u64 up = thread_uptime();
+    kdiv64(&up, THREAD_HZ);
+    p = sappend_u64(line, p, up, sizeof(line));
+    sappend(line, p, " s", sizeof(line));
+    put_line(y + 1, line, 0x07);
+    put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+    hold_screen();
+    return 1;
+}
+
+/* locks: how often each lock was taken, waited for and held how long */
+static int cmd_locks(const char* args, int* mode, int* explorer_sel) {
+    (void)args; (void)mode; (void)explorer_sel;
+    char line[80];
+    vga_clear();
+    put_line(1, "NAME    ACQUIRES   WAITED     RETRIES    AVG HOLD   MAX HOLD", 0x0E);
+    int y = 2;
+    struct LockInfo li;
+    for (int i = 0; i < LOCK_MAX && y < HEIGHT - 2; ++i) {
+        if (!lock_info(i, &li)) continue;
+        u64 avg = li.hold_cycles;
+        kdiv64(&avg, li.acquires ? li.acquires : 1);
+        int p = sappend(line, 0, li.name, sizeof(line));
+        while (p < 8) line[p++] = ' ';
+        p = sappend_u(line, p, li.acquires, sizeof(line));
+        while (p < 19) line[p++] = ' ';
+        p = sappend_u(line, p, li.contended, sizeof(line));
+        while (p < 30) line[p++] = ' ';
+        p = sappend_u(line, p, li.retries, sizeof(line));
+        while (p < 41) line[p++] = ' ';
+        p = sappend_u64(line, p, avg, sizeof(line));
+        while (p < 52) line[p++] = ' ';
+        line[p] = '\0';
+        sappend_u(line, p, li.hold_max, sizeof(line));
+        /* locks that had to be waited for stand out */
+        put_line(y++, line, li.contended ? 0x0C : 0x07);
+    }
+    put_line(y + 1, "Hold times are in cycles.", 0x07);
+    put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+    hold_screen();
+    return 1;
+}
+
+/* events: how long keys wait to be handled and redraws to be drawn */
+static int cmd_events(const char* args, int* mode, int* explorer_sel) {
+    (void)args; (void)mode; (void)explorer_sel;
+    const struct EventStats* st = event_stats();
+    char line[80];
+    vga_clear();
+    put_line(1, "Event loop", 0x0E);
+    put_cycles(3, "keys, queued to handled:   ", st->key_cycles, st->keys, "key");
+    int p = sappend(line, 0, "  slowest key: ", sizeof(line));
+    p = sappend_u64(line, p, st->key_max, sizeof(line));
+    sappend(line, p, " cycles", sizeof(line));
+    put_line(4, line, 0x07);
+    put_cycles(6, "frames, requested to drawn: ", st->frame_cycles, st->frames, "frame");
+    p = sappend(line, 0, "  slowest frame: ", sizeof(line));
+    p = sappend_u64(line, p, st->frame_max, sizeof(line));
+    sappend(line, p, " cycles", sizeof(line));
+    put_line(7, line, 0x07);
+    p = sappend(line, 0, "Events dropped (queue full): ", sizeof(line));
+    sappend_u(line, p, st->dropped, sizeof(line));
+    put_line(9, line, 0x07);
+    put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+    hold_screen();
+    return 1;
+}
+
+/* dmesg [n]: the last n log records, all that are left by default */
+static int cmd_dmesg(const char* args, int* mode, int* explorer_sel) {
+    (void)mode; (void)explorer_sel;
+    int n = KLOG_RING;
+    if (args[0] && (!parse_uint(args, &n) || n == 0)) {
+        show_error("Usage: dmesg [count]");
+        return 0;
+    }
+    if (n > KLOG_RING) n = KLOG_RING;
+    u32 head = klog_head();
+    u32 seq = (head > (u32)n) ? head - (u32)n : 0;
+    char line[KLOG_LINE + 1];
+    struct KlogRecord r;
+    for (; seq != head && !sh_out->err; ++seq) {
+        if (klog_read(seq, &r) != 1) continue;   /* overwritten, or still being written */
+        int len = klog_format(&r, line, KLOG_LINE);
+        line[len++] = '\n';
+        stream_write(sh_out, line, len);
+    }
+    return 1;
+}
+
+/* trace start|stop|dump: the dump goes to the serial port, or to the
+   pipe or file the command writes to */
+static int trace_to_serial(void* ctx, const char* line, int len) {
+    (void)ctx;
+    serial_write(line, len);
+    return 0;
+}
+
+static int trace_to_stream(void* ctx, const char* line, int len) {
+    return stream_write((struct Stream*)ctx, line, len) != STREAM_OK;
+}
+
+static int cmd_trace(const char* args, int* mode, int* explorer_sel) {
+    (void)mode; (void)explorer_sel;
+    struct TraceStats st;
+    char line[80];
+    if (kstrcmp(args, "start") == 0) {
+        if (trace_start() < 0) {
+            show_error("No memory for the trace rings");
+            return 0;
+        }
+        show_message("Tracing on", 0x0A);
+        return 1;
+    }
+    if (kstrcmp(args, "stop") == 0) {
+        trace_stop();
+        trace_stats(&st);
+        int p = sappend(line, 0, "Tracing off: ", sizeof(line));
+        p = sappend_u(line, p, st.records, sizeof(line));
+        p = sappend(line, p, " records, ", sizeof(line));
+        p = sappend_u(line, p, st.kept, sizeof(line));
+        sappend(line, p, " kept", sizeof(line));
+        show_message(line, 0x0A);
+        return 1;
+    }
+    if (kstrcmp(args, "dump") == 0) {
+        if (!out_is_screen(sh_out)) {
+            trace_dump(trace_to_stream, sh_out);
+            return 1;
+        }
+        if (!serial_present()) {
+            show_error("No serial port: redirect the dump to a file");
+            return 0;
+        }
+        trace_dump(trace_to_serial, 0);
+        trace_stats(&st);
+        int p = sappend(line, 0, "Sent ", sizeof(line));
+        p = sappend_u(line, p, st.kept, sizeof(line));
+        sappend(line, p, " trace records to the serial port", sizeof(line));
+        show_message(line, 0x0A);
+        return 1;
+    }
+    show_error("Usage: trace start|stop|dump");
+    return 0;
+}
+
+/* serial: traffic through the COM1 rings */
+static int cmd_serial(const char* args, int* mode, int* explorer_sel) {
+    (void)args; (void)mode; (void)explorer_sel;
+    if (!serial_present()) {
+        show_error("No serial port");
+        return 0;
+    }
+    struct SerialStats st;
+    serial_stats(&st);
+    char line[80];
+    vga_clear();
+    put_line(1, "Serial console, COM1", 0x0E);
+    int p = sappend(line, 0, "Sent:     ", sizeof(line));
+    p = sappend_u(line, p, st.tx_bytes, sizeof(line));
+    p = sappend(line, p, " bytes in ", sizeof(line));
+    p = sappend_u(line, p, st.tx_irqs, sizeof(line));
+    sappend(line, p, " FIFO refills", sizeof(line));
+    put_line(3, line, 0x07);
+    p = sappend(line, 0, "Received: ", sizeof(line));
+    p = sappend_u(line, p, st.rx_bytes, sizeof(line));
+    sappend(line, p, " bytes", sizeof(line));
+    put_line(4, line, 0x07);
+    p = sappend(line, 0, "Writers that waited for room: ", sizeof(line));
+    sappend_u(line, p, st.tx_waits, sizeof(line));
+    put_line(6, line, 0x07);
+    p = sappend(line, 0, "Bytes lost on input: ", sizeof(line));
+    sappend_u(line, p, st.rx_dropped, sizeof(line));
+    put_line(7, line, 0x07);
+    struct KlogStats ks;
+    klog_stats(&ks);
+    p = sappend(line, 0, "Log records: ", sizeof(line));
+    p = sappend_u(line, p, ks.written, sizeof(line));
+    p = sappend(line, p, " written, ", sizeof(line));
+    p = sappend_u(line, p, ks.drained, sizeof(line));
+    p = sappend(line, p, " sent, ", sizeof(line));
+    p = sappend_u(line, p, ks.lost, sizeof(line));
+    sappend(line, p, " lost", sizeof(line));
+    put_line(9, line, 0x07);
+    put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+    hold_screen();
+    return 1;
+}
+
+static int cmd_bench(const char* args, int* mode, int* explorer_sel) {
+    (void)mode; (void)explorer_sel;
+    int n = 0;
+
+    if (kstrncmp(args, "text", 4) == 0 && (args[4] == 0 || args[4] == ' ')) {
+        const char* a = args + 4;
+        while (*a == ' ') a++;
+        if (!parse_uint(a, &n)) n = BENCH_TEXT_MAX;
+        if (n < 1 || n > BENCH_TEXT_MAX) { show_error("Usage: bench text [1-100000]"); return 0; }
+
+        show_message("Running text benchmark...", 0x0E);
+        u64 text_cyc, flat_cyc;
+        if (bench_text_typing(n, &text_cyc, &flat_cyc) < 0) { show_error("Text pool exhausted"); return 0; }
+
+        vga_clear();
+        char line[80];
+        int p = sappend(line, 0, "Typing ", sizeof(line));
+        p = sappend_u(line, p, (u32)n, sizeof(line));
+        sappend(line, p, " characters at random positions", sizeof(line));
+        put_line(1, line, 0x0E);
+        put_cycles(3, "paged gap buffer: ", text_cyc, (u32)n, "key");
+        put_cycles(4, "flat array:       ", flat_cyc, (u32)n, "key");
+        put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+        hold_screen();
+        return 1;
+    }
+
+    if (kstrncmp(args, "page", 4) == 0 && (args[4] == 0 || args[4] == ' ')) {
+        const char* a = args + 4;
+        while (*a == ' ') a++;
+        if (!parse_uint(a, &n)) n = 4096;
+        if (n < 1 || n > BENCH_PAGE_MAX_KIB) { show_error("Usage: bench page [1-8192 KiB]"); return 0; }
+
+        show_message("Writing bench.log...", 0x0E);
+        u64 attach_cyc, top_cyc, bottom_cyc;
+        if (bench_text_page(n, &attach_cyc, &top_cyc, &bottom_cyc) < 0) { show_error("Out of space"); return 0; }
+
+        vga_clear();
+        char line[80];
+        int p = sappend(line, 0, "Streaming a ", sizeof(line));
+        p = sappend_u(line, p, (u32)n, sizeof(line));
+        sappend(line, p, " KiB log, one screen at each end", sizeof(line));
+        put_line(1, line, 0x0E);
+        put_cycles(3, "open (newline scan): ", attach_cyc, 1, "open");
+        put_cycles(4, "screen at the top:   ", top_cyc, BENCH_PAGE_LINES, "line");
+        put_cycles(5, "screen at the end:   ", bottom_cyc, BENCH_PAGE_LINES, "line");
+        put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+        hold_screen();
+        return 1;
+    }
+
+    if (kstrncmp(args, "switch", 6) == 0 && (args[6] == 0 || args[6] == ' ')) {
+        const char* a = args + 6;
+        while (*a == ' ') a++;
+        if (!parse_uint(a, &n)) n = 10000;
+        if (n < 1 || n > BENCH_SWITCH_MAX) { show_error("Usage: bench switch [1-100000]"); return 0; }
+
+        u64 yield_cyc, wake_cyc;
+        if (bench_switch(n, &yield_cyc, &wake_cyc) < 0) { show_error("No free thread slots"); return 0; }
+
+        vga_clear();
+        char line[80];
+        int p = sappend(line, 0, "Two threads trading the CPU ", sizeof(line));
+        p = sappend_u(line, p, (u32)n, sizeof(line));
+        sappend(line, p, " times each", sizeof(line));
+        put_line(1, line, 0x0E);
+        put_cycles(3, "thread_yield():    ", yield_cyc, 1, "switch");
+        put_cycles(4, "wakeup then wait:  ", wake_cyc, 1, "switch");
+        put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+        hold_screen();
+        return 1;
+    }
+
+    if (kstrncmp(args, "smp", 3) == 0 && (args[3] == 0 || args[3] == ' ')) {
+        const char* a = args + 3;
+        while (*a == ' ') a++;
+        if (!parse_uint(a, &n)) n = BENCH_SMP_MAX_KIB;
+        if (n < BENCH_SMP_BLOCK || n > BENCH_SMP_MAX_KIB) { show_error("Usage: bench smp [16-4096 KiB]"); return 0; }
+
+        show_message("Running SMP benchmark...", 0x0E);
+        vga_clear();
+        char line[80];
+        int p = sappend(line, 0, "CRC32 of ", sizeof(line));
+        p = sappend_u(line, p, (u32)n, sizeof(line));
+        p = sappend(line, p, " KiB in fork-join tasks, ", sizeof(line));
+        p = sappend_u(line, p, (u32)smp_count(), sizeof(line));
+        sappend(line, p, " CPUs online", sizeof(line));
+        put_line(1, line, 0x0E);
+        put_line(3, "CPUS  CYCLES        SPEEDUP  STOLEN", 0x0E);
+        u64 base = 0;
+        u32 base_sum = 0;
+        int y = 4;
+        for (int cpus = 1; cpus <= SMP_MAX_CPUS && cpus <= smp_count(); ++cpus) {
+            u32 stolen0 = 0, stolen1 = 0, sum;
+            struct PoolStats ps;
+            for (int i = 0; i < SMP_MAX_CPUS; ++i) { pool_stats(i, &ps); stolen0 += ps.stolen; }
+            u64 cyc;
+            if (!bench_smp(n, cpus, &cyc, &sum)) {
+                put_line(y, "no memory for the buffer", 0x0C);
+                break;
+            }
+            for (int i = 0; i < SMP_MAX_CPUS; ++i) { pool_stats(i, &ps); stolen1 += ps.stolen; }
+            if (cpus == 1) { base = cyc; base_sum = sum; }
+            u64 x100 = base, d = cyc;
+            while (d >> 32) { x100 >>= 1; d >>= 1; }   /* kdiv64 takes a 32-bit divisor */
+            x100 *= 100;
+            kdiv64(&x100, d ? (u32)d : 1);
+            p = sappend_u(line, 0, (u32)cpus, sizeof(line));
+            while (p < 6) line[p++] = ' ';
+            p = sappend_u64(line, p, cyc, sizeof(line));
+            while (p < 20) line[p++] = ' ';
+            p = sappend_u(line, p, (u32)x100 / 100, sizeof(line));
+            line[p++] = '.';
+            line[p++] = (char)('0' + (u32)x100 / 10 % 10);
+            line[p++] = (char)('0' + (u32)x100 % 10);
+            line[p++] = 'x';
+            while (p < 29) line[p++] = ' ';
+            line[p] = '\0';
+            p = sappend_u(line, p, stolen1 - stolen0, sizeof(line));
+            if (sum != base_sum) sappend(line, p, "  CRC MISMATCH", sizeof(line));
+            put_line(y++, line, sum == base_sum ? 0x07 : 0x0C);
+        }
+        put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+        hold_screen();
+        return 1;
+    }
+
+    if (kstrncmp(args, "rcu", 3) == 0 && (args[3] == 0 || args[3] == ' ')) {
+        const char* a = args + 3;
+        while (*a == ' ') a++;
+        if (!parse_uint(a, &n)) n = 100000;
+        if (n < 1 || n > BENCH_RCU_MAX) { show_error("Usage: bench rcu [1-1000000]"); return 0; }
+
+        show_message("Running RCU benchmark...", 0x0E);
+        vga_clear();
+        char line[80];
+        int p = sappend(line, 0, "Lookups in the CWD, ", sizeof(line));
+        p = sappend_u(line, p, (u32)n, sizeof(line));
+        sappend(line, p, " per reader CPU, one renaming writer", sizeof(line));
+        put_line(1, line, 0x0E);
+        put_line(3, "CPUS  RCU LOOKUPS/MCYC  RENAMES   LOCKED LOOKUPS/MCYC  RENAMES", 0x0E);
+        int y = 4;
+        for (int cpus = 1; cpus <= SMP_MAX_CPUS && cpus <= smp_count(); ++cpus) {
+            p = sappend_u(line, 0, (u32)cpus, sizeof(line));
+            for (int locked = 0; locked < 2; ++locked) {
+                u64 cyc;
+                u32 lookups, renames;
+                if (bench_rcu(n, cpus, locked, &cyc, &lookups, &renames) < 0) { show_error("Cannot create rcu.a"); return 0; }
+                /* lookups per million cycles */
+                u64 rate = lookups, d = cyc;
+                while (d >> 32) { rate >>= 1; d >>= 1; }
+                rate *= 1000000;
+                kdiv64(&rate, d ? (u32)d : 1);
+                while (p < (locked ? 36 : 6)) line[p++] = ' ';
+                p = sappend_u64(line, p, rate, sizeof(line));
+                while (p < (locked ? 57 : 24)) line[p++] = ' ';
+                line[p] = '\0';
+                p = sappend_u(line, p, renames, sizeof(line));
+            }
+            put_line(y++, line, 0x07);
+        }
+        struct RcuStats rs;
+        rcu_stats(&rs);
+        p = sappend(line, 0, "Grace periods: ", sizeof(line));
+        p = sappend_u(line, p, rs.grace_periods, sizeof(line));
+        p = sappend(line, p, "   versions freed: ", sizeof(line));
+        p = sappend_u(line, p, rs.freed, sizeof(line));
+        p = sappend(line, p, "   waiting: ", sizeof(line));
+        sappend_u(line, p, rs.pending, sizeof(line));
+        put_line(y + 1, line, 0x07);
+        put_line(HEIGHT - 1, "Press any key to continue...", 0x0E);
+        hold_screen();
+        return 1;
+    }
+
+    show_error("Usage: bench text [n] | bench page [KiB] | bench switch [n] | bench smp [KiB] | bench rcu [n]");
+    return 0;
+}
+
+/* undo [bytes]: show or set the editor's undo history budget */
+static int cmd_undo(const char* args, int* mode, int* explorer_sel) {
+    (void)mode; (void)explorer_sel;
+    int n;
+    if (*args) {
+        if (!parse_uint(args, &n) || n < UNDO_MIN_BUDGET || n > UNDO_ARENA_SIZE) {
+            show_error("Usage: undo [1024-65536 bytes]");
+            return 0;
+        }
+        editor_set_undo_budget(n);
+    }
+    char line[64];
+    int p = sappend(line, 0, "Undo budget: ", sizeof(line));
+    p = sappend_u(line, p, (u32)editor_undo_budget_get(), sizeof(line));
+    sappend(line, p, " bytes per file", sizeof(line));
+    show_message(line, 0x0F);
+    return 1;
+}
+
 /* Command table */
 static const shell_command_t commands[] = {
-    {"help", "Show available commands", cmd_help},
-    {"ls", "List files", cmd_list},
-    {"dir", "List files", cmd_list},
-    {"edit", "Edit a file", cmd_edit},
-    {"cat", "View file contents", cmd_cat},
-    {"snake", "Play snake game", cmd_snake},
-    {"clear", "Clear screen", cmd_clear},
-    {"cls", "Clear screen", cmd_clear},
-    {"info", "System information", cmd_info},
-    {"exit", "Return to browser", cmd_exit},
-    {"quit", "Return to browser", cmd_exit},
-    {"cd",   "Change directory",   cmd_cd},
-    {"mkdir","Make directory",     cmd_mkdir},
-    {"rmdir","Remove directory",   cmd_rmdir},
-    {"new",  "Create file",        cmd_new},
-    {"del",  "Delete file",        cmd_del},
-    {"pwd",  "Print working dir",  cmd_pwd},
-
-    {NULL, NULL, NULL} /* Terminator */
+    {"help", "Show available commands", cmd_help, NULL, CMD_DRAWS},
+    {"ls", "List files", cmd_list, NULL, 0},
+    {"dir", "List files", cmd_list, NULL, 0},
+    {"edit", "Edit a file", cmd_edit, NULL, CMD_DRAWS},
+    {"cat", "View file contents", NULL, &cat_filter, 0},
+    {"grep", "Lines matching a pattern", NULL, &grep_filter, 0},
+    {"wc",  "Count lines, words, bytes", NULL, &wc_filter, 0},
+    {"echo", "Print its arguments", cmd_echo, NULL, 0},
+    {"set",  "Set a variable",     cmd_set, NULL, 0},
+    {"let",  "Integer arithmetic", cmd_let, NULL, 0},
+    {"test", "Compare values",     cmd_test, NULL, 0},
+    {"run",  "Run a script",       cmd_run, NULL, 0},
+    {"snake", "Play snake game", cmd_snake, NULL, CMD_DRAWS},
+    {"clear", "Clear screen", cmd_clear, NULL, CMD_DRAWS},
+    {"cls", "Clear screen", cmd_clear, NULL, CMD_DRAWS},
+    {"info", "System information", cmd_info, NULL, CMD_DRAWS},
+    {"exit", "Return to browser", cmd_exit, NULL, 0},
+    {"quit", "Return to browser", cmd_exit, NULL, 0},
+    {"cd",   "Change directory",   cmd_cd, NULL, 0},
+    {"mkdir","Make directory",     cmd_mkdir, NULL, 0},
+    {"rmdir","Remove directory",   cmd_rmdir, NULL, 0},
+    {"new",  "Create file",        cmd_new, NULL, 0},
+    {"del",  "Delete file",        cmd_del, NULL, 0},
+    {"pwd",  "Print working dir",  cmd_pwd, NULL, 0},
+    {"blk",  "Block I/O stats",    cmd_blk, NULL, CMD_DRAWS},
+    {"bench","Run a benchmark",    cmd_bench, NULL, CMD_DRAWS},
+    {"undo", "Editor undo budget", cmd_undo, NULL, CMD_DRAWS},
+    {"events","Input/frame latency", cmd_events, NULL, CMD_DRAWS},
+    {"threads","List kernel threads", cmd_threads, NULL, CMD_DRAWS},
+    {"locks",  "Show lock statistics", cmd_locks, NULL, CMD_DRAWS},
+    {"serial", "Show serial port statistics", cmd_serial, NULL, CMD_DRAWS},
+    {"dmesg",  "Show the kernel log", cmd_dmesg, NULL, 0},
+    {"trace",  "Record tracepoints: trace start|stop|dump", cmd_trace, NULL, 0},
+
+    {NULL, NULL, NULL, NULL, 0} /* Terminator */
 };
 
 /* Utility functions */
 static void show_error(const char* message) {
+    char where[80];
+    int p = 0;
+    if (script_depth) {
+        /* "script:line: message", and the script goes on */
+        struct ScriptFrame* fr = &frames[script_depth - 1];
+        p = sappend(where, 0, fr->sc->name, sizeof(where));
+        p = sappend(where, p, ":", sizeof(where));
+        p = sappend_u(where, p, (u32)fr->line, sizeof(where));
+        p = sappend(where, p, ": ", sizeof(where));
+    }
+    sappend(where, p, message, sizeof(where));
+    klog(KLOG_ERR, "%s", where);
+    if (sl.remote) {
+        serial_puts(where);
+        serial_puts("\n");
+        sl.sent = 1;
+    }
     for (int x = 1; x < 78; ++x) vga_putcell(x, 23, ' ', 0x07);
-    for (int i = 0; message[i] && i < 70; i++) {
-        vga_putcell(1 + i, 23, message[i], 0x0C);
+    for (int i = 0; where[i] && i < 70; i++) {
+        vga_putcell(1 + i, 23, where[i], 0x0C);
     }
-    read_key();
+    hold_screen();
 }
 
 static void show_message(const char* message, unsigned char color) {
+    if (sl.remote) {
+        serial_puts(message);
+        serial_puts("\n");
+    }
     for (int x = 1; x < 78; ++x) vga_putcell(x, 23, ' ', 0x07);
     for (int i = 0; message[i] && i < 70; i++) {
         vga_putcell(1 + i, 23, message[i], color);
     }
 }
 
-/* Add command to history */
-static void add_to_history(const char* cmd) {
-    if (!cmd[0]) return;
-    
-    /* Don't duplicates of the last command */
-    if (history_count > 0 && 
-        kstrcmp(cmd_history[(history_count - 1) % CMD_HISTORY_SIZE], cmd) == 0) {
-        return;
+/* -------- Completion --------
+   Tab completes the word before the cursor: a command name at the start
+   of a pipeline stage, otherwise a name in the CWD. Both come from
+   tries, so it costs the length of the word, not the number of names. */
+static struct Trie cmd_trie;     /* value: index into commands[] */
+static struct Trie entry_trie;   /* value: 1 for directories */
+static struct Dir* entry_dir;
+static u32 entry_version;
+
+void shell_init(void) {
+    history_init();
+    trie_init(&cmd_trie);
+    for (int i = 0; commands[i].name; i++) trie_insert(&cmd_trie, commands[i].name, i);
+    serial_puts("NoirOS serial console\n" SERIAL_PROMPT);
+}
+
+/* names in the CWD; the trie follows the directory's change stamp */
+static const struct Trie* cwd_entries(void) {
+    struct Dir* d = fs_cwd();
+    if (d == entry_dir && d->version == entry_version) return &entry_trie;
+    trie_init(&entry_trie);
+    rcu_read_lock();
+    const struct DirList* l = fs_dir_list(d);
+    for (int i = 0; i < l->subdir_count; ++i) trie_insert(&entry_trie, l->subdirs[i]->name, 1);
+    for (int i = 0; i < l->file_count; ++i) trie_insert(&entry_trie, l->files[i]->name, 0);
+    rcu_read_unlock();
+    entry_dir = d;
+    entry_version = d->version;
+    return &entry_trie;
+}
+
+#define CAND_ROW (HEIGHT - 1)   /* bottom edge of the status box, under the prompt */
+
+static int show_candidate(void* ctx, const char* name, int value) {
+    int* x = ctx;
+    int n = kstrlen(name) + (value == 1);
+    if (*x + n + 4 >= WIDTH - 1) {
+        for (int i = 0; i < 3; ++i) vga_putcell((*x)++, CAND_ROW, '.', 0x08);
+        return 1;
     }
-    
-    int index = history_count % CMD_HISTORY_SIZE;
-    int len = 0;
-    while (cmd[len] && len < MAX_CMD_LEN - 1) {
-        cmd_history[index][len] = cmd[len];
-        len++;
+    for (int i = 0; name[i]; ++i) vga_putcell((*x)++, CAND_ROW, name[i], 0x07);
+    if (value == 1) vga_putcell((*x)++, CAND_ROW, '/', 0x07);
+    *x += 2;
+    return 0;
+}
+
+/* Extend out[0..*ipos) by what every match of its last word shares, or
+   list the matches under the prompt when that is nothing */
+static void complete_word(char* out, int* ipos, int* cx, int outsz, int sy) {
+    int ws = *ipos;
+    while (ws > 0 && out[ws - 1] != ' ' && out[ws - 1] != '|' && out[ws - 1] != '>') ws--;
+    int b = ws;
+    while (b > 0 && out[b - 1] == ' ') b--;
+    const struct Trie* t = (b == 0 || out[b - 1] == '|') ? &cmd_trie : cwd_entries();
+
+    char ext[TRIE_NAME_MAX];
+    int value;
+    int n = trie_complete(t, out + ws, *ipos - ws, ext, sizeof(ext), &value);
+    if (n == 0) return;
+    int e = kstrlen(ext);
+    if (n == 1 && value != 1 && e < TRIE_NAME_MAX - 1) {   /* a whole file or command name */
+        ext[e++] = ' ';
+        ext[e] = '\0';
+    }
+    for (int i = 0; ext[i] && *ipos < outsz - 1; ++i) {
+        out[(*ipos)++] = ext[i];
+        vga_putcell((*cx)++, sy, ext[i], 0x0F);
+    }
+    if (n > 1 && !ext[0]) {
+        int x = 1;
+        for (int i = 0; i < WIDTH - 1; ++i) vga_putcell(i, CAND_ROW, ' ', 0x07);
+        trie_each(t, out + ws, *ipos - ws, show_candidate, &x);
     }
-    cmd_history[index][len] = '\0';
-    
-    history_count++;
-    history_pos = history_count;
 }
-/* history support starts here */
-static int shell_readline_enhanced(const char *prompt, char *out, int outsz) {
-    const int sy = 23;
-    const int sx = 1;
-    int cx;
 
-    /* Clear status area */
-    for (int x = sx; x < 78; ++x) vga_putcell(x, sy, ' ', 0x07);
+/* -------- Line input --------
+   The command line is edited a key at a time as the events come in;
+   between keys its whole state lives here. */
+#define LINE_X 1
+#define LINE_Y 23
+#define LINE_PROMPT "cmd> "
+
+static struct {
+    char buf[MAX_CMD_LEN];
+    int len, cx;
+    int hist;        /* entry shown, history_end() for a new line */
+    int searching;   /* Ctrl+R */
+    char q[MAX_CMD_LEN];
+    int qn, match, failing;
+} li;
+
+/* line outcomes */
+#define LINE_MORE   0
+#define LINE_DONE   1
+#define LINE_CANCEL 2
 
-    /* Draw prompt */
+static int draw_prompt(const char* prompt, int sx, int sy) {
+    for (int x = sx; x < 78; ++x) vga_putcell(x, sy, ' ', 0x07);
     int pi = 0;
     for (; prompt[pi]; ++pi) vga_putcell(sx + pi, sy, prompt[pi], 0x0E);
+    return sx + pi;
+}
 
-    cx = sx + pi;
-    int ipos = 0;
-    int local_history_pos = history_count;
+/* replace the input with s */
+static void set_input(char* out, int* ipos, int* cx, int outsz, int sy, const char* s) {
+    while (*ipos > 0) {
+        (*ipos)--;
+        (*cx)--;
+        vga_putcell(*cx, sy, ' ', 0x07);
+    }
+    for (int i = 0; s[i] && *ipos < outsz - 1; i++) {
+        out[(*ipos)++] = s[i];
+        vga_putcell((*cx)++, sy, s[i], 0x0F);
+    }
+}
 
-    while (1) {
-        int ch = read_key();
+static void search_draw(void) {
+    int x = draw_prompt(li.failing ? "failing search `" : "search `", LINE_X, LINE_Y);
+    for (int i = 0; i < li.qn; ++i) vga_putcell(x++, LINE_Y, li.q[i], 0x0F);
+    vga_putcell(x++, LINE_Y, '\'', 0x0E);
+    vga_putcell(x++, LINE_Y, ':', 0x0E);
+    x++;
+    const char* m = (li.match >= 0) ? history_get(li.match) : "";
+    for (int i = 0; m[i] && x < 78; ++i) vga_putcell(x++, LINE_Y, m[i], 0x07);
+}
 
-        if (ch == '\n' || ch == '\r') {
-            out[ipos] = '\0';
-            return 1;
+static void line_draw(void) {
+    if (li.searching) {
+        search_draw();
+        return;
+    }
+    li.cx = draw_prompt(LINE_PROMPT, LINE_X, LINE_Y);
+    for (int i = 0; i < li.len; ++i) vga_putcell(li.cx++, LINE_Y, li.buf[i], 0x0F);
+}
+
+static void line_open(void) {
+    li.len = 0;
+    li.hist = history_end();
+    li.searching = 0;
+    line_draw();
+}
+
+/* Ctrl+R: search the history backwards as the query is typed, Ctrl+R
+   again for an older match. A key that ends the search is returned, to
+   be handled as line input with the match taken as the input; ESC ends
+   it keeping the input, and -1 means the search used the key. */
+static int search_key(int ch) {
+    if (ch <= 0) return -1;   /* a release or a modifier: no key, the search goes on */
+    if (ch == 18) {   /* Ctrl+R */
+        int older = li.qn ? history_search(li.q, li.qn, (li.match >= 0) ? li.match : history_end()) : -1;
+        li.failing = (li.qn && older < 0);
+        if (older >= 0) li.match = older;
+    } else if (ch == '\b') {
+        if (li.qn > 0) li.qn--;
+        li.match = history_search(li.q, li.qn, history_end());
+        li.failing = 0;
+    } else if (ch >= 32 && ch <= 126) {
+        if (li.qn < MAX_CMD_LEN - 1) li.q[li.qn++] = (char)ch;
+        /* a longer query can still match the current entry */
+        int m = history_search(li.q, li.qn, (li.match >= 0) ? li.match + 1 : history_end());
+        li.failing = (m < 0);
+        if (m >= 0) li.match = m;
+    } else {
+        li.searching = 0;
+        li.buf[li.len] = '\0';
+        char keep[MAX_CMD_LEN];
+        kstrncpy(keep, (ch != K_ESC && li.match >= 0) ? history_get(li.match) : li.buf, sizeof(keep));
+        li.cx = draw_prompt(LINE_PROMPT, LINE_X, LINE_Y);
+        li.len = 0;
+        set_input(li.buf, &li.len, &li.cx, MAX_CMD_LEN, LINE_Y, keep);
+        return (ch == K_ESC) ? -1 : ch;
+    }
+    search_draw();
+    return -1;
+}
+
+static int line_key(int key) {
+    if (li.searching && (key = search_key(key)) < 0) return LINE_MORE;
+
+    if (key == 18) {   /* Ctrl+R */
+        li.searching = 1;
+        li.qn = 0;
+        li.match = -1;
+        li.failing = 0;
+        search_draw();
+        return LINE_MORE;
+    }
+    if (key == '\n' || key == '\r') {
+        li.buf[li.len] = '\0';
+        return LINE_DONE;
+    }
+    if (key == K_ESC) return LINE_CANCEL;
+    if (key == '\t') {
+        complete_word(li.buf, &li.len, &li.cx, MAX_CMD_LEN, LINE_Y);
+        return LINE_MORE;
+    }
+    if (key == '\b') {
+        if (li.len > 0) {
+            li.len--;
+            li.cx--;
+            vga_putcell(li.cx, LINE_Y, ' ', 0x07);
         }
+        return LINE_MORE;
+    }
 
-        if (ch == K_ESC) {
-            out[0] = '\0';
-            ui_draw();
+    /* History navigation */
+    if (key == K_ARROW_UP) {
+        if (li.hist > history_first()) set_input(li.buf, &li.len, &li.cx, MAX_CMD_LEN, LINE_Y, history_get(--li.hist));
+        return LINE_MORE;
+    }
+    if (key == K_ARROW_DOWN) {
+        if (li.hist < history_end() - 1) set_input(li.buf, &li.len, &li.cx, MAX_CMD_LEN, LINE_Y, history_get(++li.hist));
+        return LINE_MORE;
+    }
+
+    /* Regular character input */
+    if (key >= 32 && key <= 126 && li.len < MAX_CMD_LEN - 1) {
+        li.buf[li.len++] = (char)key;
+        vga_putcell(li.cx++, LINE_Y, (char)key, 0x0F);
+    }
+    return LINE_MORE;
+}
+
+/* -------- Screen output --------
+   What reaches the screen is shown full-page the way cat always showed a
+   file: the first page opens the view, and once it is full the writer is
+   told to stop instead of producing what nobody will see. */
+static struct {
+    const char* title;
+    int open;
+    int line, col;
+} viewer;
+
+static void viewer_open(void) {
+    vga_clear();
+    char title[80];
+    int pos = sappend(title, 0, "Viewing: ", 70);
+    sappend(title, pos, viewer.title, 70);
+    for (int x = 0; x < WIDTH; ++x) vga_putcell(x, 0, ' ', 0x1F);
+    for (int j = 0; title[j] && j < WIDTH - 2; ++j) vga_putcell(1 + j, 0, title[j], 0x1F);
+    viewer.open = 1;
+    viewer.line = 2;
+    viewer.col = 1;
+}
+
+static int screen_sink(void* ctx, struct PipePage* pg) {
+    (void)ctx;
+    if (!viewer.open) viewer_open();
+    serial_write(pg->data, pg->len);
+    sl.sent = 1;
+    for (int j = 0; j < pg->len && viewer.line < HEIGHT - 2; j++) {
+        char ch = pg->data[j];
+        if (ch == '\n') {
+            viewer.line++;
+            viewer.col = 1;
+        } else if (ch >= 32 && ch <= 126) {
+            if (viewer.col < WIDTH - 1) vga_putcell(viewer.col++, viewer.line, ch, 0x07);
+        } else if (ch == '\t') {
+            viewer.col += 4;
+            if (viewer.col >= WIDTH) viewer.col = WIDTH - 1;
+        }
+    }
+    pipe_page_free(pg);
+    /* the port gets the whole output, not just the first page */
+    return (viewer.line < HEIGHT - 2 || sl.remote) ? STREAM_OK : STREAM_ERR_CLOSED;
+}
+
+static void viewer_close(void) {
+    if (!viewer.open) return;
+    viewer.open = 0;
+    const char* footer = "Press any key to return...";
+    for (int j = 0; footer[j]; ++j) vga_putcell(1 + j, HEIGHT - 1, footer[j], 0x0E);
+    hold_screen();
+}
+
+/* -------- Pipelines --------
+   "a | b | c > file": each command writes into a stream whose pages go
+   straight to the next one, so the whole pipeline advances together a
+   page at a time and no command's output is ever held in full. A script
+   line runs while the `run` that started it is still a stage of its own
+   pipeline, so every script depth has its own set of stages. */
+static struct Stage stage_sets[SCRIPT_MAX_NEST + 1][MAX_STAGES];
+
+static int stage_sink(void* ctx, struct PipePage* pg) {
+    struct Stage* st = ctx;
+    return st->cmd->filter->feed(st, pg);
+}
+
+/* a script line's output joins that of the `run` it is part of */
+static int outer_sink(void* ctx, struct PipePage* pg) {
+    return stream_pass((struct Stream*)ctx, pg);
+}
+
+static const shell_command_t* find_command(const char* name, int len) {
+    int i = trie_find(&cmd_trie, name, len);
+    return (i >= 0) ? &commands[i] : NULL;
+}
+
+static char* trim(char* s) {
+    while (*s == ' ') s++;
+    int n = kstrlen(s);
+    while (n > 0 && s[n - 1] == ' ') s[--n] = '\0';
+    return s;
+}
+
+static void unknown_command(const char* name, int len) {
+    char error_msg[80];
+    int pos = sappend(error_msg, 0, "Unknown command: ", sizeof(error_msg));
+    for (int i = 0; i < len && pos < 70; i++) error_msg[pos++] = name[i];
+    error_msg[pos] = '\0';
+    show_error(error_msg);
+}
+
+/* Split line (modified in place) into stages and an optional
+   "> file" / ">> file" at the end; -> number of stages, 0 on error */
+static int parse_pipeline(char* line, struct Stage* stages, char** target, int* append) {
+    *target = 0;
+    *append = 0;
+    for (int i = 0; line[i]; ++i) {
+        if (line[i] != '>') continue;
+        line[i] = '\0';
+        if (line[i + 1] == '>') { *append = 1; i++; }
+        *target = trim(line + i + 1);
+        if (!(*target)[0]) { show_error("Missing file after >"); return 0; }
+        break;
+    }
+
+    int n = 0;
+    char* part = line;
+    for (;;) {
+        char* bar = part;
+        while (*bar && *bar != '|') bar++;
+        int last = (*bar == '\0');
+        *bar = '\0';
+        char* cmd = trim(part);
+        if (!cmd[0]) { show_error("Empty command in pipeline"); return 0; }
+        if (n == MAX_STAGES) { show_error("Too many commands in pipeline"); return 0; }
+
+        int len = 0;
+        while (cmd[len] && cmd[len] != ' ') len++;
+        struct Stage* st = &stages[n];
+        st->cmd = find_command(cmd, len);
+        if (!st->cmd) { unknown_command(cmd, len); return 0; }
+        st->args = trim(cmd + len);
+        st->src = 0;
+        if (n > 0 && !st->cmd->filter) { show_error("Command does not read a pipe"); return 0; }
+        if (st->cmd->draws && (*target || !last)) {
+            show_error("Command draws on screen: it cannot be piped or redirected");
             return 0;
         }
+        n++;
+        if (last) break;
+        part = bar + 1;
+    }
+    return n;
+}
 
-        if (ch == '\b') {
-            if (ipos > 0) {
-                ipos--;
-                cx--;
-                vga_putcell(cx, sy, ' ', 0x07);
-            }
-            continue;
+/* Parse and execute command */
+static int execute_pipeline(const char* input, int* mode, int* explorer_sel) {
+    if (!input[0]) return 1;
+    char line[SCRIPT_LINE_MAX];
+    kstrncpy(line, input, sizeof(line));
+    line[sizeof(line) - 1] = '\0';
+
+    struct Stage* stages = stage_sets[script_depth];
+    struct Stream* outer = sh_out;   /* the enclosing `run`'s, in a script */
+    char* target;
+    int append;
+    int n = parse_pipeline(line, stages, &target, &append);
+    if (n == 0) return 0;
+
+    /* filters get their arguments first; only the first may name a file */
+    for (int i = 0; i < n; ++i) {
+        struct Stage* st = &stages[i];
+        if (!st->cmd->filter) continue;
+        if (st->cmd->filter->start(st, st->args) < 0 || (i > 0) != !st->src) {
+            show_error(st->cmd->filter->usage);
+            return 0;
         }
-        
-        /* History navigation */
-        if (ch == K_ARROW_UP && history_count > 0) {
-            if (local_history_pos > 0) local_history_pos--;
-            
-            /* Clear current input */
-            while (ipos > 0) {
-                ipos--;
-                cx--;
-                vga_putcell(cx, sy, ' ', 0x07);
-            }
-            
-            /* Copy from history */
-            const char* hist_cmd = cmd_history[local_history_pos % CMD_HISTORY_SIZE];
-            for (int i = 0; hist_cmd[i] && ipos < outsz - 1; i++) {
-                out[ipos] = hist_cmd[i];
-                vga_putcell(cx++, sy, hist_cmd[i], 0x0F);
-                ipos++;
-            }
-            continue;
+    }
+
+    /* wire each stage to the next, the last to the file or the screen */
+    for (int i = 0; i + 1 < n; ++i) stream_init(&stages[i].out, stage_sink, &stages[i + 1]);
+    struct Stream* last = &stages[n - 1].out;
+    if (target) {
+        if (stream_open_file(last, target, append) < 0) {
+            show_error("Cannot write to file");
+            return 0;
         }
-        
-        if (ch == K_ARROW_DOWN && history_count > 0) {
-            if (local_history_pos < history_count - 1) {
-                local_history_pos++;
-                
-                /* Clear current input */
-                while (ipos > 0) {
-                    ipos--;
-                    cx--;
-                    vga_putcell(cx, sy, ' ', 0x07);
-                }
-                
-                /* Copy from history */
-                const char* hist_cmd = cmd_history[local_history_pos % CMD_HISTORY_SIZE];
-                for (int i = 0; hist_cmd[i] && ipos < outsz - 1; i++) {
-                    out[ipos] = hist_cmd[i];
-                    vga_putcell(cx++, sy, hist_cmd[i], 0x0F);
-                    ipos++;
-                }
-            }
-            continue;
+    } else if (script_depth > 0 && outer && !out_is_screen(outer)) {
+        stream_init(last, outer_sink, outer);
+    } else {
+        stream_init(last, screen_sink, 0);
+        viewer.title = input;
+    }
+
+    int ok = 1;
+    struct Stage* first = &stages[0];
+    if (first->cmd->filter) {
+        struct Stream in;
+        stream_init(&in, stage_sink, first);
+        int r = stream_copy_file(&in, first->src);
+        stream_close(&in);
+        if (r == STREAM_ERR_NOTFOUND) { show_error("File not found"); ok = 0; }
+    } else {
+        sh_out = &first->out;
+        ok = first->cmd->handler(first->args, mode, explorer_sel);
+        sh_out = outer;
+    }
+
+    /* drain front to back: closing a stage's stream feeds the next the
+       rest of its input before that one is finished */
+    int err = STREAM_OK;
+    for (int i = 0; i < n; ++i) {
+        struct Stage* st = &stages[i];
+        if (st->cmd->filter) {
+            int r = st->cmd->filter->finish(st);
+            if (r < 0 && !st->out.err) st->out.err = r;
         }
+        int r = stream_close(&st->out);
+        if (r < 0 && r != STREAM_ERR_CLOSED && !err) err = r;
+    }
+    viewer_close();
+    if (err == STREAM_ERR_NOMEM) show_error("Out of pipe memory");
+    else if (err < 0) show_error("Write failed");
+    return ok && err == STREAM_OK;
+}
 
-        /* Regular character input */
-        if (ch >= 32 && ch <= 126) {
-            if (ipos < outsz - 1) {
-                out[ipos++] = (char)ch;
-                vga_putcell(cx++, sy, (char)ch, 0x0F);
-            }
+/* -------- Serial console --------
+   Lines typed on COM1 run like the ones typed at the prompt, whatever
+   screen is up. Output a command streams to the screen is copied to the
+   port in full; a command that only draws, like info, is sent as the
+   text it left on screen. */
+static void send_screen(void) {
+    char row[WIDTH + 1];
+    int text = 0, blank = 0;   /* blank rows since the last with text */
+    for (int y = 0; y < HEIGHT; ++y) {
+        int n = 0;
+        for (int x = 0; x < WIDTH; ++x) {
+            char c = vga_getcell_char(x, y);
+            row[x] = (c >= 32 && c <= 126) ? c : ' ';
+            if (row[x] != ' ') n = x + 1;
+        }
+        if (n == 0) {
+            blank += text;
+            continue;
         }
+        for (; blank > 0; --blank) serial_puts("\n");
+        text = 1;
+        row[n] = '\n';
+        serial_write(row, n + 1);
     }
 }
 
-/* Parse and execute command */
-static int execute_command(const char* input, int* mode, int* explorer_sel) {
-    if (!input[0]) return 1;
-    
-    /* Find command separator */
-    int cmd_len = 0;
-    while (input[cmd_len] && input[cmd_len] != ' ') cmd_len++;
-    
-    /* Extract arguments */
-    const char* args = "";
-    if (input[cmd_len] == ' ') {
-        args = &input[cmd_len + 1];
-        /* Skip leading spaces in arguments */
-        while (*args == ' ') args++;
+static int serial_run(const char* text, int explorer_sel, int* mode) {
+    int prev = sh_state, was = *mode;
+    char line[SCRIPT_LINE_MAX];
+    history_add(text);
+    expand_vars(text, line, sizeof(line));
+    sh_state = SH_BROWSE;
+    sl.remote = 1;
+    sl.sent = 0;
+    run_line(line, mode, &explorer_sel);
+    sl.remote = 0;
+    if (sh_state == SH_HOLD && !sl.sent) send_screen();
+    /* a line being typed at the keyboard, or another screen, comes back */
+    if (prev == SH_LINE || was != MODE_BROWSER) sh_state = prev;
+    if (sh_state != SH_HOLD) event_request_redraw();
+    return ui_get_selected();
+}
+
+int shell_serial_char(int c, int explorer_sel, int *mode) {
+    int last = sl.last;
+    sl.last = c;
+    if (sl.esc || c == K_ESC) {
+        /* ESC, then '[' and parameters up to a final letter */
+        sl.esc = (c == K_ESC) || (c == '[' && last == K_ESC) || (c >= '0' && c <= '9') || c == ';';
+        return explorer_sel;
     }
-    
-    /* Find and execute command */
-    for (int i = 0; commands[i].name; i++) {
-        if (kstrncmp(input, commands[i].name, cmd_len) == 0 && 
-            kstrlen(commands[i].name) == cmd_len) {
-            return commands[i].handler(args, mode, explorer_sel);
+    if (c == '\r' || c == '\n') {
+        if (c == '\n' && last == '\r') return explorer_sel;
+        serial_puts("\n");
+        sl.buf[sl.len] = '\0';
+        sl.len = 0;
+        if (sl.buf[0]) explorer_sel = serial_run(sl.buf, explorer_sel, mode);
+        serial_puts(SERIAL_PROMPT);
+    } else if (c == '\b' || c == 127) {
+        if (sl.len > 0) {
+            sl.len--;
+            serial_puts("\b \b");
         }
+    } else if (c == 3) {   /* ^C drops the line */
+        sl.len = 0;
+        serial_puts("^C\n" SERIAL_PROMPT);
+    } else if (c >= 32 && c <= 126 && sl.len < SCRIPT_LINE_MAX - 1) {
+        char ch = (char)c;
+        sl.buf[sl.len++] = ch;
+        serial_write(&ch, 1);
     }
-    
-    /* Command not found */
-    char error_msg[80];
-    int pos = 0;
-    const char* prefix = "Unknown command: ";
-    for (int i = 0; prefix[i]; i++) error_msg[pos++] = prefix[i];
-    for (int i = 0; i < cmd_len && pos < 70; i++) error_msg[pos++] = input[i];
-    error_msg[pos] = '\0';
-    
-    show_error(error_msg);
-    return 0;
+    return explorer_sel;
+}
+
+static int execute_command(const char* input, int* mode, int* explorer_sel) {
+    TRACE_BEGIN(TP_EXEC, 0);
+    int ok = execute_pipeline(input, mode, explorer_sel);
+    TRACE_END(TP_EXEC, ok);
+    return ok;
 }
 
-/* Main shell loop function */
-/* Replace your shell_loop() with this version */
-int shell_loop(int explorer_sel_in, int *mode) {
-    /* Note: explorer_sel is stored in UI; accept explorer_sel_in but use ui_get_selected() */
-    int explorer_sel = explorer_sel_in;
+void shell_draw(void) {
+    if (sh_state == SH_HOLD) return;   /* the command's screen stays */
+    ui_draw();
+    if (sh_state == SH_LINE) line_draw();
+}
 
-    int k = read_key();
+static int handle_key(int k, int explorer_sel, int *mode) {
+    if (sh_state == SH_HOLD) {
+        /* any key dismisses the screen and is used up doing so */
+        sh_state = SH_BROWSE;
+        event_request_redraw();
+        return ui_get_selected();
+    }
+
+    if (sh_state == SH_LINE) {
+        int r = line_key(k);
+        if (r == LINE_MORE) return ui_get_selected();
+        sh_state = SH_BROWSE;
+        if (r == LINE_DONE && li.buf[0]) {
+            history_add(li.buf);
+            char line[SCRIPT_LINE_MAX];
+            expand_vars(li.buf, line, sizeof(line));
+            run_line(line, mode, &explorer_sel);
+        }
+        if (sh_state != SH_HOLD) event_request_redraw();
+        return ui_get_selected();
+    }
 
     /* Let UI see the key first (sets pressed states / invokes callbacks) */
     ui_handle_key(k);
 
-    /* If F1/F2/F3 were pressed, handled by ui_handle_key and don't want to
-       feed them to the rest of shell logic. Just redraw and return. */
-#ifdef K_F1
-    if (k == K_F1) { ui_draw(); return ui_get_selected(); }
-#endif
-#ifdef K_F2
-    if (k == K_F2) { ui_draw(); return ui_get_selected(); }
-#endif
-#ifdef K_F3
-    if (k == K_F3) { ui_draw(); return ui_get_selected(); }
-#endif
+    /* F1/F2/F3 were handled by ui_handle_key; just redraw */
+    if (k == K_F1 || k == K_F2 || k == K_F3) {
+        event_request_redraw();
+        return ui_get_selected();
+    }
 
     /* Navigation keys: use combined total (dirs + files) */
     int total = fs_dir_count() + fs_count();
@@ -519,40 +2048,30 @@ int shell_loop(int explorer_sel_in, int *mode) {
         int sel = ui_get_selected();
         if (sel > 0) sel--;
         ui_set_selected(sel);
-        ui_draw();
-        return ui_get_selected();
+        event_request_redraw();
     } else if (k == K_ARROW_DOWN || k == 's' || k == 'S') {
         int sel = ui_get_selected();
         int max = (total > 0) ? total - 1 : 0;
         if (sel < max) sel++;
         ui_set_selected(sel);
-        ui_draw();
-        return ui_get_selected();
+        event_request_redraw();
     } else if (k == K_PAGE_UP) {
         ui_scroll_viewer(-3);
-        ui_draw();
-        return ui_get_selected();
+        event_request_redraw();
     } else if (k == K_PAGE_DOWN) {
         ui_scroll_viewer(3);
-        ui_draw();
-        return ui_get_selected();
+        event_request_redraw();
     } else if (k == '\n' || k == '\r') {
         /* CMD input mode */
-        char input[MAX_CMD_LEN];
-        if (!shell_readline_enhanced("cmd> ", input, sizeof(input))) {
-            return ui_get_selected(); /* Aborted */
-        }
-
-        if (input[0]) {
-            add_to_history(input);
-            execute_command(input, mode, &explorer_sel); /* note: this expects explorer_sel index-by-ref */
-        }
-
-        ui_draw();
-        return ui_get_selected();
+        sh_state = SH_LINE;
+        line_open();
     }
-
-    /* Nothing handled: just return current selection */
     return ui_get_selected();
 }
 
+int shell_handle_key(int k, int explorer_sel, int *mode) {
+    TRACE_BEGIN(TP_SHELL_KEY, k);
+    int sel = handle_key(k, explorer_sel, mode);
+    TRACE_END(TP_SHELL_KEY, k);
+    return sel;
+}
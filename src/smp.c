@@ -0,0 +1,177 @@
+#include "../include/smp.h"
+#include "../include/cpu.h"
+#include "../include/thread.h"
+#include "../include/pool.h"
+#include "../include/paging.h"
+#include "../include/klog.h"
+#include "../include/util.h"
+
+/* Local APIC registers */
+#define LAPIC_ID    0x020
+#define LAPIC_EOI   0x0B0
+#define LAPIC_SVR   0x0F0
+#define LAPIC_ICR_LO 0x300
+#define LAPIC_ICR_HI 0x310
+
+#define ICR_INIT     0x00000500
+#define ICR_STARTUP  0x00000600
+#define ICR_PENDING  0x00001000
+#define ICR_ASSERT   0x00004000
+#define ICR_LEVEL    0x00008000
+#define ICR_OTHERS   0x000C0000   /* all but self */
+
+static volatile u32* lapic = 0;
+static struct Cpu cpus[SMP_MAX_CPUS];
+static int ncpus = 1;              /* found in the MADT, the BSP first */
+static u8 apic_to_cpu[256];
+static u8 ap_stacks[SMP_MAX_CPUS][SMP_STACK] __attribute__((aligned(16)));
+
+extern char ap_trampoline[], ap_trampoline_end[], ap_stack[];   /* start.S */
+
+static u32 lapic_read(u32 reg) { return lapic[reg / 4]; }
+static void lapic_write(u32 reg, u32 v) { lapic[reg / 4] = v; }
+
+static void lapic_enable(void) {
+    lapic_write(LAPIC_SVR, 0x100 | VEC_SPURIOUS);
+}
+
+static void lapic_ipi(u8 apic_id, u32 cmd) {
+    lapic_write(LAPIC_ICR_HI, (u32)apic_id << 24);
+    lapic_write(LAPIC_ICR_LO, cmd);
+    while (lapic_read(LAPIC_ICR_LO) & ICR_PENDING) __asm__ volatile ("pause");
+}
+
+static void ipi_eoi(int vector) {
+    (void)vector;   /* taking it is the whole point */
+    this_cpu()->ipis++;
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/* -------- ACPI -------- */
+static int checksum_ok(const u8* p, u32 n) {
+    u8 sum = 0;
+    for (u32 i = 0; i < n; ++i) sum += p[i];
+    return sum == 0;
+}
+
+static const u8* find_rsdp_in(u32 from, u32 to) {
+    for (u32 a = from; a + 20 <= to; a += 16)
+        if (kmemcmp((const void*)a, "RSD PTR ", 8) == 0 && checksum_ok((const u8*)a, 20)) return (const u8*)a;
+    return 0;
+}
+
+static const u8* find_madt(void) {
+    u16 seg;
+    kmemcpy(&seg, (const void*)0x40E, 2);   /* EBDA segment, from the BIOS data area */
+    u32 ebda = (u32)seg << 4;
+    const u8* rsdp = ebda ? find_rsdp_in(ebda, ebda + 1024) : 0;
+    if (!rsdp) rsdp = find_rsdp_in(0xE0000, 0x100000);
+    if (!rsdp) return 0;
+    /* the tables may sit above the RAM paging_init() mapped */
+    const u8* rsdt = (const u8*)*(const u32*)(rsdp + 16);
+    paging_map_mmio((u32)rsdt, 36);
+    u32 len = *(const u32*)(rsdt + 4);
+    paging_map_mmio((u32)rsdt, len);
+    if (kmemcmp(rsdt, "RSDT", 4) != 0 || !checksum_ok(rsdt, len)) return 0;
+    for (u32 off = 36; off + 4 <= len; off += 4) {
+        const u8* t = (const u8*)*(const u32*)(rsdt + off);
+        paging_map_mmio((u32)t, 36);
+        paging_map_mmio((u32)t, *(const u32*)(t + 4));
+        if (kmemcmp(t, "APIC", 4) == 0 && checksum_ok(t, *(const u32*)(t + 4))) return t;
+    }
+    return 0;
+}
+
+/* the local APIC address and one Cpu per enabled processor entry */
+static int parse_madt(const u8* madt) {
+    u32 len = *(const u32*)(madt + 4);
+    lapic = (volatile u32*)*(const u32*)(madt + 36);
+    paging_map_mmio((u32)lapic, PAGE_SIZE);
+    u8 bsp = (u8)(lapic_read(LAPIC_ID) >> 24);
+    cpus[0].apic_id = bsp;
+    ncpus = 1;
+    for (u32 off = 44; off + 2 <= len; off += madt[off + 1]) {
+        const u8* e = madt + off;
+        if (e[1] < 2) break;
+        if (e[0] != 0 || !(*(const u32*)(e + 4) & 1) || e[3] == bsp) continue;
+        if (ncpus == SMP_MAX_CPUS) break;
+        cpus[ncpus++].apic_id = e[3];
+    }
+    for (int i = 0; i < ncpus; ++i) {
+        cpus[i].id = i;
+        apic_to_cpu[cpus[i].apic_id] = (u8)i;
+    }
+    return ncpus;
+}
+
+/* -------- APs -------- */
+void ap_main(void) {
+    int me = apic_to_cpu[lapic_read(LAPIC_ID) >> 24];
+    cpu_init_ap(me);
+    paging_init_ap();
+    lapic_enable();
+    cpus[me].online = 1;
+    pool_worker(me);
+}
+
+static int start_ap(struct Cpu* c) {
+    *(u32*)(AP_TRAMPOLINE + (ap_stack - ap_trampoline)) = (u32)(ap_stacks[c->id] + SMP_STACK);
+    lapic_ipi(c->apic_id, ICR_INIT | ICR_ASSERT | ICR_LEVEL);
+    thread_sleep(10);
+    for (int i = 0; i < 2 && !c->online; ++i) {
+        lapic_ipi(c->apic_id, ICR_STARTUP | (AP_TRAMPOLINE >> 12));
+        thread_sleep(1);
+    }
+    for (int t = 0; t < 100 && !c->online; ++t) thread_sleep(1);
+    return c->online;
+}
+
+int smp_init(void) {
+    u32 a, b, c, d;
+    __asm__ volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1));
+    cpus[0].online = 1;
+    const u8* madt = (d & (1u << 9)) ? find_madt() : 0;   /* CPUID: on-chip APIC */
+    if (!madt || parse_madt(madt) == 1) {
+        ncpus = 1;
+        return 1;
+    }
+    lapic_enable();
+    ipi_handler = ipi_eoi;
+    kmemcpy((void*)AP_TRAMPOLINE, ap_trampoline, (int)(ap_trampoline_end - ap_trampoline));
+    int online = 1;
+    for (int i = 1; i < ncpus; ++i) {
+        if (start_ap(&cpus[i])) online++;
+        else klog(KLOG_WARN, "smp: cpu %d (APIC %d) did not start", i, cpus[i].apic_id);
+    }
+    return online;
+}
+
+int smp_count(void) {
+    int n = 0;
+    for (int i = 0; i < ncpus; ++i) n += cpus[i].online;
+    return n;
+}
+
+int smp_cpu(void) {
+    return cpu_id();
+}
+
+const struct Cpu* smp_get(int i) {
+    return (i >= 0 && i < ncpus) ? &cpus[i] : 0;
+}
+
+void smp_wake_all(void) {
+    if (lapic && ncpus > 1) lapic_ipi(0, ICR_OTHERS | ICR_ASSERT | VEC_IPI_WAKE);
+}
+
+void smp_sync(void) {
+    if (smp_count() < 2) return;
+    u32 seen[SMP_MAX_CPUS];
+    int me = cpu_id();
+    for (int i = 0; i < ncpus; ++i) seen[i] = cpu_percpu(i)->ipis;
+    lapic_ipi(0, ICR_OTHERS | ICR_ASSERT | VEC_IPI_WAKE);
+    for (int i = 0; i < ncpus; ++i) {
+        if (i == me || !cpus[i].online) continue;
+        while (cpu_percpu(i)->ipis == seen[i]) __asm__ volatile ("pause");
+    }
+}
@@ -0,0 +1,30 @@
+#include "../include/spinlock.h"
+
+static struct Spinlock* locks[LOCK_MAX];
+static volatile u32 nlocks = 0;
+
+void spin_wait(struct Spinlock* l, u16 ticket) {
+    while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != ticket) __asm__ volatile ("pause");
+    l->contended++;   /* ours now */
+}
+
+void lock_list(struct Spinlock* l) {
+    /* we hold l, so only one CPU gets here per lock */
+    l->listed = 1;
+    u32 i = __atomic_fetch_add(&nlocks, 1, __ATOMIC_RELAXED);
+    if (i < LOCK_MAX) __atomic_store_n(&locks[i], l, __ATOMIC_RELEASE);
+}
+
+int lock_info(int i, struct LockInfo* out) {
+    if (i < 0 || i >= LOCK_MAX || (u32)i >= nlocks) return 0;
+    struct Spinlock* l = __atomic_load_n(&locks[i], __ATOMIC_ACQUIRE);
+    if (!l) return 0;
+    /* a snapshot without the lock: good enough for statistics */
+    out->name = l->name ? l->name : "?";
+    out->acquires = l->acquires;
+    out->contended = l->contended;
+    out->retries = l->retries;
+    out->hold_max = l->hold_max;
+    out->hold_cycles = l->hold_cycles;
+    return 1;
+}
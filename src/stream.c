@@ -0,0 +1,149 @@
+#include "../include/stream.h"
+#include "../include/fs.h"
+#include "../include/util.h"
+
+static struct PipePage pipe_pool[PIPE_POOL_PAGES];
+static struct PipePage* pipe_free_list = 0;
+static int pipe_free_count = 0;
+static int pipe_pool_ready = 0;
+
+/* -------- Page pool -------- */
+struct PipePage* pipe_page_alloc(void) {
+    if (!pipe_pool_ready) {
+        for (int i = 0; i < PIPE_POOL_PAGES; ++i) pipe_page_free(&pipe_pool[i]);
+        pipe_pool_ready = 1;
+    }
+    struct PipePage* pg = pipe_free_list;
+    if (!pg) return 0;
+    pipe_free_list = pg->next;
+    pipe_free_count--;
+    pg->next = 0;
+    pg->len = 0;
+    return pg;
+}
+
+void pipe_page_free(struct PipePage* pg) {
+    pg->next = pipe_free_list;
+    pipe_free_list = pg;
+    pipe_free_count++;
+}
+
+int pipe_free_pages(void) {
+    return pipe_pool_ready ? pipe_free_count : PIPE_POOL_PAGES;
+}
+
+/* -------- File sink: pages are appended through the FS layer -------- */
+static int file_sink(void* ctx, struct PipePage* pg) {
+    struct Stream* s = ctx;
+    int r = fs_pwrite(s->fd, pg->data, pg->len, 0);
+    int n = pg->len;
+    pipe_page_free(pg);
+    return (r == n) ? STREAM_OK : STREAM_ERR_IO;
+}
+
+/* hand the current page to the sink, whatever its fill */
+static int hand_over(struct Stream* s) {
+    struct PipePage* pg = s->page;
+    s->page = 0;
+    if (!pg) return s->err;
+    if (pg->len == 0 || s->err) {
+        pipe_page_free(pg);
+        return s->err;
+    }
+    int r = s->sink(s->ctx, pg);
+    if (r < 0 && !s->err) s->err = r;
+    return s->err;
+}
+
+/* -------- Public API -------- */
+void stream_init(struct Stream* s, stream_sink_fn sink, void* ctx) {
+    s->page = 0;
+    s->sink = sink;
+    s->ctx = ctx;
+    s->fd = -1;
+    s->err = STREAM_OK;
+    s->bytes = 0;
+}
+
+int stream_open_file(struct Stream* s, const char* name, int append) {
+    stream_init(s, file_sink, s);
+    if (!fs_find(name)) {
+        int r = fs_create(name, FILE_TEXT);
+        if (r < 0) return STREAM_ERR_IO;
+    }
+    s->fd = fs_open(name, FS_O_WRONLY | FS_O_APPEND | (append ? 0 : FS_O_TRUNC));
+    return (s->fd < 0) ? STREAM_ERR_IO : STREAM_OK;
+}
+
+char* stream_space(struct Stream* s, int* room) {
+    *room = 0;
+    if (s->err) return 0;
+    if (!s->page && !(s->page = pipe_page_alloc())) {
+        s->err = STREAM_ERR_NOMEM;
+        return 0;
+    }
+    *room = PIPE_PAGE_SIZE - s->page->len;
+    return s->page->data + s->page->len;
+}
+
+void stream_commit(struct Stream* s, int n) {
+    if (!s->page || n <= 0) return;
+    s->page->len += n;
+    s->bytes += (u32)n;
+    if (s->page->len == PIPE_PAGE_SIZE) hand_over(s);
+}
+
+int stream_write(struct Stream* s, const char* buf, int n) {
+    while (n > 0) {
+        int room;
+        char* at = stream_space(s, &room);
+        if (!at) return s->err;
+        if (room > n) room = n;
+        kmemcpy(at, buf, room);
+        stream_commit(s, room);
+        buf += room;
+        n -= room;
+    }
+    return s->err;
+}
+
+int stream_pass(struct Stream* s, struct PipePage* pg) {
+    hand_over(s);   /* keep the byte order */
+    if (s->err) {
+        pipe_page_free(pg);
+        return s->err;
+    }
+    s->bytes += (u32)pg->len;
+    s->page = pg;
+    return hand_over(s);
+}
+
+int stream_flush(struct Stream* s) {
+    return hand_over(s);
+}
+
+int stream_close(struct Stream* s) {
+    int r = hand_over(s);
+    if (s->fd >= 0) fs_close(s->fd);
+    s->fd = -1;
+    return r;
+}
+
+int stream_copy_file(struct Stream* s, const char* name) {
+    int fd = fs_open(name, FS_O_RDONLY);
+    if (fd < 0) return STREAM_ERR_NOTFOUND;
+    int total = 0, n = 1;
+    while (n > 0) {
+        int room;
+        char* at = stream_space(s, &room);
+        if (!at) break;
+        n = fs_read(fd, at, room);
+        if (n > 0) {
+            stream_commit(s, n);
+            total += n;
+        }
+    }
+    fs_close(fd);
+    if (n < 0) return STREAM_ERR_IO;
+    return (s->err && s->err != STREAM_ERR_CLOSED) ? s->err : total;
+}
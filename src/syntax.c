@@ -0,0 +1,325 @@
+#include "../include/syntax.h"
+#include "../include/util.h"
+
+/* Lexer modes; only the ones marked (carried) survive a line end */
+#define M_CODE     0
+#define M_BLOCK    1   /* C block comment (carried) */
+#define M_LINE     2   /* comment to end of line */
+#define M_DQ       3   /* "string" (carried in shell) */
+#define M_SQ       4   /* 'string' (carried in shell) */
+#define M_PREPROC  5   /* C preprocessor line */
+#define M_FENCE    6   /* markdown ``` block (carried) */
+#define M_FENCE_END 7  /* rest of a closing ``` line */
+#define M_HEADING  8   /* markdown # line */
+#define M_ICODE    9   /* markdown `inline code` */
+
+#define SYN_NO_HINT 0xFF   /* matches no mode */
+
+static const char* const c_keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if",
+    "inline", "int", "long", "register", "return", "short", "signed",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned",
+    "void", "volatile", "while", "u8", "u16", "u32", "u64", 0
+};
+
+static const char* const sh_keywords[] = {
+    "if", "then", "else", "elif", "fi", "for", "while", "until", "do",
+    "done", "case", "esac", "in", "function", "return", "local", "export",
+    "break", "continue", "exit", 0
+};
+
+static int is_ident(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static int is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static int ends_with(const char* s, const char* ext) {
+    int ls = kstrlen(s), le = kstrlen(ext);
+    return ls > le && kstrcmp(s + ls - le, ext) == 0;
+}
+
+int syntax_lang_for(const char* filename) {
+    if (!filename) return SYN_NONE;
+    if (ends_with(filename, ".c") || ends_with(filename, ".h")) return SYN_C;
+    if (ends_with(filename, ".md")) return SYN_MD;
+    if (ends_with(filename, ".sh")) return SYN_SH;
+    return SYN_NONE;
+}
+
+/* -------- Per-language character rules -------- */
+static u8 lex_c(struct SynLexer* lx, char c, u8* prev_attr) {
+    switch (lx->mode) {
+    case M_BLOCK:
+        if (lx->prev == '*' && c == '/') { lx->mode = M_CODE; c = 0; }  /* the closing slash cannot start a new comment */
+        lx->prev = c;
+        return SYN_ATTR_COMMENT;
+    case M_LINE:
+        return SYN_ATTR_COMMENT;
+    case M_PREPROC:
+        return SYN_ATTR_PREPROC;
+    case M_DQ:
+    case M_SQ:
+        if (lx->esc) lx->esc = 0;
+        else if (c == '\\') lx->esc = 1;
+        else if (c == (lx->mode == M_DQ ? '"' : '\'')) lx->mode = M_CODE;
+        return SYN_ATTR_STRING;
+    }
+
+    /* code */
+    if (lx->prev == '/' && (c == '*' || c == '/')) {
+        lx->mode = (c == '*') ? M_BLOCK : M_LINE;
+        if (prev_attr) *prev_attr = SYN_ATTR_COMMENT;
+        lx->prev = 0;
+        return SYN_ATTR_COMMENT;
+    }
+    char prev = lx->prev;
+    lx->prev = c;
+    if (c == '"') { lx->mode = M_DQ; return SYN_ATTR_STRING; }
+    if (c == '\'') { lx->mode = M_SQ; return SYN_ATTR_STRING; }
+    if (c == '#' && lx->col == 0) { lx->mode = M_PREPROC; return SYN_ATTR_PREPROC; }
+    if (is_digit(c) && !is_ident(prev)) lx->num = 1;
+    else if (!is_ident(c) && c != '.') lx->num = 0;
+    return lx->num ? SYN_ATTR_NUMBER : SYN_ATTR_TEXT;
+}
+
+static u8 lex_md(struct SynLexer* lx, char c) {
+    /* a run of backticks from the start of the line opens or closes a fence */
+    int opening = (c == '`' && lx->ticks == lx->col);
+    if (opening) lx->ticks++;
+
+    switch (lx->mode) {
+    case M_FENCE:
+        if (opening && lx->ticks == 3) lx->mode = M_FENCE_END;
+        return SYN_ATTR_CODE;
+    case M_FENCE_END:
+    case M_ICODE:
+        if (lx->mode == M_ICODE && c == '`') lx->mode = M_CODE;
+        return SYN_ATTR_CODE;
+    case M_HEADING:
+        return SYN_ATTR_HEADING;
+    }
+
+    if (opening) {
+        if (lx->ticks == 3) lx->mode = M_FENCE;
+        return SYN_ATTR_CODE;
+    }
+    if (lx->ticks > 0 && lx->ticks == lx->col) {
+        /* one or two leading backticks were inline code after all */
+        lx->ticks = 0;
+        if (lx->col & 1) lx->mode = M_ICODE;
+    }
+    if (lx->mode == M_ICODE) return SYN_ATTR_CODE;   /* just opened above */
+    if (c == '`') { lx->mode = M_ICODE; return SYN_ATTR_CODE; }
+    if (c == '#' && lx->col == 0) { lx->mode = M_HEADING; return SYN_ATTR_HEADING; }
+    if ((c == '>' && lx->col == 0) ||
+        ((c == '-' || c == '*' || c == '+') && lx->prev == 0))
+        return SYN_ATTR_MARKER;
+    if (c != ' ' && c != '\t') lx->prev = c;   /* prev stays 0 through leading blanks */
+    return SYN_ATTR_TEXT;
+}
+
+static u8 lex_sh(struct SynLexer* lx, char c) {
+    char prev = lx->prev;
+    lx->prev = c;
+    switch (lx->mode) {
+    case M_LINE:
+        return SYN_ATTR_COMMENT;
+    case M_DQ:
+        if (lx->esc) lx->esc = 0;
+        else if (c == '\\') lx->esc = 1;
+        else if (c == '"') lx->mode = M_CODE;
+        return SYN_ATTR_STRING;
+    case M_SQ:
+        if (c == '\'') lx->mode = M_CODE;
+        return SYN_ATTR_STRING;
+    }
+
+    if (lx->var) {
+        if (is_ident(c) || c == '{' || c == '}') return SYN_ATTR_VAR;
+        lx->var = 0;
+    }
+    if (c == '#' && (lx->col == 0 || prev == ' ' || prev == '\t')) { lx->mode = M_LINE; return SYN_ATTR_COMMENT; }
+    if (c == '"') { lx->mode = M_DQ; return SYN_ATTR_STRING; }
+    if (c == '\'') { lx->mode = M_SQ; return SYN_ATTR_STRING; }
+    if (c == '$') { lx->var = 1; return SYN_ATTR_VAR; }
+    if (is_digit(c) && !is_ident(prev)) lx->num = 1;
+    else if (!is_ident(c)) lx->num = 0;
+    return lx->num ? SYN_ATTR_NUMBER : SYN_ATTR_TEXT;
+}
+
+/* -------- Lexer -------- */
+void syntax_begin(struct SynLexer* lx, int lang, u8 state) {
+    lx->lang = (u8)lang;
+    lx->mode = state;
+    lx->esc = lx->num = lx->var = lx->ticks = 0;
+    lx->prev = 0;
+    lx->col = 0;
+}
+
+void syntax_scan(struct SynLexer* lx, const char* s, int n, u8* attrs) {
+    for (int i = 0; i < n; ++i) {
+        u8 a;
+        if (lx->lang == SYN_C)       a = lex_c(lx, s[i], (attrs && i > 0) ? &attrs[i - 1] : 0);
+        else if (lx->lang == SYN_MD) a = lex_md(lx, s[i]);
+        else if (lx->lang == SYN_SH) a = lex_sh(lx, s[i]);
+        else a = SYN_ATTR_TEXT;
+        if (attrs) attrs[i] = a;
+        lx->col++;
+    }
+}
+
+u8 syntax_end(struct SynLexer* lx) {
+    switch (lx->mode) {
+    case M_BLOCK:
+        return (lx->lang == SYN_C) ? M_BLOCK : M_CODE;
+    case M_FENCE:
+        return M_FENCE;
+    case M_DQ:
+    case M_SQ:
+        return (lx->lang == SYN_SH) ? lx->mode : M_CODE;
+    }
+    return M_CODE;
+}
+
+/* plain-text words that are keywords get the keyword colour */
+static void color_keywords(int lang, const char* s, int n, u8* attrs) {
+    const char* const* kw = (lang == SYN_C) ? c_keywords : (lang == SYN_SH) ? sh_keywords : 0;
+    if (!kw) return;
+    for (int i = 0; i < n; ) {
+        if (!is_ident(s[i]) || attrs[i] != SYN_ATTR_TEXT || (i > 0 && is_ident(s[i - 1]))) { i++; continue; }
+        int j = i;
+        while (j < n && is_ident(s[j])) j++;
+        for (int k = 0; kw[k]; ++k) {
+            int L = kstrlen(kw[k]);
+            if (L == j - i && kstrncmp(s + i, kw[k], L) == 0) {
+                for (int m = i; m < j; ++m) attrs[m] = SYN_ATTR_KEYWORD;
+                break;
+            }
+        }
+        i = j;
+    }
+}
+
+void syntax_color(int lang, u8 state, const char* s, int n, u8* attrs) {
+    struct SynLexer lx;
+    syntax_begin(&lx, lang, state);
+    syntax_scan(&lx, s, n, attrs);
+    color_keywords(lang, s, n, attrs);
+}
+
+/* bytes lexed around a span so words cut by its edges are judged whole;
+   longer than any keyword */
+#define SPAN_CONTEXT 16
+#define SPAN_MAX     128
+
+void syntax_color_span(int lang, u8 state, struct Text* t, int off, int len,
+                       int from, int n, u8* attrs) {
+    if (n <= 0) return;
+    if (lang == SYN_NONE || n > SPAN_MAX - 2 * SPAN_CONTEXT) {
+        kmemset(attrs, SYN_ATTR_TEXT, n);
+        return;
+    }
+    int lo = (from > SPAN_CONTEXT) ? from - SPAN_CONTEXT : 0;
+    int hi = from + n + SPAN_CONTEXT;
+    if (hi > len) hi = len;
+
+    struct SynLexer lx;
+    syntax_begin(&lx, lang, state);
+    if (lo > 0) {
+        /* a wrapped row further into the line: lex up to it first */
+        struct TextIter it;
+        text_iter_init(&it, t, off);
+        char c;
+        for (int i = 0; i < lo; ++i) {
+            c = (char)text_iter_next(&it);
+            syntax_scan(&lx, &c, 1, 0);
+        }
+    }
+    char buf[SPAN_MAX];
+    u8 span[SPAN_MAX];
+    text_copy(t, off + lo, buf, hi - lo);
+    syntax_scan(&lx, buf, hi - lo, span);
+    color_keywords(lang, buf, hi - lo, span);
+    kmemcpy(attrs, span + (from - lo), n);
+}
+
+/* -------- Line-start cache -------- */
+void syntax_reset(struct SynCache* c, int lang) {
+    c->lang = (u8)lang;
+    c->state[0] = M_CODE;
+    c->valid = 1;
+    c->hint_end = 1;
+}
+
+void syntax_edit(struct SynCache* c, int line, int delta) {
+    if (c->lang == SYN_NONE || line < 0 || line + 1 >= SYN_MAX_LINES) return;
+
+    /* start modes below the edit move with their lines */
+    int from = line + 1;
+    int tail = SYN_MAX_LINES - from;
+    if (delta > 0 && delta < tail) {
+        kmemmove(&c->state[from + delta], &c->state[from], tail - delta);
+        kmemset(&c->state[from], SYN_NO_HINT, delta);   /* new lines have no old mode */
+    }
+    else if (delta < 0 && -delta < tail)
+        kmemmove(&c->state[from], &c->state[from - delta], tail + delta);
+    if (c->hint_end > from) {
+        c->hint_end += delta;
+        if (c->hint_end < from) c->hint_end = from;
+        if (c->hint_end > SYN_MAX_LINES) c->hint_end = SYN_MAX_LINES;
+    }
+
+    if (from < c->valid) {
+        /* exact modes past the edit become the hints; older hints beyond
+           them may not follow from the last exact line, so they go */
+        c->hint_end = c->valid + delta;
+        if (c->hint_end > SYN_MAX_LINES) c->hint_end = SYN_MAX_LINES;
+        c->valid = from;
+    } else if (c->hint_end > from) {
+        /* hints below an edited hint line were lexed from its old text */
+        c->hint_end = from;
+    }
+    if (c->hint_end < c->valid) c->hint_end = c->valid;
+}
+
+void syntax_forget(struct SynCache* c, int line) {
+    if (line < 0) line = 0;
+    if (line + 1 < c->valid) c->valid = line + 1;
+    c->hint_end = c->valid;
+}
+
+u8 syntax_state_at(struct SynCache* c, struct Text* t, int line) {
+    if (c->lang == SYN_NONE || line <= 0 || line >= SYN_MAX_LINES) return M_CODE;
+    if (line < c->valid) return c->state[line];
+
+    /* lex forward from the last exact line; stop early once the mode at a
+       line start matches its hint, since everything after is unchanged */
+    struct TextIter it;
+    text_iter_init(&it, t, text_line_start(t, c->valid - 1));
+    char buf[128];
+    while (c->valid <= line) {
+        struct SynLexer lx;
+        syntax_begin(&lx, c->lang, c->state[c->valid - 1]);
+        int n = 0, ch;
+        while ((ch = text_iter_next(&it)) >= 0 && ch != '\n') {
+            buf[n++] = (char)ch;
+            if (n == (int)sizeof(buf)) { syntax_scan(&lx, buf, n, 0); n = 0; }
+        }
+        syntax_scan(&lx, buf, n, 0);
+        u8 s = syntax_end(&lx);
+
+        if (c->valid < c->hint_end && c->state[c->valid] == s) {
+            c->valid = c->hint_end;
+            if (line < c->valid) break;
+            text_iter_init(&it, t, text_line_start(t, c->valid - 1));
+            continue;
+        }
+        c->state[c->valid++] = s;
+        if (c->hint_end < c->valid) c->hint_end = c->valid;
+    }
+    return c->state[line];
+}
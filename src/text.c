@@ -0,0 +1,581 @@
+#include "../include/text.h"
+#include "../include/util.h"
+
+/* -------- Frame pool (shared by all documents) -------- */
+static char text_frames[TEXT_POOL_PAGES][TEXT_PAGE_SIZE];
+static u16  free_stack[TEXT_POOL_PAGES];
+static int  free_top = -1;   /* -1 until first use */
+
+/* frames a fault may always claim, so reading never starves behind edits */
+#define TEXT_FAULT_RESERVE 2
+
+/* attached documents: the only ones whose pages can be evicted */
+static struct Text* backed[TEXT_MAX_BACKED];
+
+static void pool_init(void) {
+    if (free_top >= 0) return;
+    for (int i = 0; i < TEXT_POOL_PAGES; ++i) free_stack[i] = (u16)(TEXT_POOL_PAGES - 1 - i);
+    free_top = TEXT_POOL_PAGES;
+}
+
+static int frame_alloc(void) {
+    pool_init();
+    if (free_top == 0) return -1;
+    return free_stack[--free_top];
+}
+
+static void frame_release(u16 frame) {
+    free_stack[free_top++] = frame;
+}
+
+int text_free_frames(void) {
+    pool_init();
+    return free_top;
+}
+
+/* -------- Eviction -------- */
+static inline int page_len(const struct TextPage* p) {
+    return TEXT_PAGE_SIZE - (p->gap_end - p->gap_start);
+}
+
+static inline int page_clean(const struct TextPage* p) {
+    return p->frame != TEXT_NO_FRAME && p->src >= 0;
+}
+
+/* Clock over t's pages: a clean page touched since the last pass gets a
+   second chance, the first one that was not loses its frame. */
+static int evict_from(struct Text* t) {
+    for (int n = 0; n < 2 * t->npages; ++n) {
+        if (t->clock >= t->npages) t->clock = 0;
+        struct TextPage* p = &t->pages[t->clock++];
+        if (!page_clean(p)) continue;
+        if (p->ref) { p->ref = 0; continue; }
+        int frame = p->frame;
+        int len = page_len(p);
+        p->frame = TEXT_NO_FRAME;
+        p->gap_start = (u16)len;   /* reloads land in front of the gap */
+        p->gap_end = TEXT_PAGE_SIZE;
+        return frame;
+    }
+    return -1;
+}
+
+static int frame_get(void) {
+    int frame = frame_alloc();
+    for (int d = 0; frame < 0 && d < TEXT_MAX_BACKED; ++d)
+        if (backed[d]) frame = evict_from(backed[d]);
+    return frame;
+}
+
+/* free frames plus clean ones that could be evicted, counted up to need */
+static int frames_available(int need) {
+    int n = text_free_frames();
+    for (int d = 0; d < TEXT_MAX_BACKED && n < need; ++d) {
+        struct Text* t = backed[d];
+        if (!t) continue;
+        for (int i = 0; i < t->npages && n < need; ++i)
+            if (page_clean(&t->pages[i])) n++;
+    }
+    return n >= need;
+}
+
+/* -------- Fenwick trees over page order -------- */
+static void fw_add(int* fw, int n, int i, int delta) {
+    for (++i; i <= n; i += i & -i) fw[i] += delta;
+}
+
+/* sum over pages [0, i) */
+static int fw_prefix(const int* fw, int i) {
+    int s = 0;
+    for (; i > 0; i -= i & -i) s += fw[i];
+    return s;
+}
+
+/* First page whose running total exceeds target; *rem gets target minus
+   the total of the pages before it. Returns n if the total is <= target. */
+static int fw_find(const int* fw, int n, int target, int* rem) {
+    int pos = 0;
+    if (n > 0) {
+        for (int step = 1 << (31 - __builtin_clz((u32)n)); step; step >>= 1) {
+            if (pos + step <= n && fw[pos + step] <= target) {
+                pos += step;
+                target -= fw[pos];
+            }
+        }
+    }
+    *rem = target;
+    return pos;
+}
+
+/* O(P) rebuild after pages were inserted, removed or reshaped */
+static void fw_rebuild(struct Text* t) {
+    int n = t->npages;
+    for (int i = 1; i <= n; ++i) {
+        t->fw_len[i] = page_len(&t->pages[i - 1]);
+        t->fw_nl[i]  = t->pages[i - 1].nl;
+    }
+    for (int i = 1; i <= n; ++i) {
+        int j = i + (i & -i);
+        if (j <= n) {
+            t->fw_len[j] += t->fw_len[i];
+            t->fw_nl[j]  += t->fw_nl[i];
+        }
+    }
+}
+
+/* -------- Page helpers -------- */
+static inline char* page_data(const struct TextPage* p) {
+    return text_frames[p->frame];
+}
+
+static inline char page_char(const struct TextPage* p, int i) {
+    const char* d = page_data(p);
+    return (i < p->gap_start) ? d[i] : d[i + (p->gap_end - p->gap_start)];
+}
+
+static int count_nl(const char* s, int n) {
+    int c = 0;
+    for (int i = 0; i < n; ++i) if (s[i] == '\n') c++;
+    return c;
+}
+
+/* Make p resident, reading it from the source if it is cold; 0 when no
+   frame can be found or the source no longer has the bytes (t is then
+   marked lost). Cold pages keep their bytes in front of the gap. */
+static int page_load(struct Text* t, struct TextPage* p) {
+    if (p->frame == TEXT_NO_FRAME) {
+        int frame = frame_get();
+        if (frame < 0) return 0;
+        int len = page_len(p);
+        int r = t->read(t->read_ctx, text_frames[frame], len, p->src);
+        if (r < len) {
+            /* deleted or truncated under us: nothing to make the page from */
+            frame_release((u16)frame);
+            t->lost = 1;
+            return 0;
+        }
+        p->frame = (u16)frame;
+    }
+    p->ref = 1;
+    return 1;
+}
+
+/* load p for editing; edited pages are pinned until the next rebase */
+static int page_touch(struct Text* t, struct TextPage* p) {
+    if (!page_load(t, p)) return 0;
+    p->src = -1;
+    return 1;
+}
+
+/* index of the k-th (0-based) newline at or after `from`, -1 if none */
+static int page_find_nl(struct Text* t, struct TextPage* p, int from, int k) {
+    if (!page_load(t, p)) return -1;
+    const char* d = page_data(p);
+    int gap = p->gap_end - p->gap_start;
+    int len = page_len(p);
+    for (int i = from; i < p->gap_start; ++i)
+        if (d[i] == '\n' && k-- == 0) return i;
+    for (int i = (from > p->gap_start ? from : p->gap_start); i < len; ++i)
+        if (d[i + gap] == '\n' && k-- == 0) return i;
+    return -1;
+}
+
+static void page_move_gap(struct TextPage* p, int idx) {
+    char* d = page_data(p);
+    if (idx < p->gap_start) {
+        int n = p->gap_start - idx;
+        kmemmove(d + p->gap_end - n, d + idx, n);
+        p->gap_start = (u16)idx;
+        p->gap_end   = (u16)(p->gap_end - n);
+    } else if (idx > p->gap_start) {
+        int n = idx - p->gap_start;
+        kmemmove(d + p->gap_start, d + p->gap_end, n);
+        p->gap_start = (u16)(p->gap_start + n);
+        p->gap_end   = (u16)(p->gap_end + n);
+    }
+}
+
+/* copy page bytes [from, from+n) out, across the gap */
+static void page_copy_out(const struct TextPage* p, int from, char* out, int n) {
+    const char* d = page_data(p);
+    if (from < p->gap_start) {
+        int k = p->gap_start - from;
+        if (k > n) k = n;
+        kmemcpy(out, d + from, k);
+        out += k; from += k; n -= k;
+    }
+    if (n > 0) kmemcpy(out, d + from + (p->gap_end - p->gap_start), n);
+}
+
+/* Page holding offset off, *idx set inside it; -1 if off is past the end.
+   For inserts an offset on a page boundary resolves to the end of the
+   earlier page, so typing keeps filling the page the gap is already in. */
+static int locate(const struct Text* t, int off, int* idx, int for_insert) {
+    if (off < 0 || off > t->len || t->npages == 0) { *idx = 0; return -1; }
+    int i = fw_find(t->fw_len, t->npages, off, idx);
+    if (for_insert && i > 0 && *idx == 0) {
+        i--;
+        *idx = page_len(&t->pages[i]);
+    }
+    if (i >= t->npages) { *idx = 0; return -1; }
+    return i;
+}
+
+/* drop pages [at, at+count) with a single shift of the page table */
+static void page_remove_run(struct Text* t, int at, int count) {
+    for (int k = at; k < at + count; ++k)
+        if (t->pages[k].frame != TEXT_NO_FRAME) frame_release(t->pages[k].frame);
+    kmemmove(&t->pages[at], &t->pages[at + count], (t->npages - at - count) * (int)sizeof(struct TextPage));
+    t->npages -= count;
+}
+
+/* count new empty pages at position `at` with a single shift of the page
+   table; caller rebuilds the trees */
+static int page_insert_run(struct Text* t, int at, int count) {
+    if (t->npages + count > TEXT_MAX_PAGES) return 0;
+    kmemmove(&t->pages[at + count], &t->pages[at], (t->npages - at) * (int)sizeof(struct TextPage));
+    t->npages += count;
+    for (int k = 0; k < count; ++k) {
+        struct TextPage* p = &t->pages[at + k];
+        p->frame = TEXT_NO_FRAME;   /* not evictable while frames are found */
+        p->gap_start = 0;
+        p->gap_end = TEXT_PAGE_SIZE;
+        p->nl = 0;
+        p->src = -1;
+        p->ref = 1;
+    }
+    for (int k = 0; k < count; ++k) {
+        int frame = frame_get();
+        if (frame < 0) {
+            page_remove_run(t, at, count);
+            return 0;
+        }
+        t->pages[at + k].frame = (u16)frame;
+    }
+    return 1;
+}
+
+/* fold page i+1 into page i when both fit in half a page; cold pages
+   are left alone so a delete never pulls in more of the source */
+static void page_try_merge(struct Text* t, int i) {
+    if (i < 0 || i + 1 >= t->npages) return;
+    struct TextPage* p = &t->pages[i];
+    struct TextPage* q = &t->pages[i + 1];
+    if (p->frame == TEXT_NO_FRAME || q->frame == TEXT_NO_FRAME) return;
+    int lp = page_len(p), lq = page_len(q);
+    if (lp + lq > TEXT_PAGE_SIZE / 2) return;
+    page_touch(t, q);
+    page_touch(t, p);
+    page_move_gap(p, lp);
+    page_copy_out(q, 0, page_data(p) + lp, lq);
+    p->gap_start = (u16)(lp + lq);
+    p->nl = (u16)(p->nl + q->nl);
+    page_remove_run(t, i + 1, 1);
+    fw_rebuild(t);
+}
+
+/* -------- Public API -------- */
+void text_init(struct Text* t) {
+    pool_init();
+    t->npages = 0;
+    t->len = 0;
+    t->nl = 0;
+    t->read = 0;
+    t->read_ctx = 0;
+    t->clock = 0;
+    t->lost = 0;
+}
+
+void text_free(struct Text* t) {
+    for (int i = 0; i < t->npages; ++i)
+        if (t->pages[i].frame != TEXT_NO_FRAME) frame_release(t->pages[i].frame);
+    for (int d = 0; d < TEXT_MAX_BACKED; ++d)
+        if (backed[d] == t) backed[d] = 0;
+    t->npages = 0;
+    t->len = 0;
+    t->nl = 0;
+    t->read = 0;
+}
+
+int text_length(const struct Text* t) { return t->len; }
+
+int text_attach(struct Text* t, text_read_fn read, void* ctx, int len) {
+    text_free(t);
+    text_init(t);
+    if (!read || len < 0) return TEXT_ERR_RANGE;
+    if ((len + TEXT_COLD_FILL - 1) / TEXT_COLD_FILL > TEXT_MAX_PAGES) return TEXT_ERR_NOMEM;
+    int slot = -1;
+    for (int d = 0; d < TEXT_MAX_BACKED; ++d) if (!backed[d]) { slot = d; break; }
+    if (slot < 0) return TEXT_ERR_NOMEM;
+    backed[slot] = t;
+    t->read = read;
+    t->read_ctx = ctx;
+
+    /* the start of the source stays resident while at least half the
+       pool is free; past that pages are scanned for newlines and left cold */
+    static char scan[TEXT_COLD_FILL];
+    for (int off = 0; off < len; ) {
+        int n = len - off;
+        if (n > TEXT_COLD_FILL) n = TEXT_COLD_FILL;
+        int frame = (text_free_frames() > TEXT_POOL_PAGES / 2) ? frame_alloc() : -1;
+        char* buf = (frame >= 0) ? text_frames[frame] : scan;
+        int r = read(ctx, buf, n, off);
+        if (r <= 0) {
+            if (frame >= 0) frame_release((u16)frame);
+            break;
+        }
+        struct TextPage* p = &t->pages[t->npages++];
+        p->frame = (frame >= 0) ? (u16)frame : TEXT_NO_FRAME;
+        p->gap_start = (u16)r;
+        p->gap_end = TEXT_PAGE_SIZE;
+        p->nl = (u16)count_nl(buf, r);
+        p->src = off;
+        p->ref = 0;
+        t->len += r;
+        t->nl += p->nl;
+        off += r;
+    }
+    fw_rebuild(t);
+    return TEXT_OK;
+}
+
+int text_source_lost(const struct Text* t) {
+    return t->lost;
+}
+
+int text_fully_loaded(const struct Text* t) {
+    for (int i = 0; i < t->npages; ++i)
+        if (t->pages[i].frame == TEXT_NO_FRAME) return 0;
+    return 1;
+}
+
+void text_rebase(struct Text* t) {
+    if (!t->read) return;   /* nothing to reload from */
+    int off = 0;
+    for (int i = 0; i < t->npages; ++i) {
+        t->pages[i].src = off;
+        off += page_len(&t->pages[i]);
+    }
+}
+
+int text_detach(struct Text* t) {
+    for (int i = 0; i < t->npages; ++i)
+        if (!page_touch(t, &t->pages[i])) return TEXT_ERR_NOMEM;
+    for (int d = 0; d < TEXT_MAX_BACKED; ++d)
+        if (backed[d] == t) backed[d] = 0;
+    t->read = 0;
+    return TEXT_OK;
+}
+
+int text_pin(struct Text* t) {
+    for (int i = 0; i < t->npages; ++i)
+        if (!page_touch(t, &t->pages[i])) return TEXT_ERR_NOMEM;
+    return TEXT_OK;
+}
+
+void text_move(struct Text* dst, struct Text* src) {
+    if (dst == src) return;
+    text_free(dst);
+    kmemcpy(dst, src, sizeof(*dst));
+    for (int d = 0; d < TEXT_MAX_BACKED; ++d)
+        if (backed[d] == src) backed[d] = dst;
+    text_init(src);
+}
+
+/* Insert that overflows page i: the bytes after idx move to a page of
+   their own, page i is topped up and the rest goes into full new pages,
+   all placed with one shift of the page table and one tree rebuild. */
+static int insert_spill(struct Text* t, int i, int idx, const char* s, int n) {
+    struct TextPage* p = &t->pages[i];
+    int tail = page_len(p) - idx;
+    int room = TEXT_PAGE_SIZE - idx;
+    int rest = (n > room) ? n - room : 0;
+    int extra = (rest + TEXT_PAGE_SIZE - 1) / TEXT_PAGE_SIZE + (tail > 0);
+    if (!page_insert_run(t, i + 1, extra)) return TEXT_ERR_NOMEM;
+
+    p = &t->pages[i];
+    page_move_gap(p, idx);
+    if (tail > 0) {
+        struct TextPage* q = &t->pages[i + extra];
+        kmemcpy(page_data(q), page_data(p) + p->gap_end, tail);
+        q->gap_start = (u16)tail;
+        q->nl = (u16)count_nl(page_data(q), tail);
+        p->gap_end = TEXT_PAGE_SIZE;
+        p->nl = (u16)(p->nl - q->nl);
+    }
+    for (int j = i; n > 0; ++j) {
+        struct TextPage* d = &t->pages[j];
+        int k = TEXT_PAGE_SIZE - d->gap_start;
+        if (k > n) k = n;
+        int nl = count_nl(s, k);
+        kmemcpy(page_data(d) + d->gap_start, s, k);
+        d->gap_start = (u16)(d->gap_start + k);
+        d->gap_end = TEXT_PAGE_SIZE;
+        d->nl = (u16)(d->nl + nl);
+        t->len += k; t->nl += nl;
+        s += k; n -= k;
+    }
+    fw_rebuild(t);
+    return TEXT_OK;
+}
+
+int text_insert(struct Text* t, int off, const char* s, int n) {
+    if (off < 0 || off > t->len || n < 0) return TEXT_ERR_RANGE;
+    if (n == 0) return TEXT_OK;
+
+    /* new pages plus a split-off tail and the page written into; refuse
+       up front rather than fail halfway through */
+    int need = n / TEXT_PAGE_SIZE + 3;
+    if (!frames_available(need + TEXT_FAULT_RESERVE) || t->npages + need > TEXT_MAX_PAGES)
+        return TEXT_ERR_NOMEM;
+
+    int idx;
+    int i = locate(t, off, &idx, 1);
+    if (i < 0) {
+        if (!page_insert_run(t, 0, 1)) return TEXT_ERR_NOMEM;
+        fw_rebuild(t);
+        i = 0;
+        idx = 0;
+    }
+    struct TextPage* p = &t->pages[i];
+    if (!page_touch(t, p)) return TEXT_ERR_NOMEM;
+    if (n > TEXT_PAGE_SIZE - page_len(p)) return insert_spill(t, i, idx, s, n);
+
+    int nl = count_nl(s, n);
+    page_move_gap(p, idx);
+    kmemcpy(page_data(p) + p->gap_start, s, n);
+    p->gap_start = (u16)(p->gap_start + n);
+    p->nl = (u16)(p->nl + nl);
+    fw_add(t->fw_len, t->npages, i, n);
+    fw_add(t->fw_nl, t->npages, i, nl);
+    t->len += n; t->nl += nl;
+    return TEXT_OK;
+}
+
+int text_delete(struct Text* t, int off, int n) {
+    if (off < 0 || n < 0 || off + n > t->len) return TEXT_ERR_RANGE;
+    /* only the pages at either end of the range are read in and edited */
+    if (!frames_available(2 + TEXT_FAULT_RESERVE)) return TEXT_ERR_NOMEM;
+    int last = -1;
+    while (n > 0) {
+        int idx;
+        int i = locate(t, off, &idx, 0);
+        struct TextPage* p = &t->pages[i];
+        if (idx == 0 && page_len(p) <= n) {
+            /* a run of whole pages goes at once, without reading them in */
+            int j = i, bytes = 0, nls = 0;
+            while (j < t->npages && bytes + page_len(&t->pages[j]) <= n) {
+                bytes += page_len(&t->pages[j]);
+                nls += t->pages[j].nl;
+                j++;
+            }
+            page_remove_run(t, i, j - i);
+            fw_rebuild(t);
+            t->len -= bytes; t->nl -= nls; n -= bytes;
+            last = i - 1;
+            continue;
+        }
+        int k = page_len(p) - idx;
+        if (k > n) k = n;
+        if (!page_touch(t, p)) return TEXT_ERR_NOMEM;
+        page_move_gap(p, idx);
+        int nl = count_nl(page_data(p) + p->gap_end, k);
+        p->gap_end = (u16)(p->gap_end + k);
+        p->nl = (u16)(p->nl - nl);
+        t->len -= k; t->nl -= nl; n -= k;
+        fw_add(t->fw_len, t->npages, i, -k);
+        fw_add(t->fw_nl, t->npages, i, -nl);
+        last = i;
+    }
+    /* keep pages from fragmenting after large deletes */
+    page_try_merge(t, last);
+    page_try_merge(t, last - 1);
+    return TEXT_OK;
+}
+
+char text_char_at(struct Text* t, int off) {
+    int idx;
+    int i = locate(t, off, &idx, 0);
+    if (i < 0 || !page_load(t, &t->pages[i])) return '\0';
+    return page_char(&t->pages[i], idx);
+}
+
+int text_copy(struct Text* t, int off, char* out, int n) {
+    if (off < 0 || off >= t->len || n <= 0) return 0;
+    if (n > t->len - off) n = t->len - off;
+    int idx;
+    int i = locate(t, off, &idx, 0);
+    int done = 0;
+    while (done < n && i < t->npages) {
+        if (!page_load(t, &t->pages[i])) break;
+        int k = page_len(&t->pages[i]) - idx;
+        if (k > n - done) k = n - done;
+        page_copy_out(&t->pages[i], idx, out + done, k);
+        done += k;
+        i++;
+        idx = 0;
+    }
+    return done;
+}
+
+/* -------- Iteration and lines -------- */
+void text_iter_init(struct TextIter* it, struct Text* t, int off) {
+    it->t = t;
+    it->page = locate(t, off, &it->idx, 0);
+    if (it->page < 0) { it->page = t->npages; it->idx = 0; }
+}
+
+int text_iter_next(struct TextIter* it) {
+    while (it->page < it->t->npages) {
+        struct TextPage* p = &it->t->pages[it->page];
+        if (it->idx < page_len(p)) {
+            if (!page_load(it->t, p)) return -1;
+            return (unsigned char)page_char(p, it->idx++);
+        }
+        it->page++;
+        it->idx = 0;
+    }
+    return -1;
+}
+
+int text_line_count(const struct Text* t) {
+    return t->nl + 1;
+}
+
+/* offset just past the k-th (0-based) newline of the document */
+static int nl_end(struct Text* t, int k) {
+    int rem;
+    int i = fw_find(t->fw_nl, t->npages, k, &rem);
+    int idx = page_find_nl(t, &t->pages[i], 0, rem);
+    return fw_prefix(t->fw_len, i) + idx + 1;
+}
+
+int text_line_start(struct Text* t, int line) {
+    if (line <= 0) return 0;
+    if (line > t->nl) return t->len;
+    return nl_end(t, line - 1);
+}
+
+int text_line_length(struct Text* t, int start) {
+    int idx;
+    int i = locate(t, start, &idx, 0);
+    if (i < 0) return 0;
+    int at = page_find_nl(t, &t->pages[i], idx, 0);
+    if (at >= 0) return at - idx;
+    /* no newline left in this page: the next one is found through the tree */
+    int before = fw_prefix(t->fw_nl, i + 1);
+    if (before >= t->nl) return t->len - start;
+    return nl_end(t, before) - 1 - start;
+}
+
+int text_line_of(struct Text* t, int off) {
+    if (off <= 0) return 0;
+    if (off >= t->len) return t->nl;
+    int idx;
+    int i = locate(t, off, &idx, 0);
+    struct TextPage* p = &t->pages[i];
+    int line = fw_prefix(t->fw_nl, i);
+    if (!page_load(t, p)) return line;
+    for (int j = 0; j < idx; ++j) if (page_char(p, j) == '\n') line++;
+    return line;
+}
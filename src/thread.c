@@ -0,0 +1,231 @@
+#include "../include/thread.h"
+#include "../include/cpu.h"
+#include "../include/util.h"
+#include "../include/spinlock.h"
+
+struct Thread {
+    u32  esp;               /* saved by cpu_switch() */
+    int  state;
+    int  prio;
+    int  quantum;           /* ticks left */
+    char name[THREAD_NAME_MAX];
+    struct Thread* next;    /* run queue */
+    const void* chan;       /* waiting on, 0 if none */
+    u32  deadline;          /* tick to wake at, 0 if none */
+    int  woken;
+    thread_fn fn;
+    void* arg;
+    u32  switches;
+    u32  ticks;
+};
+
+static struct Thread threads[THREAD_MAX];
+static u8 stacks[THREAD_MAX][THREAD_STACK] __attribute__((aligned(16)));   /* slot 0 runs on the boot stack */
+static struct Thread* current;
+
+/* run queues: one FIFO per priority, bit p of ready_mask set if queue p has threads */
+static struct Thread* rq_head[THREAD_PRIOS];
+static struct Thread* rq_tail[THREAD_PRIOS];
+static u32 ready_mask = 0;
+
+/* 64-bit so uptime never wraps; the BSP's timer writes it, anyone reads */
+static volatile u64 ticks = 0;
+static struct Seqlock clock_seq = SEQLOCK_INIT("clock");
+static u32 switches = 0;
+static int need_resched = 0;
+
+void cpu_switch(u32* save_esp, u32 next_esp);   /* start.S */
+
+/* -------- Run queues (interrupts off) -------- */
+static void rq_push(struct Thread* t) {
+    t->state = T_READY;
+    t->next = 0;
+    if (rq_tail[t->prio]) rq_tail[t->prio]->next = t;
+    else rq_head[t->prio] = t;
+    rq_tail[t->prio] = t;
+    ready_mask |= 1u << t->prio;
+}
+
+static struct Thread* rq_pop(void) {
+    int p = __builtin_ctz(ready_mask);   /* the idle thread keeps the mask non-zero */
+    struct Thread* t = rq_head[p];
+    rq_head[p] = t->next;
+    if (!rq_head[p]) {
+        rq_tail[p] = 0;
+        ready_mask &= ~(1u << p);
+    }
+    return t;
+}
+
+static void make_ready(struct Thread* t) {
+    t->chan = 0;
+    t->deadline = 0;
+    rq_push(t);
+    if (t->prio < current->prio) need_resched = 1;
+}
+
+/* Switch to the best ready thread; the current one goes to the back of
+   its queue if it can still run. Interrupts off. */
+static void schedule(void) {
+    struct Thread* prev = current;
+    need_resched = 0;
+    if (prev->state == T_RUNNING) rq_push(prev);
+    struct Thread* next = rq_pop();
+    next->state = T_RUNNING;
+    next->quantum = THREAD_QUANTUM;
+    if (next == prev) return;
+    next->switches++;
+    switches++;
+    current = next;
+    cpu_switch(&prev->esp, next->esp);
+}
+
+/* -------- Timer -------- */
+static void timer_tick(void) {
+    u32 f = seq_write_begin(&clock_seq);
+    ticks++;
+    seq_write_end(&clock_seq, f);
+    u32 now = (u32)ticks;
+    current->ticks++;
+    for (int i = 0; i < THREAD_MAX; ++i) {
+        struct Thread* t = &threads[i];
+        if (t->state == T_BLOCKED && t->deadline && (s32)(now - t->deadline) >= 0) make_ready(t);
+    }
+    if (--current->quantum <= 0 && (ready_mask & ((2u << current->prio) - 1))) need_resched = 1;
+}
+
+static void irq_exit(void) {
+    if (need_resched) schedule();
+}
+
+/* -------- Threads -------- */
+static void thread_start(void) {
+    irq_enable();
+    current->fn(current->arg);
+    thread_exit();
+}
+
+static void idle_loop(void* arg) {
+    (void)arg;
+    for (;;) __asm__ volatile ("sti; hlt");
+}
+
+void thread_init(void) {
+    struct Thread* t = &threads[0];
+    kstrncpy(t->name, "ui", THREAD_NAME_MAX);
+    t->prio = PRIO_UI;
+    t->state = T_RUNNING;
+    t->quantum = THREAD_QUANTUM;
+    current = t;
+    thread_create("idle", PRIO_IDLE, idle_loop, 0);
+    irq_exit_hook = irq_exit;
+    pit_init(THREAD_HZ);
+    irq_set_handler(IRQ_TIMER, timer_tick);
+    irq_enable();
+}
+
+int thread_create(const char* name, int prio, thread_fn fn, void* arg) {
+    if (prio < 0 || prio >= THREAD_PRIOS) return THREAD_ERR_PRIO;
+    u32 f = irq_save();
+    int id = -1;
+    for (int i = 1; i < THREAD_MAX && id < 0; ++i)
+        if (threads[i].state == T_FREE || threads[i].state == T_DONE) id = i;
+    if (id < 0) {
+        irq_restore(f);
+        return THREAD_ERR_NOMEM;
+    }
+    struct Thread* t = &threads[id];
+    kmemset(t, 0, sizeof(*t));
+    kstrncpy(t->name, name, THREAD_NAME_MAX);
+    t->prio = prio;
+    t->fn = fn;
+    t->arg = arg;
+    /* what cpu_switch() pops: edi esi ebx ebp eflags, then it returns into thread_start */
+    u32* sp = (u32*)(stacks[id] + THREAD_STACK);
+    *--sp = 0;                     /* thread_start's return address; never used */
+    *--sp = (u32)thread_start;
+    *--sp = 0x002;                 /* eflags, interrupts off until thread_start */
+    *--sp = 0;                     /* ebp */
+    *--sp = 0;                     /* ebx */
+    *--sp = 0;                     /* esi */
+    *--sp = 0;                     /* edi */
+    t->esp = (u32)sp;
+    make_ready(t);
+    if (need_resched) schedule();
+    irq_restore(f);
+    return id;
+}
+
+void thread_exit(void) {
+    irq_save();
+    current->state = T_DONE;
+    schedule();
+    for (;;) __asm__ volatile ("hlt");   /* not reached */
+}
+
+void thread_yield(void) {
+    u32 f = irq_save();
+    schedule();
+    irq_restore(f);
+}
+
+int thread_wait(const void* chan, u32 timeout) {
+    u32 f = irq_save();
+    current->chan = chan;
+    current->deadline = timeout ? (u32)ticks + timeout : 0;
+    if (current->deadline == 0 && timeout) current->deadline = 1;   /* 0 means none */
+    current->woken = 0;
+    current->state = T_BLOCKED;
+    schedule();
+    int woken = current->woken;
+    irq_restore(f);
+    return woken;
+}
+
+void thread_sleep(u32 n) {
+    if (n) thread_wait(0, n);
+}
+
+int thread_wakeup(const void* chan) {
+    u32 f = irq_save();
+    int n = 0;
+    for (int i = 0; i < THREAD_MAX; ++i) {
+        struct Thread* t = &threads[i];
+        if (t->state != T_BLOCKED || !chan || t->chan != chan) continue;
+        t->woken = 1;
+        make_ready(t);
+        n++;
+    }
+    /* in an IRQ handler the switch waits for irq_exit() */
+    if (need_resched && (f & 0x200)) schedule();
+    irq_restore(f);
+    return n;
+}
+
+int thread_self(void) { return (int)(current - threads); }
+u32 thread_ticks(void) { return (u32)ticks; }   /* the low word alone is one load */
+
+u64 thread_uptime(void) {
+    u64 t;
+    u32 v;
+    do {
+        v = seq_read_begin(&clock_seq);
+        t = ticks;
+    } while (seq_read_retry(&clock_seq, v));
+    return t;
+}
+u32 thread_switches(void) { return switches; }
+
+int thread_info(int i, struct ThreadInfo* out) {
+    if (i < 0 || i >= THREAD_MAX || threads[i].state == T_FREE) return 0;
+    u32 f = irq_save();
+    struct Thread* t = &threads[i];
+    out->id = i;
+    kstrncpy(out->name, t->name, THREAD_NAME_MAX);
+    out->prio = t->prio;
+    out->state = t->state;
+    out->switches = t->switches;
+    out->ticks = t->ticks;
+    irq_restore(f);
+    return 1;
+}
@@ -0,0 +1,104 @@
+#include "../include/trace.h"
+#include "../include/paging.h"
+#include "../include/thread.h"
+#include "../include/io.h"
+#include "../include/util.h"
+
+u8 trace_on = 0;
+static struct TraceRecord* rings;   /* CPU_MAX rings, a region made by the first start */
+static u64 start_tsc, stop_tsc;
+static u32 start_ticks, stop_ticks;
+
+static const char* names[TP_COUNT] = {
+    "key", "event", "shell_key", "exec", "ui_draw", "vga_clear", "vga_scroll",
+    "fs_read", "fs_write", "fs_open", "fs_create", "fs_delete", "fs_rename",
+    "fs_mkdir", "fs_rmdir",
+};
+
+void trace_record(int id, int kind, u32 arg) {
+    u32 i = 1;
+    __asm__ volatile ("xaddl %0, %%fs:%c1"
+                      : "+r"(i) : "i"(__builtin_offsetof(struct PerCpu, trace_head)) : "memory");
+    int cpu = cpu_id();
+    struct TraceRecord* r = &rings[cpu * TRACE_RING + (i & (TRACE_RING - 1))];
+    r->tsc = rdtsc();
+    r->id = (u16)id;
+    r->kind = (u8)kind;
+    r->cpu = (u8)cpu;
+    r->arg = arg;
+}
+
+int trace_start(void) {
+    if (!rings) rings = region_create("trace", CPU_MAX * TRACE_RING * sizeof(struct TraceRecord), 0);
+    if (!rings) return TRACE_ERR_NOMEM;
+    trace_on = 0;
+    for (int i = 0; i < CPU_MAX; ++i) cpu_percpu(i)->trace_head = 0;
+    start_ticks = thread_ticks();
+    start_tsc = rdtsc();
+    trace_on = 1;
+    return TRACE_OK;
+}
+
+void trace_stop(void) {
+    if (!trace_on) return;
+    trace_on = 0;
+    stop_tsc = rdtsc();
+    stop_ticks = thread_ticks();
+}
+
+void trace_stats(struct TraceStats* out) {
+    out->on = trace_on;
+    out->records = out->kept = 0;
+    for (int i = 0; i < CPU_MAX; ++i) {
+        u32 h = cpu_percpu(i)->trace_head;
+        out->records += h;
+        out->kept += (h < TRACE_RING) ? h : TRACE_RING;
+    }
+}
+
+static int line_u64(char* out, int p, u64 v) {
+    p += ku64toa(out + p, v);
+    out[p++] = ' ';
+    return p;
+}
+
+void trace_dump(trace_emit_fn emit, void* ctx) {
+    trace_stop();
+    char line[64];
+    u64 per_ms = stop_tsc - start_tsc;
+    u32 ms = stop_ticks - start_ticks;
+    kdiv64(&per_ms, ms ? ms : 1);
+    if (emit(ctx, "# noir-trace 1\n", 15)) return;
+    kmemcpy(line, "# cycles_per_ms ", 16);
+    int p = 16 + ku64toa(line + 16, per_ms);
+    line[p++] = '\n';
+    if (emit(ctx, line, p) || !rings) return;
+
+    /* merge the rings: the oldest record left in any of them goes next */
+    u32 pos[CPU_MAX], end[CPU_MAX];
+    for (int i = 0; i < CPU_MAX; ++i) {
+        end[i] = cpu_percpu(i)->trace_head;
+        pos[i] = (end[i] > TRACE_RING) ? end[i] - TRACE_RING : 0;
+    }
+    for (;;) {
+        const struct TraceRecord* next = 0;
+        int cpu = -1;
+        for (int i = 0; i < CPU_MAX; ++i) {
+            if (pos[i] == end[i]) continue;
+            const struct TraceRecord* r = &rings[i * TRACE_RING + (pos[i] & (TRACE_RING - 1))];
+            if (!next || r->tsc < next->tsc) { next = r; cpu = i; }
+        }
+        if (!next) break;
+        pos[cpu]++;
+        p = line_u64(line, 0, (u64)next->cpu);
+        p = line_u64(line, p, next->tsc);
+        line[p++] = (char)next->kind;
+        line[p++] = ' ';
+        const char* name = (next->id < TP_COUNT) ? names[next->id] : "?";
+        while (*name) line[p++] = *name++;
+        line[p++] = ' ';
+        p += kutoa(line + p, next->arg);
+        line[p++] = '\n';
+        if (emit(ctx, line, p)) break;
+    }
+}
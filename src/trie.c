@@ -0,0 +1,106 @@
+#include "../include/trie.h"
+#include "../include/util.h"
+
+static int node_new(struct Trie* t, char c) {
+    if (t->used == TRIE_NODES) return -1;
+    struct TrieNode* n = &t->node[t->used];
+    n->c = c;
+    n->end = 0;
+    n->child = TRIE_NONE;
+    n->next = TRIE_NONE;
+    n->words = 0;
+    n->value = -1;
+    return t->used++;
+}
+
+/* node reached by key[0..len), TRIE_NONE if no name starts with it */
+static int walk(const struct Trie* t, const char* key, int len) {
+    int at = 0;
+    for (int i = 0; i < len && at != TRIE_NONE; ++i) {
+        int ch = t->node[at].child;
+        while (ch != TRIE_NONE && t->node[ch].c != key[i]) ch = t->node[ch].next;
+        at = ch;
+    }
+    return at;
+}
+
+void trie_init(struct Trie* t) {
+    t->used = 0;
+    node_new(t, 0);
+}
+
+int trie_insert(struct Trie* t, const char* key, int value) {
+    int n = kstrlen(key);
+    if (n >= TRIE_NAME_MAX || t->used + n > TRIE_NODES) return -1;   /* room for the worst case */
+    int at = walk(t, key, n);
+    int fresh = (at == TRIE_NONE || !t->node[at].end);
+    at = 0;
+    for (int i = 0; i < n; ++i) {
+        if (fresh) t->node[at].words++;
+        /* find key[i] among the sorted children, or link a new node in place */
+        u16* link = &t->node[at].child;
+        while (*link != TRIE_NONE && (u8)t->node[*link].c < (u8)key[i]) link = &t->node[*link].next;
+        if (*link == TRIE_NONE || t->node[*link].c != key[i]) {
+            int nn = node_new(t, key[i]);
+            t->node[nn].next = *link;
+            *link = (u16)nn;
+        }
+        at = *link;
+    }
+    if (fresh) t->node[at].words++;
+    t->node[at].end = 1;
+    t->node[at].value = value;
+    return 0;
+}
+
+int trie_find(const struct Trie* t, const char* key, int len) {
+    int at = walk(t, key, len);
+    if (at == TRIE_NONE || !t->node[at].end) return -1;
+    return t->node[at].value;
+}
+
+int trie_complete(const struct Trie* t, const char* key, int len, char* out, int max, int* value) {
+    int at = walk(t, key, len);
+    int p = 0;
+    *value = -1;
+    if (at == TRIE_NONE) { out[0] = '\0'; return 0; }
+    /* follow the path while it does not branch and no name ends on it */
+    while (!t->node[at].end && p < max - 1) {
+        int ch = t->node[at].child;
+        if (ch == TRIE_NONE || t->node[ch].next != TRIE_NONE) break;
+        out[p++] = t->node[ch].c;
+        at = ch;
+    }
+    out[p] = '\0';
+    if (t->node[at].words == 1) {
+        while (!t->node[at].end) at = t->node[at].child;
+        *value = t->node[at].value;
+    }
+    return t->node[at].words;
+}
+
+/* depth-first over the subtree of at; name[0..len) spells the path to it */
+static int each(const struct Trie* t, int at, char* name, int len, trie_visit_fn fn, void* ctx, int* seen) {
+    if (t->node[at].end) {
+        name[len] = '\0';
+        (*seen)++;
+        if (fn(ctx, name, t->node[at].value)) return 1;
+    }
+    for (int ch = t->node[at].child; ch != TRIE_NONE; ch = t->node[ch].next) {
+        if (len == TRIE_NAME_MAX - 1) break;
+        name[len] = t->node[ch].c;
+        if (each(t, ch, name, len + 1, fn, ctx, seen)) return 1;
+    }
+    return 0;
+}
+
+int trie_each(const struct Trie* t, const char* key, int len, trie_visit_fn fn, void* ctx) {
+    char name[TRIE_NAME_MAX];
+    int seen = 0;
+    if (len >= TRIE_NAME_MAX) return 0;
+    int at = walk(t, key, len);
+    if (at == TRIE_NONE) return 0;
+    kmemcpy(name, key, len);
+    each(t, at, name, len, fn, ctx, &seen);
+    return seen;
+}
@@ -2,6 +2,8 @@
 #include "../include/vga.h"
 #include "../include/fs.h"
 #include "../include/util.h"
+#include "../include/rcu.h"
+#include "../include/trace.h"
 
 static Window explorer_win = {0, 1, 32, 20, " Explorer "};
 /* viewer shrunk so controls window fits under it */
@@ -79,7 +81,7 @@ void ui_set_shutdown_callback(void (*cb)(void)) { cb_shutdown = cb; }
 void ui_set_sleep_callback(void (*cb)(void))    { cb_sleep    = cb; }
 
 
-/* Called from shell_loop() immediately after read_key() so UI can react to Fn keys */
+/* Called from shell_handle_key() for each browser key so UI can react to Fn keys */
 void ui_handle_key(int key) {
     /* you must have K_F1/K_F2/K_F3 defined in your input.h - used elsewhere already */
 #ifdef K_F1
@@ -167,6 +169,7 @@ static void draw_controls_window(void) {
 
 /* -------- Main draw function (dirs + files + controls) -------- */
 void ui_draw(void) {
+    TRACE_BEGIN(TP_UI_DRAW, 0);
     /* tick down pressed states (so they are transient) */
     if (restart_ticks > 0) restart_ticks--;
     if (shutdown_ticks > 0) shutdown_ticks--;
@@ -216,6 +219,8 @@ void ui_draw(void) {
         draw_text_in_win(viewer_win.x, viewer_win.y, viewer_win.w, viewer_win.h, 0, 0, "(empty)", 0x07);
     } else if (explorer_sel < dir_count) {
         struct Dir* d = fs_dir_get(explorer_sel);
+        rcu_read_lock();
+        const struct DirList* l = fs_dir_list(d);
         char linebuf[200];
         int line = 0;
         int hb = 0;
@@ -224,46 +229,61 @@ void ui_draw(void) {
         append_char(linebuf, &hb, '/', sizeof(linebuf));
         append_str(linebuf, &hb, "  (", sizeof(linebuf));
         char tmp[32];
-        int_to_dec(tmp, d->file_count);
+        int_to_dec(tmp, l->file_count);
         append_str(linebuf, &hb, tmp, sizeof(linebuf));
         append_str(linebuf, &hb, " files, ", sizeof(linebuf));
-        int_to_dec(tmp, d->subdir_count);
+        int_to_dec(tmp, l->subdir_count);
         append_str(linebuf, &hb, tmp, sizeof(linebuf));
         append_str(linebuf, &hb, " subdirs)", sizeof(linebuf));
         draw_text_in_win(viewer_win.x, viewer_win.y, viewer_win.w, viewer_win.h, 0, line++, linebuf, 0x07);
         draw_text_in_win(viewer_win.x, viewer_win.y, viewer_win.w, viewer_win.h, 0, line++, "Use 'cd <name>' or press Enter to open", 0x07);
-        for (int fi = 0; fi < d->subdir_count && line < viewer_win.h - 2; ++fi) {
+        for (int fi = 0; fi < l->subdir_count && line < viewer_win.h - 2; ++fi) {
             char buf[128]; int bp = 0;
             append_char(buf, &bp, 'd', sizeof(buf));
             append_char(buf, &bp, ' ', sizeof(buf));
-            append_str(buf, &bp, d->subdirs[fi]->name, sizeof(buf));
+            append_str(buf, &bp, l->subdirs[fi]->name, sizeof(buf));
             append_char(buf, &bp, '/', sizeof(buf));
             draw_text_in_win(viewer_win.x, viewer_win.y, viewer_win.w, viewer_win.h, 0, line++, buf, 0x07);
         }
-        for (int fi = 0; fi < d->file_count && line < viewer_win.h - 2; ++fi) {
+        for (int fi = 0; fi < l->file_count && line < viewer_win.h - 2; ++fi) {
             char buf[128]; int bp = 0;
-            struct File* ff = &d->files[fi];
+            const struct File* ff = l->files[fi];
             char tc = (ff->type == 1) ? '*' : (ff->type == 2) ? '>' : (ff->readonly ? ' ' : '+');
             append_char(buf, &bp, tc, sizeof(buf));
             append_char(buf, &bp, ' ', sizeof(buf));
             append_str(buf, &bp, ff->name, sizeof(buf));
             draw_text_in_win(viewer_win.x, viewer_win.y, viewer_win.w, viewer_win.h, 0, line++, buf, 0x07);
         }
+        rcu_read_unlock();
     } else {
         struct File* f = fs_get(explorer_sel - dir_count);
-        const char* p = f->content;
         char linebuf[200];
+        char chunk[128];
         int max_lines = viewer_win.h - 2;
         int skip = viewer_scroll;
-        int line_no = 0;
-        while (*p && line_no < skip + max_lines) {
-            int lb = 0;
-            while (*p && *p != '\n' && lb < (viewer_win.w - 3)) linebuf[lb++] = *p++;
-            if (*p == '\n') p++;
+        int line_no = 0, lb = 0, n = 0, ci = 0;
+        /* stream the file in; reading stops once the window is full */
+        int fd = fs_open(f->name, FS_O_RDONLY);
+        while (fd >= 0 && line_no < skip + max_lines) {
+            if (ci == n) {
+                n = fs_read(fd, chunk, sizeof(chunk));
+                ci = 0;
+                if (n <= 0) break;
+            }
+            char c = chunk[ci];
+            if (c == '\0') break;
+            if (c != '\n' && lb < (viewer_win.w - 3)) { linebuf[lb++] = c; ci++; continue; }
+            if (c == '\n') ci++;
             linebuf[lb] = '\0';
             if (line_no >= skip) draw_text_in_win(viewer_win.x, viewer_win.y, viewer_win.w, viewer_win.h, 0, line_no - skip, linebuf, 0x07);
             line_no++;
+            lb = 0;
         }
+        if (lb > 0 && line_no >= skip && line_no < skip + max_lines) {
+            linebuf[lb] = '\0';
+            draw_text_in_win(viewer_win.x, viewer_win.y, viewer_win.w, viewer_win.h, 0, line_no - skip, linebuf, 0x07);
+        }
+        if (fd >= 0) fs_close(fd);
     }
 
     /* Status */
@@ -288,6 +308,7 @@ void ui_draw(void) {
     int pos = 0;
     for (int i = 0; user_info[i] && pos < 60; ++i) vga_putcell(status_win.x + 1 + pos, status_win.y + 1, user_info[i], 0x07), pos++;
     for (int i = 0; fname[i] && pos < 70; ++i) vga_putcell(status_win.x + 1 + pos, status_win.y + 1, fname[i], 0x0F), pos++;
+    TRACE_END(TP_UI_DRAW, 0);
 }
 
 void ui_clear(void) {
@@ -0,0 +1,155 @@
+#include "../include/undo.h"
+#include "../include/util.h"
+
+/* Record layout in the ring:
+     [type:1][flags:1][off:4][len:4][text:len][size:4]
+   Positions are free-running u32 byte counters; the arena index is the
+   position masked to UNDO_ARENA_SIZE. */
+#define REC_HEADER   10
+#define REC_OVERHEAD (REC_HEADER + 4)
+#define RING_MASK    (UNDO_ARENA_SIZE - 1)
+
+/* -------- Ring access -------- */
+static void ring_write(struct UndoLog* u, u32 pos, const char* src, int n) {
+    int at = (int)(pos & RING_MASK);
+    int k = UNDO_ARENA_SIZE - at;
+    if (k > n) k = n;
+    kmemcpy(u->arena + at, src, k);
+    if (n > k) kmemcpy(u->arena, src + k, n - k);
+}
+
+static void ring_read(const struct UndoLog* u, u32 pos, char* dst, int n) {
+    int at = (int)(pos & RING_MASK);
+    int k = UNDO_ARENA_SIZE - at;
+    if (k > n) k = n;
+    kmemcpy(dst, u->arena + at, k);
+    if (n > k) kmemcpy(dst + k, u->arena, n - k);
+}
+
+static void put_u32(struct UndoLog* u, u32 pos, u32 v) {
+    char b[4] = { (char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24) };
+    ring_write(u, pos, b, 4);
+}
+
+static u32 get_u32(const struct UndoLog* u, u32 pos) {
+    unsigned char b[4];
+    ring_read(u, pos, (char*)b, 4);
+    return b[0] | (b[1] << 8) | (b[2] << 16) | ((u32)b[3] << 24);
+}
+
+/* start of the record ending at pos */
+static u32 rec_before(const struct UndoLog* u, u32 pos) {
+    return pos - get_u32(u, pos - 4);
+}
+
+static void rec_read(const struct UndoLog* u, u32 start, struct UndoOp* op) {
+    char h[2];
+    ring_read(u, start, h, 2);
+    op->type  = (u8)h[0];
+    op->flags = (u8)h[1];
+    op->off   = (int)get_u32(u, start + 2);
+    op->len   = (int)get_u32(u, start + 6);
+}
+
+/* drop the oldest records until need more bytes fit in the budget */
+static void make_room(struct UndoLog* u, int need) {
+    while (u->tail != u->head && (int)(u->head - u->tail) + need > u->budget)
+        u->tail += REC_OVERHEAD + get_u32(u, u->tail + 6);
+    if ((int)(u->cursor - u->tail) < 0) u->cursor = u->tail;
+}
+
+/* append typed text to the newest record when it continues it */
+static int try_extend(struct UndoLog* u, int type, int off, const char* text, int len) {
+    if (type != UNDO_INSERT || u->cursor == u->tail) return 0;
+    u32 start = rec_before(u, u->head);
+    struct UndoOp last;
+    rec_read(u, start, &last);
+    if (last.type != UNDO_INSERT || !(last.flags & UNDO_COALESCE)) return 0;
+    if (last.off + last.len != off) return 0;
+    if ((int)(u->head - start) + len > u->budget) return 0;
+
+    make_room(u, len);
+    u32 end = u->head - 4;   /* the old size field is overwritten */
+    ring_write(u, end, text, len);
+    put_u32(u, end + len, (u32)(REC_OVERHEAD + last.len + len));
+    put_u32(u, start + 6, (u32)(last.len + len));
+    u->head += len;
+    u->cursor = u->head;
+    return 1;
+}
+
+/* -------- Public API -------- */
+void undo_init(struct UndoLog* u, int budget) {
+    u->budget = UNDO_DEFAULT_BUDGET;
+    undo_set_budget(u, budget);
+    undo_clear(u);
+}
+
+void undo_clear(struct UndoLog* u) {
+    u->tail = u->cursor = u->head = 0;
+}
+
+int undo_set_budget(struct UndoLog* u, int budget) {
+    if (budget < UNDO_MIN_BUDGET || budget > UNDO_ARENA_SIZE) return -1;
+    u->budget = budget;
+    make_room(u, 0);
+    return 0;
+}
+
+int undo_used(const struct UndoLog* u) {
+    return (int)(u->head - u->tail);
+}
+
+int undo_fits(const struct UndoLog* u, int records, int bytes) {
+    return (u32)records * REC_OVERHEAD + (u32)bytes <= (u32)u->budget;
+}
+
+void undo_record(struct UndoLog* u, int type, int off, const char* text, int len, int flags) {
+    u->head = u->cursor;   /* a new edit ends the redo history */
+    if ((flags & UNDO_COALESCE) && try_extend(u, type, off, text, len)) return;
+
+    int size = REC_OVERHEAD + len;
+    if (size > u->budget) {
+        /* cannot be kept, and older records no longer line up without it */
+        undo_clear(u);
+        return;
+    }
+    make_room(u, size);
+    char h[2] = { (char)type, (char)flags };
+    ring_write(u, u->head, h, 2);
+    put_u32(u, u->head + 2, (u32)off);
+    put_u32(u, u->head + 6, (u32)len);
+    ring_write(u, u->head + REC_HEADER, text, len);
+    put_u32(u, u->head + REC_HEADER + len, (u32)size);
+    u->head += size;
+    u->cursor = u->head;
+}
+
+int undo_peek(const struct UndoLog* u, int dir, struct UndoOp* op) {
+    u32 start;
+    if (dir == UNDO_BACK) {
+        if (u->cursor == u->tail) return 0;
+        start = rec_before(u, u->cursor);
+    } else {
+        if (u->cursor == u->head) return 0;
+        start = u->cursor;
+    }
+    rec_read(u, start, op);
+
+    int at = (int)((start + REC_HEADER) & RING_MASK);
+    int k = UNDO_ARENA_SIZE - at;
+    if (k > op->len) k = op->len;
+    op->text[0] = u->arena + at;
+    op->text_len[0] = k;
+    op->text[1] = u->arena;
+    op->text_len[1] = op->len - k;
+    return 1;
+}
+
+void undo_step(struct UndoLog* u, int dir) {
+    if (dir == UNDO_BACK) {
+        if (u->cursor != u->tail) u->cursor = rec_before(u, u->cursor);
+    } else {
+        if (u->cursor != u->head) u->cursor += REC_OVERHEAD + get_u32(u, u->cursor + 6);
+    }
+}
@@ -27,3 +27,64 @@ void kstrncpy(char *dest, const char *src, int n) {
     }
     dest[i] = '\0';
 }
+int kutoa(char* out, u32 val) {
+    char tmp[10];
+    int tp = 0;
+    do { tmp[tp++] = (char)('0' + val % 10); val /= 10; } while (val);
+    for (int i = 0; i < tp; ++i) out[i] = tmp[tp - 1 - i];
+    out[tp] = '\0';
+    return tp;
+}
+
+/* *n /= base, returns the remainder (like Linux do_div); keeps 64-bit
+   division away from libgcc, which the kernel does not link */
+u32 kdiv64(u64* n, u32 base) {
+    u32 hi = (u32)(*n >> 32), lo = (u32)*n;
+    u32 qhi = hi / base;
+    u32 qlo, rem;
+    hi %= base;
+    __asm__ ("divl %4" : "=a"(qlo), "=d"(rem) : "a"(lo), "d"(hi), "rm"(base));
+    *n = ((u64)qhi << 32) | qlo;
+    return rem;
+}
+
+int ku64toa(char* out, u64 val) {
+    char tmp[20];
+    int tp = 0;
+    do { tmp[tp++] = (char)('0' + kdiv64(&val, 10)); } while (val);
+    for (int i = 0; i < tp; ++i) out[i] = tmp[tp - 1 - i];
+    out[tp] = '\0';
+    return tp;
+}
+
+/* Memory primitives. GCC may emit calls to memcpy/memmove/memset/memcmp
+   even in freestanding code, so the plain names forward to these. */
+void* kmemcpy(void* dst, const void* src, int n) {
+    void* d = dst;
+    __asm__ volatile ("cld; rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+    return dst;
+}
+void* kmemmove(void* dst, const void* src, int n) {
+    if ((const char*)dst <= (const char*)src || (const char*)dst >= (const char*)src + n)
+        return kmemcpy(dst, src, n);
+    /* overlapping with dst above src: copy backwards */
+    char* d = (char*)dst + n - 1;
+    const char* s = (const char*)src + n - 1;
+    __asm__ volatile ("std; rep movsb; cld" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+    return dst;
+}
+void* kmemset(void* dst, int c, int n) {
+    void* d = dst;
+    __asm__ volatile ("cld; rep stosb" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+    return dst;
+}
+int kmemcmp(const void* a, const void* b, int n) {
+    const unsigned char* x = (const unsigned char*)a;
+    const unsigned char* y = (const unsigned char*)b;
+    for (int i = 0; i < n; ++i) if (x[i] != y[i]) return (int)x[i] - (int)y[i];
+    return 0;
+}
+void* memcpy(void* dst, const void* src, unsigned long n) { return kmemcpy(dst, src, (int)n); }
+void* memmove(void* dst, const void* src, unsigned long n) { return kmemmove(dst, src, (int)n); }
+void* memset(void* dst, int c, unsigned long n) { return kmemset(dst, c, (int)n); }
+int memcmp(const void* a, const void* b, unsigned long n) { return kmemcmp(a, b, (int)n); }
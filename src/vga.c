@@ -1,6 +1,7 @@
 #include "../include/vga.h"
 #include "../include/common.h"
 #include "../include/util.h"
+#include "../include/trace.h"
 
 volatile u16* const vga = (u16*)VGA_ADDR;
 static int cursor_x = 0, cursor_y = 0;
@@ -11,10 +12,18 @@ void vga_putcell(int x, int y, char ch, u8 attr) {
     vga[y * WIDTH + x] = ((u16)attr << 8) | (u8)ch;
 }
 void vga_clear(void) {
+    TRACE_BEGIN(TP_VGA_CLEAR, 0);
     for (int y = 0; y < HEIGHT; ++y)
         for (int x = 0; x < WIDTH; ++x)
             vga_putcell(x, y, ' ', default_attr);
     cursor_x = cursor_y = 0;
+    TRACE_END(TP_VGA_CLEAR, 0);
+}
+/* move n full rows from src_y to dst_y (overlap safe) */
+void vga_move_rows(int dst_y, int src_y, int n) {
+    if (n <= 0 || dst_y < 0 || src_y < 0 || dst_y + n > HEIGHT || src_y + n > HEIGHT) return;
+    TRACE_MARK(TP_VGA_SCROLL, n);
+    kmemmove((u16*)vga + dst_y * WIDTH, (u16*)vga + src_y * WIDTH, n * WIDTH * 2);
 }
 void term_putc(char c) {
     if (c == '\n') { cursor_x = 0; cursor_y++; return; }
@@ -0,0 +1,101 @@
+#include "../include/wrap.h"
+#include "../include/util.h"
+
+/* -------- Fenwick tree over line heights -------- */
+static void fw_add(int* fw, int n, int i, int delta) {
+    for (++i; i <= n; i += i & -i) fw[i] += delta;
+}
+
+/* O(n) rebuild after lines were inserted or removed */
+static void fw_rebuild(struct WrapMap* m) {
+    int n = m->lines;
+    for (int i = 1; i <= n; ++i) m->fw[i] = m->height[i - 1];
+    for (int i = 1; i <= n; ++i) {
+        int j = i + (i & -i);
+        if (j <= n) m->fw[j] += m->fw[i];
+    }
+}
+
+static int line_height(const struct WrapMap* m, int len) {
+    return len / m->width + 1;
+}
+
+/* -------- Public API -------- */
+int wrap_build(struct WrapMap* m, struct Text* t, int width) {
+    int lines = text_line_count(t);
+    if (lines > WRAP_MAX_LINES) return WRAP_ERR_LINES;
+    m->width = width;
+    m->lines = lines;
+
+    struct TextIter it;
+    text_iter_init(&it, t, 0);
+    int line = 0, len = 0, c;
+    while ((c = text_iter_next(&it)) >= 0) {
+        if (c != '\n') { len++; continue; }
+        m->height[line++] = line_height(m, len);
+        len = 0;
+    }
+    m->height[line] = line_height(m, len);
+    fw_rebuild(m);
+    return WRAP_OK;
+}
+
+int wrap_edit(struct WrapMap* m, struct Text* t, int line, int delta) {
+    if (line < 0 || line >= m->lines) return 0;
+    if (delta == 0) {
+        int h = line_height(m, text_line_length(t, text_line_start(t, line)));
+        int d = h - m->height[line];
+        if (d == 0) return 0;
+        m->height[line] = h;
+        fw_add(m->fw, m->lines, line, d);
+        return 1;
+    }
+
+    if (m->lines + delta > WRAP_MAX_LINES) return WRAP_ERR_LINES;
+    int from = line + 1;   /* first line after the edit, before it moved */
+    int tail = m->lines - from;
+    if (delta > 0) {
+        kmemmove(&m->height[from + delta], &m->height[from], tail * (int)sizeof(int));
+    } else {
+        int gone = -delta;
+        if (gone > tail) gone = tail;
+        kmemmove(&m->height[from], &m->height[from + gone], (tail - gone) * (int)sizeof(int));
+    }
+    m->lines += delta;
+    int last = (delta > 0) ? line + delta : line;
+    for (int l = line; l <= last && l < m->lines; ++l)
+        m->height[l] = line_height(m, text_line_length(t, text_line_start(t, l)));
+    fw_rebuild(m);
+    return 1;
+}
+
+int wrap_rows(const struct WrapMap* m) {
+    return wrap_row_of(m, m->lines);
+}
+
+int wrap_row_of(const struct WrapMap* m, int line) {
+    int s = 0;
+    if (line > m->lines) line = m->lines;
+    for (int i = line; i > 0; i -= i & -i) s += m->fw[i];
+    return s;
+}
+
+int wrap_line_at(const struct WrapMap* m, int row, int* sub) {
+    int pos = 0, n = m->lines;
+    if (row < 0) row = 0;
+    if (n > 0) {
+        for (int step = 1 << (31 - __builtin_clz((u32)n)); step; step >>= 1) {
+            if (pos + step <= n && m->fw[pos + step] <= row) {
+                pos += step;
+                row -= m->fw[pos];
+            }
+        }
+    }
+    if (pos >= n) {
+        /* past the last row: the end of the last line */
+        pos = n - 1;
+        row = m->height[pos] - 1;
+    }
+    *sub = row;
+    return pos;
+}